@@ -600,6 +600,7 @@ int main (int argc, char *argv[])
    bool useGUI(true);
    long nbTrial(1000000);
    long nbRun(1);
+   long nbWorld(-1);
    double finalCost=0.;
    bool silent=false;
    string outfilename("Fox-out.xml");
@@ -624,7 +625,10 @@ int main (int argc, char *argv[])
    string IP;
    bool testLSQ=false;
    bool testMC=false;
+   bool testNbWorld=false;
+   bool testMultiRun=false;
    bool testSPEED=false;
+   string benchmarkFile;
    for(int i=1;i<argc;i++)
    {
        #ifdef __WX__CRYST__
@@ -713,6 +717,37 @@ int main (int argc, char *argv[])
          cout << "Fox will do "<<nbRun<<" runs, randomizing before each run"<<endl;
          continue;
       }
+      if(STRCMP("--nbworld",argv[i])==0)
+      {
+         ++i;
+         #ifdef __WX__CRYST__
+         wxString(argv[i]).ToLong(&nbWorld);
+         #else
+         stringstream sstr(argv[i]);
+         sstr >> nbWorld;
+         #endif
+         if(nbWorld<2)
+         {
+            cout << "Invalid number of worlds for parallel tempering: "<<argv[i]<<", using 2"<<endl;
+            nbWorld=2;
+         }
+         cout << "Fox will use "<<nbWorld<<" worlds for parallel tempering"<<endl;
+         continue;
+      }
+      if(STRCMP("--nbthread",argv[i])==0)
+      {
+         ++i;
+         long nbThread=1;
+         #ifdef __WX__CRYST__
+         wxString(argv[i]).ToLong(&nbThread);
+         #else
+         stringstream sstr(argv[i]);
+         sstr >> nbThread;
+         #endif
+         SetNbThread(nbThread);
+         cout << "Fox will use "<<GetNbThread()<<" thread(s) for parallel computations"<<endl;
+         continue;
+      }
       if((STRCMP("--cif2pattern",argv[i])==0) || (STRCMP("--cif2patternN",argv[i])==0))
       {
          if(STRCMP("--cif2patternN",argv[i])==0) cif2patternN=true;
@@ -808,6 +843,12 @@ int main (int argc, char *argv[])
          testSPEED=true;
          continue;
       }
+      if(STRCMP("--benchmark",argv[i])==0)
+      {
+         ++i;
+         benchmarkFile=argv[i];
+         continue;
+      }
       if(STRCMP("--test-lsq",argv[i])==0)
       {
          testLSQ=true;
@@ -818,6 +859,16 @@ int main (int argc, char *argv[])
          testMC=true;
          continue;
       }
+      if(STRCMP("--test-nbworld",argv[i])==0)
+      {
+         testNbWorld=true;
+         continue;
+      }
+      if(STRCMP("--test-multirun",argv[i])==0)
+      {
+         testMultiRun=true;
+         continue;
+      }
       if(STRCMP("--exportfullprof",argv[i])==0)
       {
          exportfullprof=true;
@@ -1160,10 +1211,19 @@ int main (int argc, char *argv[])
            <<"                             the --loadfouriergrd keyword can be omitted if the file extension is .grd"<<endl
            <<"   --loadfourierdsn6 map.DN6: load and display a DSN6 fourier map with (first) crystal structure"<<endl
            <<"                             the --loadfourierdsn6 keyword can be omitted if the file extension is .dsn6 or .dn6"<<endl
+           <<"   --speedtest: run the standard speed tests"<<endl
+           <<"   --test-nbworld: run short parallel tempering optimizations with 2 and 4 worlds"<<endl
+           <<"   --test-multirun: run 8 short optimizations with refinable lattice parameters,"<<endl
+           <<"                    concurrently if --nbthread is used"<<endl
+           <<"   --benchmark out.json: run a series of speed tests and save the results to 'out.json'"<<endl
+           <<"                         (CSV format if the file extension is .csv)"<<endl
            <<"   --nogui: run without GUI, automatically launches optimization"<<endl
            <<"      options with --nogui:"<<endl
            <<"         -n 10000     : run for 10000 trials at most (default: 1000000)"<<endl
            <<"         --nbrun 5     : do 5 runs, randomizing before each run (default: 1), use -1 to run indefinitely"<<endl
+           <<"         --nbthread 8  : use 8 threads for parallel computations (default: 1), use 0 for all processors"<<endl
+           <<"                         with --nbrun, runs are made concurrently, one per thread"<<endl
+           <<"         --nbworld 32  : use 32 worlds for parallel tempering (default: 30)"<<endl
            <<"         -o out.xml   : output in 'out.xml'"<<endl
            <<"         --randomize  : randomize initial configuration"<<endl
            <<"         --silent     : (almost) no text output"<<endl
@@ -1436,6 +1496,45 @@ int main (int argc, char *argv[])
       #endif
       return 0;
    }
+   if(testNbWorld)
+   {
+      bool ok=true;
+      const long vNbWorld[2]={2,4};
+      for(unsigned int i=0;i<2;++i)
+      {
+         const bool res=ParallelTemperingTest(vNbWorld[i],20000);
+         cout<<" Parallel Tempering test with "<<vNbWorld[i]<<" worlds - "<<(res?"SUCCESS":"FAILED")<<" -"<<endl;
+         ok=ok&&res;
+      }
+      #ifdef __WX__CRYST__
+      this->OnExit();
+      #endif
+      exit(ok?0:1);
+   }
+   if(testMultiRun)
+   {
+      const bool ok=MultiRunTest(8,20000);
+      cout<<" Multiple runs test using "<<GetNbThread()<<" threads - "<<(ok?"SUCCESS":"FAILED")<<" -"<<endl;
+      #ifdef __WX__CRYST__
+      this->OnExit();
+      #endif
+      exit(ok?0:1);
+   }
+   if(benchmarkFile!="")
+   {
+      const std::list<SpeedTestReport> vReport=SpeedTestMatrix(2.5);
+      ofstream out(benchmarkFile.c_str());
+      out.imbue(std::locale::classic());
+      if((benchmarkFile.size()>4)&&(benchmarkFile.substr(benchmarkFile.size()-4)==".csv"))
+         WriteSpeedTestReportCSV(out,vReport,foxVersion);
+      else WriteSpeedTestReportJSON(out,vReport,foxVersion);
+      out.close();
+      cout<<"Benchmark results saved to: "<<benchmarkFile<<endl;
+      #ifdef __WX__CRYST__
+      this->OnExit();
+      #endif
+      return 0;
+   }
    if(testSPEED)
    {
       standardSpeedTest();
@@ -1447,6 +1546,12 @@ int main (int argc, char *argv[])
    }
    if(!useGUI)
    {
+      if(nbWorld>0)
+         for(int i=0;i<gOptimizationObjRegistry.GetNb();i++)
+         {
+            MonteCarloObj *pMonteCarlo=dynamic_cast<MonteCarloObj*>(&(gOptimizationObjRegistry.GetObj(i)));
+            if(pMonteCarlo!=0) pMonteCarlo->SetNbWorld(nbWorld);
+         }
       if(nbTrial!=0)
       {
          if(nbRun==1)
@@ -166,6 +166,23 @@ const ScatteringComponentList& Atom::GetScatteringComponentList() const
 
 string Atom::GetComponentName(const int i) const{ return this->GetName();}
 
+bool Atom::GetScatteringComponentListDeriv(const RefinablePar &par,
+                                           CrystVector_REAL &dx, CrystVector_REAL &dy,
+                                           CrystVector_REAL &dz, CrystVector_REAL &docc)const
+{
+   const REAL *p=par.GetPointer();
+   if((p!=mXYZ.data())&&(p!=mXYZ.data()+1)&&(p!=mXYZ.data()+2)&&(p!=&mOccupancy)) return false;
+   dx.resize(1);
+   dy.resize(1);
+   dz.resize(1);
+   docc.resize(1);
+   dx(0)  =(p==mXYZ.data())  ?1:0;
+   dy(0)  =(p==mXYZ.data()+1)?1:0;
+   dz(0)  =(p==mXYZ.data()+2)?1:0;
+   docc(0)=(p==&mOccupancy)  ?1:0;
+   return true;
+}
+
 void Atom::Print() const
 {
    VFN_DEBUG_MESSAGE("Atom::Print()",1)
@@ -104,6 +104,9 @@ class Atom: public Scatterer
       virtual int GetNbComponent() const;
       virtual const ScatteringComponentList& GetScatteringComponentList() const;
       virtual string GetComponentName(const int i) const;
+      virtual bool GetScatteringComponentListDeriv(const RefinablePar &par,
+                                                   CrystVector_REAL &dx, CrystVector_REAL &dy,
+                                                   CrystVector_REAL &dz, CrystVector_REAL &docc)const;
 
       virtual void Print() const;
 
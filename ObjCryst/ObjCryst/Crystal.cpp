@@ -24,6 +24,7 @@
 #include <cmath>
 #include <set>
 #include <vector>
+#include <algorithm>
 #include <typeinfo>
 #include <boost/format.hpp>
 
@@ -43,8 +44,65 @@
 #include <fstream>
 #include <iomanip>
 
+#ifdef HAVE_SSE_MATHFUN
+#include "ObjCryst/Quirks/sse_mathfun.h"
+#include "ObjCryst/Quirks/sse_mathfun_pd.h"
+#ifdef __AVX2__
+#include "ObjCryst/Quirks/avx_mathfun.h"
+#endif
+#endif
+
 namespace ObjCryst
 {
+/// Sum of w[i]*exp(x[i]) for i<nb, used for bond valence sums
+inline float ExpWeightedSum(const float *x,const float *w,const unsigned long nb)
+{
+   float sum=0;
+   unsigned long i=0;
+   #ifdef HAVE_SSE_MATHFUN
+   #ifdef __AVX2__
+   if(nb>=8)
+   {
+      v8sf vsum=_mm256_setzero_ps();
+      for(;(i+8)<=nb;i+=8)
+         vsum=_mm256_add_ps(vsum,_mm256_mul_ps(_mm256_loadu_ps(w+i),exp256_ps(_mm256_loadu_ps(x+i))));
+      float tmp[8];
+      _mm256_storeu_ps(tmp,vsum);
+      for(unsigned int j=0;j<8;++j) sum+=tmp[j];
+   }
+   #endif
+   if((i+4)<=nb)
+   {
+      v4sf vsum=_mm_setzero_ps();
+      for(;(i+4)<=nb;i+=4)
+         vsum=_mm_add_ps(vsum,_mm_mul_ps(_mm_loadu_ps(w+i),exp_ps(_mm_loadu_ps(x+i))));
+      float tmp[4];
+      _mm_storeu_ps(tmp,vsum);
+      sum+=tmp[0]+tmp[1]+tmp[2]+tmp[3];
+   }
+   #endif
+   for(;i<nb;i++) sum+=w[i]*exp(x[i]);
+   return sum;
+}
+inline double ExpWeightedSum(const double *x,const double *w,const unsigned long nb)
+{
+   double sum=0;
+   unsigned long i=0;
+   #ifdef HAVE_SSE_MATHFUN
+   if(nb>=2)
+   {
+      v2df vsum=_mm_setzero_pd();
+      for(;(i+2)<=nb;i+=2)
+         vsum=_mm_add_pd(vsum,_mm_mul_pd(_mm_loadu_pd(w+i),exp_pd(_mm_loadu_pd(x+i))));
+      double tmp[2];
+      _mm_storeu_pd(tmp,vsum);
+      sum+=tmp[0]+tmp[1];
+   }
+   #endif
+   for(;i<nb;i++) sum+=w[i]*exp(x[i]);
+   return sum;
+}
+
 const RefParType *gpRefParTypeCrystal=0;
 long NiftyStaticGlobalObjectsInitializer_Crystal::mCount=0;
 ////////////////////////////////////////////////////////////////////////
@@ -861,27 +919,35 @@ REAL Crystal::GetBumpMergeCost() const
 
    mBumpMergeCost=0;
 
-   std::vector<NeighbourHood>::const_iterator pos;
-   std::vector<Crystal::Neighbour>::const_iterator neigh;
-   REAL tmp;
-   const ScatteringPower *i1,*i2;
-   VBumpMergePar::const_iterator par;
-   for(pos=mvDistTableSq.begin();pos<mvDistTableSq.end();pos++)
-   {
-      i1=mScattCompList(pos->mIndex).mpScattPow;
-      for(neigh=pos->mvNeighbour.begin();neigh<pos->mvNeighbour.end();neigh++)
+   this->CalcPackedDistTable();
+   // Anti-bump parameters for each pair of ScatteringPower (negative distance if none)
+   const unsigned long nbPow=mvPackedScattPow.size();
+   std::vector<REAL> vDist2(nbPow*nbPow,-1);
+   std::vector<bool> vCanOverlap(nbPow*nbPow,false);
+   for(unsigned long i1=0;i1<nbPow;i1++)
+      for(unsigned long i2=0;i2<nbPow;i2++)
       {
-         i2=mScattCompList(neigh->mNeighbourIndex).mpScattPow;
-         if(i1<i2) par=mvBumpMergePar.find(std::make_pair(i1,i2));
-         else par=mvBumpMergePar.find(std::make_pair(i2,i1));
+         VBumpMergePar::const_iterator par;
+         if(mvPackedScattPow[i1]<mvPackedScattPow[i2])
+            par=mvBumpMergePar.find(std::make_pair(mvPackedScattPow[i1],mvPackedScattPow[i2]));
+         else par=mvBumpMergePar.find(std::make_pair(mvPackedScattPow[i2],mvPackedScattPow[i1]));
          if(par==mvBumpMergePar.end()) continue;
-         if(neigh->mDist2 > par->second.mDist2) continue;
-         if(true==par->second.mCanOverlap)
-            tmp = 0.5*sin(M_PI*(1.-sqrt(neigh->mDist2/par->second.mDist2)))/0.1;
-         else
-            tmp = tan(M_PI*0.49999*(1.-sqrt(neigh->mDist2/par->second.mDist2)))/0.1;
-         mBumpMergeCost += tmp*tmp;
+         vDist2[i1*nbPow+i2]=par->second.mDist2;
+         vCanOverlap[i1*nbPow+i2]=par->second.mCanOverlap;
       }
+   // Only the few neighbours closer than the anti-bump distance contribute
+   REAL tmp;
+   const unsigned long nbNeighbour=mvPackedNeighbourDist2.size();
+   for(unsigned long k=0;k<nbNeighbour;k++)
+   {
+      const REAL d2=mvPackedNeighbourDist2[k];
+      const REAL d2max=vDist2[mvPackedNeighbourPair[k]];
+      if(d2 > d2max) continue;
+      if(true==vCanOverlap[mvPackedNeighbourPair[k]])
+         tmp = 0.5*sin(M_PI*(1.-sqrt(d2/d2max)))/0.1;
+      else
+         tmp = tan(M_PI*0.49999*(1.-sqrt(d2/d2max)))/0.1;
+      mBumpMergeCost += tmp*tmp;
    }
    mBumpMergeCost *= this->GetSpaceGroup().GetNbSymmetrics();
    mBumpMergeCostClock.Click();
@@ -930,12 +996,12 @@ void Crystal::GlobalOptRandomMove(const REAL mutationAmplitude,
    VFN_DEBUG_ENTRY("Crystal::GlobalOptRandomMove()",2)
    //Either a random move or a permutation of two scatterers
    const unsigned long nb=(unsigned long)this->GetNbScatterer();
-   if( ((rand()/(REAL)RAND_MAX)<.02) && (nb>1))
+   if( ((ObjCrystRand()/(REAL)RAND_MAX)<.02) && (nb>1))
    {
       // This is safe even if one scatterer is partially fixed,
       // since we the SetX/SetY/SetZ actually use the MutateTo() function.
-      const unsigned long n1=rand()%nb;
-      const unsigned long n2=(  (rand()%(nb-1)) +n1+1) %nb;
+      const unsigned long n1=ObjCrystRand()%nb;
+      const unsigned long n2=(  (ObjCrystRand()%(nb-1)) +n1+1) %nb;
       const float x1=this->GetScatt(n1).GetX();
       const float y1=this->GetScatt(n1).GetY();
       const float z1=this->GetScatt(n1).GetZ();
@@ -1282,30 +1348,34 @@ void Crystal::CalcBondValenceSum()const
    VFN_DEBUG_MESSAGE("Crystal::CalcBondValenceSum()",4)
    TAU_PROFILE("Crystal::CalcBondValenceSum()","void ()",TAU_DEFAULT);
    mvBondValenceCalc.clear();
+   this->CalcPackedDistTable();
+   // Ro for each pair of ScatteringPower (negative if none)
+   const unsigned long nbPow=mvPackedScattPow.size();
+   std::vector<REAL> vRo(nbPow*nbPow,-1);
+   for(unsigned long i1=0;i1<nbPow;i1++)
+      for(unsigned long i2=0;i2<nbPow;i2++)
+      {
+         map<pair<const ScatteringPower*,const ScatteringPower*>,REAL>::const_iterator pos;
+         if(mvPackedScattPow[i1]<mvPackedScattPow[i2])
+            pos=mvBondValenceRo.find(make_pair(mvPackedScattPow[i1],mvPackedScattPow[i2]));
+         else pos=mvBondValenceRo.find(make_pair(mvPackedScattPow[i2],mvPackedScattPow[i1]));
+         if(pos!=mvBondValenceRo.end()) vRo[i1*nbPow+i2]=pos->second;
+      }
+   // Exponent (Ro-dist)/0.37 and occupancy of the neighbours of one atom
+   std::vector<REAL> vArg,vOccup;
    for(long i=0;i<mScattCompList.GetNbComponent();i++)
    {
-      const ScatteringPower *pow1=mScattCompList(i).mpScattPow;
-      int nb=0;
-      REAL val=0.0;
-      std::vector<Crystal::Neighbour>::const_iterator pos;
-      for(pos=mvDistTableSq[i].mvNeighbour.begin();
-          pos<mvDistTableSq[i].mvNeighbour.end();pos++)
+      vArg.clear();
+      vOccup.clear();
+      for(unsigned long k=mvPackedNeighbourStart[i];k<mvPackedNeighbourStart[i+1];k++)
       {
-         const REAL dist=sqrt(pos->mDist2);
-         const REAL occup= mScattCompList(pos->mNeighbourIndex).mOccupancy
-                          *mScattCompList(pos->mNeighbourIndex).mDynPopCorr;
-         const ScatteringPower *pow2=mScattCompList(pos->mNeighbourIndex).mpScattPow;
-         map<pair<const ScatteringPower*,const ScatteringPower*>,REAL>::const_iterator pos;
-         if(pow1<pow2) pos=mvBondValenceRo.find(make_pair(pow1,pow2));
-         else pos=mvBondValenceRo.find(make_pair(pow2,pow1));
-         if(pos!=mvBondValenceRo.end())
-         {
-            const REAL v=exp((pos->second-dist)/0.37);
-            val += occup * v;
-            nb++;
-         }
+         const REAL ro=vRo[mvPackedNeighbourPair[k]];
+         if(ro<0) continue;
+         const ScatteringComponent *pComp=&(mScattCompList(mvPackedNeighbourIndex[k]));
+         vArg.push_back((ro-sqrt(mvPackedNeighbourDist2[k]))/0.37);
+         vOccup.push_back(pComp->mOccupancy*pComp->mDynPopCorr);
       }
-      if(nb!=0) mvBondValenceCalc[i]=val;
+      if(vArg.size()!=0) mvBondValenceCalc[i]=ExpWeightedSum(&vArg[0],&vOccup[0],vArg.size());
    }
    mBondValenceCalcClock.Click();
 }
@@ -1955,6 +2025,57 @@ void Crystal::CalcDistTable(const bool fast) const
       const REAL m12=(*pOrthMatrix)(1,2);
       const REAL m22=(*pOrthMatrix)(2,2);
 
+      // Candidate neighbours (indices in vPos) for each unique atom.
+      std::vector<unsigned long> vCandidate;
+      // Without lattice translations, use a periodic cell list (in fractional coordinates),
+      // so that only positions in the neighbouring cells are tested, rather than all of them.
+      // Each cell is at least mDistTableMaxDistance wide (perpendicular to its faces), so
+      // all neighbours are in the 3x3x3 block of cells around the unique atom.
+      // The orthogonalization matrix is upper triangular, so the length of the reciprocal
+      // lattice vectors (1/distance between lattice planes) are easily computed
+      const REAL inva=sqrt(1/(m00*m00)+m01*m01/(m00*m00*m11*m11)
+                           +(m01*m12-m02*m11)*(m01*m12-m02*m11)/(m00*m00*m11*m11*m22*m22));
+      const REAL invb=sqrt(1/(m11*m11)+m12*m12/(m11*m11*m22*m22));
+      const REAL invc=1/m22;
+      int nbCellX=1,nbCellY=1,nbCellZ=1;
+      if(mDistTableMaxDistance>0)
+      {
+         nbCellX=(int)(1/(mDistTableMaxDistance*inva));
+         nbCellY=(int)(1/(mDistTableMaxDistance*invb));
+         nbCellZ=(int)(1/(mDistTableMaxDistance*invc));
+      }
+      if(nbCellX<1) nbCellX=1; else if(nbCellX>64) nbCellX=64;
+      if(nbCellY<1) nbCellY=1; else if(nbCellY>64) nbCellY=64;
+      if(nbCellZ<1) nbCellZ=1; else if(nbCellZ>64) nbCellZ=64;
+      const bool useCellList=(!loopOnLattice) && ((nbCellX*nbCellY*nbCellZ)>=27);
+      // Cell index for each position in vPos
+      std::vector<int> vPosCell;
+      // Positions sorted by cell, and start of each cell in that list
+      std::vector<unsigned long> vCellPos,vCellStart;
+      if(useCellList)
+      {
+         const int nbCell=nbCellX*nbCellY*nbCellZ;
+         vPosCell.resize(vPos.size());
+         vCellStart.assign(nbCell+1,0);
+         for(unsigned long j=0;j<vPos.size();j++)
+         {
+            int cx=(int)((vPos[j].mX-floor(vPos[j].mX))*nbCellX);if(cx>=nbCellX) cx=nbCellX-1;
+            int cy=(int)((vPos[j].mY-floor(vPos[j].mY))*nbCellY);if(cy>=nbCellY) cy=nbCellY-1;
+            int cz=(int)((vPos[j].mZ-floor(vPos[j].mZ))*nbCellZ);if(cz>=nbCellZ) cz=nbCellZ-1;
+            vPosCell[j]=(cz*nbCellY+cy)*nbCellX+cx;
+            vCellStart[vPosCell[j]+1]++;
+         }
+         for(int c=0;c<nbCell;c++) vCellStart[c+1]+=vCellStart[c];
+         vCellPos.resize(vPos.size());
+         std::vector<unsigned long> vCellFill(vCellStart.begin(),vCellStart.end()-1);
+         for(unsigned long j=0;j<vPos.size();j++) vCellPos[vCellFill[vPosCell[j]]++]=j;
+      }
+      else
+      {
+         vCandidate.resize(vPos.size());
+         for(unsigned long j=0;j<vPos.size();j++) vCandidate[j]=j;
+      }
+
       for(long i=0;i<nbComponent;i++)
       {
          VFN_DEBUG_MESSAGE("Crystal::CalcDistTable(fast):4:component "<<i,0)
@@ -1971,8 +2092,35 @@ void Crystal::CalcDistTable(const bool fast) const
          const REAL x0i=vPos[vUniqueIndex[i] ].mX;
          const REAL y0i=vPos[vUniqueIndex[i] ].mY;
          const REAL z0i=vPos[vUniqueIndex[i] ].mZ;
-         for(unsigned long j=0;j<vPos.size();j++)
+         if(useCellList)
          {
+            const int c0=vPosCell[vUniqueIndex[i]];
+            const int cx0=c0%nbCellX,cy0=(c0/nbCellX)%nbCellY,cz0=c0/(nbCellX*nbCellY);
+            // With less than 3 cells along one direction, all are scanned (only once)
+            const int dx0=(nbCellX<3)?0:-1,dx1=(nbCellX<3)?nbCellX-1:1;
+            const int dy0=(nbCellY<3)?0:-1,dy1=(nbCellY<3)?nbCellY-1:1;
+            const int dz0=(nbCellZ<3)?0:-1,dz1=(nbCellZ<3)?nbCellZ-1:1;
+            vCandidate.clear();
+            for(int dz=dz0;dz<=dz1;dz++)
+            {
+               const int cz=(cz0+dz+nbCellZ)%nbCellZ;
+               for(int dy=dy0;dy<=dy1;dy++)
+               {
+                  const int cy=(cy0+dy+nbCellY)%nbCellY;
+                  for(int dx=dx0;dx<=dx1;dx++)
+                  {
+                     const int c=(cz*nbCellY+cy)*nbCellX+(cx0+dx+nbCellX)%nbCellX;
+                     for(unsigned long k=vCellStart[c];k<vCellStart[c+1];k++)
+                        vCandidate.push_back(vCellPos[k]);
+                  }
+               }
+            }
+            // Keep the same order of neighbours as when testing all positions
+            std::sort(vCandidate.begin(),vCandidate.end());
+         }
+         for(std::vector<unsigned long>::const_iterator posj=vCandidate.begin();posj!=vCandidate.end();++posj)
+         {
+            const unsigned long j=*posj;
             if((vUniqueIndex[i]==j) && (!loopOnLattice)) continue;// distance to self !
             // Start with the smallest absolute coordinates possible
             REAL x=fmod(vPos[j].mX - x0i,(REAL)1.0);if(x<-.5)x+=1;if(x>.5)x-=1;
@@ -2056,6 +2204,45 @@ void Crystal::CalcDistTable(const bool fast) const
    VFN_DEBUG_EXIT("Crystal::CalcDistTable()",4)
 }
 
+void Crystal::CalcPackedDistTable()const
+{
+   this->CalcDistTable(true);
+   if(mPackedDistTableClock>mDistTableClock) return;
+   VFN_DEBUG_ENTRY("Crystal::CalcPackedDistTable()",4)
+   TAU_PROFILE("Crystal::CalcPackedDistTable()","void ()",TAU_DEFAULT);
+   const long nbComponent=mScattCompList.GetNbComponent();
+   mvPackedScattPow.clear();
+   mvPackedScattPowIndex.resize(nbComponent);
+   for(long i=0;i<nbComponent;i++)
+   {
+      const ScatteringPower *pow=mScattCompList(i).mpScattPow;
+      unsigned long j=0;
+      for(;j<mvPackedScattPow.size();j++) if(mvPackedScattPow[j]==pow) break;
+      if(j==mvPackedScattPow.size()) mvPackedScattPow.push_back(pow);
+      mvPackedScattPowIndex[i]=j;
+   }
+   const int nbPow=mvPackedScattPow.size();
+   mvPackedNeighbourStart.resize(nbComponent+1);
+   mvPackedNeighbourIndex.clear();
+   mvPackedNeighbourDist2.clear();
+   mvPackedNeighbourPair.clear();
+   for(long i=0;i<nbComponent;i++)
+   {
+      mvPackedNeighbourStart[i]=mvPackedNeighbourIndex.size();
+      const int i1=mvPackedScattPowIndex[mvDistTableSq[i].mIndex];
+      std::vector<Crystal::Neighbour>::const_iterator pos;
+      for(pos=mvDistTableSq[i].mvNeighbour.begin();pos<mvDistTableSq[i].mvNeighbour.end();pos++)
+      {
+         mvPackedNeighbourIndex.push_back(pos->mNeighbourIndex);
+         mvPackedNeighbourDist2.push_back(pos->mDist2);
+         mvPackedNeighbourPair.push_back(i1*nbPow+mvPackedScattPowIndex[pos->mNeighbourIndex]);
+      }
+   }
+   mvPackedNeighbourStart[nbComponent]=mvPackedNeighbourIndex.size();
+   mPackedDistTableClock.Click();
+   VFN_DEBUG_EXIT("Crystal::CalcPackedDistTable()",4)
+}
+
 void Crystal::SetDeleteSubObjInDestructor(const bool b) {
     mDeleteSubObjInDestructor=b;
 }
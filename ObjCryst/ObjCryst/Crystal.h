@@ -419,6 +419,10 @@ class Crystal:public UnitCell
       * \warning Crystal::GetScatteringComponentList() \b must be called beforehand,
       * since this will not be done here.
       *
+      * When the unit cell is large enough (no lattice translations needed), the
+      * neighbours of each unique atom are only searched in the nearby cells of a
+      * periodic cell list, instead of among all generated positions.
+      *
       * \return see Crystal::mDistTableSq and Crystal::mDistTableIndex
       * \todo sanitize the result distance table in a more usable structure than the currently
       * used Crystal::mDistTableSq and Crystal::mDistTableIndex.
@@ -481,6 +485,27 @@ class Crystal:public UnitCell
       mutable RefinableObjClock mDistTableClock;
       /// The distance up to which the distance table & neighbours needs to be calculated
       mutable REAL mDistTableMaxDistance;
+      /** \internal Update the packed (structure-of-arrays) copy of the distance table,
+      * with the index of the ScatteringPower pair for each neighbour. This is used
+      * for a fast evaluation of the anti-bump and bond valence costs, using tables
+      * indexed by ScatteringPower pair rather than a map lookup for each neighbour.
+      */
+      void CalcPackedDistTable()const;
+      /// ScatteringPower of the scattering components, as indexed in the packed distance table
+      mutable std::vector<const ScatteringPower*> mvPackedScattPow;
+      /// Index of the ScatteringPower (in mvPackedScattPow) for each scattering component
+      mutable std::vector<int> mvPackedScattPowIndex;
+      /// Index of the first neighbour in the packed arrays for each unique atom
+      /// (with one extra element for the end of the last one)
+      mutable std::vector<unsigned long> mvPackedNeighbourStart;
+      /// Index of each neighbour in the scattering component list
+      mutable std::vector<unsigned long> mvPackedNeighbourIndex;
+      /// Squared distance of each neighbour
+      mutable std::vector<REAL> mvPackedNeighbourDist2;
+      /// ScatteringPower pair index (i1*nbScattPow+i2) of each neighbour
+      mutable std::vector<int> mvPackedNeighbourPair;
+      /// The time when the packed distance table was last calculated
+      mutable RefinableObjClock mPackedDistTableClock;
 
       /// The list of all scattering components in the crystal
       mutable ScatteringComponentList mScattCompList;
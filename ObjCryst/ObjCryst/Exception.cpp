@@ -24,8 +24,13 @@
 #include "ObjCryst/ObjCryst/General.h"
 #include <iostream>
 #include <ctime>
+#include <cstdlib>
 #include "ObjCryst/ObjCryst/IO.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 namespace ObjCryst
 {
 
@@ -80,4 +85,53 @@ void ObjCrystInformUserStdOut(const string &str)
    cout <<str<<endl;
 }
 
+//######################################################################
+static int sObjCrystNbThread=1;
+
+void SetNbThread(const int nb)
+{
+   #ifdef _OPENMP
+   if(nb<=0) sObjCrystNbThread=omp_get_num_procs();
+   else sObjCrystNbThread=nb;
+   #else
+   sObjCrystNbThread=1;
+   #endif
+}
+
+int GetNbThread()
+{
+   return sObjCrystNbThread;
+}
+
+//######################################################################
+static unsigned long *spObjCrystRandomState=0;
+#ifdef _OPENMP
+#pragma omp threadprivate(spObjCrystRandomState)
+#endif
+
+int ObjCrystRand()
+{
+   if(spObjCrystRandomState==0) return rand();
+   // 32-bit xorshift generator
+   unsigned long x=*spObjCrystRandomState;
+   x^=(x<<13)&0xFFFFFFFFUL;
+   x^=x>>17;
+   x^=(x<<5)&0xFFFFFFFFUL;
+   *spObjCrystRandomState=x;
+   return (int)((x>>1)%((unsigned long)RAND_MAX+1));
+}
+
+void SetRandomState(unsigned long *state)
+{
+   spObjCrystRandomState=state;
+}
+
+unsigned long InitRandomState(const unsigned long seed)
+{
+   // The xorshift state must be a non-zero 32-bit value
+   const unsigned long x=(seed*2654435761UL+1)&0xFFFFFFFFUL;
+   if(x==0) return 1;
+   return x;
+}
+
 }//namespace
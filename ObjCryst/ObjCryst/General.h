@@ -148,6 +148,37 @@ void ObjCrystInformUserStdOut(const string &);
 */
 extern void (*fpObjCrystInformUser)(const string &);
 
+//######################################################################
+/** \brief Set the number of threads used for parallel computations
+*
+* This only has an effect if ObjCryst++ was compiled with OpenMP support
+* (e.g. using "make openmp=1"), otherwise all computations are serial.
+*
+* \param nb: the number of threads. If nb<=0, all available processors are used.
+* The default is 1, i.e. parallel computations must be explicitly enabled.
+*/
+void SetNbThread(const int nb);
+/// Number of threads used for parallel computations (always 1 without OpenMP support)
+int GetNbThread();
+
+/** \brief Pseudo-random integer between 0 and RAND_MAX, for use in global optimizations
+*
+* This uses the generator state selected for the current thread with SetRandomState(),
+* or rand() if no state was selected (the default). Copies of an optimization run in
+* parallel (e.g. the Worlds of a parallel tempering) can each select their own state,
+* so that their random sequences do not depend on the scheduling of the threads.
+*/
+int ObjCrystRand();
+/** \brief Select the generator state used by ObjCrystRand() in the current thread
+*
+* \param state: the generator state, which is updated by each call to ObjCrystRand().
+* It must remain valid until SetRandomState(0) is called in the same thread. If 0,
+* ObjCrystRand() uses rand().
+*/
+void SetRandomState(unsigned long *state);
+/// Initial generator state for SetRandomState(), from a seed (any value)
+unsigned long InitRandomState(const unsigned long seed);
+
 /** Class to compare pairs of objects, with the two objects playing a
 * symmetric role.
 */
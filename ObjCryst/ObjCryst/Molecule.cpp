@@ -1871,7 +1871,7 @@ void StretchModeTwist::RandomStretch(const REAL amplitude,
    const REAL dy=mpAtom2->GetY()-mpAtom1->GetY();
    const REAL dz=mpAtom2->GetZ()-mpAtom1->GetZ();
    if((abs(dx)+abs(dy)+abs(dz))<1e-6) return;// :KLUDGE:
-   const REAL change=(REAL)(2.*rand()-RAND_MAX)/(REAL)RAND_MAX*mBaseAmplitude*amplitude;
+   const REAL change=(REAL)(2.*ObjCrystRand()-RAND_MAX)/(REAL)RAND_MAX*mBaseAmplitude*amplitude;
    mpMol->RotateAtomGroup(*mpAtom1,*mpAtom2,mvRotatedAtomList,change,keepCenter);
 }
 
@@ -2612,7 +2612,7 @@ void Molecule::RandomizeConfiguration()
       for(list<RotorGroup>::const_iterator pos=mvRotorGroupTorsion.begin();
           pos!=mvRotorGroupTorsion.end();++pos)
       {
-         const REAL angle=(REAL)rand()*2.*M_PI/(REAL)RAND_MAX;
+         const REAL angle=(REAL)ObjCrystRand()*2.*M_PI/(REAL)RAND_MAX;
          this->RotateAtomGroup(*(pos->mpAtom1),*(pos->mpAtom2),
                                pos->mvRotatedAtomList,angle);
       }
@@ -2620,7 +2620,7 @@ void Molecule::RandomizeConfiguration()
       for(list<RotorGroup>::const_iterator pos=mvRotorGroupTorsionSingleChain.begin();
           pos!=mvRotorGroupTorsionSingleChain.end();++pos)
       {
-         const REAL angle=(REAL)rand()*2.*M_PI/(REAL)RAND_MAX;
+         const REAL angle=(REAL)ObjCrystRand()*2.*M_PI/(REAL)RAND_MAX;
          this->RotateAtomGroup(*(pos->mpAtom1),*(pos->mpAtom2),
                                pos->mvRotatedAtomList,angle);
       }
@@ -2628,7 +2628,7 @@ void Molecule::RandomizeConfiguration()
       for(list<RotorGroup>::const_iterator pos=mvRotorGroupInternal.begin();
           pos!=mvRotorGroupInternal.end();++pos)
       {
-         const REAL angle=(REAL)rand()*2.*M_PI/(REAL)RAND_MAX;
+         const REAL angle=(REAL)ObjCrystRand()*2.*M_PI/(REAL)RAND_MAX;
          this->RotateAtomGroup(*(pos->mpAtom1),*(pos->mpAtom2),
                                pos->mvRotatedAtomList,angle);
       }
@@ -2637,7 +2637,7 @@ void Molecule::RandomizeConfiguration()
          pos=mvStretchModeTorsion.begin();
        pos!=mvStretchModeTorsion.end();++pos)
    {
-      const REAL amp=2*M_PI*rand()/(REAL)RAND_MAX;
+      const REAL amp=2*M_PI*ObjCrystRand()/(REAL)RAND_MAX;
       this->DihedralAngleRandomChange(*pos,amp,true);
    }
    // Molecular dynamics moves
@@ -2646,7 +2646,7 @@ void Molecule::RandomizeConfiguration()
       // Random initial speed for all atoms
       map<MolAtom*,XYZ> v0;
       for(vector<MolAtom*>::iterator at=this->GetAtomList().begin();at!=this->GetAtomList().end();++at)
-         v0[*at]=XYZ(rand()/(REAL)RAND_MAX+0.5,rand()/(REAL)RAND_MAX+0.5,rand()/(REAL)RAND_MAX+0.5);
+         v0[*at]=XYZ(ObjCrystRand()/(REAL)RAND_MAX+0.5,ObjCrystRand()/(REAL)RAND_MAX+0.5,ObjCrystRand()/(REAL)RAND_MAX+0.5);
 
       const REAL nrj0=mMDMoveEnergy*( this->GetBondList().size()
                                      +this->GetBondAngleList().size()
@@ -2680,8 +2680,8 @@ void Molecule::RandomizeConfiguration()
    {//Rotate around an arbitrary vector
       const REAL amp=M_PI/RAND_MAX;
       mQuat *= Quaternion::RotationQuaternion
-                  ((2.*(REAL)rand()-(REAL)RAND_MAX)*amp,
-                   (REAL)rand(),(REAL)rand(),(REAL)rand());
+                  ((2.*(REAL)ObjCrystRand()-(REAL)RAND_MAX)*amp,
+                   (REAL)ObjCrystRand(),(REAL)ObjCrystRand(),(REAL)ObjCrystRand());
       mQuat.Normalize();
       mClockOrientation.Click();
    }
@@ -2715,12 +2715,12 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
       &&(mFlipModel.GetChoice()==0)
       &&(gpRefParTypeScattConform->IsDescendantFromOrSameAs(type))
       &&(mvFlipGroup.size()>0)
-      &&(((rand()%100)==0)))
+      &&(((ObjCrystRand()%100)==0)))
    {
 
       this->SaveParamSet(mLocalParamSet);
       const REAL llk0=this->GetLogLikelihood()/mLogLikelihoodScale;
-      const unsigned long i=rand() % mvFlipGroup.size();
+      const unsigned long i=ObjCrystRand() % mvFlipGroup.size();
       list<FlipGroup>::iterator pos=mvFlipGroup.begin();
       for(unsigned long j=0;j<i;++j)++pos;
       this->FlipAtomGroup(*pos,true);
@@ -2778,8 +2778,8 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
          REAL mult=1.0;
          if((1==mFlexModel.GetChoice())||(mvRotorGroupTorsion.size()<2)) mult=2.0;
          mQuat *= Quaternion::RotationQuaternion
-                     ((2.*(REAL)rand()-(REAL)RAND_MAX)*amp*mutationAmplitude*mult,
-                      (REAL)rand(),(REAL)rand(),(REAL)rand());
+                     ((2.*(REAL)ObjCrystRand()-(REAL)RAND_MAX)*amp*mutationAmplitude*mult,
+                      (REAL)ObjCrystRand(),(REAL)ObjCrystRand(),(REAL)ObjCrystRand());
          mQuat.Normalize();
          mClockOrientation.Click();
       }
@@ -2796,9 +2796,9 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
       {
          if(mFlexModel.GetChoice()!=1)
          {
-            #if 1 // Move as many atoms as possible
-            if((mvMDFullAtomGroup.size()>3)&&(rand()<(RAND_MAX*mMDMoveFreq)))
-            {
+            if(  (mMDMoveType.GetChoice()==0)&&(mvMDFullAtomGroup.size()>3)
+               &&(ObjCrystRand()<(RAND_MAX*mMDMoveFreq)))
+            {// Move as many atoms as possible
                #if 0
                // Use one center for the position of an impulsion, applied to all atoms with an exponential decrease
                // Determine extent of atom group
@@ -2822,9 +2822,9 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
                if(dx<2) dx=2;
                if(dy<2) dy=2;
                if(dz<2) dz=2;
-               const REAL xc=xmin+rand()/(REAL)RAND_MAX*(xmax-xmin);
-               const REAL yc=ymin+rand()/(REAL)RAND_MAX*(ymax-ymin);
-               const REAL zc=zmin+rand()/(REAL)RAND_MAX*(zmax-zmin);
+               const REAL xc=xmin+ObjCrystRand()/(REAL)RAND_MAX*(xmax-xmin);
+               const REAL yc=ymin+ObjCrystRand()/(REAL)RAND_MAX*(ymax-ymin);
+               const REAL zc=zmin+ObjCrystRand()/(REAL)RAND_MAX*(zmax-zmin);
                map<MolAtom*,XYZ> v0;
                const REAL ax=-4.*log(2.)/(dx*dx);
                const REAL ay=-4.*log(2.)/(dy*dy);
@@ -2839,7 +2839,7 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
                for(set<MolAtom*>::iterator at=this->mvMDFullAtomGroup.begin();at!=this->mvMDFullAtomGroup.end();++at)
                   v0[*at]=XYZ(0,0,0);
                std::map<MolAtom*,unsigned long> pushedAtoms;
-               unsigned long idx=rand()%v0.size();
+               unsigned long idx=ObjCrystRand()%v0.size();
                set<MolAtom*>::iterator at0=this->mvMDFullAtomGroup.begin();
                for(unsigned int i=0;i<idx;i++) at0++;
                const REAL xc=(*at0)->GetX();
@@ -2850,14 +2850,14 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
                REAL ux,uy,uz,n=0;
                while(n<1)
                {
-                  ux=REAL(rand()-RAND_MAX/2);
-                  uy=REAL(rand()-RAND_MAX/2);
-                  uz=REAL(rand()-RAND_MAX/2);
+                  ux=REAL(ObjCrystRand()-RAND_MAX/2);
+                  uy=REAL(ObjCrystRand()-RAND_MAX/2);
+                  uz=REAL(ObjCrystRand()-RAND_MAX/2);
                   n=sqrt(ux*ux+uy*uy+uz*uz);
                }
                ux=ux/n;uy=uy/n;uz=uz/n;
                const REAL a=-4.*log(2.)/(2*2);//FWHM=2 Angstroems
-               if(rand()%2==0)
+               if(ObjCrystRand()%2==0)
                   for(map<MolAtom*,unsigned long>::iterator at=pushedAtoms.begin() ;at!=pushedAtoms.end();++at)
                      v0[at->first]=XYZ(ux*exp(a*(at->first->GetX()-xc)*(at->first->GetX()-xc)),
                                  uy*exp(a*(at->first->GetY()-yc)*(at->first->GetY()-yc)),
@@ -2880,29 +2880,26 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
                                              this->GetDihedralAngleList(),
                                              vr,nrj0);
             }
-            #else // Move atoms belonging to a MD group
-            if((mvMDAtomGroup.size()>0)&&(rand()<(RAND_MAX*mMDMoveFreq)))
-            {
-               const unsigned int n=rand()%mvMDAtomGroup.size();
-               list<MDAtomGroup>::iterator pos=mvMDAtomGroup.begin();
-               for(unsigned int i=0;i<n;++i)++pos;
-               map<MolAtom*,XYZ> v0;
-               for(set<MolAtom*>::iterator at=pos->mvpAtom.begin();at!=pos->mvpAtom.end();++at)
-                  v0[*at]=XYZ(rand()/(REAL)RAND_MAX+0.5,rand()/(REAL)RAND_MAX+0.5,rand()/(REAL)RAND_MAX+0.5);
-
-               const REAL nrj0=mMDMoveEnergy*( pos->mvpBond.size()
-                                    +pos->mvpBondAngle.size()
-                                    +pos->mvpDihedralAngle.size());
-               map<RigidGroup*,std::pair<XYZ,XYZ> > vr;
+            else if(  (mMDMoveType.GetChoice()==1)&&(mvMDAtomGroupBatch.size()>0)
+                    &&(ObjCrystRand()<(RAND_MAX*mMDMoveFreq)))
+            {// Move atoms belonging to a batch of independent MD groups
+               const vector<MDAtomGroup*> *pBatch=&(mvMDAtomGroupBatch[ObjCrystRand()%mvMDAtomGroupBatch.size()]);
+               vector<map<MolAtom*,XYZ> > vv0(pBatch->size());
+               vector<REAL> vnrj0(pBatch->size());
                float nrjMult=1.0+mutationAmplitude*0.2;
-               if((rand()%20)==0) nrjMult=4.0;
-               this->MolecularDynamicsEvolve(v0, int(100*sqrt(mutationAmplitude)),0.004,
-                                             pos->mvpBond,
-                                             pos->mvpBondAngle,
-                                             pos->mvpDihedralAngle,
-                                             vr,nrj0*nrjMult);
+               if((ObjCrystRand()%20)==0) nrjMult=4.0;
+               for(unsigned int i=0;i<pBatch->size();++i)
+               {
+                  const MDAtomGroup *pos=(*pBatch)[i];
+                  for(set<MolAtom*>::iterator at=pos->mvpAtom.begin();at!=pos->mvpAtom.end();++at)
+                     vv0[i][*at]=XYZ(ObjCrystRand()/(REAL)RAND_MAX+0.5,ObjCrystRand()/(REAL)RAND_MAX+0.5,ObjCrystRand()/(REAL)RAND_MAX+0.5);
+
+                  vnrj0[i]=nrjMult*mMDMoveEnergy*( pos->mvpBond.size()
+                                                  +pos->mvpBondAngle.size()
+                                                  +pos->mvpDihedralAngle.size());
+               }
+               this->MolecularDynamicsEvolveBatch(*pBatch,vv0,int(100*sqrt(mutationAmplitude)),0.004,vnrj0);
             }
-            #endif
             else
             {
             #if 0 // For tests
@@ -2916,7 +2913,7 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
             for(list<StretchMode*>::const_iterator mode=mvpStretchModeNotFree.begin();
                 mode!=mvpStretchModeNotFree.end();++mode)
             {
-               //if((rand()%3)==0)
+               //if((ObjCrystRand()%3)==0)
                {
                   // 2) Get the derivative of the overall LLK for this mode
                   (*mode)->CalcDeriv();
@@ -2928,7 +2925,7 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
                   for(map<const MolDihedralAngle*,REAL>::const_iterator pos=(*mode)->mvpBrokenDihedralAngle.begin();
                       pos!=(*mode)->mvpBrokenDihedralAngle.end();++pos) llk+=pos->first->GetLogLikelihood(false,false);
                   // 3) Calculate MD move. base step =0.1 A (accelerated moves may go faster)
-                  REAL change=(2.*(REAL)rand()-(REAL)RAND_MAX)/(REAL)RAND_MAX;
+                  REAL change=(2.*(REAL)ObjCrystRand()-(REAL)RAND_MAX)/(REAL)RAND_MAX;
                   // if llk>100, change has to be in the opposite direction
                   // For a single restraint, sqrt(llk)=dx/sigma, so do not go above 10*sigma
                   if((*mode)->mLLKDeriv>0)
@@ -2984,10 +2981,10 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
             for(list<StretchMode*>::iterator mode=mvpStretchModeFree.begin();
                 mode!=mvpStretchModeFree.end();++mode)
             {
-               if((rand()%2)==0) (*mode)->RandomStretch(mutationAmplitude);
+               if((ObjCrystRand()%2)==0) (*mode)->RandomStretch(mutationAmplitude);
             }
             TAU_PROFILE_STOP(timer2);
-            if((rand()%3)==0)
+            if((ObjCrystRand()%3)==0)
             {
                // Now do an hybrid move for other modes, with a smaller amplitude (<=0.5)
                // 1) Calc LLK and derivatives for restraints
@@ -3006,7 +3003,7 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
                    mode!=mvpStretchModeNotFree.end();++mode)
                {
                   // 2) Choose Stretch modes
-                  if((rand()%3)==0)
+                  if((ObjCrystRand()%3)==0)
                   {
                      // 2) Get the derivative of the overall LLK for this mode
                      (*mode)->CalcDeriv();
@@ -3017,7 +3014,7 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
                          pos!=(*mode)->mvpBrokenBondAngle.end();++pos) llk+=pos->first->GetLogLikelihood(false,false);
                      for(map<const MolDihedralAngle*,REAL>::const_iterator pos=(*mode)->mvpBrokenDihedralAngle.begin();
                          pos!=(*mode)->mvpBrokenDihedralAngle.end();++pos) llk+=pos->first->GetLogLikelihood(false,false);
-                     REAL change=(2.*(REAL)rand()-(REAL)RAND_MAX)/(REAL)RAND_MAX;
+                     REAL change=(2.*(REAL)ObjCrystRand()-(REAL)RAND_MAX)/(REAL)RAND_MAX;
                      // if llk>100, change has to be in the direction minimising the llk
                      if((*mode)->mLLKDeriv>0)
                      {
@@ -3037,7 +3034,7 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
                // Here we do not take mLogLikelihoodScale into account
                // :TODO: take into account cases where the lllk cannot go down to 0 because of
                // combined restraints.
-               if( ((rand()%100)==0) && (mLogLikelihood>(mvpRestraint.size()*10)))
+               if( ((ObjCrystRand()%100)==0) && (mLogLikelihood>(mvpRestraint.size()*10)))
                   this->OptimizeConformationSteepestDescent(0.02,5);
                TAU_PROFILE_STOP(timer4);
             }
@@ -3046,11 +3043,11 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
             #if 0
             for(list<MDAtomGroup>::iterator pos=mvMDAtomGroup.begin();pos!=mvMDAtomGroup.end();++pos)
             {
-               if((rand()%100)==0)
+               if((ObjCrystRand()%100)==0)
                {
                   map<MolAtom*,XYZ> v0;
                   for(set<MolAtom*>::iterator at=pos->mvpAtom.begin();at!=pos->mvpAtom.end();++at)
-                     v0[*at]=XYZ(rand()/(REAL)RAND_MAX+0.5,rand()/(REAL)RAND_MAX+0.5,rand()/(REAL)RAND_MAX+0.5);
+                     v0[*at]=XYZ(ObjCrystRand()/(REAL)RAND_MAX+0.5,ObjCrystRand()/(REAL)RAND_MAX+0.5,ObjCrystRand()/(REAL)RAND_MAX+0.5);
 
                   const REAL nrj0=20*(pos->mvpBond.size()+pos->mvpBondAngle.size()+pos->mvpDihedralAngle.size());
                   map<RigidGroup*,std::pair<XYZ,XYZ> > vr;
@@ -3064,14 +3061,14 @@ void Molecule::GlobalOptRandomMove(const REAL mutationAmplitude,
             #endif
             }
             // Do a steepest descent from time to time
-            if((rand()%100)==0) this->OptimizeConformationSteepestDescent(0.02,1);
+            if((ObjCrystRand()%100)==0) this->OptimizeConformationSteepestDescent(0.02,1);
 
             mClockLogLikelihood.Click();
             #endif
          }
       }
    }
-   if((rand()%100)==0)
+   if((ObjCrystRand()%100)==0)
    {// From time to time, bring back average position to 0
       REAL x0=0,y0=0,z0=0;
       for(vector<MolAtom*>::iterator pos=mvpAtom.begin();pos!=mvpAtom.end();++pos)
@@ -3103,7 +3100,10 @@ REAL Molecule::GetLogLikelihood()const
       &&(mClockLogLikelihood>mClockAtomPosition)
       &&(mClockLogLikelihood>mClockScatterer)) return mLogLikelihood*mLogLikelihoodScale;
    TAU_PROFILE("Molecule::GetLogLikelihood()","REAL ()",TAU_DEFAULT);
-   mLogLikelihood=this->RefinableObj::GetLogLikelihood();
+   // Use the flat restraint table unless other restraints have been added
+   if(mvpRestraint.size()==(mvpBond.size()+mvpBondAngle.size()+mvpDihedralAngle.size()))
+      mLogLikelihood=this->GetRestraintTableLogLikelihood();
+   else mLogLikelihood=this->RefinableObj::GetLogLikelihood();
    mClockLogLikelihood.Click();
    return mLogLikelihood*mLogLikelihoodScale;
 }
@@ -3156,8 +3156,68 @@ const CrystVector_REAL& Molecule::GetLSQWeight(const unsigned int) const
 
 const CrystVector_REAL& Molecule::GetLSQDeriv(const unsigned int n, RefinablePar&par)
 {
-   //:TODO: return analytical derivatives
-   return RefinableObj::GetLSQDeriv(n,par);
+   TAU_PROFILE("Molecule::GetLSQDeriv()","void (int,RefinablePar&)",TAU_DEFAULT);
+   const REAL *p=par.GetPointer();
+   mLSQDeriv.resize(mvpRestraint.size());
+   // Restraints only depend on the atomic coordinates of this Molecule
+   if(this->FindPar(p)<0)
+   {
+      mLSQDeriv=0;
+      return mLSQDeriv;
+   }
+   // Bond lengths, angles and dihedral angles are invariant by a global
+   // translation or rotation of the Molecule
+   if(  (p==&mXYZ(0))||(p==&mXYZ(1))||(p==&mXYZ(2))||(p==&mOccupancy)
+      ||(p==&(mQuat.Q0()))||(p==&(mQuat.Q1()))||(p==&(mQuat.Q2()))||(p==&(mQuat.Q3())))
+   {
+      mLSQDeriv=0;
+      return mLSQDeriv;
+   }
+   // Atomic coordinate: derivatives from the restraints' gradients
+   map<const MolAtom*,XYZ> m;
+   for(vector<MolAtom*>::const_iterator pos=mvpAtom.begin();pos!=mvpAtom.end();++pos)
+   {
+      if(p==&((*pos)->X())) {m[*pos]=XYZ(1,0,0);break;}
+      if(p==&((*pos)->Y())) {m[*pos]=XYZ(0,1,0);break;}
+      if(p==&((*pos)->Z())) {m[*pos]=XYZ(0,0,1);break;}
+   }
+   // Other parameters (e.g. rigid groups): use numerical derivatives
+   if(m.size()==0) return RefinableObj::GetLSQDeriv(n,par);
+
+   const MolAtom *pAtom=m.begin()->first;
+   REAL *d=mLSQDeriv.data();
+   for(vector<MolBond*>::const_iterator pos=this->GetBondList().begin();pos!=this->GetBondList().end();++pos)
+   {
+      if((&((*pos)->GetAtom1())!=pAtom)&&(&((*pos)->GetAtom2())!=pAtom)) {*d++=0;continue;}
+      (*pos)->GetLogLikelihood(true,true);
+      *d++=(*pos)->GetDeriv(m);
+   }
+   for(vector<MolBondAngle*>::const_iterator pos=this->GetBondAngleList().begin();pos!=this->GetBondAngleList().end();++pos)
+   {
+      if(  (&((*pos)->GetAtom1())!=pAtom)&&(&((*pos)->GetAtom2())!=pAtom)
+         &&(&((*pos)->GetAtom3())!=pAtom)) {*d++=0;continue;}
+      (*pos)->GetLogLikelihood(true,true);
+      *d++=(*pos)->GetDeriv(m);
+   }
+   for(vector<MolDihedralAngle*>::const_iterator pos=this->GetDihedralAngleList().begin();pos!=this->GetDihedralAngleList().end();++pos)
+   {
+      const MolAtom &at1=(*pos)->GetAtom1(),&at2=(*pos)->GetAtom2(),
+                    &at3=(*pos)->GetAtom3(),&at4=(*pos)->GetAtom4();
+      if((&at1!=pAtom)&&(&at2!=pAtom)&&(&at3!=pAtom)&&(&at4!=pAtom)) {*d++=0;continue;}
+      (*pos)->GetLogLikelihood(true,true);
+      // The log(likelihood) derivatives use the sign of v21.v34 for the
+      // dihedral angle, whereas GetDihedralAngle() (used through GetAngle() in
+      // GetLSQCalc) uses the sign of the mixed product v21.(v34 x v23). The raw
+      // angle must be used: GetAngle() may add +/-2pi, which changes its sign
+      // but not the derivative.
+      REAL sgn=1;
+      if( ( (at1.GetX()-at2.GetX())*(at4.GetX()-at3.GetX())
+           +(at1.GetY()-at2.GetY())*(at4.GetY()-at3.GetY())
+           +(at1.GetZ()-at2.GetZ())*(at4.GetZ()-at3.GetZ()))<0) sgn=-sgn;
+      if(GetDihedralAngle(at1,at2,at3,at4)<0) sgn=-sgn;
+      *d++=sgn*(*pos)->GetDeriv(m);
+   }
+   return mLSQDeriv;
 }
 
 void Molecule::TagNewBestConfig()const
@@ -3225,6 +3285,128 @@ string Molecule::GetComponentName(const int i) const
    return mvpAtom[i]->GetName();
 }
 
+/** Product a*v*conj(b) of quaternions a, b and of the pure quaternion v=(0,v1,v2,v3),
+* written in (v1,v2,v3). For a==b this is Quaternion::RotateVector().
+*/
+static void QuaternionProductVector(const REAL a0,const REAL a1,const REAL a2,const REAL a3,
+                                    const REAL b0,const REAL b1,const REAL b2,const REAL b3,
+                                    REAL &v1,REAL &v2,REAL &v3)
+{
+   const REAL p0=-a1*v1 - a2*v2 - a3*v3;
+   const REAL p1= a0*v1 + a2*v3 - a3*v2;
+   const REAL p2= a0*v2 - a1*v3 + a3*v1;
+   const REAL p3= a0*v3 + a1*v2 - a2*v1;
+   v1=-p0*b1 + p1*b0 - p2*b3 + p3*b2;
+   v2=-p0*b2 + p2*b0 + p1*b3 - p3*b1;
+   v3=-p0*b3 + p3*b0 - p1*b2 + p2*b1;
+}
+
+bool Molecule::GetScatteringComponentListDeriv(const RefinablePar &par,
+                                               CrystVector_REAL &dx, CrystVector_REAL &dy,
+                                               CrystVector_REAL &dz, CrystVector_REAL &docc)const
+{
+   #ifdef RIGID_BODY_STRICT_EXPERIMENTAL
+   // Rigid group translations & rotations are applied in UpdateScattCompList()
+   if(this->GetRigidGroupList().size()>0) return false;
+   #endif
+   VFN_DEBUG_ENTRY("Molecule::GetScatteringComponentListDeriv():"<<par.GetName(),3)
+   const REAL *p=par.GetPointer();
+   const long nb=this->GetNbComponent();
+   // Identify the parameter
+   int quatIndex=-1;
+   if(p==&(mQuat.Q0())) quatIndex=0;
+   if(p==&(mQuat.Q1())) quatIndex=1;
+   if(p==&(mQuat.Q2())) quatIndex=2;
+   if(p==&(mQuat.Q3())) quatIndex=3;
+   long atomIndex=-1;
+   int atomAxis=-1;
+   for(long i=0;(i<nb)&&(atomIndex<0);++i)
+   {
+      const MolAtom *pAtom=mvpAtom[i];
+      if(p==&(pAtom->X())) {atomIndex=i;atomAxis=0;}
+      if(p==&(pAtom->Y())) {atomIndex=i;atomAxis=1;}
+      if(p==&(pAtom->Z())) {atomIndex=i;atomAxis=2;}
+   }
+   if(  (p!=mXYZ.data())&&(p!=mXYZ.data()+1)&&(p!=mXYZ.data()+2)&&(p!=&mOccupancy)
+      &&(quatIndex<0)&&(atomIndex<0))
+   {
+      VFN_DEBUG_EXIT("Molecule::GetScatteringComponentListDeriv():not a Molecule parameter",3)
+      return false;
+   }
+   this->UpdateScattCompList();// This normalizes the quaternion
+   dx.resize(nb);
+   dy.resize(nb);
+   dz.resize(nb);
+   docc.resize(nb);
+   dx=0;
+   dy=0;
+   dz=0;
+   docc=0;
+   const REAL q0=mQuat.Q0(),q1=mQuat.Q1(),q2=mQuat.Q2(),q3=mQuat.Q3();
+   if(p==mXYZ.data())   dx=1;
+   if(p==mXYZ.data()+1) dy=1;
+   if(p==mXYZ.data()+2) dz=1;
+   if(p==&mOccupancy)
+      for(long i=0;i<nb;++i) docc(i)=mvpAtom[i]->GetOccupancy();
+   const bool centerAtom=(mMoleculeCenter.GetChoice()!=0) && (mpCenterAtom!=0);
+   if(quatIndex>=0)
+   {// Rotation by the normalized quaternion q/|q|: derivative for |q|=1 is
+    // e_k*v*conj(q)+q*v*conj(e_k)-2*q_k*q*v*conj(q)
+      REAL x0=0,y0=0,z0=0;
+      if(centerAtom)
+      {
+         x0=mpCenterAtom->GetX();
+         y0=mpCenterAtom->GetY();
+         z0=mpCenterAtom->GetZ();
+      }
+      else
+      {
+         for(long i=0;i<nb;++i)
+         {
+            x0+=mvpAtom[i]->GetX();
+            y0+=mvpAtom[i]->GetY();
+            z0+=mvpAtom[i]->GetZ();
+         }
+         x0/=nb;
+         y0/=nb;
+         z0/=nb;
+      }
+      const REAL e0=(quatIndex==0)?1:0,e1=(quatIndex==1)?1:0,
+                 e2=(quatIndex==2)?1:0,e3=(quatIndex==3)?1:0;
+      const REAL qk=(quatIndex==0)?q0:((quatIndex==1)?q1:((quatIndex==2)?q2:q3));
+      for(long i=0;i<nb;++i)
+      {
+         const REAL v1=mvpAtom[i]->GetX()-x0,v2=mvpAtom[i]->GetY()-y0,v3=mvpAtom[i]->GetZ()-z0;
+         REAL a1=v1,a2=v2,a3=v3,b1=v1,b2=v2,b3=v3,c1=v1,c2=v2,c3=v3;
+         QuaternionProductVector(e0,e1,e2,e3,q0,q1,q2,q3,a1,a2,a3);
+         QuaternionProductVector(q0,q1,q2,q3,e0,e1,e2,e3,b1,b2,b3);
+         QuaternionProductVector(q0,q1,q2,q3,q0,q1,q2,q3,c1,c2,c3);
+         REAL d1=a1+b1-2*qk*c1,d2=a2+b2-2*qk*c2,d3=a3+b3-2*qk*c3;
+         this->GetCrystal().OrthonormalToFractionalCoords(d1,d2,d3);
+         dx(i)=d1;
+         dy(i)=d2;
+         dz(i)=d3;
+      }
+   }
+   if(atomIndex>=0)
+   {// Moving one atom also moves the center of the Molecule, if it is the center of mass
+      REAL d1=(atomAxis==0)?1:0,d2=(atomAxis==1)?1:0,d3=(atomAxis==2)?1:0;
+      mQuat.RotateVector(d1,d2,d3);
+      this->GetCrystal().OrthonormalToFractionalCoords(d1,d2,d3);
+      for(long i=0;i<nb;++i)
+      {
+         REAL w=(i==atomIndex)?1:0;
+         if(centerAtom) {if(mvpAtom[atomIndex]==mpCenterAtom) w-=1;}
+         else w-=1/(REAL)nb;
+         dx(i)=w*d1;
+         dy(i)=w*d2;
+         dz(i)=w*d3;
+      }
+   }
+   VFN_DEBUG_EXIT("Molecule::GetScatteringComponentListDeriv()",3)
+   return true;
+}
+
 ostream& Molecule::POVRayDescription(ostream &os,const CrystalPOVRayOptions &options)const
 {
    VFN_DEBUG_ENTRY("Molecule::POVRayDescription()",3)
@@ -4218,6 +4400,352 @@ MolAtom &Molecule::GetAtom(const string &name){return **(this->FindAtom(name));}
 
 const MolAtom &Molecule::GetAtom(const string &name)const{return **(this->FindAtom(name));}
 
+/** Index of an atom in the Molecule's atom list, from the (atom, index) pairs sorted
+* by atom pointer (see Molecule::mvRestraintTableAtomIndex).
+*/
+static inline unsigned long RestraintTableAtomIndex(const vector<pair<const MolAtom*,unsigned long> > &vIndex,
+                                                    const MolAtom *pAtom)
+{
+   return lower_bound(vIndex.begin(),vIndex.end(),make_pair(pAtom,(unsigned long)0))->second;
+}
+
+/** Log(likelihood) of a restraint with value v, ideal value v0, tolerance delta and sigma,
+* as computed in MolBond::GetLogLikelihood(). The derivative of the log(likelihood)
+* versus v is stored in dllk. If periodic is true, deviations are taken modulo 2pi.
+*/
+static inline REAL RestraintTablePenalty(const REAL v,const REAL v0,const REAL delta,const REAL sigma,
+                                         const bool periodic,REAL &dllk)
+{
+   dllk=0;
+   if(sigma<1e-6) return 0;
+   REAL d=v-(v0+delta);
+   if(periodic)
+   {
+      if(d<(-M_PI)) d += 2*M_PI;
+      if(d>  M_PI ) d -= 2*M_PI;
+   }
+   if(d<=0)
+   {
+      d=v-(v0-delta);
+      if(periodic)
+      {
+         if(d<(-M_PI)) d += 2*M_PI;
+         if(d>  M_PI ) d -= 2*M_PI;
+      }
+      if(d>=0) return 0;
+   }
+   d/=sigma;
+   #ifdef RESTRAINT_X2_X4_X6
+   const REAL d2=d*d;
+   dllk=(2*d+4*d2)/sigma;
+   return d2*(1+d2);
+   #else
+   dllk=2*d/sigma;
+   return d*d;
+   #endif
+}
+
+/** Log(likelihood) of bond, bond angle and dihedral angle restraints, from the flat
+* arrays of atomic coordinates xyz and of atom indices vBond (2 per bond), vAngle (3 per
+* bond angle) and vDihed (4 per dihedral angle). par holds the ideal value, delta and sigma
+* of all restraints (bonds, then bond angles and dihedral angles). If grad is not null,
+* the gradient is \b added to it, and vDeriv is used as a work array.
+*/
+static REAL RestraintTableLogLikelihood(const REAL *RESTRICT xyz,const vector<unsigned long> &vBond,
+                                        const vector<unsigned long> &vAngle,
+                                        const vector<unsigned long> &vDihed,
+                                        const REAL *RESTRICT par,vector<REAL> &vDeriv,REAL *grad)
+{
+   const long nbBond=vBond.size()/2;
+   const long nbAngle=vAngle.size()/3;
+   const long nbDihed=vDihed.size()/4;
+   // Derivatives of each restraint llk vs its atoms (the last atom is deduced from the others)
+   if(grad!=0) vDeriv.resize(3*nbBond+6*nbAngle+9*nbDihed);
+   REAL *RESTRICT deriv=((grad!=0)&&(vDeriv.size()>0)) ? &vDeriv[0] : 0;
+
+   REAL llk=0;
+   // Bonds
+   if(nbBond>0)
+   {
+      const unsigned long *RESTRICT idx=&vBond[0];
+      const REAL *RESTRICT p=par;
+      REAL *RESTRICT d=deriv;
+      for(long i=0;i<nbBond;++i)
+      {
+         const REAL *a1=xyz+3*idx[2*i], *a2=xyz+3*idx[2*i+1];
+         const REAL x=a2[0]-a1[0], y=a2[1]-a1[1], z=a2[2]-a1[2];
+         const REAL length=sqrt(abs(x*x+y*y+z*z));
+         REAL dllk;
+         llk+=RestraintTablePenalty(length,p[3*i],p[3*i+1],p[3*i+2],false,dllk);
+         if(d!=0)
+         {
+            const REAL tmp=-dllk/(length+1e-10);
+            d[3*i  ]=x*tmp;
+            d[3*i+1]=y*tmp;
+            d[3*i+2]=z*tmp;
+         }
+      }
+   }
+   // Bond angles
+   if(nbAngle>0)
+   {
+      const unsigned long *RESTRICT idx=&vAngle[0];
+      const REAL *RESTRICT p=par+3*nbBond;
+      REAL *RESTRICT d=(deriv!=0) ? deriv+3*nbBond : 0;
+      for(long i=0;i<nbAngle;++i)
+      {
+         const REAL *a1=xyz+3*idx[3*i], *a2=xyz+3*idx[3*i+1], *a3=xyz+3*idx[3*i+2];
+         const REAL x21=a1[0]-a2[0], y21=a1[1]-a2[1], z21=a1[2]-a2[2];
+         const REAL x23=a3[0]-a2[0], y23=a3[1]-a2[1], z23=a3[2]-a2[2];
+         const REAL n1=sqrt(abs(x21*x21+y21*y21+z21*z21));
+         const REAL n3=sqrt(abs(x23*x23+y23*y23+z23*z23));
+         const REAL pr=x21*x23+y21*y23+z21*z23;
+         const REAL a0=pr/(n1*n3+1e-10);
+         REAL angle;
+         if(a0>=1) angle=0;
+         else
+         {
+            if(a0<=-1) angle=M_PI;
+            else angle=acos(a0);
+         }
+         REAL dllk;
+         llk+=RestraintTablePenalty(angle,p[3*i],p[3*i+1],p[3*i+2],false,dllk);
+         if(d!=0)
+         {
+            const REAL s=dllk/(sqrt(1-a0*a0+1e-6));
+            const REAL s0=-s/(n1*n3+1e-10);
+            const REAL s1= s*pr/(n3*n1*n1*n1+1e-10);
+            const REAL s3= s*pr/(n1*n3*n3*n3+1e-10);
+            d[6*i  ]=s0*x23+s1*x21;
+            d[6*i+1]=s0*y23+s1*y21;
+            d[6*i+2]=s0*z23+s1*z21;
+            d[6*i+3]=s0*x21+s3*x23;
+            d[6*i+4]=s0*y21+s3*y23;
+            d[6*i+5]=s0*z21+s3*z23;
+         }
+      }
+   }
+   // Dihedral angles
+   if(nbDihed>0)
+   {
+      const unsigned long *RESTRICT idx=&vDihed[0];
+      const REAL *RESTRICT p=par+3*(nbBond+nbAngle);
+      REAL *RESTRICT d=(deriv!=0) ? deriv+3*nbBond+6*nbAngle : 0;
+      for(long i=0;i<nbDihed;++i)
+      {
+         const REAL *a1=xyz+3*idx[4*i  ], *a2=xyz+3*idx[4*i+1],
+                    *a3=xyz+3*idx[4*i+2], *a4=xyz+3*idx[4*i+3];
+         const REAL x21=a1[0]-a2[0], y21=a1[1]-a2[1], z21=a1[2]-a2[2];
+         const REAL x34=a4[0]-a3[0], y34=a4[1]-a3[1], z34=a4[2]-a3[2];
+         const REAL x23=a3[0]-a2[0], y23=a3[1]-a2[1], z23=a3[2]-a2[2];
+         // v21 x v23
+         const REAL x123= y21*z23-z21*y23;
+         const REAL y123= z21*x23-x21*z23;
+         const REAL z123= x21*y23-y21*x23;
+         // v32 x v34 (= -v23 x v34)
+         const REAL x234= -(y23*z34-z23*y34);
+         const REAL y234= -(z23*x34-x23*z34);
+         const REAL z234= -(x23*y34-y23*x34);
+         const REAL n123= sqrt(x123*x123+y123*y123+z123*z123+1e-7);
+         const REAL n234= sqrt(x234*x234+y234*y234+z234*z234+1e-6);
+         const REAL pr=x123*x234+y123*y234+z123*z234;
+         const REAL a0=pr/(n123*n234+1e-10);
+         REAL angle;
+         if(a0>= 1) angle=0;
+         else
+         {
+            if(a0<=-1) angle=M_PI;
+            else angle=acos(a0);
+         }
+         REAL sgn=1.0;
+         if((x21*x34 + y21*y34 + z21*z34)<0) {angle=-angle;sgn=-1;}
+         REAL dllk;
+         llk+=RestraintTablePenalty(angle,p[3*i],p[3*i+1],p[3*i+2],true,dllk);
+         if(d!=0)
+         {
+            const REAL s=dllk*sgn/(sqrt(1-a0*a0+1e-6));
+            const REAL s0=-s/(n123*n234+1e-10);
+            const REAL s1= s*pr/(n234*n123*n123*n123+1e-10);
+            const REAL s3= s*pr/(n123*n234*n234*n234+1e-10);
+            d[9*i  ]=s0*(-z23*y234+y23*z234)+s1*(-z23*y123+y23*z123);
+            d[9*i+1]=s0*(-x23*z234+z23*x234)+s1*(-x23*z123+z23*x123);
+            d[9*i+2]=s0*(-y23*x234+x23*y234)+s1*(-y23*x123+x23*y123);
+
+            d[9*i+3]=s0*((z23-z21)*y234-y123*z34+(y21-y23)*z234+z123*y34)+s1*(y123*(z23-z21)+z123*(y21-y23))+s3*(-y234*z34+z234*y34);
+            d[9*i+4]=s0*((x23-x21)*z234-z123*x34+(z21-z23)*x234+x123*z34)+s1*(z123*(x23-x21)+x123*(z21-z23))+s3*(-z234*x34+x234*z34);
+            d[9*i+5]=s0*((y23-y21)*x234-x123*y34+(x21-x23)*y234+y123*x34)+s1*(x123*(y23-y21)+y123*(x21-x23))+s3*(-x234*y34+y234*x34);
+
+            d[9*i+6]=s0*(-z23*y123+y23*z123)+s3*(-z23*y234+y23*z234);
+            d[9*i+7]=s0*(-x23*z123+z23*x123)+s3*(-x23*z234+z23*x234);
+            d[9*i+8]=s0*(-y23*x123+x23*y123)+s3*(-y23*x234+x23*y234);
+         }
+      }
+   }
+   if(grad==0) return llk;
+   // Add the restraints derivatives to the atomic gradients. This is kept separate
+   // from the evaluation loops above, which can then be vectorized.
+   {
+      const REAL *d=deriv;
+      const unsigned long *idx=nbBond>0 ? &vBond[0] : 0;
+      for(long i=0;i<nbBond;++i,d+=3,idx+=2)
+         for(unsigned int k=0;k<3;++k)
+         {
+            grad[3*idx[0]+k]+=d[k];
+            grad[3*idx[1]+k]-=d[k];
+         }
+      idx=nbAngle>0 ? &vAngle[0] : 0;
+      for(long i=0;i<nbAngle;++i,d+=6,idx+=3)
+         for(unsigned int k=0;k<3;++k)
+         {
+            grad[3*idx[0]+k]+=d[k];
+            grad[3*idx[1]+k]-=d[k]+d[3+k];
+            grad[3*idx[2]+k]+=d[3+k];
+         }
+      idx=nbDihed>0 ? &vDihed[0] : 0;
+      for(long i=0;i<nbDihed;++i,d+=9,idx+=4)
+         for(unsigned int k=0;k<3;++k)
+         {
+            grad[3*idx[0]+k]+=d[k];
+            grad[3*idx[1]+k]+=d[3+k];
+            grad[3*idx[2]+k]-=d[k]+d[3+k]+d[6+k];
+            grad[3*idx[3]+k]+=d[6+k];
+         }
+   }
+   return llk;
+}
+
+/// Local index of an atom (see MDRestraintTopology()), which is added to the local atoms if necessary
+static inline unsigned long MDLocalIndex(const unsigned long i,vector<long> &vLocal,vector<unsigned long> &vAtom)
+{
+   if(vLocal[i]<0)
+   {
+      vLocal[i]=vAtom.size();
+      vAtom.push_back(i);
+   }
+   return vLocal[i];
+}
+
+/** Restraint topology for molecular dynamics, using local atom indices: the local atoms
+* are the moved atoms (in the vMoved order), followed by the other atoms used by the given
+* bonds, bond angles and dihedral angles. This gives the restraints atom indices and their
+* ideal value, delta and sigma, in the format used by RestraintTableLogLikelihood().
+*
+* \param index: (atom, index in the Molecule's atom list) pairs, sorted by atom pointer
+* \param vLocal: work array, with one element per atom of the Molecule, which must be
+* filled with -1. It is reset to -1 on return.
+* \param vMoved: indices of the moved atoms in the Molecule's atom list
+* \param vAtom: on return, the index in the Molecule's atom list of each local atom
+*/
+static void MDRestraintTopology(const vector<pair<const MolAtom*,unsigned long> > &index,vector<long> &vLocal,
+                                const vector<unsigned long> &vMoved,
+                                const vector<MolBond*> &vb,const vector<MolBondAngle*> &va,
+                                const vector<MolDihedralAngle*> &vd,vector<unsigned long> &vAtom,
+                                vector<unsigned long> &vBond,vector<unsigned long> &vAngle,
+                                vector<unsigned long> &vDihed,vector<REAL> &par)
+{
+   vAtom=vMoved;
+   for(unsigned long j=0;j<vMoved.size();++j) vLocal[vMoved[j]]=j;
+   vBond.clear();
+   vAngle.clear();
+   vDihed.clear();
+   par.clear();
+   vBond.reserve(2*vb.size());
+   vAngle.reserve(3*va.size());
+   vDihed.reserve(4*vd.size());
+   par.reserve(3*(vb.size()+va.size()+vd.size())+1);
+   for(vector<MolBond*>::const_iterator pos=vb.begin();pos!=vb.end();++pos)
+   {
+      vBond.push_back(MDLocalIndex(RestraintTableAtomIndex(index,&((*pos)->GetAtom1())),vLocal,vAtom));
+      vBond.push_back(MDLocalIndex(RestraintTableAtomIndex(index,&((*pos)->GetAtom2())),vLocal,vAtom));
+      par.push_back((*pos)->GetLength0());
+      par.push_back((*pos)->GetLengthDelta());
+      par.push_back((*pos)->GetLengthSigma());
+   }
+   for(vector<MolBondAngle*>::const_iterator pos=va.begin();pos!=va.end();++pos)
+   {
+      vAngle.push_back(MDLocalIndex(RestraintTableAtomIndex(index,&((*pos)->GetAtom1())),vLocal,vAtom));
+      vAngle.push_back(MDLocalIndex(RestraintTableAtomIndex(index,&((*pos)->GetAtom2())),vLocal,vAtom));
+      vAngle.push_back(MDLocalIndex(RestraintTableAtomIndex(index,&((*pos)->GetAtom3())),vLocal,vAtom));
+      par.push_back((*pos)->GetAngle0());
+      par.push_back((*pos)->GetAngleDelta());
+      par.push_back((*pos)->GetAngleSigma());
+   }
+   for(vector<MolDihedralAngle*>::const_iterator pos=vd.begin();pos!=vd.end();++pos)
+   {
+      vDihed.push_back(MDLocalIndex(RestraintTableAtomIndex(index,&((*pos)->GetAtom1())),vLocal,vAtom));
+      vDihed.push_back(MDLocalIndex(RestraintTableAtomIndex(index,&((*pos)->GetAtom2())),vLocal,vAtom));
+      vDihed.push_back(MDLocalIndex(RestraintTableAtomIndex(index,&((*pos)->GetAtom3())),vLocal,vAtom));
+      vDihed.push_back(MDLocalIndex(RestraintTableAtomIndex(index,&((*pos)->GetAtom4())),vLocal,vAtom));
+      par.push_back((*pos)->GetAngle0());
+      par.push_back((*pos)->GetAngleDelta());
+      par.push_back((*pos)->GetAngleSigma());
+   }
+   for(vector<unsigned long>::const_iterator pos=vAtom.begin();pos!=vAtom.end();++pos) vLocal[*pos]=-1;
+   if(par.size()==0) par.push_back(0);// Avoid taking the address of an empty vector
+}
+
+/** Molecular dynamics evolution (velocity Verlet) on dense arrays.
+*
+* \param xyz: coordinates of the nbAtom atoms involved in the restraints or moved. Only the
+* coordinates of the moved atoms are modified. The gradients use 3*nbAtom values, so
+* the arrays should only include the atoms used by the restraints (see MDRestraintTopology()).
+* \param vMoved: indices (in xyz) of the moved atoms
+* \param v: speed of the moved atoms (3 per atom), updated on return
+* \param vBond,vAngle,vDihed,par: restraint topology (see MDRestraintTopology())
+* \param nrj0: total energy to maintain (if 0, the initial energy is used)
+*/
+static void MolecularDynamicsEvolveArrays(REAL *xyz,const unsigned long nbAtom,
+                                          const vector<unsigned long> &vMoved,vector<REAL> &v,
+                                          const unsigned nbStep,const REAL dt,
+                                          const vector<unsigned long> &vBond,
+                                          const vector<unsigned long> &vAngle,
+                                          const vector<unsigned long> &vDihed,
+                                          const vector<REAL> &par,REAL nrj0)
+{
+   const REAL m=500;// mass
+   const REAL im=1./m;
+   const unsigned long nbMoved=vMoved.size();
+   vector<REAL> deriv;
+   // Gradient at the beginning and the end of the step
+   vector<REAL> grad0(3*nbAtom,0),grad1(3*nbAtom);
+   REAL e_v=RestraintTableLogLikelihood(xyz,vBond,vAngle,vDihed,&par[0],deriv,&grad0[0]);
+
+   // Velocity Verlet integration. Try to keep total energy constant
+   REAL e_k,v_r=1.0;
+   for(unsigned i = 0; i < nbStep; ++i)
+   {
+      //kinetic energy
+      e_k=0;
+      for(unsigned long j=0;j<3*nbMoved;++j) e_k += 0.5*m*v[j]*v[j];
+
+      if(nrj0==0) nrj0=e_k+e_v;
+      else
+      {
+         // Apply a coefficient to the speed to keep the overall energy constant
+         const REAL de=e_k+e_v-nrj0;
+         if(de<e_k) v_r=sqrt((e_k-de)/e_k);
+         else v_r=0.0;
+      }
+      #if 0
+      char buf[100];
+      sprintf(buf,"(i) LLK + Ek = %10.3f + %10.3f =%10.3f (nrj0=%10.3f)",e_v,e_k,e_v+e_k,nrj0);
+      cout<<buf<<endl;
+      #endif
+      // Move according to speed and gradient
+      for(unsigned long j=0;j<nbMoved;++j)
+         for(unsigned int k=0;k<3;++k)
+            xyz[3*vMoved[j]+k] += v[3*j+k]*dt*v_r-0.5*im*dt*dt*grad0[3*vMoved[j]+k];
+      // New gradient
+      for(unsigned long j=0;j<3*nbAtom;++j) grad1[j]=0;
+      e_v=RestraintTableLogLikelihood(xyz,vBond,vAngle,vDihed,&par[0],deriv,&grad1[0]);
+      // Compute new speed from the average of the old and new accelerations
+      for(unsigned long j=0;j<nbMoved;++j)
+         for(unsigned int k=0;k<3;++k)
+            v[3*j+k] = v_r*v[3*j+k] - 0.5*(grad0[3*vMoved[j]+k]+grad1[3*vMoved[j]+k])*dt*im;
+      grad0.swap(grad1);
+   }
+}
+
 void Molecule::OptimizeConformation(const long nbTrial,const REAL stopCost)
 {
    VFN_DEBUG_ENTRY("Molecule::OptimizeConformation()",5)
@@ -4239,42 +4767,31 @@ void Molecule::OptimizeConformation(const long nbTrial,const REAL stopCost)
 void Molecule::OptimizeConformationSteepestDescent(const REAL maxStep,const unsigned nbStep)
 {
    //cout<<"LLK="<<this->GetLogLikelihood()<<endl;
+   const unsigned long nbAtom=mvpAtom.size();
+   if(nbAtom==0) return;
+   // Index of atoms, to average the gradient in rigid groups
+   this->BuildRestraintTable();
+   const vector<pair<const MolAtom*,unsigned long> > *pIndex=&mvRestraintTableAtomIndex;
    for(unsigned i = 0; i < nbStep; ++i)
    {
-      // Calc full gradient
-      //Calculate & display gradient
-      map<MolAtom*,XYZ> grad;
-      for(vector<MolAtom*>::iterator pos=this->GetAtomList().begin();
-         pos!=this->GetAtomList().end();++pos) grad[*pos]=XYZ(0,0,0);
-
+      // Calc full gradient, in the mvpAtom order
+      vector<REAL> grad(3*nbAtom,0);
       // :TODO: remove atoms that are in rigid groups ?
-      for(vector<MolBond*>::iterator pos=this->GetBondList().begin();
-         pos!=this->GetBondList().end();++pos)          (*pos)->CalcGradient(grad);
-
-      for(vector<MolBondAngle*>::iterator pos=this->GetBondAngleList().begin();
-         pos!=this->GetBondAngleList().end();++pos)     (*pos)->CalcGradient(grad);
-
-      for(vector<MolDihedralAngle*>::iterator pos=this->GetDihedralAngleList().begin();
-         pos!=this->GetDihedralAngleList().end();++pos) (*pos)->CalcGradient(grad);
+      this->GetRestraintTableLogLikelihood(&grad[0]);
 
       #if 0
       // Display gradient - for tests
-      for(map<MolAtom*,XYZ>::const_iterator pos=grad.begin();pos!=grad.end();++pos)
+      for(unsigned long j=0;j<nbAtom;++j)
       {
          char buf[100];
          sprintf(buf,"%10s Grad LLK= (%8.3f %8.3f %8.3f)",
-               pos->first->GetName().c_str(),pos->second.x,pos->second.y,pos->second.z);
+               mvpAtom[j]->GetName().c_str(),grad[3*j],grad[3*j+1],grad[3*j+2]);
          cout<<buf<<endl;
       }
       #endif
       // Find maximum absolute value of gradient
       REAL f=0;
-      for(map<MolAtom*,XYZ>::const_iterator pos=grad.begin();pos!=grad.end();++pos)
-      {
-         if(abs(pos->second.x)>f) f=abs(pos->second.x);
-         if(abs(pos->second.y)>f) f=abs(pos->second.y);
-         if(abs(pos->second.z)>f) f=abs(pos->second.z);
-      }
+      for(unsigned long j=0;j<3*nbAtom;++j) if(abs(grad[j])>f) f=abs(grad[j]);
       if(f>1e-6) f=maxStep/f;
       else break;//nothing to optimize ?
       // Average derivatives inside rigid groups
@@ -4286,26 +4803,28 @@ void Molecule::OptimizeConformationSteepestDescent(const REAL maxStep,const unsi
          REAL dx=0,dy=0,dz=0;
          for(set<MolAtom *>::const_iterator at=(*pos)->begin();at!=(*pos)->end();++at)
          {
-            dx+=(*at)->GetX();
-            dy+=(*at)->GetY();
-            dz+=(*at)->GetZ();
+            const unsigned long j=RestraintTableAtomIndex(*pIndex,*at);
+            dx+=grad[3*j];
+            dy+=grad[3*j+1];
+            dz+=grad[3*j+2];
          }
          dx/=(*pos)->size();
          dy/=(*pos)->size();
          dz/=(*pos)->size();
          for(set<MolAtom *>::const_iterator at=(*pos)->begin();at!=(*pos)->end();++at)
          {
-            grad[*at].x=dx;
-            grad[*at].y=dy;
-            grad[*at].z=dz;
+            const unsigned long j=RestraintTableAtomIndex(*pIndex,*at);
+            grad[3*j  ]=dx;
+            grad[3*j+1]=dy;
+            grad[3*j+2]=dz;
          }
       }
       // Move according to max step to minimize LLK
-      for(map<MolAtom*,XYZ>::const_iterator pos=grad.begin();pos!=grad.end();++pos)
+      for(unsigned long j=0;j<nbAtom;++j)
       {
-         pos->first->SetX(pos->first->GetX()-pos->second.x*f);
-         pos->first->SetY(pos->first->GetY()-pos->second.y*f);
-         pos->first->SetZ(pos->first->GetZ()-pos->second.z*f);
+         mvpAtom[j]->SetX(mvpAtom[j]->GetX()-grad[3*j  ]*f);
+         mvpAtom[j]->SetY(mvpAtom[j]->GetY()-grad[3*j+1]*f);
+         mvpAtom[j]->SetZ(mvpAtom[j]->GetZ()-grad[3*j+2]*f);
       }
       //this->RestraintStatus(cout);
       //cout<<"LLK="<<this->GetLogLikelihood()<<endl;
@@ -4317,6 +4836,7 @@ void Molecule::MolecularDynamicsEvolve(map<MolAtom*,XYZ> &v0,const unsigned nbSt
                                        const vector<MolDihedralAngle*> &vd,
                                        map<RigidGroup*,std::pair<XYZ,XYZ> > &vr, REAL nrj0)
 {
+   TAU_PROFILE("Molecule::MolecularDynamicsEvolve()","void (...)",TAU_DEFAULT);
    const vector<MolBond*> *pvb=&vb;
    const vector<MolBondAngle*> *pva=&va;
    const vector<MolDihedralAngle*> *pvd=&vd;
@@ -4329,83 +4849,143 @@ void Molecule::MolecularDynamicsEvolve(map<MolAtom*,XYZ> &v0,const unsigned nbSt
       for(vector<RigidGroup *>::iterator pos=this->GetRigidGroupList().begin();pos!=this->GetRigidGroupList().end();++pos)
          (*pvr)[*pos]=make_pair(XYZ(0,0,0),XYZ(0,0,0));
    }
-   const REAL m=500;// mass
-   const REAL im=1./m;
-
-   // Try to keep total energy constant
-   REAL e_v,e_k,v_r=1.0;
-   for(unsigned i = 0; i < nbStep; ++i)
-   {
-      // Calc full gradient
-      map<MolAtom*,XYZ> grad;
-      for(map<MolAtom*,XYZ>::iterator pos=v0.begin();pos!=v0.end();++pos) grad[pos->first]=XYZ(0,0,0);
-
-      // :TODO: handle rigid groups ?
-      e_v=0;
-      for(vector<MolBond*>::const_iterator pos=pvb->begin();pos!=pvb->end();++pos)
-      {
-         (*pos)->CalcGradient(grad);
-         e_v+=(*pos)->GetLogLikelihood(false,false);
-      }
-
-      for(vector<MolBondAngle*>::const_iterator pos=pva->begin();pos!=pva->end();++pos)
-      {
-         (*pos)->CalcGradient(grad);
-         e_v+=(*pos)->GetLogLikelihood(false,false);
-      }
-
-      for(vector<MolDihedralAngle*>::const_iterator pos=pvd->begin();pos!=pvd->end();++pos)
-      {
-         (*pos)->CalcGradient(grad);
-         e_v+=(*pos)->GetLogLikelihood(false,false);
+   if(v0.size()==0) return;
+
+   const unsigned long nbAtom=mvpAtom.size();
+   this->BuildRestraintTable();
+   const vector<pair<const MolAtom*,unsigned long> > &index=mvRestraintTableAtomIndex;
+   // Moved atoms and their speed
+   const unsigned long nbMoved=v0.size();
+   vector<unsigned long> vMoved(nbMoved);
+   vector<REAL> v(3*nbMoved);
+   {
+      unsigned long j=0;
+      for(map<MolAtom*,XYZ>::const_iterator pos=v0.begin();pos!=v0.end();++pos,++j)
+      {
+         vMoved[j]=RestraintTableAtomIndex(index,pos->first);
+         v[3*j  ]=pos->second.x;
+         v[3*j+1]=pos->second.y;
+         v[3*j+2]=pos->second.z;
+      }
+   }
+   if(  (pvb==&mvpBond)&&(pva==&mvpBondAngle)&&(pvd==&mvpDihedralAngle)
+      &&((mvpBond.size()+mvpBondAngle.size()+mvpDihedralAngle.size())>0))
+   {// All the restraints of the Molecule: use the flat restraint table, with all atoms
+      this->UpdateRestraintTablePar();
+      vector<REAL> xyz(3*nbAtom);
+      for(unsigned long i=0;i<nbAtom;++i)
+      {
+         xyz[3*i  ]=mvpAtom[i]->GetX();
+         xyz[3*i+1]=mvpAtom[i]->GetY();
+         xyz[3*i+2]=mvpAtom[i]->GetZ();
+      }
+      MolecularDynamicsEvolveArrays(&xyz[0],nbAtom,vMoved,v,nbStep,dt,mvRestraintTableBond,
+                                    mvRestraintTableBondAngle,mvRestraintTableDihedral,
+                                    mvRestraintTablePar,nrj0);
+      unsigned long j=0;
+      for(map<MolAtom*,XYZ>::iterator pos=v0.begin();pos!=v0.end();++pos,++j)
+      {
+         const unsigned long k=vMoved[j];
+         pos->first->SetX(xyz[3*k  ]);
+         pos->first->SetY(xyz[3*k+1]);
+         pos->first->SetZ(xyz[3*k+2]);
+         pos->second.x=v[3*j  ];
+         pos->second.y=v[3*j+1];
+         pos->second.z=v[3*j+2];
       }
-
-      //kinetic energy
-      e_k=0;
-      for(map<MolAtom*,XYZ>::const_iterator pos=v0.begin();pos!=v0.end();++pos)
-         e_k += 0.5*m*(pos->second.x*pos->second.x + pos->second.y*pos->second.y + pos->second.z*pos->second.z);
-
-      if(nrj0==0) nrj0=e_k+e_v;
-      else
-      {
-         // Apply a coefficient to the speed to keep the overall energy constant
-         const REAL de=e_k+e_v-nrj0;
-         if(de<e_k) v_r=sqrt((e_k-de)/e_k);
-         else v_r=0.0;
-      }
-
-      #if 0
-      char buf[100];
-      sprintf(buf,"(i) LLK + Ek = %10.3f + %10.3f =%10.3f (nrj0=%10.3f)",e_v,e_k,e_v+e_k,nrj0);
-      cout<<buf<<endl;
-
-      // Display gradient & speed - for tests
-      for(map<MolAtom*,XYZ>::iterator pos=v0.begin();pos!=v0.end();++pos)
-      {
-         sprintf(buf,"%10s xyz= (%8.3f %8.3f %8.3f) v= (%8.3f %8.3f %8.3f) m*a= (%8.3f %8.3f %8.3f)",
-               pos->first->GetName().c_str(),
-               pos->first->GetX(),pos->first->GetY(),pos->first->GetZ(),
-                v0[*pos].x    ,v0[*pos].y     ,v0[*pos].z,
-               -grad[*pos].x*im,-grad[*pos].y*im,-grad[*pos].z*im);
-         //cout<<buf<<endl;
-      }
-      //cout<<endl<<endl;
-      #endif
-      // Move according to max step to minimize LLK
-      for(map<MolAtom*,XYZ>::const_iterator pos=v0.begin();pos!=v0.end();++pos)
-      {
-         const XYZ *pa=&(grad[pos->first]);
-         pos->first->SetX(pos->first->GetX()+pos->second.x*dt*v_r-0.5*im*dt*dt*pa->x);
-         pos->first->SetY(pos->first->GetY()+pos->second.y*dt*v_r-0.5*im*dt*dt*pa->y);
-         pos->first->SetZ(pos->first->GetZ()+pos->second.z*dt*v_r-0.5*im*dt*dt*pa->z);
-      }
-      // Compute new speed
-      for(map<MolAtom*,XYZ>::iterator pos=v0.begin();pos!=v0.end();++pos)
+      return;
+   }
+   // Restraint topology and positions, for the local atoms (moved atoms first)
+   vector<long> vLocal(nbAtom,-1);
+   vector<unsigned long> vAtom,vBond,vAngle,vDihed;
+   vector<REAL> par;
+   MDRestraintTopology(index,vLocal,vMoved,*pvb,*pva,*pvd,vAtom,vBond,vAngle,vDihed,par);
+   const unsigned long nbLocal=vAtom.size();
+   vector<REAL> xyz(3*nbLocal);
+   for(unsigned long j=0;j<nbLocal;++j)
+   {
+      xyz[3*j  ]=mvpAtom[vAtom[j]]->GetX();
+      xyz[3*j+1]=mvpAtom[vAtom[j]]->GetY();
+      xyz[3*j+2]=mvpAtom[vAtom[j]]->GetZ();
+   }
+   vector<unsigned long> vMovedLocal(nbMoved);
+   for(unsigned long j=0;j<nbMoved;++j) vMovedLocal[j]=j;
+
+   MolecularDynamicsEvolveArrays(&xyz[0],nbLocal,vMovedLocal,v,nbStep,dt,vBond,vAngle,vDihed,par,nrj0);
+
+   // Update atomic positions and speeds
+   {
+      unsigned long j=0;
+      for(map<MolAtom*,XYZ>::iterator pos=v0.begin();pos!=v0.end();++pos,++j)
+      {
+         pos->first->SetX(xyz[3*j  ]);
+         pos->first->SetY(xyz[3*j+1]);
+         pos->first->SetZ(xyz[3*j+2]);
+         pos->second.x=v[3*j  ];
+         pos->second.y=v[3*j+1];
+         pos->second.z=v[3*j+2];
+      }
+   }
+}
+
+void Molecule::MolecularDynamicsEvolveBatch(const vector<MDAtomGroup*> &vpGroup,
+                                            vector<map<MolAtom*,XYZ> > &vv0,
+                                            const unsigned nbStep,const REAL dt,
+                                            const vector<REAL> &vnrj0)
+{
+   TAU_PROFILE("Molecule::MolecularDynamicsEvolveBatch()","void (...)",TAU_DEFAULT);
+   const long nbGroup=vpGroup.size();
+   if(nbGroup==0) return;
+   const unsigned long nbAtom=mvpAtom.size();
+   this->BuildRestraintTable();
+   const vector<pair<const MolAtom*,unsigned long> > &index=mvRestraintTableAtomIndex;
+   // Moved atoms, speeds, restraint topology and positions of the local atoms
+   // (moved atoms first) of each group
+   vector<long> vLocal(nbAtom,-1);
+   vector<vector<unsigned long> > vMoved(nbGroup),vAtom(nbGroup),vBond(nbGroup),vAngle(nbGroup),vDihed(nbGroup);
+   vector<vector<REAL> > v(nbGroup),par(nbGroup),xyz(nbGroup);
+   for(long i=0;i<nbGroup;++i)
+   {
+      vMoved[i].reserve(vv0[i].size());
+      v[i].reserve(3*vv0[i].size());
+      for(map<MolAtom*,XYZ>::const_iterator pos=vv0[i].begin();pos!=vv0[i].end();++pos)
+      {
+         vMoved[i].push_back(RestraintTableAtomIndex(index,pos->first));
+         v[i].push_back(pos->second.x);
+         v[i].push_back(pos->second.y);
+         v[i].push_back(pos->second.z);
+      }
+      MDRestraintTopology(index,vLocal,vMoved[i],vpGroup[i]->mvpBond,vpGroup[i]->mvpBondAngle,
+                          vpGroup[i]->mvpDihedralAngle,vAtom[i],vBond[i],vAngle[i],vDihed[i],par[i]);
+      xyz[i].resize(3*vAtom[i].size()+1);
+      for(unsigned long j=0;j<vAtom[i].size();++j)
+      {
+         xyz[i][3*j  ]=mvpAtom[vAtom[i][j]]->GetX();
+         xyz[i][3*j+1]=mvpAtom[vAtom[i][j]]->GetY();
+         xyz[i][3*j+2]=mvpAtom[vAtom[i][j]]->GetZ();
+      }
+      for(unsigned long j=0;j<vMoved[i].size();++j) vMoved[i][j]=j;
+   }
+   // Groups in a batch do not move any atom used by another group, so they can
+   // all be evolved concurrently, each on its own local positions.
+   #ifdef _OPENMP
+   #pragma omp parallel for schedule(dynamic,1) num_threads(GetNbThread()) if(nbGroup>1)
+   #endif
+   for(long i=0;i<nbGroup;++i)
+      MolecularDynamicsEvolveArrays(&xyz[i][0],vAtom[i].size(),vMoved[i],v[i],nbStep,dt,
+                                    vBond[i],vAngle[i],vDihed[i],par[i],vnrj0[i]);
+   // Update atomic positions and speeds
+   for(long i=0;i<nbGroup;++i)
+   {
+      unsigned long j=0;
+      for(map<MolAtom*,XYZ>::iterator pos=vv0[i].begin();pos!=vv0[i].end();++pos,++j)
       {
-         const XYZ *pa=&(grad[pos->first]);
-         pos->second.x = v_r*pos->second.x - pa->x*dt*im;
-         pos->second.y = v_r*pos->second.y - pa->y*dt*im;
-         pos->second.z = v_r*pos->second.z - pa->z*dt*im;
+         pos->first->SetX(xyz[i][3*j  ]);
+         pos->first->SetY(xyz[i][3*j+1]);
+         pos->first->SetZ(xyz[i][3*j+2]);
+         pos->second.x=v[i][3*j  ];
+         pos->second.y=v[i][3*j+1];
+         pos->second.z=v[i][3*j+2];
       }
    }
 }
@@ -4733,7 +5313,7 @@ REAL FlatLorentzianIntegral(const REAL x1,const REAL x2, const REAL sigma, const
 REAL LorentzianBiasedRandomMove(const REAL x0,const REAL sigma,const REAL delta,const REAL amplitude)
 {
    //static const REAL SPI2=0.88622692545275794;//sqrt(pi)/2
-   REAL r=(REAL)rand()/(REAL)RAND_MAX;
+   REAL r=(REAL)ObjCrystRand()/(REAL)RAND_MAX;
    if(sigma<1e-6)
    {
       REAL x=x0+amplitude*(2*r-1.0);
@@ -4822,12 +5402,12 @@ REAL LorentzianBiasedRandomMove(const REAL x0,const REAL sigma,const REAL delta,
          {
             REAL ymin=(abs(xmin)-delta)/sigma;
             ymin=atan(ymin);
-            const REAL y=ymin*(REAL)rand()/(REAL)RAND_MAX;
+            const REAL y=ymin*(REAL)ObjCrystRand()/(REAL)RAND_MAX;
             return -delta-tan(y)*sigma;
          }
          else
          {
-            return -delta+(REAL)rand()/(REAL)RAND_MAX*(xmax+delta);
+            return -delta+(REAL)ObjCrystRand()/(REAL)RAND_MAX*(xmax+delta);
          }
       }
       else //xmax>delta && xmin <= -delta
@@ -4840,19 +5420,19 @@ REAL LorentzianBiasedRandomMove(const REAL x0,const REAL sigma,const REAL delta,
          {
             REAL ymin=(abs(xmin)-delta)/sigma;
             ymin=atan(ymin);//exp(ymin*ymin);
-            const REAL y=ymin*(REAL)rand()/(REAL)RAND_MAX;
+            const REAL y=ymin*(REAL)ObjCrystRand()/(REAL)RAND_MAX;
             const REAL x=-delta-tan(y)*sigma;
             return x;
          }
          if(r<(p0+p1)/n)
          {
-            const REAL x=-delta+(REAL)rand()/(REAL)RAND_MAX*2*delta;
+            const REAL x=-delta+(REAL)ObjCrystRand()/(REAL)RAND_MAX*2*delta;
             return x;
          }
 
          REAL ymax=(xmax-delta)/sigma;
          ymax=atan(ymax);
-         const REAL y=ymax*(REAL)rand()/(REAL)RAND_MAX;
+         const REAL y=ymax*(REAL)ObjCrystRand()/(REAL)RAND_MAX;
          const REAL x=delta+tan(y)*sigma;
          return x;
       }
@@ -4868,12 +5448,12 @@ REAL LorentzianBiasedRandomMove(const REAL x0,const REAL sigma,const REAL delta,
       const REAL p1=atan((xmax-delta)/sigma)*sigma;// proba in[delta;xmax]
       if(r<(p0/(p0+p1)))
       {
-         return xmin+(REAL)rand()/(REAL)RAND_MAX*(delta-xmin);
+         return xmin+(REAL)ObjCrystRand()/(REAL)RAND_MAX*(delta-xmin);
       }
 
       REAL ymax=(xmax-delta)/sigma;
       ymax=atan(ymax);
-      const REAL y=ymax*(REAL)rand()/(REAL)RAND_MAX;
+      const REAL y=ymax*(REAL)ObjCrystRand()/(REAL)RAND_MAX;
       return delta+tan(y)*sigma;
    }
    //xmin>delta
@@ -4940,7 +5520,7 @@ REAL Molecule::BondLengthRandomChange(const StretchModeBondLength& mode, const R
       const REAL max=delta+sigma*5.0;
       if(sigma<1e-6)
       {
-         REAL d1=d0+(REAL)(2*rand()-RAND_MAX)/(REAL)RAND_MAX*amplitude*0.1;
+         REAL d1=d0+(REAL)(2*ObjCrystRand()-RAND_MAX)/(REAL)RAND_MAX*amplitude*0.1;
          if(d1> delta)d1= delta;
          if(d1<-delta)d1=-delta;
          change=d1-d0;
@@ -4949,7 +5529,7 @@ REAL Molecule::BondLengthRandomChange(const StretchModeBondLength& mode, const R
       if((d0+change)>max) change=max-d0;
       else if((d0+change)<(-max)) change=-max-d0;
       #if 0
-      if(rand()%10000==0)
+      if(ObjCrystRand()%10000==0)
       {
          cout<<"BOND LENGTH change("<<change<<"):"
              <<mode.mpAtom0->GetName()<<"-"
@@ -4959,7 +5539,7 @@ REAL Molecule::BondLengthRandomChange(const StretchModeBondLength& mode, const R
       }
       #endif
    }
-   else change=(2.*(REAL)rand()-(REAL)RAND_MAX)/(REAL)RAND_MAX*amplitude*0.1;
+   else change=(2.*(REAL)ObjCrystRand()-(REAL)RAND_MAX)/(REAL)RAND_MAX*amplitude*0.1;
    dx*=change/l;
    dy*=change/l;
    dz*=change/l;
@@ -5000,7 +5580,7 @@ REAL Molecule::BondAngleRandomChange(const StretchModeBondAngle& mode, const REA
       const REAL delta=mode.mpBondAngle->GetAngleDelta();
       if(sigma<1e-6)
       {
-         REAL a1=a0+(REAL)(2*rand()-RAND_MAX)/(REAL)RAND_MAX*amplitude*mode.mBaseAmplitude;
+         REAL a1=a0+(REAL)(2*ObjCrystRand()-RAND_MAX)/(REAL)RAND_MAX*amplitude*mode.mBaseAmplitude;
          if(a1> delta)a1= delta;
          if(a1<-delta)a1=-delta;
          change=a1-a0;
@@ -5009,7 +5589,7 @@ REAL Molecule::BondAngleRandomChange(const StretchModeBondAngle& mode, const REA
       if((a0+change)>(delta+sigma*5.0))       change= delta+sigma*5.0-a0;
       else if((a0+change)<(-delta-sigma*5.0)) change=-delta-sigma*5.0-a0;
       #if 0
-      if(rand()%1==0)
+      if(ObjCrystRand()%1==0)
       {
          cout<<"ANGLE change("<<change*RAD2DEG<<"):"
              <<mode.mpAtom0->GetName()<<"-"
@@ -5020,7 +5600,7 @@ REAL Molecule::BondAngleRandomChange(const StretchModeBondAngle& mode, const REA
       }
       #endif
    }
-   else change=(2.*(REAL)rand()-(REAL)RAND_MAX)/(REAL)RAND_MAX*mode.mBaseAmplitude*amplitude;
+   else change=(2.*(REAL)ObjCrystRand()-(REAL)RAND_MAX)/(REAL)RAND_MAX*mode.mBaseAmplitude*amplitude;
    this->RotateAtomGroup(*(mode.mpAtom1),vx,vy,vz,mode.mvRotatedAtomList,change,true);
    return change;
 }
@@ -5040,7 +5620,7 @@ REAL Molecule::DihedralAngleRandomChange(const StretchModeTorsion& mode, const R
       const REAL delta=mode.mpDihedralAngle->GetAngleDelta();
       if(sigma<1e-6)
       {
-         REAL a1=a0+(REAL)(2*rand()-RAND_MAX)/(REAL)RAND_MAX*amplitude*mode.mBaseAmplitude;
+         REAL a1=a0+(REAL)(2*ObjCrystRand()-RAND_MAX)/(REAL)RAND_MAX*amplitude*mode.mBaseAmplitude;
          if(a1> delta)a1= delta;
          if(a1<-delta)a1=-delta;
          change=a1-a0;
@@ -5049,7 +5629,7 @@ REAL Molecule::DihedralAngleRandomChange(const StretchModeTorsion& mode, const R
       if((a0+change)>(delta+sigma*5.0))       change= delta+sigma*5.0-a0;
       else if((a0+change)<(-delta-sigma*5.0)) change=-delta-sigma*5.0-a0;
       #if 0
-      if(rand()%1==0)
+      if(ObjCrystRand()%1==0)
       {
          cout<<"TORSION change ("
              <<mode.mpAtom1->GetName()<<"-"<<mode.mpAtom2->GetName()<<"):"<<endl
@@ -5060,7 +5640,7 @@ REAL Molecule::DihedralAngleRandomChange(const StretchModeTorsion& mode, const R
       }
       #endif
    }
-   else change=(REAL)(2.*rand()-RAND_MAX)/(REAL)RAND_MAX*mode.mBaseAmplitude*amplitude;
+   else change=(REAL)(2.*ObjCrystRand()-RAND_MAX)/(REAL)RAND_MAX*mode.mBaseAmplitude*amplitude;
    this->RotateAtomGroup(*(mode.mpAtom1),*(mode.mpAtom2),mode.mvRotatedAtomList,change,true);
    return change;
 }
@@ -5718,9 +6298,9 @@ void Molecule::BuildStretchModeBondLength()
       {
          for(vector<MolAtom*>::iterator pos=mvpAtom.begin();pos!=mvpAtom.end();++pos)
          {
-            (*pos)->SetX(100.*rand()/(REAL) RAND_MAX);
-            (*pos)->SetY(100.*rand()/(REAL) RAND_MAX);
-            (*pos)->SetZ(100.*rand()/(REAL) RAND_MAX);
+            (*pos)->SetX(100.*ObjCrystRand()/(REAL) RAND_MAX);
+            (*pos)->SetY(100.*ObjCrystRand()/(REAL) RAND_MAX);
+            (*pos)->SetZ(100.*ObjCrystRand()/(REAL) RAND_MAX);
          }
          paramSetRandom[i]=this->CreateParamSet();
       }
@@ -6036,9 +6616,9 @@ void Molecule::BuildStretchModeBondAngle()
       {
          for(vector<MolAtom*>::iterator pos=mvpAtom.begin();pos!=mvpAtom.end();++pos)
          {
-            (*pos)->SetX(100.*rand()/(REAL) RAND_MAX);
-            (*pos)->SetY(100.*rand()/(REAL) RAND_MAX);
-            (*pos)->SetZ(100.*rand()/(REAL) RAND_MAX);
+            (*pos)->SetX(100.*ObjCrystRand()/(REAL) RAND_MAX);
+            (*pos)->SetY(100.*ObjCrystRand()/(REAL) RAND_MAX);
+            (*pos)->SetZ(100.*ObjCrystRand()/(REAL) RAND_MAX);
          }
          paramSetRandom[i]=this->CreateParamSet();
       }
@@ -6448,9 +7028,9 @@ void Molecule::BuildStretchModeTorsion()
       {
          for(vector<MolAtom*>::iterator pos=mvpAtom.begin();pos!=mvpAtom.end();++pos)
          {
-            (*pos)->SetX(100.*rand()/(REAL) RAND_MAX);
-            (*pos)->SetY(100.*rand()/(REAL) RAND_MAX);
-            (*pos)->SetZ(100.*rand()/(REAL) RAND_MAX);
+            (*pos)->SetX(100.*ObjCrystRand()/(REAL) RAND_MAX);
+            (*pos)->SetY(100.*ObjCrystRand()/(REAL) RAND_MAX);
+            (*pos)->SetZ(100.*ObjCrystRand()/(REAL) RAND_MAX);
          }
          paramSetRandom[i]=this->CreateParamSet();
       }
@@ -6744,9 +7324,9 @@ void Molecule::BuildStretchModeTwist()
       {
          for(vector<MolAtom*>::iterator pos=mvpAtom.begin();pos!=mvpAtom.end();++pos)
          {
-            (*pos)->SetX(100.*rand()/(REAL) RAND_MAX);
-            (*pos)->SetY(100.*rand()/(REAL) RAND_MAX);
-            (*pos)->SetZ(100.*rand()/(REAL) RAND_MAX);
+            (*pos)->SetX(100.*ObjCrystRand()/(REAL) RAND_MAX);
+            (*pos)->SetY(100.*ObjCrystRand()/(REAL) RAND_MAX);
+            (*pos)->SetZ(100.*ObjCrystRand()/(REAL) RAND_MAX);
          }
          paramSetRandom[i]=this->CreateParamSet();
       }
@@ -6975,7 +7555,7 @@ void Molecule::TuneGlobalOptimRotationAmplitude()
       for(unsigned int k=0;k<10;++k)
       {
          Quaternion quat=Quaternion::RotationQuaternion
-                     (mBaseRotationAmplitude,(REAL)rand(),(REAL)rand(),(REAL)rand());
+                     (mBaseRotationAmplitude,(REAL)ObjCrystRand(),(REAL)ObjCrystRand(),(REAL)ObjCrystRand());
          for(long i=0;i<this->GetNbComponent();++i)
          {
             REAL x=x0[i]-xc;
@@ -7545,6 +8125,57 @@ void Molecule::BuildMDAtomGroups()
       mvMDAtomGroup.back().Print(cout);
    }
 
+   // Partition the MD groups in batches which can be evolved concurrently. Greedy
+   // assignment to the first batch where the group does not move an atom used by
+   // another group, and does not use an atom moved by another group.
+   mvMDAtomGroupBatch.clear();
+   {
+      vector<set<MolAtom*> > vBatchMoved,vBatchUsed;
+      for(list<MDAtomGroup>::iterator pos=mvMDAtomGroup.begin();pos!=mvMDAtomGroup.end();++pos)
+      {
+         set<MolAtom*> used=pos->mvpAtom;
+         for(vector<MolBond*>::const_iterator pr=pos->mvpBond.begin();pr!=pos->mvpBond.end();++pr)
+         {
+            used.insert(&((*pr)->GetAtom1()));
+            used.insert(&((*pr)->GetAtom2()));
+         }
+         for(vector<MolBondAngle*>::const_iterator pr=pos->mvpBondAngle.begin();pr!=pos->mvpBondAngle.end();++pr)
+         {
+            used.insert(&((*pr)->GetAtom1()));
+            used.insert(&((*pr)->GetAtom2()));
+            used.insert(&((*pr)->GetAtom3()));
+         }
+         for(vector<MolDihedralAngle*>::const_iterator pr=pos->mvpDihedralAngle.begin();pr!=pos->mvpDihedralAngle.end();++pr)
+         {
+            used.insert(&((*pr)->GetAtom1()));
+            used.insert(&((*pr)->GetAtom2()));
+            used.insert(&((*pr)->GetAtom3()));
+            used.insert(&((*pr)->GetAtom4()));
+         }
+         unsigned int i=0;
+         for(;i<mvMDAtomGroupBatch.size();++i)
+         {
+            bool conflict=false;
+            for(set<MolAtom*>::const_iterator at=pos->mvpAtom.begin();at!=pos->mvpAtom.end();++at)
+               if(vBatchUsed[i].find(*at)!=vBatchUsed[i].end()) {conflict=true;break;}
+            if(conflict) continue;
+            for(set<MolAtom*>::const_iterator at=used.begin();at!=used.end();++at)
+               if(vBatchMoved[i].find(*at)!=vBatchMoved[i].end()) {conflict=true;break;}
+            if(!conflict) break;
+         }
+         if(i==mvMDAtomGroupBatch.size())
+         {
+            mvMDAtomGroupBatch.push_back(vector<MDAtomGroup*>());
+            vBatchMoved.push_back(set<MolAtom*>());
+            vBatchUsed.push_back(set<MolAtom*>());
+         }
+         mvMDAtomGroupBatch[i].push_back(&(*pos));
+         vBatchMoved[i].insert(pos->mvpAtom.begin(),pos->mvpAtom.end());
+         vBatchUsed[i].insert(used.begin(),used.end());
+      }
+   }
+   cout<<"MD atom groups: "<<mvMDAtomGroup.size()<<" in "<<mvMDAtomGroupBatch.size()<<" batch(es)"<<endl;
+
    // Create mvMDFullAtomGroup
    mvMDFullAtomGroup.clear();
    #if 1
@@ -7572,6 +8203,95 @@ void Molecule::BuildMDAtomGroups()
    mClockMDAtomGroup.Click();
 }
 
+void Molecule::BuildRestraintTable()const
+{
+   if(  (mClockRestraintTable>mClockAtomList)
+      &&(mClockRestraintTable>mClockBondList)
+      &&(mClockRestraintTable>mClockBondAngleList)
+      &&(mClockRestraintTable>mClockDihedralAngleList)) return;
+   VFN_DEBUG_ENTRY("Molecule::BuildRestraintTable()",5)
+   TAU_PROFILE("Molecule::BuildRestraintTable()","void ()",TAU_DEFAULT);
+   mvRestraintTableAtomIndex.resize(mvpAtom.size());
+   for(unsigned long i=0;i<mvpAtom.size();++i) mvRestraintTableAtomIndex[i]=make_pair((const MolAtom*)mvpAtom[i],i);
+   sort(mvRestraintTableAtomIndex.begin(),mvRestraintTableAtomIndex.end());
+   const vector<pair<const MolAtom*,unsigned long> > &index=mvRestraintTableAtomIndex;
+
+   mvRestraintTableBond.resize(2*mvpBond.size());
+   unsigned long *p=mvRestraintTableBond.size()>0 ? &mvRestraintTableBond[0] : 0;
+   for(vector<MolBond*>::const_iterator pos=mvpBond.begin();pos!=mvpBond.end();++pos)
+   {
+      *p++=RestraintTableAtomIndex(index,&((*pos)->GetAtom1()));
+      *p++=RestraintTableAtomIndex(index,&((*pos)->GetAtom2()));
+   }
+   mvRestraintTableBondAngle.resize(3*mvpBondAngle.size());
+   p=mvRestraintTableBondAngle.size()>0 ? &mvRestraintTableBondAngle[0] : 0;
+   for(vector<MolBondAngle*>::const_iterator pos=mvpBondAngle.begin();pos!=mvpBondAngle.end();++pos)
+   {
+      *p++=RestraintTableAtomIndex(index,&((*pos)->GetAtom1()));
+      *p++=RestraintTableAtomIndex(index,&((*pos)->GetAtom2()));
+      *p++=RestraintTableAtomIndex(index,&((*pos)->GetAtom3()));
+   }
+   mvRestraintTableDihedral.resize(4*mvpDihedralAngle.size());
+   p=mvRestraintTableDihedral.size()>0 ? &mvRestraintTableDihedral[0] : 0;
+   for(vector<MolDihedralAngle*>::const_iterator pos=mvpDihedralAngle.begin();pos!=mvpDihedralAngle.end();++pos)
+   {
+      *p++=RestraintTableAtomIndex(index,&((*pos)->GetAtom1()));
+      *p++=RestraintTableAtomIndex(index,&((*pos)->GetAtom2()));
+      *p++=RestraintTableAtomIndex(index,&((*pos)->GetAtom3()));
+      *p++=RestraintTableAtomIndex(index,&((*pos)->GetAtom4()));
+   }
+   mClockRestraintTable.Click();
+   VFN_DEBUG_EXIT("Molecule::BuildRestraintTable()",5)
+}
+
+REAL Molecule::GetRestraintTableLogLikelihood(REAL *grad)const
+{
+   TAU_PROFILE("Molecule::GetRestraintTableLogLikelihood()","REAL (REAL*)",TAU_DEFAULT);
+   this->BuildRestraintTable();
+   const long nbAtom=mvpAtom.size();
+   const long nbBond=mvpBond.size();
+   const long nbAngle=mvpBondAngle.size();
+   const long nbDihed=mvpDihedralAngle.size();
+   if((nbBond+nbAngle+nbDihed)==0) return 0;
+   // Contiguous copy of the atomic coordinates
+   mvRestraintTableXYZ.resize(3*nbAtom);
+   REAL *RESTRICT xyz=&mvRestraintTableXYZ[0];
+   for(long i=0;i<nbAtom;++i)
+   {
+      xyz[3*i  ]=mvpAtom[i]->GetX();
+      xyz[3*i+1]=mvpAtom[i]->GetY();
+      xyz[3*i+2]=mvpAtom[i]->GetZ();
+   }
+   this->UpdateRestraintTablePar();
+   const REAL *RESTRICT par=&mvRestraintTablePar[0];
+   return RestraintTableLogLikelihood(xyz,mvRestraintTableBond,mvRestraintTableBondAngle,
+                                      mvRestraintTableDihedral,par,mvRestraintTableDeriv,grad);
+}
+
+void Molecule::UpdateRestraintTablePar()const
+{
+   mvRestraintTablePar.resize(3*(mvpBond.size()+mvpBondAngle.size()+mvpDihedralAngle.size()));
+   REAL *p=mvRestraintTablePar.size()>0 ? &mvRestraintTablePar[0] : 0;
+   for(vector<MolBond*>::const_iterator pos=mvpBond.begin();pos!=mvpBond.end();++pos)
+   {
+      *p++=(*pos)->GetLength0();
+      *p++=(*pos)->GetLengthDelta();
+      *p++=(*pos)->GetLengthSigma();
+   }
+   for(vector<MolBondAngle*>::const_iterator pos=mvpBondAngle.begin();pos!=mvpBondAngle.end();++pos)
+   {
+      *p++=(*pos)->GetAngle0();
+      *p++=(*pos)->GetAngleDelta();
+      *p++=(*pos)->GetAngleSigma();
+   }
+   for(vector<MolDihedralAngle*>::const_iterator pos=mvpDihedralAngle.begin();pos!=mvpDihedralAngle.end();++pos)
+   {
+      *p++=(*pos)->GetAngle0();
+      *p++=(*pos)->GetAngleDelta();
+      *p++=(*pos)->GetAngleSigma();
+   }
+}
+
 void Molecule::UpdateScattCompList()const
 {
    if(  (mClockAtomPosition<mClockScattCompList)
@@ -7585,8 +8305,9 @@ void Molecule::UpdateScattCompList()const
    // Get internal coords
    for(long i=0;i<nb;++i)
    {
-      if(mvpAtom[i]->IsDummy()) mScattCompList(i).mpScattPow=0;
-      else mScattCompList(i).mpScattPow=&(mvpAtom[i]->GetScatteringPower());
+      const ScatteringPower *pow=0;
+      if(!(mvpAtom[i]->IsDummy())) pow=&(mvpAtom[i]->GetScatteringPower());
+      mScattCompList(i).mpScattPow=pow;
       mScattCompList(i).mX=mvpAtom[i]->GetX();
       mScattCompList(i).mY=mvpAtom[i]->GetY();
       mScattCompList(i).mZ=mvpAtom[i]->GetZ();
@@ -7644,33 +8365,53 @@ void Molecule::UpdateScattCompList()const
       y0=mpCenterAtom->GetY();
       z0=mpCenterAtom->GetZ();
    }
-   for(long i=0;i<nb;++i)
-   {
-      mScattCompList(i).mX -= x0;
-      mScattCompList(i).mY -= y0;
-      mScattCompList(i).mZ -= z0;
-   }
-   //VFN_DEBUG_MESSAGE("Molecule::UpdateScattCompList()",10)
    // rotate
    mQuat.Normalize();
-   for(long i=0;i<nb;++i)
+   // Only the atoms which moved (relatively to the Molecule) since the last update
+   // need to be rotated and converted to fractional coordinates, unless the
+   // orientation or the lattice changed. The internal coordinates are compared
+   // rather than flagged, as they can be modified directly (e.g. by RefinablePar).
+   bool full=  (mvScattCompCacheXYZ.size()==0)||(mvScattCompCacheXYZ.size()!=(unsigned long)(3*nb))
+             ||(this->GetCrystal().GetClockLatticePar()>mClockScattCompCache)
+             ||(mScattCompCacheQuat[0]!=mQuat.Q0())||(mScattCompCacheQuat[1]!=mQuat.Q1())
+             ||(mScattCompCacheQuat[2]!=mQuat.Q2())||(mScattCompCacheQuat[3]!=mQuat.Q3());
+   if(full)
    {
-      //#error the vector must not be normalized !
-      mQuat.RotateVector(mScattCompList(i).mX,mScattCompList(i).mY,mScattCompList(i).mZ);
+      mvScattCompCacheXYZ.resize(3*nb);
+      mvScattCompCacheFrac.resize(3*nb);
+      mScattCompCacheQuat[0]=mQuat.Q0();
+      mScattCompCacheQuat[1]=mQuat.Q1();
+      mScattCompCacheQuat[2]=mQuat.Q2();
+      mScattCompCacheQuat[3]=mQuat.Q3();
+      mClockScattCompCache.Click();
    }
-   // Convert to fractionnal coordinates
    for(long i=0;i<nb;++i)
    {
-      this->GetCrystal().OrthonormalToFractionalCoords(mScattCompList(i).mX,
-                                                       mScattCompList(i).mY,
-                                                       mScattCompList(i).mZ);
-   }
-   // translate center to position in unit cell
+      REAL *RESTRICT p=&mvScattCompCacheXYZ[3*i];
+      REAL x=mScattCompList(i).mX,y=mScattCompList(i).mY,z=mScattCompList(i).mZ;
+      if((!full)&&(p[0]==x)&&(p[1]==y)&&(p[2]==z)) continue;
+      p[0]=x;
+      p[1]=y;
+      p[2]=z;
+      //#error the vector must not be normalized !
+      mQuat.RotateVector(x,y,z);
+      // Convert to fractionnal coordinates
+      this->GetCrystal().OrthonormalToFractionalCoords(x,y,z);
+      mvScattCompCacheFrac[3*i  ]=x;
+      mvScattCompCacheFrac[3*i+1]=y;
+      mvScattCompCacheFrac[3*i+2]=z;
+   }
+   // translate center to (0,0,0), then to position in unit cell
+   mQuat.RotateVector(x0,y0,z0);
+   this->GetCrystal().OrthonormalToFractionalCoords(x0,y0,z0);
+   x0=mXYZ(0)-x0;
+   y0=mXYZ(1)-y0;
+   z0=mXYZ(2)-z0;
    for(long i=0;i<nb;++i)
    {
-      mScattCompList(i).mX += mXYZ(0);
-      mScattCompList(i).mY += mXYZ(1);
-      mScattCompList(i).mZ += mXYZ(2);
+      mScattCompList(i).mX = mvScattCompCacheFrac[3*i  ]+x0;
+      mScattCompList(i).mY = mvScattCompCacheFrac[3*i+1]+y0;
+      mScattCompList(i).mZ = mvScattCompCacheFrac[3*i+2]+z0;
    }
    mClockScattCompList.Click();
    VFN_DEBUG_EXIT("Molecule::UpdateScattCompList()",5)
@@ -7714,6 +8455,9 @@ void Molecule::InitOptions()
    static string moleculeCenterName;
    static string moleculeCenterChoices[2];
 
+   static string mdMoveTypeName;
+   static string mdMoveTypeChoices[2];
+
    static bool needInitNames=true;
    if(true==needInitNames)
    {
@@ -7739,6 +8483,10 @@ void Molecule::InitOptions()
       moleculeCenterChoices[0]="Geometrical center (recommended)";
       moleculeCenterChoices[1]="User-chosen Atom";
 
+      mdMoveTypeName="Molecular Dynamics Moves";
+      mdMoveTypeChoices[0]="All non-rigid atoms";
+      mdMoveTypeChoices[1]="Batches of independent atom groups (parallel)";
+
       needInitNames=false;
    }
    mFlexModel.Init(3,&Flexname,Flexchoices);
@@ -7759,6 +8507,9 @@ void Molecule::InitOptions()
    mMoleculeCenter.Init(2,&moleculeCenterName,moleculeCenterChoices);
    this->AddOption(&mMoleculeCenter);
 
+   mMDMoveType.Init(2,&mdMoveTypeName,mdMoveTypeChoices);
+   this->AddOption(&mMDMoveType);
+
    VFN_DEBUG_EXIT("Molecule::InitOptions",7)
 }
 
@@ -786,6 +786,15 @@ class Molecule: public Scatterer
       virtual int GetNbComponent() const;
       virtual const ScatteringComponentList& GetScatteringComponentList() const;
       virtual string GetComponentName(const int i) const;
+      /** Analytical derivatives of the scattering components versus the position,
+      * occupancy, orientation (quaternion) and atomic coordinates of the Molecule.
+      *
+      * This takes into account the re-centering of the Molecule (see mMoleculeCenter)
+      * and the normalization of the quaternion in UpdateScattCompList().
+      */
+      virtual bool GetScatteringComponentListDeriv(const RefinablePar &par,
+                                                   CrystVector_REAL &dx, CrystVector_REAL &dy,
+                                                   CrystVector_REAL &dz, CrystVector_REAL &docc)const;
       virtual ostream& POVRayDescription(ostream &os,
                                          const CrystalPOVRayOptions &options)const;
 
@@ -920,6 +929,10 @@ class Molecule: public Scatterer
       * The atoms actually moved are those included as keys in v0, and those part of the
       * rigid bodies in vr.
       *
+      * The evolution uses a velocity Verlet integrator working on dense arrays of
+      * positions, speeds and gradients, with the restraints converted to atom indices
+      * once before the first step.
+      *
       * \param v0: initial speed of all atoms. On return, includes the new speed coordinates.
       * Only the atoms used as keys in v0 will be moved, so this should be used to work
       * only on a subgroup of atoms.
@@ -941,6 +954,22 @@ class Molecule: public Scatterer
                                    const std::vector<MolBond*> &vb,const std::vector<MolBondAngle*> &va,
                                    const std::vector<MolDihedralAngle*> &vd,
                                    std::map<RigidGroup*,std::pair<XYZ,XYZ> > &vr, REAL nrj0=0);
+      /** Change concurrently the conformation of several groups of atoms using
+      * molecular dynamics. Each group is evolved as in MolecularDynamicsEvolve(), taking
+      * into account only its own restraints.
+      *
+      * \param vpGroup: the groups of atoms. No atom moved by one group may be moved or used
+      * in a restraint by another group (see Molecule::mvMDAtomGroupBatch).
+      * \param vv0: initial speed of the atoms of each group. On return, includes the
+      * new speed coordinates.
+      * \param nbStep: number of steps to perform.
+      * \param dt: time step.
+      * \param vnrj0: the total energy each group should try to maintain.
+      */
+      void MolecularDynamicsEvolveBatch(const std::vector<MDAtomGroup*> &vpGroup,
+                                        std::vector<std::map<MolAtom*,XYZ> > &vv0,
+                                        const unsigned nbStep,const REAL dt,
+                                        const std::vector<REAL> &vnrj0);
       const std::vector<MolAtom*>& GetAtomList()const;
       const std::vector<MolBond*>& GetBondList()const;
       const std::vector<MolBondAngle*>& GetBondAngleList()const;
@@ -1127,6 +1156,24 @@ class Molecule: public Scatterer
       * list of free/non-free stretch mode has been built.
       */
       void BuildMDAtomGroups();
+      /** Build the flat restraint table, i.e. the indices (in Molecule::mvpAtom) of the atoms
+      * of all bonds, bond angles and dihedral angles.
+      *
+      * The table is \e only rebuilt if the atom or restraint lists have changed.
+      */
+      void BuildRestraintTable()const;
+      /** Compute the log(likelihood) of all bond, bond angle and dihedral angle restraints
+      * using the flat restraint table, without any virtual call or map lookup.
+      *
+      * \param grad: if not null, the gradient of the log(likelihood) versus
+      * the atomic coordinates is \b added to this array, which must hold 3*mvpAtom.size()
+      * values (x,y,z for each atom, in the Molecule::mvpAtom order).
+      * \note this does not update the log(likelihood) stored in each restraint, so
+      * e.g. MolBond::GetLogLikelihood(false,false) is not affected.
+      */
+      REAL GetRestraintTableLogLikelihood(REAL *grad=0)const;
+      /// Copy the ideal value, delta and sigma of all restraints to the restraint table.
+      void UpdateRestraintTablePar()const;
       /** Update the Molecule::mScattCompList from the cartesian coordinates
       * of all atoms, and the orientation parameters.
       */
@@ -1175,6 +1222,33 @@ class Molecule: public Scatterer
       * \note this only reflects the bond list, so it is mutable.
       */
       mutable list<MolRing> mvRing;
+      /** Flat restraint table: (atom, index in mvpAtom) pairs, sorted by atom pointer,
+      * to find the index of an atom without a map.
+      */
+      mutable std::vector<std::pair<const MolAtom*,unsigned long> > mvRestraintTableAtomIndex;
+      /// Flat restraint table: indices of the 2 atoms of each bond
+      mutable std::vector<unsigned long> mvRestraintTableBond;
+      /// Flat restraint table: indices of the 3 atoms of each bond angle
+      mutable std::vector<unsigned long> mvRestraintTableBondAngle;
+      /// Flat restraint table: indices of the 4 atoms of each dihedral angle
+      mutable std::vector<unsigned long> mvRestraintTableDihedral;
+      /** Flat restraint table: ideal value, delta and sigma of each restraint (bonds,
+      * then bond angles and dihedral angles). This is refreshed for every evaluation as
+      * these can be changed without any clock being clicked.
+      */
+      mutable std::vector<REAL> mvRestraintTablePar;
+      /// Flat restraint table: contiguous atomic coordinates
+      mutable std::vector<REAL> mvRestraintTableXYZ;
+      /// Flat restraint table: derivatives of the log(likelihood) of each restraint vs its atoms
+      mutable std::vector<REAL> mvRestraintTableDeriv;
+      /// Internal (cartesian) coordinates of the atoms at the last update of the
+      /// scattering component list, to detect which atoms moved.
+      mutable std::vector<REAL> mvScattCompCacheXYZ;
+      /// Rotated fractional coordinates (before translation) of the atoms at the last
+      /// update of the scattering component list.
+      mutable std::vector<REAL> mvScattCompCacheFrac;
+      /// Orientation quaternion used for Molecule::mvScattCompCacheFrac
+      mutable REAL mScattCompCacheQuat[4];
       /** The unit quaternion defining the orientation
       *
       */
@@ -1212,6 +1286,9 @@ class Molecule: public Scatterer
          mutable RefinableObjClock mClockStretchModeTorsion;
          mutable RefinableObjClock mClockStretchModeTwist;
          mutable RefinableObjClock mClockMDAtomGroup;
+         mutable RefinableObjClock mClockRestraintTable;
+         /// Last time the cached rotated coordinates were fully recomputed
+         mutable RefinableObjClock mClockScattCompCache;
 
       // For local minimization (EXPERIMENTAL)
          unsigned long mLocalParamSet;
@@ -1245,6 +1322,12 @@ class Molecule: public Scatterer
       */
       RefObjOpt mMoleculeCenter;
 
+      /** Option to choose the atoms moved by molecular dynamics moves (see mMDMoveFreq):
+      * either all atoms which are not in a rigid group, or a batch of independent
+      * groups of atoms (mvMDAtomGroupBatch), which are evolved in parallel.
+      */
+      RefObjOpt mMDMoveType;
+
       /** Atom chosen as center of rotation, if mRotationCenter is set to use
       * an atom rather than the geometrical center.
       */
@@ -1367,6 +1450,11 @@ class Molecule: public Scatterer
       * principles.
       */
       mutable list<MDAtomGroup> mvMDAtomGroup;
+      /** Partition of Molecule::mvMDAtomGroup in batches of groups which can be
+      * evolved concurrently: within a batch, no atom moved by one group is moved or
+      * used in a restraint by another group.
+      */
+      mutable std::vector<std::vector<MDAtomGroup*> > mvMDAtomGroupBatch;
       /// Full list of atoms that can be moved using molecular dynamics
       /// This excludes any atom part of a rigid group
       mutable std::set<MolAtom*> mvMDFullAtomGroup;
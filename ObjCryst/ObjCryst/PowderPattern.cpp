@@ -367,6 +367,12 @@ void PowderPatternBackground::OptimizeBayesianBackground()
 {
    VFN_DEBUG_ENTRY("PowderPatternBackground::OptimizeBayesianBackground()",5);
    TAU_PROFILE("PowderPatternBackground::OptimizeBayesianBackground()","void ()",TAU_DEFAULT);
+   if(this->OptimizeBayesianBackgroundIRLS())
+   {
+      this->GetParentPowderPattern().UpdateDisplay();
+      VFN_DEBUG_EXIT("PowderPatternBackground::OptimizeBayesianBackground()",5);
+      return;
+   }
    PowderPatternBackgroundBayesianMinimiser min(*this);
    SimplexObj simplex("Simplex Test");
    simplex.AddRefinableObj(min);
@@ -407,6 +413,218 @@ void PowderPatternBackground::OptimizeBayesianBackground()
    VFN_DEBUG_EXIT("PowderPatternBackground::OptimizeBayesianBackground()",5);
 }
 
+/** \internal Weight for the iteratively re-weighted least squares minimisation of
+* the Bayesian background cost L(t), i.e. L'(t)/t
+*/
+static REAL BayesianBackgroundIRLSWeight(const REAL t)
+{
+   if(t<=0) return 10;// L(t)=5*t^2
+   if(t>=8) return 1/(t*t);// L(t)=A+log(t)
+   const REAL t1= t<1e-3 ? (REAL)1e-3 : t;
+   const REAL h=1e-4;
+   return (PowderPatternBackgroundBayesianMinimiser::BayesianBackgroundLogLikelihood(t1+h)
+          -PowderPatternBackgroundBayesianMinimiser::BayesianBackgroundLogLikelihood(t1-h))/(2*h*t1);
+}
+
+/** \internal Compute the background from the intensities of the free interpolation points,
+* using the contribution of each point (stored starting from pixel vFirst[i])
+*/
+static void BayesianBackgroundIRLSCalc(const CrystVector_REAL &intensity, const vector<long> &vFirst,
+                                       const vector<CrystVector_REAL> &vBasis,
+                                       const CrystVector_REAL &backgdFixed, CrystVector_REAL &backgd)
+{
+   backgd=backgdFixed;
+   for(unsigned long i=0;i<vBasis.size();i++)
+   {
+      const REAL v=intensity(i);
+      const REAL *p=vBasis[i].data();
+      REAL *pb=backgd.data()+vFirst[i];
+      for(long k=vBasis[i].numElements();k>0;k--) *pb++ += v * *p++;
+   }
+}
+
+/** \internal Bayesian cost of a background, as in PowderPatternBackgroundBayesianMinimiser::GetLogLikelihood()
+*/
+static REAL BayesianBackgroundIRLSCost(const CrystVector_REAL &backgd, const REAL *pObs, const REAL *pSigma)
+{
+   REAL llk=0;
+   const REAL *pBackgd=backgd.data();
+   for(long k=backgd.numElements();k>0;k--)
+   {
+      if(*pSigma>0)
+         llk += PowderPatternBackgroundBayesianMinimiser::BayesianBackgroundLogLikelihood
+                  ((*pObs-*pBackgd) / (1.4142135623730951**pSigma));
+      pObs++;
+      pBackgd++;
+      pSigma++;
+   }
+   return llk;
+}
+
+bool PowderPatternBackground::OptimizeBayesianBackgroundIRLS(const long nbIterMax)
+{
+   VFN_DEBUG_ENTRY("PowderPatternBackground::OptimizeBayesianBackgroundIRLS()",5);
+   TAU_PROFILE("PowderPatternBackground::OptimizeBayesianBackgroundIRLS()","bool ()",TAU_DEFAULT);
+   const long nb=this->GetPowderPatternCalc().numElements();
+   if((nb==0)||(mBackgroundNbPoint<2))
+   {
+      VFN_DEBUG_EXIT("PowderPatternBackground::OptimizeBayesianBackgroundIRLS():no points",5);
+      return false;
+   }
+   const REAL *pObs=mpParentPowderPattern->GetPowderPatternObs().data();
+   const REAL *pSigma=mpParentPowderPattern->GetPowderPatternObsSigma().data();
+   this->InitSpline();
+   // Free interpolation points, sorted by position so that the normal matrix is banded
+   vector<long> vFree;
+   for(long i=0;i<mBackgroundNbPoint;i++)
+      if(!this->GetPar(mBackgroundInterpPointIntensity.data()+mPointOrder(i)).IsFixed())
+         vFree.push_back(mPointOrder(i));
+   const long nbFree=vFree.size();
+   if(nbFree==0)
+   {
+      VFN_DEBUG_EXIT("PowderPatternBackground::OptimizeBayesianBackgroundIRLS():no free points",5);
+      return false;
+   }
+   const CrystVector_REAL intensity0=mBackgroundInterpPointIntensity;
+   const REAL llk0=BayesianBackgroundIRLSCost(this->GetPowderPatternCalc(),pObs,pSigma);
+   cout<<"Initial Chi^2(BayesianBackground)="<<llk0<<endl;
+   // The background is linear in the intensities of the interpolation points. Compute the
+   // contribution of the fixed points, and of each free point only where it is not negligible.
+   for(long i=0;i<nbFree;i++) mBackgroundInterpPointIntensity(vFree[i])=0;
+   mClockBackgroundPoint.Click();
+   const CrystVector_REAL backgdFixed=this->GetPowderPatternCalc();
+   vector<long> vFirst(nbFree);
+   vector<CrystVector_REAL> vBasis(nbFree);
+   for(long i=0;i<nbFree;i++)
+   {
+      mBackgroundInterpPointIntensity(vFree[i])=1;
+      mClockBackgroundPoint.Click();
+      const REAL *pCalc=this->GetPowderPatternCalc().data();
+      const REAL *pFixed=backgdFixed.data();
+      mBackgroundInterpPointIntensity(vFree[i])=0;
+      REAL vmax=0;
+      for(long k=0;k<nb;k++) if(fabs(pCalc[k]-pFixed[k])>vmax) vmax=fabs(pCalc[k]-pFixed[k]);
+      const REAL threshold=vmax*1e-8;
+      long first=0,last=nb;
+      while((first<nb)&&(fabs(pCalc[first]-pFixed[first])<=threshold)) first++;
+      while((last>first)&&(fabs(pCalc[last-1]-pFixed[last-1])<=threshold)) last--;
+      vFirst[i]=first;
+      vBasis[i].resize(last-first);
+      REAL *p=vBasis[i].data();
+      for(long k=first;k<last;k++) *p++ = pCalc[k]-pFixed[k];
+   }
+   // Current intensities and background
+   CrystVector_REAL intensity(nbFree),backgd(nb);
+   for(long i=0;i<nbFree;i++) intensity(i)=intensity0(vFree[i]);
+   BayesianBackgroundIRLSCalc(intensity,vFirst,vBasis,backgdFixed,backgd);
+   REAL llk=BayesianBackgroundIRLSCost(backgd,pObs,pSigma);
+   bool ok=true;
+   CrystVector_REAL weight(nb),intensity1(nbFree),dintensity(nbFree);
+   vector<long> vBand(nbFree);// first non-zero column in each row of the normal matrix
+   vector<double> M(nbFree*nbFree),B(nbFree);
+   long iter=0;
+   for(;iter<nbIterMax;iter++)
+   {
+      // IRLS weights, from the current residuals
+      for(long k=0;k<nb;k++)
+      {
+         if(pSigma[k]>0)
+            weight(k)=BayesianBackgroundIRLSWeight((pObs[k]-backgd(k))/(1.4142135623730951*pSigma[k]))
+                      /(2*pSigma[k]*pSigma[k]);
+         else weight(k)=0;
+      }
+      // Banded normal matrix (lower triangle) for the free intensities
+      for(long i=0;i<nbFree;i++)
+      {
+         const long firsti=vFirst[i],lasti=firsti+vBasis[i].numElements();
+         const REAL *pi=vBasis[i].data();
+         vBand[i]=i;
+         for(long j=0;j<=i;j++)
+         {
+            const long firstj=vFirst[j],lastj=firstj+vBasis[j].numElements();
+            const long k0= firsti>firstj ? firsti : firstj;
+            const long k1= lasti <lastj  ? lasti  : lastj;
+            double v=0;
+            if(k0<k1)
+            {
+               const REAL *pj=vBasis[j].data();
+               for(long k=k0;k<k1;k++) v+=pi[k-firsti]*weight(k)*pj[k-firstj];
+               if(vBand[i]>j) vBand[i]=j;
+            }
+            M[i*nbFree+j]=v;
+         }
+         double b=0;
+         for(long k=firsti;k<lasti;k++) b+=pi[k-firsti]*weight(k)*(pObs[k]-backgdFixed(k));
+         B[i]=b;
+      }
+      // Envelope Cholesky decomposition M=L*L^T (in place), and solution
+      for(long i=0;(i<nbFree)&&ok;i++)
+         for(long j=vBand[i];j<=i;j++)
+         {
+            double v=M[i*nbFree+j];
+            const long k0= vBand[i]>vBand[j] ? vBand[i] : vBand[j];
+            for(long k=k0;k<j;k++) v-=M[i*nbFree+k]*M[j*nbFree+k];
+            if(j<i) M[i*nbFree+j]=v/M[j*nbFree+j];
+            else if(v>0) M[i*nbFree+i]=sqrt(v);
+            else ok=false;
+         }
+      if(!ok) break;
+      for(long i=0;i<nbFree;i++)
+      {
+         double v=B[i];
+         for(long k=vBand[i];k<i;k++) v-=M[i*nbFree+k]*B[k];
+         B[i]=v/M[i*nbFree+i];
+      }
+      for(long i=nbFree-1;i>=0;i--)
+      {
+         double v=B[i];
+         for(long k=i+1;k<nbFree;k++) if(vBand[k]<=i) v-=M[k*nbFree+i]*B[k];
+         B[i]=v/M[i*nbFree+i];
+      }
+      for(long i=0;i<nbFree;i++) dintensity(i)=B[i]-intensity(i);
+      // Reduce the step if the cost increases
+      REAL llk1=llk;
+      REAL step=1;
+      for(int j=0;j<10;j++)
+      {
+         for(long i=0;i<nbFree;i++) intensity1(i)=intensity(i)+step*dintensity(i);
+         BayesianBackgroundIRLSCalc(intensity1,vFirst,vBasis,backgdFixed,backgd);
+         llk1=BayesianBackgroundIRLSCost(backgd,pObs,pSigma);
+         if(llk1<=llk) break;
+         step*=0.5;
+      }
+      if(llk1>llk) break;
+      intensity=intensity1;
+      const bool converged=(llk-llk1)<=(1e-6*fabs(llk)+1e-10);
+      llk=llk1;
+      if(converged) break;
+   }
+   if(ok)
+   {
+      for(long i=0;i<nbFree;i++) mBackgroundInterpPointIntensity(vFree[i])=intensity(i);
+      mClockBackgroundPoint.Click();
+      // Check the cost using the real (not truncated) interpolation
+      llk=BayesianBackgroundIRLSCost(this->GetPowderPatternCalc(),pObs,pSigma);
+      if(llk>llk0)
+      {
+         mBackgroundInterpPointIntensity=intensity0;
+         mClockBackgroundPoint.Click();
+         llk=llk0;
+      }
+      cout<<iter<<", Chi^2(BayesianBackground)="<<llk<<endl;
+      char buf [200];
+      sprintf(buf,"Done Optimizing Bayesian Background, Chi^2(Background)=%f",(float)llk);
+      (*fpObjCrystInformUser)((string)buf);
+   }
+   else
+   {
+      mBackgroundInterpPointIntensity=intensity0;
+      mClockBackgroundPoint.Click();
+   }
+   VFN_DEBUG_EXIT("PowderPatternBackground::OptimizeBayesianBackgroundIRLS()",5);
+   return ok;
+}
+
 void PowderPatternBackground::FixParametersBeyondMaxresolution(RefinableObj &obj)
 {
    //Auto-fix points beyond used range
@@ -1087,14 +1305,14 @@ void PowderPatternDiffraction::ExtractLeBail(unsigned int nbcycle)
       calc=this->GetPowderPatternCalc();
       for(unsigned int k0=0;k0<nbrefl;++k0)
       {
-         if(mvReflProfile[k0].profile.numElements()==0) continue; // May happen for reflections near limits ?
+         if(mvReflProfile[k0].nb==0) continue; // May happen for reflections near limits ?
          REAL s1=0;
          //cout<<mH(k0)<<" "<<mK(k0)<<" "<<mL(k0)<<" , Iobs=??"<<endl;
          long last=mvReflProfile[k0].last,first;
          if(last>=(long)(mpParentPowderPattern->GetNbPointUsed())) last=mpParentPowderPattern->GetNbPointUsed();
          if(mvReflProfile[k0].first<0)first=0;
          else first=(mvReflProfile[k0].first);
-         const REAL *p1=mvReflProfile[k0].profile.data()+(first-mvReflProfile[k0].first);
+         const REAL *p1=this->GetReflProfileData(k0)+(first-mvReflProfile[k0].first);
          const REAL *p2=calc.data()+first;
          const REAL *pobs=obs.data()+first;
          for(long i=first;i<=last;++i)
@@ -1161,7 +1379,7 @@ long PowderPatternDiffraction::GetNbReflBelowMaxSinThetaOvLambda()const
          &&(mvReflProfile[mNbReflUsed-1].first<=nbpoint)) return mNbReflUsed;
    }
 
-   if((mNbReflUsed==mNbRefl) && (mvReflProfile[mNbReflUsed-1].profile.numElements()>0))
+   if((mNbReflUsed==mNbRefl) && (mvReflProfile[mNbReflUsed-1].nb>0))
       if(mvReflProfile[mNbReflUsed-1].first<=nbpoint)return mNbReflUsed;
 
 
@@ -1272,9 +1490,16 @@ Applying profiles for "<<nbRefl<<" reflections",2)
       else mPowderPatternCalcVariance.resize(0);
       VFN_DEBUG_MESSAGE("PowderPatternDiffraction::CalcPowderPattern() Has variance:"<<useML,2)
 
+      // First list the reflections (or groups of reflections with the same profile)
+      // for which the profile must be applied, with their total intensity
+      std::vector<long> vReflIndex;
+      std::vector<REAL> vIntensity,vVar;
+      vReflIndex.reserve(mNbReflUsed);
+      vIntensity.reserve(mNbReflUsed);
+      if(useML) vVar.reserve(mNbReflUsed);
       for(long i=0;i<mNbRefl;i += step)
       {
-         if(mvReflProfile[i].profile.numElements()==0)
+         if(mvReflProfile[i].nb==0)
          {
             step=1;
             if(i>=mNbReflUsed) break;// After sin(theta)/lambda limit
@@ -1299,14 +1524,56 @@ Applying profiles for "<<nbRefl<<" reflections",2)
             <<mIntH(i)<<" "<<mIntK(i)<<" "<<mIntL(i)<<" "\
             <<"  I="<<intensity<<"  stol="<<mSinThetaLambda(i)\
             <<",pixel #"<<mvReflProfile[i].first<<"->"<<mvReflProfile[i].last,2)
+         vReflIndex.push_back(i);
+         vIntensity.push_back(intensity);
+         if(useML) vVar.push_back(var);
+      }
+      // Apply the profiles. The pattern is split in blocks of points, computed in parallel:
+      // each block adds the part of the profiles which overlap it, in the same order
+      // as for a serial computation, so the result does not depend on the number of threads.
+      const long nbProfile=vReflIndex.size();
+      long nbBlock=1;
+      #ifdef _OPENMP
+      if(specNbPoints>=2000) nbBlock=GetNbThread()*4;
+      if(nbBlock>specNbPoints/500) nbBlock=specNbPoints/500;
+      if(nbBlock<1) nbBlock=1;
+      #endif
+      const long blockSize=(specNbPoints+nbBlock-1)/nbBlock;
+      // Range of profiles overlapping each block, so that a block does not scan all profiles
+      std::vector<long> vBlockFirstProfile(nbBlock,nbProfile),vBlockLastProfile(nbBlock,-1);
+      for(long k=0;k<nbProfile;k++)
+      {
+         const ReflProfile *pProfile=&(mvReflProfile[vReflIndex[k]]);
+         long b0=pProfile->first/blockSize,b1=pProfile->last/blockSize;
+         if(b0<0) b0=0;
+         if(b1>=nbBlock) b1=nbBlock-1;
+         for(long b=b0;b<=b1;b++)
+         {
+            if(k<vBlockFirstProfile[b]) vBlockFirstProfile[b]=k;
+            vBlockLastProfile[b]=k;
+         }
+      }
+      #ifdef _OPENMP
+      #pragma omp parallel for schedule(dynamic) num_threads(GetNbThread()) if(nbBlock>1)
+      #endif
+      for(long iblock=0;iblock<nbBlock;iblock++)
+      {
+         const long block0=iblock*blockSize;
+         const long block1=((iblock+1)*blockSize<specNbPoints)?(iblock+1)*blockSize-1:specNbPoints-1;
+         for(long k=vBlockFirstProfile[iblock];k<=vBlockLastProfile[iblock];k++)
          {
-            const long first=mvReflProfile[i].first,last=mvReflProfile[i].last;
-            const REAL *p2 = mvReflProfile[i].profile.data();
+            const ReflProfile *pProfile=&(mvReflProfile[vReflIndex[k]]);
+            if((pProfile->last<block0)||(pProfile->first>block1)) continue;
+            const long first=(pProfile->first>block0)?pProfile->first:block0;
+            const long last=(pProfile->last<block1)?pProfile->last:block1;
+            const REAL intensity=vIntensity[k];
+            const REAL *p2 = this->GetReflProfileData(vReflIndex[k])+(first-pProfile->first);
             REAL *p3 = mPowderPatternCalc.data()+first;
             for(long j=first;j<=last;j++) *p3++ += *p2++ * intensity;
             if(useML)
             {
-               const REAL *p2 = mvReflProfile[i].profile.data();
+               const REAL var=vVar[k];
+               const REAL *p2 = this->GetReflProfileData(vReflIndex[k])+(first-pProfile->first);
                REAL *p3 = mPowderPatternCalcVariance.data()+first;
                for(long j=first;j<=last;j++) *p3++ += *p2++ * var;
             }
@@ -1373,7 +1640,7 @@ void PowderPatternDiffraction::CalcPowderPattern_FullDeriv(std::set<RefinablePar
 
             for(long i=0;i<mNbReflUsed;i += step)
             {
-               if(mvReflProfile[i].profile.numElements()==0)
+               if(mvReflProfile[i].nb==0)
                {
                   step=1;
                   if(i>=mNbReflUsed) break;
@@ -1393,7 +1660,7 @@ void PowderPatternDiffraction::CalcPowderPattern_FullDeriv(std::set<RefinablePar
                }
                {
                   const long first=mvReflProfile[i].first,last=mvReflProfile[i].last;
-                  const REAL *p2 = mvReflProfile[i].profile.data();
+                  const REAL *p2 = this->GetReflProfileData(i);
                   REAL *p3 = mPowderPattern_FullDeriv[*par].data()+first;
                   for(long j=first;j<=last;j++) *p3++ += *p2++ * intensity;
                }
@@ -1409,7 +1676,7 @@ void PowderPatternDiffraction::CalcPowderPattern_FullDeriv(std::set<RefinablePar
             cout<<__FILE__<<":"<<__LINE__<<":PowderPatternDiffraction::CalcPowderPattern_FullDeriv():par="<<(*par)->GetName()<<endl;
             for(long i=0;i<mNbReflUsed;i += step)
             {
-               if(mvReflProfile[i].profile.numElements()==0)
+               if(mvReflProfile[i].nb==0)
                {
                   step=1;
                   if(i>=mNbReflUsed) break;
@@ -1716,8 +1983,10 @@ Computing all Profiles",5)
    {
       mvReflProfile[i].first=0;
       mvReflProfile[i].last=0;
-      mvReflProfile[i].profile.resize(0);
+      mvReflProfile[i].offset=0;
+      mvReflProfile[i].nb=0;
    }
+   mvReflProfileArena.clear();// The allocated storage is kept
    VFN_DEBUG_MESSAGE("PowderPatternDiffraction::CalcPowderReflProfile()",5)
 
    for(unsigned int line=0;line<nbLine;line++)
@@ -1803,12 +2072,24 @@ Computing all Profiles",5)
             reflProfile=mpReflectionProfile->GetProfile(vx,center,mH(i),mK(i),mL(i));
             VFN_DEBUG_MESSAGE("PowderPatternDiffraction::CalcPowderReflProfile()",2)
             if(nbLine>1) reflProfile *=spectrumFactor(line);
-            if(line==0) mvReflProfile[i].profile = reflProfile;
-            else mvReflProfile[i].profile += reflProfile;
+            const REAL *p0=reflProfile.data();
+            if(line==0)
+            {// Store the profile at the end of the arena
+               const unsigned long offset=mvReflProfileArena.size();
+               mvReflProfile[i].offset=offset;
+               mvReflProfile[i].nb=reflProfile.numElements();
+               mvReflProfileArena.resize(offset+mvReflProfile[i].nb);
+               for(unsigned long j=0;j<mvReflProfile[i].nb;j++) mvReflProfileArena[offset+j] = *p0++;
+            }
+            else
+            {
+               const unsigned long offset=mvReflProfile[i].offset;
+               for(unsigned long j=0;j<mvReflProfile[i].nb;j++) mvReflProfileArena[offset+j] += *p0++;
+            }
          }
          else
          { // reflection is out of pattern, so store no profile
-            mvReflProfile[i].profile.resize(0);
+            mvReflProfile[i].nb=0;
          }
          VFN_DEBUG_EXIT("PowderPatternDiffraction::CalcPowderReflProfile():\
 Computing all Profiles: Reflection #"<<i,5)
@@ -1913,14 +2194,7 @@ Radiation must be either monochromatic, from an X-Ray Tube, or neutron TOF !!");
                   if((*par)->GetType()->IsDescendantFromOrSameAs(gpRefParTypeScattDataProfile))
                   {// Parameter only affects profile
                      //if(i==0) cout<<"PowderPatternDiffraction::CalcPowderReflProfile_FullDeriv()par="<<(*par)->GetName()<<":refl #"<<i<<endl;
-                     //:TODO: analytical derivatives
-                     const REAL step=(*par)->GetDerivStep();
-                     (*par)->Mutate(step);
-                     reflProfile=mpReflectionProfile->GetProfile(vx,center,mH(i),mK(i),mL(i));
-                     (*par)->Mutate(-2*step);
-                     reflProfile-=mpReflectionProfile->GetProfile(vx,center,mH(i),mK(i),mL(i));
-                     (*par)->Mutate(step);
-                     reflProfile/=2*step;
+                     reflProfile=mpReflectionProfile->GetProfileDeriv(vx,center,mH(i),mK(i),mL(i),*par);
                   }
                   else
                   {// Parameter affects reflection center
@@ -1944,12 +2218,7 @@ Radiation must be either monochromatic, from an X-Ray Tube, or neutron TOF !!");
                      {
                         //if(i==0) cout<<"PowderPatternDiffraction::CalcPowderReflProfile_FullDeriv()par="<<(*par)->GetName()<<":refl #"<<i<<", dcenter="<<setw(8)<<dcenter<<endl;
                         if(vReflProfile_DerivCenter[i].size()==0)
-                        {
-                           const REAL step=1e-4;//:TODO: adapt for TOF
-                           vReflProfile_DerivCenter[i] =mpReflectionProfile->GetProfile(vx,center+step,mH(i),mK(i),mL(i));
-                           vReflProfile_DerivCenter[i]-=mpReflectionProfile->GetProfile(vx,center-step,mH(i),mK(i),mL(i));
-                           vReflProfile_DerivCenter[i]/=2*step;
-                        }
+                           vReflProfile_DerivCenter[i]=mpReflectionProfile->GetProfileDeriv(vx,center,mH(i),mK(i),mL(i));
                         reflProfile=vReflProfile_DerivCenter[i];
                         reflProfile*=dcenter;
                      }
@@ -2253,17 +2522,31 @@ void PowderPatternDiffraction::InitOptions()
 const CrystVector_long& PowderPatternDiffraction::GetBraggLimits()const
 {
    this->CalcPowderReflProfile();
-   if((mClockProfileCalc>mClockBraggLimits)&&(this->GetNbReflBelowMaxSinThetaOvLambda()>0))
+   if((mClockProfileCalc>mClockBraggLimitsCheck)&&(this->GetNbReflBelowMaxSinThetaOvLambda()>0))
    {
       VFN_DEBUG_ENTRY("PowderPatternDiffraction::GetBraggLimits(*min,*max)",3)
       TAU_PROFILE("PowderPatternDiffraction::GetBraggLimits()","void ()",TAU_DEFAULT);
-      mIntegratedReflLimits.resize(this->GetNbReflBelowMaxSinThetaOvLambda());
+      const long nb=this->GetNbReflBelowMaxSinThetaOvLambda();
+      CrystVector_long limits(nb);
       long i = 0;
-      mIntegratedReflLimits(i)=mvReflProfile[0].first;
-      for(;i<(this->GetNbReflBelowMaxSinThetaOvLambda()-1);++i)
-         mIntegratedReflLimits(i+1)=(mvReflProfile[i].first+mvReflProfile[i].last+mvReflProfile[i+1].first+mvReflProfile[i+1].last)/4;
-      mIntegratedReflLimits(i)=mvReflProfile[i].last;
-      mClockBraggLimits.Click();
+      limits(i)=mvReflProfile[0].first;
+      for(;i<(nb-1);++i)
+         limits(i+1)=(mvReflProfile[i].first+mvReflProfile[i].last+mvReflProfile[i+1].first+mvReflProfile[i+1].last)/4;
+      limits(i)=mvReflProfile[i].last;
+      // Small cell or profile changes usually leave the limiting pixels unchanged:
+      // only click mClockBraggLimits if they did move, so that the integration
+      // intervals and the pixel->interval index in the parent PowderPattern
+      // are not rebuilt for nothing.
+      bool changed=(mIntegratedReflLimits.numElements()!=nb);
+      if(!changed)
+         for(i=0;i<nb;++i)
+            if(limits(i)!=mIntegratedReflLimits(i)) {changed=true;break;}
+      if(changed)
+      {
+         mIntegratedReflLimits=limits;
+         mClockBraggLimits.Click();
+      }
+      mClockBraggLimitsCheck.Click();
       VFN_DEBUG_EXIT("PowderPatternDiffraction::GetBraggLimits(*min,*max)",3)
    }
    return mIntegratedReflLimits;
@@ -2320,44 +2603,40 @@ void PowderPatternDiffraction::PrepareIntegratedProfile()const
    TAU_PROFILE("PowderPatternDiffraction::PrepareIntegratedProfile()","void ()",TAU_DEFAULT);
    const CrystVector_long *pMin=&(mpParentPowderPattern->GetIntegratedProfileMin());
    const CrystVector_long *pMax=&(mpParentPowderPattern->GetIntegratedProfileMax());
+   const CrystVector_long *pIndex=&(mpParentPowderPattern->GetIntegratedProfileIndex());
 
    const long numInterval=pMin->numElements();
+   const long nbIndex=pIndex->numElements();
 
-   vector< map<long, REAL> > vIntegratedProfileFactor;
-   vIntegratedProfileFactor.resize(mNbReflUsed);
-   vector< map<long, REAL> >::iterator pos1;
-   pos1=vIntegratedProfileFactor.begin();
-
+   // Intervals are sorted and do not overlap, so the intervals covered by a reflection
+   // are contiguous, starting with the first one ending after the start of the profile.
    mIntegratedProfileFactor.resize(mNbReflUsed);
-   vector< pair<unsigned long, CrystVector_REAL> >::iterator pos2;
-   pos2=mIntegratedProfileFactor.begin();
+   #ifdef _OPENMP
+   #pragma omp parallel for schedule(static) num_threads(GetNbThread()) if(mNbReflUsed>1000)
+   #endif
    for(long i=0;i<mNbReflUsed;i++)
    {
-      pos1->clear();
-      long firstInterval=numInterval;
-      for(long j=0;j<numInterval;j++)
+      pair<unsigned long, CrystVector_REAL> *pFactor=&(mIntegratedProfileFactor[i]);
+      const long first0 = mvReflProfile[i].first;
+      const long last0  = mvReflProfile[i].last ;
+      long j0=numInterval,j1=numInterval;
+      if((mvReflProfile[i].nb>0)&&(first0<nbIndex))
+      {
+         j0= first0<0 ? 0 : (*pIndex)(first0);
+         for(j1=j0;j1<numInterval;j1++) if((*pMin)(j1)>last0) break;
+      }
+      pFactor->first=j0;
+      pFactor->second.resize(j1-j0);
+      REAL *fact=pFactor->second.data();
+      for(long j=j0;j<j1;j++)
       {
-         const long first0 = mvReflProfile[i].first;
-         const long last0  = mvReflProfile[i].last ;
          const long first= first0>(*pMin)(j) ? first0:(*pMin)(j);
          const long last = last0 <(*pMax)(j) ? last0 :(*pMax)(j);
-         if((first<=last) && (mvReflProfile[i].profile.size()>0))
-         {
-            if(firstInterval>j) firstInterval=j;
-            if(pos1->find(j) == pos1->end()) (*pos1)[j]=0.;
-            REAL *fact = &((*pos1)[j]);//this creates the 'j' entry if necessary
-            const REAL *p2 = mvReflProfile[i].profile.data()+(first-first0);
-            //cout << i<<","<<j<<","<<first<<","<<last<<":"<<*fact<<"/"<<mNbReflUsed<<","<<mNbRefl<<endl;
-            for(long k=first;k<=last;k++) *fact += *p2++;
-         }
+         const REAL *p2 = this->GetReflProfileData(i)+(first-first0);
+         REAL f=0;
+         for(long k=first;k<=last;k++) f += *p2++;
+         *fact++ = f;
       }
-      pos2->first=firstInterval;
-      pos2->second.resize(pos1->size());
-      REAL *pFact=pos2->second.data();
-      for(map<long, REAL>::const_iterator pos=pos1->begin();pos!=pos1->end();++pos)
-         *pFact++ = pos->second;
-      pos1++;
-      pos2++;
    }
    mClockIntegratedProfileFactor.Click();
    #ifdef __DEBUG__
@@ -5284,6 +5563,12 @@ const CrystVector_long& PowderPattern::GetIntegratedProfileMin()const
    return mIntegratedPatternMin;
 }
 
+const CrystVector_long& PowderPattern::GetIntegratedProfileIndex()const
+{
+   this->PrepareIntegratedRfactor();
+   return mIntegratedPatternIndex;
+}
+
 const CrystVector_long& PowderPattern::GetIntegratedProfileMax()const
 {
    this->PrepareIntegratedRfactor();
@@ -6472,6 +6757,7 @@ void PowderPattern::PrepareIntegratedRfactor()const
       {
          mIntegratedPatternMin.resize(0);
          mIntegratedPatternMax.resize(0);
+         mIntegratedPatternIndex.resize(0);
          mNbIntegrationUsed=0;
          mClockIntegratedFactorsPrep.Click();
          return;
@@ -6623,6 +6909,17 @@ void PowderPattern::PrepareIntegratedRfactor()const
    //cout<<FormatVertVector<REAL>(mIntegratedPatternMin,
    //                               mIntegratedPatternMax,
    //                               mIntegratedObs,mIntegratedWeight,12,6)<<endl;
+   // Index of the first interval ending at or after each pixel
+   mIntegratedPatternIndex.resize(mNbPointUsed);
+   {
+      long j=0;
+      for(long i=0;i<long(mNbPointUsed);i++)
+      {
+         while((j<numInterval)&&(mIntegratedPatternMax(j)<i)) j++;
+         mIntegratedPatternIndex(i)=j;
+      }
+   }
+
    mNbIntegrationUsed=mIntegratedPatternMin.numElements();
    mClockIntegratedFactorsPrep.Click();
    VFN_DEBUG_EXIT("PowderPattern::PrepareIntegratedRfactor()",3);
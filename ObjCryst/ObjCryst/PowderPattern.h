@@ -227,12 +227,26 @@ class PowderPatternBackground : public PowderPatternComponent
       /** Optimize the background using a Bayesian approach. The background parameters
       * must be un-fixed before.
       *
-      * The minimization will a maximum of 50 Simplex runs (see the SimplexObj documentation),
-      * each with 200 cycles.
+      * The minimization uses iteratively re-weighted least squares (see
+      * OptimizeBayesianBackgroundIRLS()). If this fails, a Simplex minimization
+      * (see the SimplexObj documentation) followed by a least squares refinement is used.
       *
       * See the class documentation for PowderPatternBackgroundBayesianMinimiser.
       */
       void OptimizeBayesianBackground();
+      /** Optimize the background using a Bayesian approach, with iteratively
+      * re-weighted least squares.
+      *
+      * The background is linear in the intensities of the interpolation points, and each
+      * point only contributes significantly near its position, so the normal matrix is banded.
+      * Each iteration solves the weighted least squares problem with weights derived from
+      * the Bayesian cost, and the step is reduced if the cost increases.
+      *
+      * \param nbIterMax: maximum number of iterations
+      * \return false if the optimization could not be done (no free interpolation point,
+      * singular normal matrix), in which case the background is unchanged.
+      */
+      bool OptimizeBayesianBackgroundIRLS(const long nbIterMax=50);
       /** Fix parameters corresponding to points of the pattern that are not actually calculated.
       * This is necessary for modelling using splines, to avoid divergence of interpolation
       * points during least squares optimization.
@@ -433,6 +447,9 @@ class PowderPatternDiffraction : virtual public PowderPatternComponent,public Sc
          mutable RefinableObjClock mClockIntensityCorr;
          /// Last time the reflection profiles were computed
          mutable RefinableObjClock mClockProfileCalc;
+         /// Last time the Bragg limits were checked against the reflection profiles
+         /// (mClockBraggLimits is only clicked if the limits actually changed)
+         mutable RefinableObjClock mClockBraggLimitsCheck;
          /// Last time intensities were computed
          mutable RefinableObjClock mClockIhklCalc;
       /// Profile
@@ -486,11 +503,24 @@ class PowderPatternDiffraction : virtual public PowderPatternComponent,public Sc
             long first;
             /// Last point of the pattern for which the profile is calculated
             long last;
-            /// The profile
-            CrystVector_REAL profile;
+            /// Index of the first value of the profile in mvReflProfileArena
+            unsigned long offset;
+            /// Number of values of the profile (0 if the reflection is outside the pattern)
+            unsigned long nb;
          };
          ///Reflection profiles for ALL reflections during the last powder pattern generation
          mutable vector<ReflProfile> mvReflProfile;
+         /** Contiguous storage for the values of all reflection profiles (see ReflProfile::offset).
+         *
+         * This is kept between computations to avoid re-allocations.
+         */
+         mutable vector<REAL> mvReflProfileArena;
+         /// Values of the profile of reflection i (only valid if mvReflProfile[i].nb>0)
+         const REAL* GetReflProfileData(const long i)const
+         {
+            if(mvReflProfileArena.size()==0) return 0;
+            return &mvReflProfileArena[0]+mvReflProfile[i].offset;
+         }
          /// Derivatives of reflection profiles versus a list of parameters. This will be limited
          /// to the reflections actually used. First and last point of each profile
          /// are the same as in mvReflProfile.
@@ -875,6 +905,18 @@ class PowderPattern : public RefinableObj
          const CrystVector_long& GetIntegratedProfileMin()const;
          /// Get the list of last pixels for the integration intervals
          const CrystVector_long& GetIntegratedProfileMax()const;
+         /** For each pixel (up to the number of points used), the index of the first
+         * integration interval which ends at or after this pixel (the number of intervals
+         * if there is none). This gives directly the intervals covered by a reflection
+         * profile, without any search.
+         *
+         * The index depends on the integration intervals, so it is rebuilt (in
+         * O(nbPoint+nbInterval)) whenever the Bragg limits of a component change.
+         * Cell or profile changes which do not move any limiting pixel (the usual
+         * case for small steps) do not trigger a rebuild; larger changes do, and
+         * there is no partial update of the index.
+         */
+         const CrystVector_long& GetIntegratedProfileIndex()const;
          /// When were the integration intervals last changed ?
          const RefinableObjClock& GetIntegratedProfileLimitsClock()const;
       /// Get the experimental x (2theta, tof) from the theoretical value, taking
@@ -1066,6 +1108,8 @@ class PowderPattern : public RefinableObj
 
       // Integrated R-factors
          mutable CrystVector_long mIntegratedPatternMin,mIntegratedPatternMax;
+         /// Index of the first integration interval for each pixel, see GetIntegratedProfileIndex()
+         mutable CrystVector_long mIntegratedPatternIndex;
          mutable CrystVector_REAL mIntegratedObs;
          mutable CrystVector_REAL mIntegratedWeight;
          mutable CrystVector_REAL mIntegratedWeightObs;
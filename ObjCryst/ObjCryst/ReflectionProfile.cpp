@@ -21,6 +21,8 @@
 *
 */
 #include <limits>
+#include <list>
+#include <vector>
 #include "ObjCryst/ObjCryst/ReflectionProfile.h"
 #include "ObjCryst/Quirks/VFNStreamFormat.h"
 #ifdef __WX__CRYST__
@@ -33,6 +35,17 @@
 
 namespace ObjCryst
 {
+#ifdef HAVE_SSE_MATHFUN
+/// In-place exponential of 4 consecutive values (SSE for float, no SIMD exp for double)
+inline void Exp4(float *p)
+{
+   _mm_storeu_ps(p,exp_ps(_mm_loadu_ps(p)));
+}
+inline void Exp4(double *p)
+{
+   for(unsigned int j=0;j<4;++j) p[j]=exp(p[j]);
+}
+#endif
 #if defined(_MSC_VER) || defined(__BORLANDC__)
 #undef min // Predefined macros.... (wx?)
 #undef max
@@ -83,6 +96,65 @@ ReflectionProfile::~ReflectionProfile()
 {}
 bool ReflectionProfile::IsAnisotropic()const
 {return false;}
+
+CrystVector_REAL ReflectionProfile::GetProfileDeriv(const CrystVector_REAL &x, const REAL xcenter,
+                                                    const REAL h, const REAL k, const REAL l,
+                                                    RefinablePar *par)const
+{
+   VFN_DEBUG_ENTRY("ReflectionProfile::GetProfileDeriv()",2)
+   CrystVector_REAL deriv;
+   if(par==0)
+   {
+      const REAL step=1e-4;//:TODO: adapt for TOF
+      deriv =this->GetProfile(x,xcenter+step,h,k,l);
+      deriv-=this->GetProfile(x,xcenter-step,h,k,l);
+      deriv/=2*step;
+   }
+   else
+   {
+      const REAL step=par->GetDerivStep();
+      par->Mutate(step);
+      deriv =this->GetProfile(x,xcenter,h,k,l);
+      par->Mutate(-2*step);
+      deriv-=this->GetProfile(x,xcenter,h,k,l);
+      par->Mutate(step);
+      deriv/=2*step;
+   }
+   VFN_DEBUG_EXIT("ReflectionProfile::GetProfileDeriv()",2)
+   return deriv;
+}
+
+/// Initialize the option used to choose between exact and tabulated pseudo-Voigt profiles
+static void InitProfileComputationOption(RefObjOpt &opt)
+{
+   static string ProfileComputationName;
+   static string ProfileComputationChoices[4];
+   static bool needInitNames=true;
+   if(true==needInitNames)
+   {
+      ProfileComputationName="Profile Computation";
+      ProfileComputationChoices[0]="Exact";
+      ProfileComputationChoices[1]="Tabulated (max error 1e-3)";
+      ProfileComputationChoices[2]="Tabulated (max error 1e-4)";
+      ProfileComputationChoices[3]="Tabulated (max error 1e-5)";
+      needInitNames=false;
+   }
+   opt.Init(4,&ProfileComputationName,ProfileComputationChoices);
+   opt.SetChoice(0);
+}
+
+/// Maximum relative error for tabulated profiles, from the profile computation option (0 for exact)
+static REAL GetProfileComputationMaxError(const RefObjOpt &opt)
+{
+   switch(opt.GetChoice())
+   {
+      case 1: return 1e-3;
+      case 2: return 1e-4;
+      case 3: return 1e-5;
+   }
+   return 0;
+}
+
 ////////////////////////////////////////////////////////////////////////
 //
 //    ReflectionProfilePseudoVoigt
@@ -97,6 +169,8 @@ mAsymBerarBaldinozziB0(0.0),mAsymBerarBaldinozziB1(0.0),
 mAsym0(1.0),mAsym1(0.0),mAsym2(0.0)
 {
    this->InitParameters();
+   InitProfileComputationOption(mProfileComputation);
+   this->AddOption(&mProfileComputation);
 }
 
 ReflectionProfilePseudoVoigt::ReflectionProfilePseudoVoigt
@@ -110,6 +184,9 @@ mAsymBerarBaldinozziB1(old.mAsymBerarBaldinozziB1),
 mAsym0(old.mAsym0),mAsym1(old.mAsym1),mAsym2(old.mAsym2)
 {
    this->InitParameters();
+   InitProfileComputationOption(mProfileComputation);
+   mProfileComputation.SetChoice(old.mProfileComputation.GetChoice());
+   this->AddOption(&mProfileComputation);
 }
 
 ReflectionProfilePseudoVoigt::~ReflectionProfilePseudoVoigt()
@@ -150,13 +227,20 @@ CrystVector_REAL ReflectionProfilePseudoVoigt::GetProfile(const CrystVector_REAL
    else fwhm=sqrt(fwhm);
    CrystVector_REAL profile,tmpV;
    const REAL asym=mAsym0+mAsym1/sin(center)+mAsym2/pow((REAL)sin(center),(REAL)2.0);
-   profile=PowderProfileGauss(x,fwhm,center,asym);
 
    // Eta for gaussian/lorentzian mix. Make sure 0<=eta<=1, else profiles could be <0 !
    REAL eta=mPseudoVoigtEta0+center*mPseudoVoigtEta1;
    if(eta>1) eta=1;
    if(eta<0) eta=0;
 
+   const REAL maxError=GetProfileComputationMaxError(mProfileComputation);
+   if(maxError>0)
+   {
+      VFN_DEBUG_EXIT("ReflectionProfilePseudoVoigt::GetProfile()",2)
+      return PowderProfilePseudoVoigtTabulated(x,fwhm,fwhm,eta,center,asym,maxError);
+   }
+   profile=PowderProfileGauss(x,fwhm,center,asym);
+
    profile *= 1-eta;
    tmpV=PowderProfileLorentz(x,fwhm,center,asym);
    tmpV *= eta;
@@ -168,6 +252,51 @@ CrystVector_REAL ReflectionProfilePseudoVoigt::GetProfile(const CrystVector_REAL
    return profile;
 }
 
+CrystVector_REAL ReflectionProfilePseudoVoigt::GetProfileDeriv(const CrystVector_REAL &x,
+                            const REAL center,const REAL h, const REAL k, const REAL l,
+                            RefinablePar *par)const
+{
+   VFN_DEBUG_ENTRY("ReflectionProfilePseudoVoigt::GetProfileDeriv(),c="<<center,2)
+   const REAL tantheta=tan(center/2.0);
+   const REAL fwhm2= mCagliotiW+mCagliotiV*tantheta+mCagliotiU*tantheta*tantheta;
+   const REAL fwhm=(fwhm2<=0)?1e-6:sqrt(fwhm2);
+   const REAL sin2theta=sin(center);
+   const REAL asym=mAsym0+mAsym1/sin2theta+mAsym2/(sin2theta*sin2theta);
+   const REAL eta0=mPseudoVoigtEta0+center*mPseudoVoigtEta1;
+   REAL eta=eta0;
+   if(eta>1) eta=1;
+   if(eta<0) eta=0;
+   // Derivatives of fwhm, eta and asym
+   REAL dfwhm=0,deta=0,dasym=0,dcenter=0;
+   if(par==0)
+   {
+      dcenter=1;
+      if(fwhm2>0) dfwhm=(mCagliotiV+2*mCagliotiU*tantheta)*(1+tantheta*tantheta)/(4*fwhm);
+      if((eta0>0)&&(eta0<1)) deta=mPseudoVoigtEta1;
+      dasym=-cos(center)*(mAsym1+2*mAsym2/sin2theta)/(sin2theta*sin2theta);
+   }
+   else
+   {
+      const REAL *p=par->GetPointer();
+      if(p==&mCagliotiU)      {if(fwhm2>0) dfwhm=tantheta*tantheta/(2*fwhm);}
+      else if(p==&mCagliotiV) {if(fwhm2>0) dfwhm=tantheta/(2*fwhm);}
+      else if(p==&mCagliotiW) {if(fwhm2>0) dfwhm=1/(2*fwhm);}
+      else if(p==&mPseudoVoigtEta0) {if((eta0>0)&&(eta0<1)) deta=1;}
+      else if(p==&mPseudoVoigtEta1) {if((eta0>0)&&(eta0<1)) deta=center;}
+      else if(p==&mAsym0) dasym=1;
+      else if(p==&mAsym1) dasym=1/sin2theta;
+      else if(p==&mAsym2) dasym=1/(sin2theta*sin2theta);
+      else if(  (p!=&mAsymBerarBaldinozziA0)&&(p!=&mAsymBerarBaldinozziA1)
+              &&(p!=&mAsymBerarBaldinozziB0)&&(p!=&mAsymBerarBaldinozziB1))
+      {
+         VFN_DEBUG_EXIT("ReflectionProfilePseudoVoigt::GetProfileDeriv()",2)
+         return this->ReflectionProfile::GetProfileDeriv(x,center,h,k,l,par);
+      }
+   }
+   VFN_DEBUG_EXIT("ReflectionProfilePseudoVoigt::GetProfileDeriv()",2)
+   return PowderProfilePseudoVoigtDeriv(x,fwhm,fwhm,eta,center,asym,dfwhm,dfwhm,deta,dasym,dcenter);
+}
+
 void ReflectionProfilePseudoVoigt::SetProfilePar(const REAL fwhmCagliotiW,
                    const REAL fwhmCagliotiU,
                    const REAL fwhmCagliotiV,
@@ -363,6 +492,11 @@ void ReflectionProfilePseudoVoigt::XMLOutput(ostream &os,int indent)const
    this->GetPar(&mAsymBerarBaldinozziB1).XMLOutput(os,"AsymB1",indent);
    os <<endl;
    #endif
+   for(unsigned int i=0;i<this->GetNbOption();i++)
+   {
+      this->GetOption(i).XMLOutput(os,indent);
+      os <<endl<<endl;
+   }
    indent--;
    tag.SetIsEndTag(true);
    for(int i=0;i<indent;i++) os << "  " ;
@@ -489,6 +623,8 @@ mLorentzGammaHH(0),mLorentzGammaKK(0),mLorentzGammaLL(0),mLorentzGammaHK(0),mLor
 mPseudoVoigtEta0(0.5),mPseudoVoigtEta1(0),mAsym0(1.0),mAsym1(0),mAsym2(0)
 {
    this->InitParameters();
+   InitProfileComputationOption(mProfileComputation);
+   this->AddOption(&mProfileComputation);
 }
 
 ReflectionProfilePseudoVoigtAnisotropic::ReflectionProfilePseudoVoigtAnisotropic(const ReflectionProfilePseudoVoigtAnisotropic &old):
@@ -497,6 +633,9 @@ mLorentzGammaHH(old.mLorentzGammaHH),mLorentzGammaKK(old.mLorentzGammaKK),mLoren
 mPseudoVoigtEta0(old.mPseudoVoigtEta0),mPseudoVoigtEta1(old.mPseudoVoigtEta1),mAsym0(old.mAsym0),mAsym1(old.mAsym1),mAsym2(old.mAsym2)
 {
    this->InitParameters();
+   InitProfileComputationOption(mProfileComputation);
+   mProfileComputation.SetChoice(old.mProfileComputation.GetChoice());
+   this->AddOption(&mProfileComputation);
 }
 ReflectionProfilePseudoVoigtAnisotropic::~ReflectionProfilePseudoVoigtAnisotropic()
 {
@@ -538,6 +677,13 @@ CrystVector_REAL ReflectionProfilePseudoVoigtAnisotropic::GetProfile(const Cryst
    CrystVector_REAL profile(x.numElements()),tmpV(x.numElements());
    const REAL asym=mAsym0+mAsym1/sin(center)+mAsym2/pow((REAL)sin(center),(REAL)2.0);
    VFN_DEBUG_MESSAGE("ReflectionProfilePseudoVoigtAnisotropic::GetProfile():("<<int(h)<<","<<int(k)<<","<<int(l)<<"),fwhmG="<<fwhmG<<",fwhmL="<<fwhmL<<",gam="<<gam<<",asym="<<asym<<",center="<<center<<",eta="<<eta, 2)
+   const REAL maxError=GetProfileComputationMaxError(mProfileComputation);
+   if(maxError>0)
+   {
+      profile=PowderProfilePseudoVoigtTabulated(x,fwhmG,fwhmL,eta,center,asym,maxError);
+      VFN_DEBUG_EXIT("ReflectionProfilePseudoVoigtAnisotropic::GetProfile()",2)
+      return profile;
+   }
    if(fwhmG>0)
    {
       profile=PowderProfileGauss(x,fwhmG,center,asym);
@@ -555,6 +701,70 @@ CrystVector_REAL ReflectionProfilePseudoVoigtAnisotropic::GetProfile(const Cryst
    return profile;
 }
 
+CrystVector_REAL ReflectionProfilePseudoVoigtAnisotropic::GetProfileDeriv(const CrystVector_REAL &x,
+                            const REAL center,const REAL h, const REAL k, const REAL l,
+                            RefinablePar *par)const
+{
+   VFN_DEBUG_ENTRY("ReflectionProfilePseudoVoigtAnisotropic::GetProfileDeriv()",2)
+   const REAL tantheta=tan(center/2.0);
+   const REAL costheta=cos(center/2.0);
+   const REAL sintheta=sin(center/2.0);
+   const REAL fwhmG2=mCagliotiW+mCagliotiV*tantheta+mCagliotiU*tantheta*tantheta+mScherrerP/(costheta*costheta);
+   const REAL fwhmG=sqrt(abs(fwhmG2));
+   const REAL gam=mLorentzGammaHH*h*h+mLorentzGammaKK*k*k+mLorentzGammaLL*l*l+2*mLorentzGammaHK*h*k+2*mLorentzGammaHL*h*l+2*mLorentzGammaKL*k*l;
+   const REAL fwhmL= mLorentzX/costheta+(mLorentzY+gam/(sintheta*sintheta))*tantheta;
+   const REAL sin2theta=sin(center);
+   const REAL asym=mAsym0+mAsym1/sin2theta+mAsym2/(sin2theta*sin2theta);
+   const REAL eta0=mPseudoVoigtEta0+center*mPseudoVoigtEta1;
+   REAL eta=eta0;
+   if(eta>1) eta=1;
+   if(eta<0) eta=0;
+   // d(fwhmG)/d(fwhmG^2), taking into account the absolute value
+   const REAL dfwhmG_dfwhmG2=(fwhmG>0)?((fwhmG2>0)?1:-1)/(2*fwhmG):0;
+   // Derivatives of fwhmG, fwhmL, eta and asym
+   REAL dfwhmG=0,dfwhmL=0,deta=0,dasym=0,dcenter=0;
+   if(par==0)
+   {// d/d(2theta)=1/2*d/dtheta
+      dcenter=1;
+      dfwhmG=dfwhmG_dfwhmG2*( (mCagliotiV+2*mCagliotiU*tantheta)*(1+tantheta*tantheta)/2
+                             +mScherrerP*tantheta/(costheta*costheta));
+      // gam*tan(theta)/sin^2(theta)=gam/(sin(theta)cos(theta))
+      dfwhmL= mLorentzX*tantheta/costheta/2+mLorentzY*(1+tantheta*tantheta)/2
+             -gam*(costheta*costheta-sintheta*sintheta)/(2*pow(sintheta*costheta,(REAL)2));
+      if((eta0>0)&&(eta0<1)) deta=mPseudoVoigtEta1;
+      dasym=-cos(center)*(mAsym1+2*mAsym2/sin2theta)/(sin2theta*sin2theta);
+   }
+   else
+   {
+      const REAL *p=par->GetPointer();
+      const REAL dgam=tantheta/(sintheta*sintheta);
+      if(p==&mCagliotiU)            dfwhmG=dfwhmG_dfwhmG2*tantheta*tantheta;
+      else if(p==&mCagliotiV)       dfwhmG=dfwhmG_dfwhmG2*tantheta;
+      else if(p==&mCagliotiW)       dfwhmG=dfwhmG_dfwhmG2;
+      else if(p==&mScherrerP)       dfwhmG=dfwhmG_dfwhmG2/(costheta*costheta);
+      else if(p==&mLorentzX)        dfwhmL=1/costheta;
+      else if(p==&mLorentzY)        dfwhmL=tantheta;
+      else if(p==&mLorentzGammaHH)  dfwhmL=h*h*dgam;
+      else if(p==&mLorentzGammaKK)  dfwhmL=k*k*dgam;
+      else if(p==&mLorentzGammaLL)  dfwhmL=l*l*dgam;
+      else if(p==&mLorentzGammaHK)  dfwhmL=2*h*k*dgam;
+      else if(p==&mLorentzGammaHL)  dfwhmL=2*h*l*dgam;
+      else if(p==&mLorentzGammaKL)  dfwhmL=2*k*l*dgam;
+      else if(p==&mPseudoVoigtEta0) {if((eta0>0)&&(eta0<1)) deta=1;}
+      else if(p==&mPseudoVoigtEta1) {if((eta0>0)&&(eta0<1)) deta=center;}
+      else if(p==&mAsym0) dasym=1;
+      else if(p==&mAsym1) dasym=1/sin2theta;
+      else if(p==&mAsym2) dasym=1/(sin2theta*sin2theta);
+      else
+      {
+         VFN_DEBUG_EXIT("ReflectionProfilePseudoVoigtAnisotropic::GetProfileDeriv()",2)
+         return this->ReflectionProfile::GetProfileDeriv(x,center,h,k,l,par);
+      }
+   }
+   VFN_DEBUG_EXIT("ReflectionProfilePseudoVoigtAnisotropic::GetProfileDeriv()",2)
+   return PowderProfilePseudoVoigtDeriv(x,fwhmG,fwhmL,eta,center,asym,dfwhmG,dfwhmL,deta,dasym,dcenter);
+}
+
 void ReflectionProfilePseudoVoigtAnisotropic::SetProfilePar(const REAL fwhmCagliotiW,
                    const REAL fwhmCagliotiU,
                    const REAL fwhmCagliotiV,
@@ -702,6 +912,11 @@ void ReflectionProfilePseudoVoigtAnisotropic::XMLOutput(ostream &os,int indent)c
 
    this->GetPar(&mAsym2).XMLOutput(os,"Asym2",indent);
    os <<endl;
+   for(unsigned int i=0;i<this->GetNbOption();i++)
+   {
+      this->GetOption(i).XMLOutput(os,indent);
+      os <<endl<<endl;
+   }
    indent--;
    tag.SetIsEndTag(true);
    for(int i=0;i<indent;i++) os << "  " ;
@@ -1156,6 +1371,110 @@ CrystVector_REAL ReflectionProfileDoubleExponentialPseudoVoigt
    return prof;
 }
 
+CrystVector_REAL ReflectionProfileDoubleExponentialPseudoVoigt
+   ::GetProfileDeriv(const CrystVector_REAL &x, const REAL center,
+                     const REAL h, const REAL k, const REAL l, RefinablePar *par)const
+{
+   VFN_DEBUG_ENTRY("ReflectionProfileDoubleExponentialPseudoVoigt::GetProfileDeriv()",4)
+   REAL dcenter=0;
+   if(mpCell!=0)
+   {
+      REAL hh=h,kk=k,ll=l;// orthonormal coordinates in reciprocal space
+      mpCell->MillerToOrthonormalCoords(hh,kk,ll);
+      dcenter=1.0/sqrt(hh*hh+kk*kk+ll*ll);//d_hkl, in Angstroems
+   }
+   const REAL alpha=mInstrumentAlpha0+mInstrumentAlpha1/dcenter;
+   const REAL beta=mInstrumentBeta0+mInstrumentBeta1/pow(dcenter,4);
+   const REAL siggauss2= mGaussianSigma0
+                        +mGaussianSigma1*pow(dcenter,2)
+                        +mGaussianSigma2*pow(dcenter,4);
+   static const REAL log2=log(2.0);
+   const REAL hg=sqrt(8*siggauss2*log2);
+   const REAL hl= mLorentzianGamma0
+                 +mLorentzianGamma1*dcenter
+                 +mLorentzianGamma2*dcenter*dcenter;
+   const REAL hcom=pow(pow(hg,5)+2.69269*pow(hg,4)*hl+2.42843*pow(hg,3)*hl*hl
+                       +4.47163*hg*hg*pow(hl,3)+0.07842*hg*pow(hl,4)+pow(hl,5),0.2);
+   const REAL sigcom2=hcom*hcom/(8.0*log2);
+   const REAL eta=1.36603*hl/hcom-0.47719*pow(hl/hcom,2)+0.11116*pow(hl/hcom,3);
+   // Derivatives of alpha, beta, hg, hl versus the parameter, and of the profile
+   // versus the position of the center. Other parameters do not depend on the center.
+   REAL dalpha=0,dbeta=0,dhg=0,dhl=0,dcen=0;
+   if(par==0) dcen=1;
+   else
+   {
+      const REAL *p=par->GetPointer();
+      if(p==&mInstrumentAlpha0)      dalpha=1;
+      else if(p==&mInstrumentAlpha1) dalpha=1/dcenter;
+      else if(p==&mInstrumentBeta0)  dbeta=1;
+      else if(p==&mInstrumentBeta1)  dbeta=1/pow(dcenter,4);
+      else if(p==&mLorentzianGamma0) dhl=1;
+      else if(p==&mLorentzianGamma1) dhl=dcenter;
+      else if(p==&mLorentzianGamma2) dhl=dcenter*dcenter;
+      else if((hg>0)&&(p==&mGaussianSigma0)) dhg=4*log2/hg;
+      else if((hg>0)&&(p==&mGaussianSigma1)) dhg=4*log2/hg*pow(dcenter,2);
+      else if((hg>0)&&(p==&mGaussianSigma2)) dhg=4*log2/hg*pow(dcenter,4);
+      else
+      {
+         VFN_DEBUG_EXIT("ReflectionProfileDoubleExponentialPseudoVoigt::GetProfileDeriv()",4)
+         return this->ReflectionProfile::GetProfileDeriv(x,center,h,k,l,par);
+      }
+   }
+   // Chain rule through hcom=(sum of hg^n*hl^(5-n))^(1/5) and eta(hl/hcom)
+   const REAL hcom5=pow(hcom,5);
+   const REAL dhcom_dhg=hcom/(5*hcom5)*( 5*pow(hg,4)+4*2.69269*pow(hg,3)*hl+3*2.42843*hg*hg*hl*hl
+                                         +2*4.47163*hg*pow(hl,3)+0.07842*pow(hl,4));
+   const REAL dhcom_dhl=hcom/(5*hcom5)*( 2.69269*pow(hg,4)+2*2.42843*pow(hg,3)*hl+3*4.47163*hg*hg*hl*hl
+                                         +4*0.07842*hg*pow(hl,3)+5*pow(hl,4));
+   const REAL dhcom=dhcom_dhg*dhg+dhcom_dhl*dhl;
+   const REAL r=hl/hcom;
+   const REAL deta=(1.36603-2*0.47719*r+3*0.11116*r*r)*(dhl-r*dhcom)/hcom;
+   const REAL dsigcom2=hcom*dhcom/(4.0*log2);
+
+   const REAL a=alpha*beta/(2*(alpha+beta)),b=alpha*beta/(M_PI*(alpha+beta));
+   const REAL da=a*(dalpha*beta/alpha+dbeta*alpha/beta)/(alpha+beta);
+   const REAL db=2*da/M_PI;
+   const long nbPoints=x.numElements();
+   CrystVector_REAL deriv;
+   deriv=x;
+   deriv+=-center;
+   REAL *pp=deriv.data();
+   for(long i=0;i<nbPoints;i++)
+   {
+      const double t=*pp;
+      const double u=alpha/2*(alpha*sigcom2+2*t);
+      const double nu=beta/2*(beta *sigcom2-2*t);
+      const double y=(alpha*sigcom2+t)/sqrt(2*sigcom2);
+      const double z=(beta *sigcom2-t)/sqrt(2*sigcom2);
+      const complex<double> p(alpha*t,alpha*hcom/2);
+      const complex<double> q(-beta*t, beta*hcom/2);
+      const complex<double> e1p=ExponentialIntegral1_ExpZ(p);
+      const complex<double> e1q=ExponentialIntegral1_ExpZ(q);
+      REAL expnu_erfcz,expu_erfcy;
+      if(z>10.0) expnu_erfcz=exp(nu-z*z)/(z*sqrt(M_PI));
+      else expnu_erfcz=exp(nu)*erfc(z);
+      if(y>10.0) expu_erfcy=exp(u-y*y)/(y*sqrt(M_PI));
+      else expu_erfcy=exp(u)*erfc(y);
+      // exp(u-y^2)=exp(nu-z^2)=exp(-t^2/(2*sigcom2)) ; d[exp(p)E1(p)]/dp=exp(p)E1(p)-1/p
+      const double g=exp(-t*t/(2*sigcom2));
+      const complex<double> de1p=e1p-1.0/p,de1q=e1q-1.0/q;
+      // Derivatives of the Gaussian (exp*erfc) and Lorentzian (E1) sums
+      const double dgauss= (alpha*sigcom2+t)*expu_erfcy*dalpha
+                          +(beta *sigcom2-t)*expnu_erfcz*dbeta
+                          -sqrt(2*sigcom2/M_PI)*g*(dalpha+dbeta)
+                          +((alpha*alpha*expu_erfcy+beta*beta*expnu_erfcz)/2
+                            -g*(alpha+beta)/sqrt(2*M_PI*sigcom2))*dsigcom2
+                          -(alpha*expu_erfcy-beta*expnu_erfcz)*dcen;
+      const complex<double> dlorentz= de1p*(p/(double)alpha*(double)dalpha+complex<double>(-alpha*dcen,alpha*dhcom/2))
+                                     +de1q*(q/(double)beta *(double)dbeta +complex<double>( beta *dcen,beta *dhcom/2));
+      *pp++= (1-eta)*(a*dgauss+da*(expu_erfcy+expnu_erfcz))
+            -eta*(b*dlorentz.imag()+db*(e1p.imag()+e1q.imag()))
+            -deta*(a*(expu_erfcy+expnu_erfcz)+b*(e1p.imag()+e1q.imag()));
+   }
+   VFN_DEBUG_EXIT("ReflectionProfileDoubleExponentialPseudoVoigt::GetProfileDeriv()",4)
+   return deriv;
+}
+
 void ReflectionProfileDoubleExponentialPseudoVoigt
    ::SetProfilePar(const REAL instrumentAlpha0,
                    const REAL instrumentAlpha1,
@@ -1458,8 +1777,7 @@ CrystVector_REAL PowderProfileGauss  (const CrystVector_REAL ttheta,const REAL f
    for(;i>3;i-=4)
    {
      #ifdef HAVE_SSE_MATHFUN
-     v4sf x=_mm_loadu_ps(p);
-     _mm_storeu_ps(p,exp_ps(x));
+     Exp4(p);
      p+=4;
      #else
      for(unsigned int j=0;j<4;++j)
@@ -1534,6 +1852,163 @@ CrystVector_REAL PowderProfileLorentz(const CrystVector_REAL ttheta,const REAL f
    return result;
 }
 
+/// Tabulated normalized Gaussian and Lorentzian shapes, for PowderProfilePseudoVoigtTabulated()
+struct PseudoVoigtTable
+{
+   /// The maximum interpolation error
+   REAL mMaxError;
+   /// The step of the tables, in units of the half width at half maximum, and its inverse
+   REAL mStep,mInvStep;
+   /// exp(-ln(2)*t^2) and 1/(1+t^2), for t=i*mStep
+   std::vector<REAL> mvGauss,mvLorentz;
+};
+
+/** Get the tables for a given maximum error. With linear interpolation the error is
+* smaller than step^2/8*max(|f''|), with max(|f''|)=2 for the Lorentzian and 2*ln(2)
+* for the Gaussian. Beyond the end of the tables the Gaussian is negligible,
+* and the Lorentzian is computed exactly.
+*/
+static const PseudoVoigtTable& GetPseudoVoigtTable(const REAL maxError)
+{
+   static std::list<PseudoVoigtTable> vTable;
+   const PseudoVoigtTable *pTable=0;
+   #ifdef _OPENMP
+   #pragma omp critical(ObjCryst_PseudoVoigtTable)
+   #endif
+   {
+      for(std::list<PseudoVoigtTable>::const_iterator pos=vTable.begin();pos!=vTable.end();++pos)
+         if(pos->mMaxError==maxError) {pTable=&(*pos);break;}
+      if(pTable==0)
+      {
+         PseudoVoigtTable table;
+         table.mMaxError=maxError;
+         table.mStep=1.6*sqrt(maxError);
+         table.mInvStep=1/table.mStep;
+         REAL tmax=sqrt(-log(maxError*0.01)/log(2.));
+         if(tmax<16) tmax=16;
+         const long nb=(long)(tmax*table.mInvStep)+2;
+         table.mvGauss.resize(nb);
+         table.mvLorentz.resize(nb);
+         for(long i=0;i<nb;i++)
+         {
+            const REAL t=i*table.mStep;
+            table.mvGauss[i]=exp(-log(2.)*t*t);
+            table.mvLorentz[i]=1/(1+t*t);
+         }
+         vTable.push_back(table);
+         pTable=&(vTable.back());
+      }
+   }
+   return *pTable;
+}
+
+CrystVector_REAL PowderProfilePseudoVoigtTabulated(const CrystVector_REAL &x,
+                                                   const REAL fwhmG, const REAL fwhmL,
+                                                   const REAL eta, const REAL center,
+                                                   const REAL asym, const REAL maxError)
+{
+   TAU_PROFILE("PowderProfilePseudoVoigtTabulated()","Vector (Vector,REAL)",TAU_DEFAULT);
+   const PseudoVoigtTable *pTable=&GetPseudoVoigtTable(maxError);
+   const long nbPoints=x.numElements();
+   CrystVector_REAL result(nbPoints);
+   result=0;
+   const long nbTable=pTable->mvGauss.size()-1;
+   const REAL *pGauss=&(pTable->mvGauss[0]);
+   const REAL *pLorentz=&(pTable->mvLorentz[0]);
+   // Same normalization and asymmetry as PowderProfileGauss() and PowderProfileLorentz()
+   for(unsigned int component=0;component<2;component++)
+   {
+      const REAL fwhm=(component==0)?fwhmG:fwhmL;
+      const REAL weight=(component==0)?1-eta:eta;
+      if((fwhm<=0)||(weight<=0)) continue;
+      const REAL norm=weight*((component==0)?2./fwhm*sqrt(log(2.)/M_PI):2./M_PI/fwhm);
+      const REAL *pTab=(component==0)?pGauss:pLorentz;
+      // Scale from the distance to the center to the table index, below & above center
+      const REAL c1=(1.+asym)/asym/fwhm*pTable->mInvStep;
+      const REAL c2=(1.+asym)/fwhm*pTable->mInvStep;
+      const REAL *px=x.data();
+      REAL *p=result.data();
+      bool below=true;
+      for(long i=0;i<nbPoints;i++)
+      {
+         const REAL dx=*px++ - center;
+         const REAL u=abs(dx*(below?c1:c2));
+         if(dx>0) below=false;// The first point above the center still uses c1, as in PowderProfileGauss()
+         const long j=(long)u;
+         if(j<nbTable)
+         {
+            const REAL f=u-j;
+            *p++ += norm*(pTab[j]+f*(pTab[j+1]-pTab[j]));
+         }
+         else
+         {// Beyond the table: Gaussian is negligible, Lorentzian is computed
+            if(component==1)
+            {
+               const REAL t=u*pTable->mStep;
+               *p += norm/(1+t*t);
+            }
+            p++;
+         }
+      }
+   }
+   return result;
+}
+
+CrystVector_REAL PowderProfilePseudoVoigtDeriv(const CrystVector_REAL &x,
+                                               const REAL fwhmG, const REAL fwhmL,
+                                               const REAL eta, const REAL center, const REAL asym,
+                                               const REAL dfwhmG, const REAL dfwhmL,
+                                               const REAL deta, const REAL dasym,
+                                               const REAL dcenter)
+{
+   TAU_PROFILE("PowderProfilePseudoVoigtDeriv()","Vector (Vector,REAL)",TAU_DEFAULT);
+   const long nbPoints=x.numElements();
+   CrystVector_REAL result(nbPoints);
+   result=0;
+   static const REAL log2=log(2.);
+   for(unsigned int component=0;component<2;component++)
+   {
+      const REAL fwhm=(component==0)?fwhmG:fwhmL;
+      if(fwhm<=0) continue;
+      const REAL weight=(component==0)?1-eta:eta;
+      const REAL dweight=(component==0)?-deta:deta;
+      const REAL dfwhm=(component==0)?dfwhmG:dfwhmL;
+      const REAL norm=(component==0)?2./fwhm*sqrt(log2/M_PI):2./M_PI/fwhm;
+      // Scale from the distance to the center to the reduced coordinate u, below & above center,
+      // and derivatives of these scales versus asym
+      const REAL c1=(1.+asym)/asym/fwhm,dc1=-1/(asym*asym)/fwhm;
+      const REAL c2=(1.+asym)/fwhm,dc2=1/fwhm;
+      const REAL *px=x.data();
+      REAL *p=result.data();
+      bool below=true;
+      for(long i=0;i<nbPoints;i++)
+      {
+         const REAL dx=*px++ - center;
+         const REAL c=below?c1:c2;
+         const REAL dc=below?dc1:dc2;
+         if(dx>0) below=false;// The first point above the center still uses c1, as in PowderProfileGauss()
+         const REAL u=dx*c;
+         // Profile S(u) and dS/du
+         REAL prof,dprof_du;
+         if(component==0)
+         {
+            prof=norm*exp(-log2*u*u);
+            dprof_du=-2*log2*u*prof;
+         }
+         else
+         {
+            prof=norm/(1+u*u);
+            dprof_du=-2*u*prof/(1+u*u);
+         }
+         // dS/dfwhm=-(S+u*dS/du)/fwhm ; du/dasym=dx*dc ; du/dcenter=-c
+         *p++ += weight*( -(prof+u*dprof_du)/fwhm*dfwhm
+                         +dprof_du*(dx*dc*dasym-c*dcenter))
+                 +dweight*prof;
+      }
+   }
+   return result;
+}
+
 CrystVector_REAL AsymmetryBerarBaldinozzi(const CrystVector_REAL x,
                                           const REAL fw, const REAL center,
                                           const REAL a0, const REAL a1,
@@ -41,6 +41,35 @@ CrystVector_REAL PowderProfileGauss  (const CrystVector_REAL theta,
 ///function is in theta=center. If asymmetry is used, negative tth values must be first.
 CrystVector_REAL PowderProfileLorentz(const CrystVector_REAL theta,
                                       const REAL fwhm, const REAL center, const REAL asym=1.0);
+/** Pseudo-Voigt profile (1-eta)*Gauss+eta*Lorentz, normalized, computed by linear interpolation
+* of the Gaussian and Lorentzian shapes tabulated (in units of the FWHM) on a fine grid.
+*
+* The tables are computed once for each maxError value, and shared by all profiles.
+* \param fwhmG,fwhmL: the FWHM of the Gaussian and of the Lorentzian. If one is <=0,
+* the corresponding component is ignored.
+* \param asym: Toraya asymmetry coefficient (see PowderProfileGauss()), which is
+* applied exactly by scaling the distance to the center before interpolation.
+* \param maxError: the maximum interpolation error, relative to the maximum of the profile.
+*/
+CrystVector_REAL PowderProfilePseudoVoigtTabulated(const CrystVector_REAL &x,
+                                                   const REAL fwhmG, const REAL fwhmL,
+                                                   const REAL eta, const REAL center,
+                                                   const REAL asym, const REAL maxError);
+/** Derivative of the asymmetric pseudo-Voigt profile (1-eta)*Gauss+eta*Lorentz, as computed
+* by PowderProfileGauss() and PowderProfileLorentz(), given the derivatives of its
+* parameters (versus a refined parameter or the reflection position).
+*
+* \param fwhmG,fwhmL: the FWHM of the Gaussian and of the Lorentzian. If one is <=0,
+* the corresponding component is ignored.
+* \param dfwhmG,dfwhmL,deta,dasym: derivatives of fwhmG, fwhmL, eta and asym.
+* \param dcenter: derivative of the center (1 for the derivative versus the center, else 0).
+*/
+CrystVector_REAL PowderProfilePseudoVoigtDeriv(const CrystVector_REAL &x,
+                                               const REAL fwhmG, const REAL fwhmL,
+                                               const REAL eta, const REAL center, const REAL asym,
+                                               const REAL dfwhmG, const REAL dfwhmL,
+                                               const REAL deta, const REAL dasym,
+                                               const REAL dcenter);
 /// Asymmetry function [Ref J. Appl. Cryst 26 (1993), 128-129
 CrystVector_REAL AsymmetryBerarBaldinozzi(const CrystVector_REAL theta,
                                           const REAL fwhm, const REAL center,
@@ -79,6 +108,15 @@ class ReflectionProfile:public RefinableObj
       */
       virtual CrystVector_REAL GetProfile(const CrystVector_REAL &x, const REAL xcenter,
                                   const REAL h, const REAL k, const REAL l)const=0;
+      /** Get the derivative of the reflection profile, versus one of the refinable
+      * parameters of this profile, or versus the position of the center (if par==0).
+      *
+      * The default implementation uses finite differences (with the derivative step
+      * of the parameter). Derived classes compute analytical derivatives when possible.
+      */
+      virtual CrystVector_REAL GetProfileDeriv(const CrystVector_REAL &x, const REAL xcenter,
+                                               const REAL h, const REAL k, const REAL l,
+                                               RefinablePar *par=0)const;
       /// Get the (approximate) full profile width at a given percentage
       /// of the profile maximum (e.g. FWHM=GetFullProfileWidth(0.5)).
       virtual REAL GetFullProfileWidth(const REAL relativeIntensity, const REAL xcenter,
@@ -107,6 +145,9 @@ class ReflectionProfilePseudoVoigt:public ReflectionProfile
       virtual const string& GetClassName()const;
       CrystVector_REAL GetProfile(const CrystVector_REAL &x, const REAL xcenter,
                                   const REAL h, const REAL k, const REAL l)const;
+      virtual CrystVector_REAL GetProfileDeriv(const CrystVector_REAL &x, const REAL xcenter,
+                                               const REAL h, const REAL k, const REAL l,
+                                               RefinablePar *par=0)const;
       /** Set reflection profile parameters
       *
       * \param fwhmCagliotiW,fwhmCagliotiU,fwhmCagliotiV : these are the U,V and W
@@ -151,6 +192,9 @@ class ReflectionProfilePseudoVoigt:public ReflectionProfile
       * \f[ Prof(\vartheta-\vartheta_{max}>=0)=Prof_0((1+A)         (\vartheta-\vartheta_{max})) \f]
       */
       REAL mAsym0,mAsym1,mAsym2;
+      /// Compute profiles exactly, or by interpolation in tabulated Gaussian and Lorentzian
+      /// functions (faster, with a maximum relative error of 1e-3, 1e-4 or 1e-5).
+      RefObjOpt mProfileComputation;
 #ifdef __WX__CRYST__
    public:
       virtual WXCrystObjBasic* WXCreate(wxWindow* parent);
@@ -170,6 +214,9 @@ class ReflectionProfilePseudoVoigtAnisotropic:public ReflectionProfile
       virtual const string& GetClassName()const;
       CrystVector_REAL GetProfile(const CrystVector_REAL &x, const REAL xcenter,
                                   const REAL h, const REAL k, const REAL l)const;
+      virtual CrystVector_REAL GetProfileDeriv(const CrystVector_REAL &x, const REAL xcenter,
+                                               const REAL h, const REAL k, const REAL l,
+                                               RefinablePar *par=0)const;
       /** Set reflection profile parameters
        *
        * if only W is given, the width is constant
@@ -240,6 +287,9 @@ class ReflectionProfilePseudoVoigtAnisotropic:public ReflectionProfile
        * \f[ Prof(\vartheta-\vartheta_{max}>=0)=Prof_0((1+A)         (\vartheta-\vartheta_{max})) \f]
        */
       REAL mAsym0,mAsym1,mAsym2;
+      /// Compute profiles exactly, or by interpolation in tabulated Gaussian and Lorentzian
+      /// functions (faster, with a maximum relative error of 1e-3, 1e-4 or 1e-5).
+      RefObjOpt mProfileComputation;
    #ifdef __WX__CRYST__
    public:
       virtual WXCrystObjBasic* WXCreate(wxWindow* parent);
@@ -266,6 +316,9 @@ class ReflectionProfileDoubleExponentialPseudoVoigt:public ReflectionProfile
       virtual const string& GetClassName()const;
       CrystVector_REAL GetProfile(const CrystVector_REAL &x, const REAL xcenter,
                                   const REAL h, const REAL k, const REAL l)const;
+      virtual CrystVector_REAL GetProfileDeriv(const CrystVector_REAL &x, const REAL xcenter,
+                                               const REAL h, const REAL k, const REAL l,
+                                               RefinablePar *par=0)const;
       /** Set reflection profile parameters
       *
       */
@@ -105,6 +105,13 @@ REAL Scatterer::GetY()    const {return mXYZ(1);}
 REAL Scatterer::GetZ()    const {return mXYZ(2);}
 REAL Scatterer::GetOccupancy() const {return mOccupancy;}
 
+bool Scatterer::GetScatteringComponentListDeriv(const RefinablePar &par,
+                                                CrystVector_REAL &dx, CrystVector_REAL &dy,
+                                                CrystVector_REAL &dz, CrystVector_REAL &docc)const
+{
+   return false;
+}
+
 
 void Scatterer::SetX(const REAL x) { this->GetPar(mXYZ.data()).MutateTo(x);}
 void Scatterer::SetY(const REAL y) { this->GetPar(mXYZ.data()+1).MutateTo(y);}
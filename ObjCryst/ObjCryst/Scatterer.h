@@ -160,6 +160,17 @@ class Scatterer:virtual public RefinableObj
       ///
       /// \bug does not take into account dummy atoms !!
       virtual string GetComponentName(const int i) const=0;
+      /** Get the derivatives of the fractional coordinates and occupancy of all
+      * scattering components (see GetScatteringComponentList()) versus one
+      * refinable parameter of this scatterer.
+      *
+      * \return true if the derivatives were computed analytically, false if this is
+      * not possible (e.g. this parameter does not belong to this scatterer), in which
+      * case they must be computed numerically. The default implementation returns false.
+      */
+      virtual bool GetScatteringComponentListDeriv(const RefinablePar &par,
+                                                   CrystVector_REAL &dx, CrystVector_REAL &dy,
+                                                   CrystVector_REAL &dz, CrystVector_REAL &docc)const;
 
       /// X coordinate (fractionnal) of the scatterer (for complex scatterers,
       /// this corresponds to the position of one atom of the Scatterer, ideally
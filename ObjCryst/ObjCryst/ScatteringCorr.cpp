@@ -430,7 +430,7 @@ void TextureMarchDollase::GlobalOptRandomMove(const REAL mutationAmplitude,
       mRandomMoveIsDone=true;
       return;
    }
-   //if((rand()/(REAL)RAND_MAX)<.3)//only 30% proba to make a random move
+   //if((ObjCrystRand()/(REAL)RAND_MAX)<.3)//only 30% proba to make a random move
    {
       VFN_DEBUG_MESSAGE("TextureMarchDollase::GlobalOptRandomMove()",1)
       for(unsigned int i=0;i<this->GetNbPhase();i++)
@@ -453,7 +453,7 @@ void TextureMarchDollase::GlobalOptRandomMove(const REAL mutationAmplitude,
 
             ymax=.5+1/M_PI*atan((y+delta-y0)/(2.*sig));
             ymin=.5+1/M_PI*atan((y-delta-y0)/(2.*sig));
-            y=ymin+rand()/(REAL)RAND_MAX*(ymax-ymin);
+            y=ymin+ObjCrystRand()/(REAL)RAND_MAX*(ymax-ymin);
             y-=.5;
             if(y<-.499)y=-.499;//Should not happen but make sure we remain in [-pi/2;pi/2]
             if(y> .499)y= .499;
@@ -476,7 +476,7 @@ void TextureMarchDollase::GlobalOptRandomMove(const REAL mutationAmplitude,
 
                ymax=.5+1/M_PI*atan((tx+delta-tx0)/(2.*sig));
                ymin=.5+1/M_PI*atan((tx-delta-tx0)/(2.*sig));
-               y=ymin+rand()/(REAL)RAND_MAX*(ymax-ymin);
+               y=ymin+ObjCrystRand()/(REAL)RAND_MAX*(ymax-ymin);
                y-=.5;
                if(y<-.499)y=-.499;
                if(y> .499)y= .499;
@@ -484,7 +484,7 @@ void TextureMarchDollase::GlobalOptRandomMove(const REAL mutationAmplitude,
 
                ymax=.5+1/M_PI*atan((ty+delta-ty0)/(2.*sig));
                ymin=.5+1/M_PI*atan((ty-delta-ty0)/(2.*sig));
-               y=ymin+rand()/(REAL)RAND_MAX*(ymax-ymin);
+               y=ymin+ObjCrystRand()/(REAL)RAND_MAX*(ymax-ymin);
                y-=.5;
                if(y<-.499)y=-.499;
                if(y> .499)y= .499;
@@ -492,7 +492,7 @@ void TextureMarchDollase::GlobalOptRandomMove(const REAL mutationAmplitude,
 
                ymax=.5+1/M_PI*atan((tz+delta-tz0)/(2.*sig));
                ymin=.5+1/M_PI*atan((tz-delta-tz0)/(2.*sig));
-               y=ymin+rand()/(REAL)RAND_MAX*(ymax-ymin);
+               y=ymin+ObjCrystRand()/(REAL)RAND_MAX*(ymax-ymin);
                y-=.5;
                if(y<-.499)y=-.499;
                if(y> .499)y= .499;
@@ -518,7 +518,7 @@ void TextureMarchDollase::GlobalOptRandomMove(const REAL mutationAmplitude,
 
             ymin=.5+1/M_PI*atan((y-delta-y0)/(2.*sig));
             ymax=.5+1/M_PI*atan((y+delta-y0)/(2.*sig));
-            y=ymin+rand()/(REAL)RAND_MAX*(ymax-ymin);
+            y=ymin+ObjCrystRand()/(REAL)RAND_MAX*(ymax-ymin);
                y-=.5;
                if(y<-.499)y=-.499;
                if(y> .499)y= .499;
@@ -810,7 +810,7 @@ void TextureEllipsoid::GlobalOptRandomMove(const REAL mutationAmplitude,
       {
          pEPR[i] = &(this->GetPar(&(mEPR[i])));
          if (pEPR[i]->IsFixed()==false)
-            pEPR[i]->Mutate(pEPR[i]->GetGlobalOptimStep()*2*(rand()/(REAL)RAND_MAX-0.5)*mutationAmplitude);
+            pEPR[i]->Mutate(pEPR[i]->GetGlobalOptimStep()*2*(ObjCrystRand()/(REAL)RAND_MAX-0.5)*mutationAmplitude);
       }
       UpdateEllipsoidPar();
    }
@@ -46,6 +46,10 @@
 
 #ifdef HAVE_SSE_MATHFUN
 #include "ObjCryst/Quirks/sse_mathfun.h"
+#include "ObjCryst/Quirks/sse_mathfun_pd.h"
+#ifdef __AVX2__
+#include "ObjCryst/Quirks/avx_mathfun.h"
+#endif
 #endif
 
 #define POSSIBLY_UNUSED(expr) (void)(expr)
@@ -75,6 +79,261 @@ const RefParType *gpRefParTypeRadiationWavelength=0;
 
 long NiftyStaticGlobalObjectsInitializer_ScatteringData::mCount=0;
 
+#ifdef HAVE_SSE_MATHFUN
+//######################################################################
+//    SIMD kernels for the geometrical structure factor computation.
+//These are overloaded for float and double, so that the vectorized code is
+//used whatever the REAL type.
+//######################################################################
+/** \internal Add popu*cos(2pi(hx+ky+lz)) to rsf and popu*sin(2pi(hx+ky+lz)) to isf,
+* for nb reflections. hh, kk and ll are the H,K,L coordinates multiplied by 2pi.
+* If isf==0 (centrosymmetric structures), only the real part is computed.
+*/
+inline void GeomSFAdd(const float *hh,const float *kk,const float *ll,
+                      const float x,const float y,const float z,const float popu,
+                      float *rsf,float *isf,const long nb)
+{
+   const v4sf v4x=_mm_load1_ps(&x);
+   const v4sf v4y=_mm_load1_ps(&y);
+   const v4sf v4z=_mm_load1_ps(&z);
+   const v4sf v4popu=_mm_load1_ps(&popu);// Can't multiply directly a vector by a scalar ?
+   #ifdef __AVX2__
+   const v8sf v8x=_mm256_set1_ps(x);
+   const v8sf v8y=_mm256_set1_ps(y);
+   const v8sf v8z=_mm256_set1_ps(z);
+   const v8sf v8popu=_mm256_set1_ps(popu);
+   #endif
+   long jj=nb;
+   if(isf!=0)
+   {
+      #ifdef __AVX2__
+      for(;jj>7;jj-=8)
+      {
+         v8sf v8sin,v8cos;
+         sincos256_ps(avx_madd_ps(_mm256_loadu_ps(ll),v8z,
+                                     avx_madd_ps(_mm256_loadu_ps(kk),v8y,
+                                                    _mm256_mul_ps(_mm256_loadu_ps(hh),v8x))),
+                      &v8sin,&v8cos);
+         _mm256_storeu_ps(rsf,avx_madd_ps(v8cos,v8popu,_mm256_loadu_ps(rsf)));
+         _mm256_storeu_ps(isf,avx_madd_ps(v8sin,v8popu,_mm256_loadu_ps(isf)));
+         hh+=8;kk+=8;ll+=8;rsf+=8;isf+=8;
+      }
+      #endif
+      for(;jj>3;jj-=4)
+      {
+         v4sf v4sin,v4cos;
+         sincos_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(hh),v4x),
+                                         _mm_mul_ps(_mm_loadu_ps(kk),v4y)
+                                       ),
+                              _mm_mul_ps(_mm_loadu_ps(ll),v4z)
+                              ),&v4sin,&v4cos);// A bit faster
+         _mm_storeu_ps(rsf,_mm_add_ps(_mm_mul_ps(v4cos,v4popu),_mm_loadu_ps(rsf)));
+         _mm_storeu_ps(isf,_mm_add_ps(_mm_mul_ps(v4sin,v4popu),_mm_loadu_ps(isf)));
+
+         hh+=4;kk+=4;ll+=4;rsf+=4;isf+=4;
+      }
+      for(;jj>0;jj--)
+      {
+        const float tmp = *hh++ * x + *kk++ * y + *ll++ *z;
+        *rsf++ += popu * cos(tmp);
+        *isf++ += popu * sin(tmp);
+      }
+   }
+   else
+   {
+      #ifdef __AVX2__
+      for(;jj>7;jj-=8)
+      {
+         const v8sf v8cos=cos256_ps(avx_madd_ps(_mm256_loadu_ps(ll),v8z,
+                                                   avx_madd_ps(_mm256_loadu_ps(kk),v8y,
+                                                                  _mm256_mul_ps(_mm256_loadu_ps(hh),v8x))));
+         _mm256_storeu_ps(rsf,avx_madd_ps(v8cos,v8popu,_mm256_loadu_ps(rsf)));
+         hh+=8;kk+=8;ll+=8;rsf+=8;
+      }
+      #endif
+      for(;jj>3;jj-=4)
+      {
+         const v4sf v4cos=cos_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(hh),v4x),
+                                            _mm_mul_ps(_mm_loadu_ps(kk),v4y)
+                                       ),
+                              _mm_mul_ps(_mm_loadu_ps(ll),v4z)));
+         _mm_storeu_ps(rsf,_mm_add_ps(_mm_loadu_ps(rsf),_mm_mul_ps(v4cos,v4popu)));
+         hh+=4;kk+=4;ll+=4;rsf+=4;
+      }
+      for(;jj>0;jj--)
+      {
+        const float tmp = *hh++ * x + *kk++ * y + *ll++ *z;
+        *rsf++ += popu * cos(tmp);
+      }
+   }
+}
+
+inline void GeomSFAdd(const double *hh,const double *kk,const double *ll,
+                      const double x,const double y,const double z,const double popu,
+                      double *rsf,double *isf,const long nb)
+{
+   const v2df v2x=_mm_set1_pd(x);
+   const v2df v2y=_mm_set1_pd(y);
+   const v2df v2z=_mm_set1_pd(z);
+   const v2df v2popu=_mm_set1_pd(popu);
+   #ifdef __AVX2__
+   const v4df v4x=_mm256_set1_pd(x);
+   const v4df v4y=_mm256_set1_pd(y);
+   const v4df v4z=_mm256_set1_pd(z);
+   const v4df v4popu=_mm256_set1_pd(popu);
+   #endif
+   long jj=nb;
+   if(isf!=0)
+   {
+      #ifdef __AVX2__
+      for(;jj>3;jj-=4)
+      {
+         v4df v4sin,v4cos;
+         sincos256_pd(avx_madd_pd(_mm256_loadu_pd(ll),v4z,
+                                     avx_madd_pd(_mm256_loadu_pd(kk),v4y,
+                                                    _mm256_mul_pd(_mm256_loadu_pd(hh),v4x))),
+                      &v4sin,&v4cos);
+         _mm256_storeu_pd(rsf,avx_madd_pd(v4cos,v4popu,_mm256_loadu_pd(rsf)));
+         _mm256_storeu_pd(isf,avx_madd_pd(v4sin,v4popu,_mm256_loadu_pd(isf)));
+         hh+=4;kk+=4;ll+=4;rsf+=4;isf+=4;
+      }
+      #endif
+      for(;jj>1;jj-=2)
+      {
+         v2df v2sin,v2cos;
+         sincos_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(_mm_loadu_pd(hh),v2x),
+                                         _mm_mul_pd(_mm_loadu_pd(kk),v2y)),
+                              _mm_mul_pd(_mm_loadu_pd(ll),v2z)),&v2sin,&v2cos);
+         _mm_storeu_pd(rsf,_mm_add_pd(_mm_mul_pd(v2cos,v2popu),_mm_loadu_pd(rsf)));
+         _mm_storeu_pd(isf,_mm_add_pd(_mm_mul_pd(v2sin,v2popu),_mm_loadu_pd(isf)));
+         hh+=2;kk+=2;ll+=2;rsf+=2;isf+=2;
+      }
+      for(;jj>0;jj--)
+      {
+        const double tmp = *hh++ * x + *kk++ * y + *ll++ *z;
+        *rsf++ += popu * cos(tmp);
+        *isf++ += popu * sin(tmp);
+      }
+   }
+   else
+   {
+      #ifdef __AVX2__
+      for(;jj>3;jj-=4)
+      {
+         const v4df v4cos=cos256_pd(avx_madd_pd(_mm256_loadu_pd(ll),v4z,
+                                                   avx_madd_pd(_mm256_loadu_pd(kk),v4y,
+                                                                  _mm256_mul_pd(_mm256_loadu_pd(hh),v4x))));
+         _mm256_storeu_pd(rsf,avx_madd_pd(v4cos,v4popu,_mm256_loadu_pd(rsf)));
+         hh+=4;kk+=4;ll+=4;rsf+=4;
+      }
+      #endif
+      for(;jj>1;jj-=2)
+      {
+         const v2df v2cos=cos_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(_mm_loadu_pd(hh),v2x),
+                                                       _mm_mul_pd(_mm_loadu_pd(kk),v2y)),
+                                            _mm_mul_pd(_mm_loadu_pd(ll),v2z)));
+         _mm_storeu_pd(rsf,_mm_add_pd(_mm_loadu_pd(rsf),_mm_mul_pd(v2cos,v2popu)));
+         hh+=2;kk+=2;ll+=2;rsf+=2;
+      }
+      for(;jj>0;jj--)
+      {
+        const double tmp = *hh++ * x + *kk++ * y + *ll++ *z;
+        *rsf++ += popu * cos(tmp);
+      }
+   }
+}
+
+/** \internal Compute pc=cos(2pi(hx+ky+lz)) and ps=sin(2pi(hx+ky+lz)) for nb reflections.
+* hh, kk and ll are the H,K,L coordinates multiplied by 2pi.
+*/
+inline void GeomSFCosSin(const float *hh,const float *kk,const float *ll,
+                         const float x,const float y,const float z,
+                         float *pc,float *ps,const long nb)
+{
+   long jj=nb;
+   #ifdef __AVX2__
+   const v8sf v8x=_mm256_set1_ps(x);
+   const v8sf v8y=_mm256_set1_ps(y);
+   const v8sf v8z=_mm256_set1_ps(z);
+   for(;jj>7;jj-=8)
+   {
+      v8sf v8sin,v8cos;
+      sincos256_ps(avx_madd_ps(_mm256_loadu_ps(ll),v8z,
+                                  avx_madd_ps(_mm256_loadu_ps(kk),v8y,
+                                                 _mm256_mul_ps(_mm256_loadu_ps(hh),v8x))),
+                   &v8sin,&v8cos);
+      _mm256_storeu_ps(pc,v8cos);
+      _mm256_storeu_ps(ps,v8sin);
+      hh+=8;kk+=8;ll+=8;pc+=8;ps+=8;
+   }
+   #endif
+   const v4sf v4x=_mm_load1_ps(&x);
+   const v4sf v4y=_mm_load1_ps(&y);
+   const v4sf v4z=_mm_load1_ps(&z);
+   for(;jj>3;jj-=4)
+   {
+       v4sf v4sin,v4cos;
+       sincos_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(hh),v4x),
+                                       _mm_mul_ps(_mm_loadu_ps(kk),v4y)
+                                      ),
+                            _mm_mul_ps(_mm_loadu_ps(ll),v4z)
+                           ),&v4sin,&v4cos);
+       _mm_storeu_ps(pc,v4cos);
+       _mm_storeu_ps(ps,v4sin);
+
+       hh+=4;kk+=4;ll+=4;pc+=4;ps+=4;
+   }
+   for(;jj>0;jj--)
+   {
+      const float tmp = *hh++ * x + *kk++ * y + *ll++ *z;
+      *pc++ =cos(tmp);
+      *ps++ =sin(tmp);
+   }
+}
+
+inline void GeomSFCosSin(const double *hh,const double *kk,const double *ll,
+                         const double x,const double y,const double z,
+                         double *pc,double *ps,const long nb)
+{
+   long jj=nb;
+   #ifdef __AVX2__
+   const v4df v4x=_mm256_set1_pd(x);
+   const v4df v4y=_mm256_set1_pd(y);
+   const v4df v4z=_mm256_set1_pd(z);
+   for(;jj>3;jj-=4)
+   {
+      v4df v4sin,v4cos;
+      sincos256_pd(avx_madd_pd(_mm256_loadu_pd(ll),v4z,
+                                  avx_madd_pd(_mm256_loadu_pd(kk),v4y,
+                                                 _mm256_mul_pd(_mm256_loadu_pd(hh),v4x))),
+                   &v4sin,&v4cos);
+      _mm256_storeu_pd(pc,v4cos);
+      _mm256_storeu_pd(ps,v4sin);
+      hh+=4;kk+=4;ll+=4;pc+=4;ps+=4;
+   }
+   #endif
+   const v2df v2x=_mm_set1_pd(x);
+   const v2df v2y=_mm_set1_pd(y);
+   const v2df v2z=_mm_set1_pd(z);
+   for(;jj>1;jj-=2)
+   {
+      v2df v2sin,v2cos;
+      sincos_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(_mm_loadu_pd(hh),v2x),
+                                      _mm_mul_pd(_mm_loadu_pd(kk),v2y)),
+                           _mm_mul_pd(_mm_loadu_pd(ll),v2z)),&v2sin,&v2cos);
+      _mm_storeu_pd(pc,v2cos);
+      _mm_storeu_pd(ps,v2sin);
+      hh+=2;kk+=2;ll+=2;pc+=2;ps+=2;
+   }
+   for(;jj>0;jj--)
+   {
+      const double tmp = *hh++ * x + *kk++ * y + *ll++ *z;
+      *pc++ =cos(tmp);
+      *ps++ =sin(tmp);
+   }
+}
+#endif
+
 #ifndef HAVE_SSE_MATHFUN
 //######################################################################
 //    Tabulated math functions for faster (&less precise) F(hkl) calculation
@@ -881,6 +1140,7 @@ void ScatteringData::BeginOptimization(const bool allowApproximations,
    if(mUseFastLessPreciseFunc!=allowApproximations)
    {
       mClockGeomStructFact.Reset();
+      mClockGeomSFPartial.Reset();
       mClockStructFactor.Reset();
       mClockMaster.Click();
    }
@@ -894,6 +1154,7 @@ void ScatteringData::EndOptimization()
       if(mUseFastLessPreciseFunc==true)
       {
          mClockGeomStructFact.Reset();
+         mClockGeomSFPartial.Reset();
          mClockStructFactor.Reset();
          mClockMaster.Click();
       }
@@ -907,6 +1168,7 @@ void ScatteringData::SetApproximationFlag(const bool allow)
    if(mUseFastLessPreciseFunc!=allow)
    {
       mClockGeomStructFact.Reset();
+      mClockGeomSFPartial.Reset();
       mClockStructFactor.Reset();
       mClockMaster.Click();
    }
@@ -1504,8 +1766,15 @@ void ScatteringData::CalcStructFactor_FullDeriv(std::set<RefinablePar *> &vPar)
    for(std::set<RefinablePar*>::iterator par=vPar.begin();par!=vPar.end();++par)
    {
       if(*par==0) continue;
+      if((*par)->GetType()->IsDescendantFromOrSameAs(gpRefParTypeScattPowTemperatureIso))
+      {// Isotropic temperature factors: d[exp(-B*stol^2)]/dB = -stol^2*exp(-B*stol^2)
+         this->CalcStructFactorBisoDeriv(**par);
+         continue;
+      }
       if((*par)->GetType()->IsDescendantFromOrSameAs(gpRefParTypeScatt)==false)
-      {//:TODO: allow derivatives from other parameters (ML, temperature factors, etc..)
+      {//:TODO: allow derivatives from other parameters (ML, etc..)
+       // Anisotropic displacement parameters are not used for the temperature factor,
+       // so their derivatives are null.
          // No derivatives -> empty vectors
          mFhklCalcReal_FullDeriv[*par].resize(0);
          mFhklCalcImag_FullDeriv[*par].resize(0);
@@ -1675,12 +1944,7 @@ void ScatteringData::CalcGeomStructFactor() const
       const int nbTranslationVectors=pSpg->GetNbTranslationVectors();
       const long nbComp=pScattCompList->GetNbComponent();
       const std::vector<SpaceGroup::TRx> *pTransVect=&(pSpg->GetTranslationVectors());
-      CrystMatrix_REAL allCoords(nbSymmetrics,3);
       CrystVector_REAL tmpVect(mNbReflUsed);
-      #ifndef HAVE_SSE_MATHFUN
-      const int nbRefl=this->GetNbRefl();
-      CrystVector_long intVect(nbRefl);//not used if mUseFastLessPreciseFunc==false
-      #endif
       // which scattering powers are actually used ?
       map<const ScatteringPower*,bool> vUsed;
       // Add existing previously used scattering power to the test;
@@ -1716,20 +1980,100 @@ void ScatteringData::CalcGeomStructFactor() const
          }
       }
 
+      // The partial geometrical structure factors of each Scatterer only need to be
+      // recomputed if its scattering components changed, unless the list of reflections
+      // or the spacegroup changed.
+      if(  (mClockGeomSFPartial<mClockHKL)
+         ||(mClockGeomSFPartial<mClockNbReflUsed)
+         ||(mClockGeomSFPartial<pSpg->GetClockSpaceGroup())) mvGeomSFPartial.clear();
+      // First component of each Scatterer in the Crystal's list
+      std::vector<const Scatterer*> vpScatt;
+      std::vector<long> vScattFirstComp;
+      {
+         long nb=0;
+         for(long s=0;s<mpCrystal->GetNbScatterer();s++)
+         {
+            vpScatt.push_back(&(mpCrystal->GetScatt(s)));
+            vScattFirstComp.push_back(nb);
+            nb+=mpCrystal->GetScatt(s).GetScatteringComponentList().GetNbComponent();
+         }
+         if(nb!=nbComp)
+         {// This should not happen - just use a single entry for the whole Crystal
+            vpScatt.assign(1,(const Scatterer*)0);
+            vScattFirstComp.assign(1,0);
+         }
+         vScattFirstComp.push_back(nbComp);
+      }
+      // Components for which the contribution must be computed
+      std::vector<long> vComp;
+      std::vector<REAL*> vpRealGeomSF,vpImagGeomSF;
+      std::set<const Scatterer*> vScattUsed;
+      for(unsigned long s=0;s<vpScatt.size();s++)
+      {
+         vScattUsed.insert(vpScatt[s]);
+         const long first=vScattFirstComp[s],last=vScattFirstComp[s+1];
+         GeomSFPartial *pPartial=&(mvGeomSFPartial[vpScatt[s]]);
+         bool changed=(pPartial->mScattCompList.GetNbComponent()!=(last-first))
+                      ||(pPartial->mvReal.size()==0);
+         for(long i=first;(i<last)&&(!changed);i++)
+         {
+            const ScatteringComponent *pOld=&(pPartial->mScattCompList(i-first));
+            if(  ((*pScattCompList)(i)!=*pOld)
+               ||((*pScattCompList)(i).mDynPopCorr!=pOld->mDynPopCorr)) changed=true;
+         }
+         if(!changed) continue;
+         pPartial->mScattCompList.Reset();
+         pPartial->mvReal.clear();
+         pPartial->mvImag.clear();
+         for(long i=first;i<last;i++)
+         {
+            pPartial->mScattCompList+=(*pScattCompList)(i);
+            const ScatteringPower *pScattPow=(*pScattCompList)(i).mpScattPow;
+            CrystVector_REAL *pReal=&(pPartial->mvReal[pScattPow]);
+            if(pReal->numElements()==mNbReflUsed) continue;
+            pReal->resize(mNbReflUsed);
+            *pReal=0;
+            if(false==pSpg->HasInversionCenter())
+            {
+               pPartial->mvImag[pScattPow].resize(mNbReflUsed);
+               pPartial->mvImag[pScattPow]=0;
+            }
+         }
+         for(long i=first;i<last;i++)
+         {
+            const ScatteringPower *pScattPow=(*pScattCompList)(i).mpScattPow;
+            vComp.push_back(i);
+            vpRealGeomSF.push_back(pPartial->mvReal[pScattPow].data());
+            if(false==pSpg->HasInversionCenter())
+               vpImagGeomSF.push_back(pPartial->mvImag[pScattPow].data());
+            else vpImagGeomSF.push_back(0);
+         }
+      }
+      // Forget Scatterers which have been removed from the Crystal
+      for(map<const Scatterer*,GeomSFPartial>::iterator pos=mvGeomSFPartial.begin();pos!=mvGeomSFPartial.end();)
+      {
+         if(vScattUsed.find(pos->first)==vScattUsed.end()) mvGeomSFPartial.erase(pos++);
+         else ++pos;
+      }
+      const long nbCompCalc=vComp.size();
+      VFN_DEBUG_MESSAGE("-->Number of Scattering Components to recompute :"<<nbCompCalc,2)
+
       REAL centrMult=1.0;
       if(true==pSpg->HasInversionCenter()) centrMult=2.0;
-      for(long i=0;i<nbComp;i++)
+      // Get all symmetrics positions and occupancies before looping over reflections,
+      // as this loop may be run in parallel
+      std::vector<CrystMatrix_REAL> vAllCoords(nbCompCalc);
+      std::vector<REAL> vPopu(nbCompCalc);
+      for(long i=0;i<nbCompCalc;i++)
       {
-         VFN_DEBUG_MESSAGE("ScatteringData::GeomStructFactor(),comp"<<i,3)
-         const REAL x=(*pScattCompList)(i).mX;
-         const REAL y=(*pScattCompList)(i).mY;
-         const REAL z=(*pScattCompList)(i).mZ;
-         const ScatteringPower *pScattPow=(*pScattCompList)(i).mpScattPow;
-         const REAL popu= (*pScattCompList)(i).mOccupancy
-                         *(*pScattCompList)(i).mDynPopCorr
-                         *centrMult;
-
-         allCoords=pSpg->GetAllSymmetrics(x,y,z,true,true);
+         VFN_DEBUG_MESSAGE("ScatteringData::GeomStructFactor(),comp"<<vComp[i],3)
+         const ScatteringComponent *pComp=&((*pScattCompList)(vComp[i]));
+         vPopu[i]= pComp->mOccupancy
+                  *pComp->mDynPopCorr
+                  *centrMult;
+
+         CrystMatrix_REAL *pAllCoords=&(vAllCoords[i]);
+         *pAllCoords=pSpg->GetAllSymmetrics(pComp->mX,pComp->mY,pComp->mZ,true,true);
          if((true==pSpg->HasInversionCenter()) && (false==pSpg->IsInversionCenterAtOrigin()))
          {
             const REAL STBF=2.*pSpg->GetCCTbxSpg().inv_t().den();
@@ -1737,237 +2081,222 @@ void ScatteringData::CalcGeomStructFactor() const
             {
                //The phase of the structure factor will be wrong
                //This is fixed a bit further...
-               allCoords(j,0) -= ((REAL)pSpg->GetCCTbxSpg().inv_t()[0])/STBF;
-               allCoords(j,1) -= ((REAL)pSpg->GetCCTbxSpg().inv_t()[1])/STBF;
-               allCoords(j,2) -= ((REAL)pSpg->GetCCTbxSpg().inv_t()[2])/STBF;
+               (*pAllCoords)(j,0) -= ((REAL)pSpg->GetCCTbxSpg().inv_t()[0])/STBF;
+               (*pAllCoords)(j,1) -= ((REAL)pSpg->GetCCTbxSpg().inv_t()[1])/STBF;
+               (*pAllCoords)(j,2) -= ((REAL)pSpg->GetCCTbxSpg().inv_t()[2])/STBF;
             }
          }
-         for(int j=0;j<nbSymmetrics;j++)
+      }
+      // Reflections are split in contiguous blocks, one for each thread. Each block
+      // accumulates the contributions of all components in the same order as the serial
+      // calculation, so that the result does not depend on the number of threads.
+      long nbBlock=GetNbThread();
+      if(nbBlock>mNbReflUsed/256) nbBlock=mNbReflUsed/256;
+      if(nbBlock<1) nbBlock=1;
+      const long blockSize=(((mNbReflUsed+nbBlock-1)/nbBlock+3)/4)*4;
+      #ifdef _OPENMP
+      #pragma omp parallel for schedule(static) num_threads(nbBlock) if(nbBlock>1)
+      #endif
+      for(long iblock=0;iblock<nbBlock;iblock++)
+      {
+         const long first=iblock*blockSize;
+         const long nbRefl=(first+blockSize)>mNbReflUsed ? mNbReflUsed-first : blockSize;
+         if(nbRefl<=0) continue;
+         #ifndef HAVE_SSE_MATHFUN
+         CrystVector_long intVect(nbRefl);//not used if mUseFastLessPreciseFunc==false
+         CrystVector_REAL phase(nbRefl);
+         #endif
+         for(long i=0;i<nbCompCalc;i++)
          {
-            VFN_DEBUG_MESSAGE("ScatteringData::GeomStructFactor(),comp #"<<i<<", sym #"<<j,3)
-
-            #ifndef HAVE_SSE_MATHFUN
-            if(mUseFastLessPreciseFunc==true)
+            const REAL popu=vPopu[i];
+            const CrystMatrix_REAL &allCoords=vAllCoords[i];
+            for(int j=0;j<nbSymmetrics;j++)
             {
-               REAL * RESTRICT rrsf=mvRealGeomSF[pScattPow].data();
-               REAL * RESTRICT iisf=mvImagGeomSF[pScattPow].data();
-
-               const long intX=(long)(allCoords(j,0)*sLibCrystNbTabulSine);
-               const long intY=(long)(allCoords(j,1)*sLibCrystNbTabulSine);
-               const long intZ=(long)(allCoords(j,2)*sLibCrystNbTabulSine);
-
-               const long * RESTRICT intH=mIntH.data();
-               const long * RESTRICT intK=mIntK.data();
-               const long * RESTRICT intL=mIntL.data();
-
-               long * RESTRICT tmpInt=intVect.data();
-               // :KLUDGE: using a AND to bring back within [0;sLibCrystNbTabulSine[ may
-               // not be portable, depending on the model used to represent signed integers
-               // a test should be added to throw up in that case.
-               //
-               // This work if we are using "2's complement" to represent negative numbers,
-               // but not with a "sign magnitude" approach
-               for(int jj=mNbReflUsed;jj>0;jj--)
-                *tmpInt++ = (*intH++ * intX + *intK++ * intY + *intL++ *intZ)
-                              &sLibCrystNbTabulSineMASK;
-               if(false==pSpg->HasInversionCenter())
-               {
+               VFN_DEBUG_MESSAGE("ScatteringData::GeomStructFactor(),comp #"<<i<<", sym #"<<j,3)
 
-                  tmpInt=intVect.data();
-                  for(int jj=mNbReflUsed;jj>0;jj--)
-                  {
-                     const REAL *pTmp=&spLibCrystTabulCosineSine[*tmpInt++ <<1];
-                     *rrsf++ += popu * *pTmp++;
-                     *iisf++ += popu * *pTmp;
-                  }
-
-               }
-               else
+               #ifndef HAVE_SSE_MATHFUN
+               if(mUseFastLessPreciseFunc==true)
                {
-                  tmpInt=intVect.data();
-                  for(int jj=mNbReflUsed;jj>0;jj--)
-                     *rrsf++ += popu * spLibCrystTabulCosine[*tmpInt++];
-               }
-            }
-            else
-            #endif
-            {
-               const REAL x=allCoords(j,0);
-               const REAL y=allCoords(j,1);
-               const REAL z=allCoords(j,2);
-               const REAL *hh=mH2Pi.data();
-               const REAL *kk=mK2Pi.data();
-               const REAL *ll=mL2Pi.data();
+                  REAL * RESTRICT rrsf=vpRealGeomSF[i]+first;
+                  REAL * RESTRICT iisf=vpImagGeomSF[i]+first;
+
+                  const long intX=(long)(allCoords(j,0)*sLibCrystNbTabulSine);
+                  const long intY=(long)(allCoords(j,1)*sLibCrystNbTabulSine);
+                  const long intZ=(long)(allCoords(j,2)*sLibCrystNbTabulSine);
+
+                  const long * RESTRICT intH=mIntH.data()+first;
+                  const long * RESTRICT intK=mIntK.data()+first;
+                  const long * RESTRICT intL=mIntL.data()+first;
+
+                  long * RESTRICT tmpInt=intVect.data();
+                  // :KLUDGE: using a AND to bring back within [0;sLibCrystNbTabulSine[ may
+                  // not be portable, depending on the model used to represent signed integers
+                  // a test should be added to throw up in that case.
+                  //
+                  // This work if we are using "2's complement" to represent negative numbers,
+                  // but not with a "sign magnitude" approach
+                  for(int jj=nbRefl;jj>0;jj--)
+                   *tmpInt++ = (*intH++ * intX + *intK++ * intY + *intL++ *intZ)
+                                 &sLibCrystNbTabulSineMASK;
+                  if(false==pSpg->HasInversionCenter())
+                  {
 
-               #ifdef HAVE_SSE_MATHFUN
-               #if 0
-               // This not much faster and is incorrect (does not take into account sign of h k l)
+                     tmpInt=intVect.data();
+                     for(int jj=nbRefl;jj>0;jj--)
+                     {
+                        const REAL *pTmp=&spLibCrystTabulCosineSine[*tmpInt++ <<1];
+                        *rrsf++ += popu * *pTmp++;
+                        *iisf++ += popu * *pTmp;
+                     }
 
-               //cout<<__FILE__<<":"<<__LINE__<<":"<<mMaxHKL<<","<<mMaxH<<","<<mMaxK<<","<<mMaxL<<":"<<mNbReflUsed<<endl;
-               // cos&sin for 2pix 2piy 2piz
-               static const float twopi=6.283185307179586f;
-               sincos_ps(_mm_mul_ps(_mm_load1_ps(&twopi),_mm_set_ps(x,y,z,0)),cnxyz0,snxyz0);
-               // harmonics: cos&sin for 2npix 2npiy 2npiz
-               for(long k=1;k<mMaxHKL;k++)
-               {
-                  cnxyz0[k]=_mm_sub_ps(_mm_mul_ps(cnxyz0[k-1],cnxyz0[0]),_mm_mul_ps(snxyz0[k-1],snxyz0[0]));//cos((n+1)x)=cos(nx)cos(x)-sin(nx)sinx
-                  snxyz0[k]=_mm_add_ps(_mm_mul_ps(snxyz0[k-1],cnxyz0[0]),_mm_mul_ps(cnxyz0[k-1],snxyz0[0]));//sin((n+1)x)=sin(nx)cos(x)+cos(nx)sinx
-               }
-               //
-               for(long k=0;k<4;++k){*(pcnxyz0+k)=1.0f;*(psnxyz0+k)=0.0f;}
-               for(long k=1;k<mMaxHKL;k++)
-               {
-                  _mm_store_ps(pcnxyz0+4*k,cnxyz0[k-1]);
-                  _mm_store_ps(psnxyz0+4*k,snxyz0[k-1]);
-               }
-               // Actual structure factor calculations
-               if(false==pSpg->HasInversionCenter())
-               {// Slow ?
-                  REAL *rsf=mvRealGeomSF[pScattPow].data();
-                  REAL *isf=mvImagGeomSF[pScattPow].data();
-                  const long *h=mIntH.data();
-                  const long *k=mIntK.data();
-                  const long *l=mIntL.data();
-                  int jj;
-                  const v4sf v4popu=_mm_set1_ps(popu);
-                  for(jj=mNbReflUsed;jj>3;jj-=4)
-                  {
-                     //cout<<__FILE__<<":"<<__LINE__<<":"<<mNbReflUsed<<","<<jj<<"("<<*h<<','<<*k<<","<<*l<<")"<<endl;
-                     const v4sf ck=_mm_set_ps(pcnxyz0[(*(k))*4+1],pcnxyz0[(*(k+1))*4+1],pcnxyz0[(*(k+2))*4+1],pcnxyz0[(*(k+3))*4+1]);//cos 2pi kx =ck
-                     const v4sf cl=_mm_set_ps(pcnxyz0[(*(l))*4+1],pcnxyz0[(*(l+1))*4+1],pcnxyz0[(*(l+2))*4+1],pcnxyz0[(*(l+3))*4+1]);//cos 2pi lz =cl
-                     const v4sf sk=_mm_set_ps(psnxyz0[(*(k))*4+1],psnxyz0[(*(k+1))*4+1],psnxyz0[(*(k+2))*4+1],psnxyz0[(*(k+3))*4+1]);//sin 2pi kx =sk
-                     const v4sf sl=_mm_set_ps(psnxyz0[(*(l))*4+1],psnxyz0[(*(l+1))*4+1],psnxyz0[(*(l+2))*4+1],psnxyz0[(*(l+3))*4+1]);//sin 2pi lz =sl
-                     #define CH _mm_set_ps(pcnxyz0[*(h)*4],pcnxyz0[*(h+1)*4],pcnxyz0[*(h+2)*4],pcnxyz0[*(h+3)*4])
-                     #define SH _mm_set_ps(psnxyz0[*(h)*4],psnxyz0[*(h+1)*4],psnxyz0[*(h+2)*4],psnxyz0[*(h+3)*4])
-                     //                           popu *(                    ch*(                      ck*cl    -        sk*sl)         -    sh*(                     ck*sl + sk*cl))
-                     _mm_store_ps(rsf,_mm_mul_ps(v4popu,_mm_sub_ps(_mm_mul_ps(CH,_mm_sub_ps(_mm_mul_ps(ck,cl),_mm_mul_ps(sk,sl))),_mm_mul_ps(SH,_mm_add_ps(_mm_mul_ps(ck,sl),_mm_mul_ps(sk,cl))))));
-                     //                           popu *(                    sh*(                      ck*cl    -        sk*sl)         +    ch*(                     ck*sl + sk*cl))
-                     _mm_store_ps(isf,_mm_mul_ps(v4popu,_mm_add_ps(_mm_mul_ps(SH,_mm_sub_ps(_mm_mul_ps(ck,cl),_mm_mul_ps(sk,sl))),_mm_mul_ps(CH,_mm_add_ps(_mm_mul_ps(ck,sl),_mm_mul_ps(sk,cl))))));
-                     rsf+=4;isf+=4;h+=4;k+=4,l+=4;
                   }
-                  for(;jj>0;jj--)
+                  else
                   {
-                     const float ch=pcnxyz0[*h   *4];
-                     const float sh=psnxyz0[*h++ *4];
-                     const float ck=pcnxyz0[*k   *4+1];
-                     const float sk=psnxyz0[*k++ *4+1];
-                     const float cl=pcnxyz0[*l   *4+2];
-                     const float sl=psnxyz0[*l++ *4+2];
-                     *rsf++ += popu*(ch*(ck*cl-sk*sl)-sh*(sk*cl+ck*sl));
-                     *isf++ += popu*(sh*(ck*cl-sk*sl)+ch*(sk*cl+ck*sl));
+                     tmpInt=intVect.data();
+                     for(int jj=nbRefl;jj>0;jj--)
+                        *rrsf++ += popu * spLibCrystTabulCosine[*tmpInt++];
                   }
                }
                else
+               #endif
                {
-                  REAL *rsf=mvRealGeomSF[pScattPow].data();
-                  const long *h=mIntH.data();
-                  const long *k=mIntK.data();
-                  const long *l=mIntL.data();
-                  int jj;
-                  const v4sf v4popu=_mm_set1_ps(popu);
-                  for(jj=mNbReflUsed;jj>3;jj-=4)
+                  const REAL x=allCoords(j,0);
+                  const REAL y=allCoords(j,1);
+                  const REAL z=allCoords(j,2);
+                  const REAL *hh=mH2Pi.data()+first;
+                  const REAL *kk=mK2Pi.data()+first;
+                  const REAL *ll=mL2Pi.data()+first;
+
+                  #ifdef HAVE_SSE_MATHFUN
+                  #if 0
+                  // This not much faster and is incorrect (does not take into account sign of h k l)
+
+                  //cout<<__FILE__<<":"<<__LINE__<<":"<<mMaxHKL<<","<<mMaxH<<","<<mMaxK<<","<<mMaxL<<":"<<nbRefl<<endl;
+                  // cos&sin for 2pix 2piy 2piz
+                  static const float twopi=6.283185307179586f;
+                  sincos_ps(_mm_mul_ps(_mm_load1_ps(&twopi),_mm_set_ps(x,y,z,0)),cnxyz0,snxyz0);
+                  // harmonics: cos&sin for 2npix 2npiy 2npiz
+                  for(long k=1;k<mMaxHKL;k++)
                   {
-                     //cout<<__FILE__<<":"<<__LINE__<<":"<<mNbReflUsed<<","<<jj<<"("<<*h<<','<<*k<<","<<*l<<")"<<endl;
-                     const v4sf ck=_mm_set_ps(pcnxyz0[(*(k))*4+1],pcnxyz0[(*(k+1))*4+1],pcnxyz0[(*(k+2))*4+1],pcnxyz0[(*(k+3))*4+1]);//cos 2pi kx =ck
-                     const v4sf cl=_mm_set_ps(pcnxyz0[(*(l))*4+1],pcnxyz0[(*(l+1))*4+1],pcnxyz0[(*(l+2))*4+1],pcnxyz0[(*(l+3))*4+1]);//cos 2pi lz =cl
-                     const v4sf sk=_mm_set_ps(psnxyz0[(*(k))*4+1],psnxyz0[(*(k+1))*4+1],psnxyz0[(*(k+2))*4+1],psnxyz0[(*(k+3))*4+1]);//sin 2pi kx =sk
-                     const v4sf sl=_mm_set_ps(psnxyz0[(*(l))*4+1],psnxyz0[(*(l+1))*4+1],psnxyz0[(*(l+2))*4+1],psnxyz0[(*(l+3))*4+1]);//sin 2pi lz =sl
-                     #define CH _mm_set_ps(pcnxyz0[*(h)*4],pcnxyz0[*(h+1)*4],pcnxyz0[*(h+2)*4],pcnxyz0[*(h+3)*4])
-                     #define SH _mm_set_ps(psnxyz0[*(h)*4],psnxyz0[*(h+1)*4],psnxyz0[*(h+2)*4],psnxyz0[*(h+3)*4])
-                     //                           popu *(                    ch*(                      ck*cl    -        sk*sl)         -    sh*(                     ck*sl + sk*cl))
-                     _mm_store_ps(rsf,_mm_mul_ps(v4popu,_mm_sub_ps(_mm_mul_ps(CH,_mm_sub_ps(_mm_mul_ps(ck,cl),_mm_mul_ps(sk,sl))),_mm_mul_ps(SH,_mm_add_ps(_mm_mul_ps(ck,sl),_mm_mul_ps(sk,cl))))));
-                     rsf+=4;h+=4;k+=4,l+=4;
+                     cnxyz0[k]=_mm_sub_ps(_mm_mul_ps(cnxyz0[k-1],cnxyz0[0]),_mm_mul_ps(snxyz0[k-1],snxyz0[0]));//cos((n+1)x)=cos(nx)cos(x)-sin(nx)sinx
+                     snxyz0[k]=_mm_add_ps(_mm_mul_ps(snxyz0[k-1],cnxyz0[0]),_mm_mul_ps(cnxyz0[k-1],snxyz0[0]));//sin((n+1)x)=sin(nx)cos(x)+cos(nx)sinx
                   }
-                  for(;jj>0;jj--)
+                  //
+                  for(long k=0;k<4;++k){*(pcnxyz0+k)=1.0f;*(psnxyz0+k)=0.0f;}
+                  for(long k=1;k<mMaxHKL;k++)
                   {
-                     const float ch=pcnxyz0[*h   *4];
-                     const float sh=psnxyz0[*h++ *4];
-                     const float ck=pcnxyz0[*k   *4+1];
-                     const float sk=psnxyz0[*k++ *4+1];
-                     const float cl=pcnxyz0[*l   *4+2];
-                     const float sl=psnxyz0[*l++ *4+2];
-                     *rsf++ += popu*(ch*(ck*cl-sk*sl)-sh*(sk*cl+ck*sl));
+                     _mm_store_ps(pcnxyz0+4*k,cnxyz0[k-1]);
+                     _mm_store_ps(psnxyz0+4*k,snxyz0[k-1]);
                   }
-               }
-
-
-               #else
-               const v4sf v4x=_mm_load1_ps(&x);
-               const v4sf v4y=_mm_load1_ps(&y);
-               const v4sf v4z=_mm_load1_ps(&z);
-               const v4sf v4popu=_mm_load1_ps(&popu);// Can't multiply directly a vector by a scalar ?
-               if(false==pSpg->HasInversionCenter())
-               {
-                  REAL *rsf=mvRealGeomSF[pScattPow].data();
-                  REAL *isf=mvImagGeomSF[pScattPow].data();
-                  int jj=mNbReflUsed;
-                  for(;jj>3;jj-=4)
-                  {
-                      v4sf v4sin,v4cos;
-//                       sincos_ps(_mm_setr_ps(*(hh  )*x+ *(kk  )*y + *(ll  )*z,
-//                                             *(hh+1)*x+ *(kk+1)*y + *(ll+1)*z,
-//                                             *(hh+2)*x+ *(kk+2)*y + *(ll+2)*z,
-//                                             *(hh+3)*x+ *(kk+3)*y + *(ll+3)*z),&v4sin,&v4cos);
-                     sincos_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(hh),v4x),
-                                                     _mm_mul_ps(_mm_loadu_ps(kk),v4y)
-                                                   ),
-                                          _mm_mul_ps(_mm_loadu_ps(ll),v4z)
-                                          ),&v4sin,&v4cos);// A bit faster
-                     _mm_storeu_ps(rsf,_mm_add_ps(_mm_mul_ps(v4cos,v4popu),_mm_loadu_ps(rsf)));
-                     _mm_storeu_ps(isf,_mm_add_ps(_mm_mul_ps(v4sin,v4popu),_mm_loadu_ps(isf)));
-
-                     hh+=4;kk+=4;ll+=4;rsf+=4;isf+=4;
+                  // Actual structure factor calculations
+                  if(false==pSpg->HasInversionCenter())
+                  {// Slow ?
+                     REAL *rsf=vpRealGeomSF[i]+first;
+                     REAL *isf=vpImagGeomSF[i]+first;
+                     const long *h=mIntH.data()+first;
+                     const long *k=mIntK.data()+first;
+                     const long *l=mIntL.data()+first;
+                     int jj;
+                     const v4sf v4popu=_mm_set1_ps(popu);
+                     for(jj=nbRefl;jj>3;jj-=4)
+                     {
+                        //cout<<__FILE__<<":"<<__LINE__<<":"<<nbRefl<<","<<jj<<"("<<*h<<','<<*k<<","<<*l<<")"<<endl;
+                        const v4sf ck=_mm_set_ps(pcnxyz0[(*(k))*4+1],pcnxyz0[(*(k+1))*4+1],pcnxyz0[(*(k+2))*4+1],pcnxyz0[(*(k+3))*4+1]);//cos 2pi kx =ck
+                        const v4sf cl=_mm_set_ps(pcnxyz0[(*(l))*4+1],pcnxyz0[(*(l+1))*4+1],pcnxyz0[(*(l+2))*4+1],pcnxyz0[(*(l+3))*4+1]);//cos 2pi lz =cl
+                        const v4sf sk=_mm_set_ps(psnxyz0[(*(k))*4+1],psnxyz0[(*(k+1))*4+1],psnxyz0[(*(k+2))*4+1],psnxyz0[(*(k+3))*4+1]);//sin 2pi kx =sk
+                        const v4sf sl=_mm_set_ps(psnxyz0[(*(l))*4+1],psnxyz0[(*(l+1))*4+1],psnxyz0[(*(l+2))*4+1],psnxyz0[(*(l+3))*4+1]);//sin 2pi lz =sl
+                        #define CH _mm_set_ps(pcnxyz0[*(h)*4],pcnxyz0[*(h+1)*4],pcnxyz0[*(h+2)*4],pcnxyz0[*(h+3)*4])
+                        #define SH _mm_set_ps(psnxyz0[*(h)*4],psnxyz0[*(h+1)*4],psnxyz0[*(h+2)*4],psnxyz0[*(h+3)*4])
+                        //                           popu *(                    ch*(                      ck*cl    -        sk*sl)         -    sh*(                     ck*sl + sk*cl))
+                        _mm_store_ps(rsf,_mm_mul_ps(v4popu,_mm_sub_ps(_mm_mul_ps(CH,_mm_sub_ps(_mm_mul_ps(ck,cl),_mm_mul_ps(sk,sl))),_mm_mul_ps(SH,_mm_add_ps(_mm_mul_ps(ck,sl),_mm_mul_ps(sk,cl))))));
+                        //                           popu *(                    sh*(                      ck*cl    -        sk*sl)         +    ch*(                     ck*sl + sk*cl))
+                        _mm_store_ps(isf,_mm_mul_ps(v4popu,_mm_add_ps(_mm_mul_ps(SH,_mm_sub_ps(_mm_mul_ps(ck,cl),_mm_mul_ps(sk,sl))),_mm_mul_ps(CH,_mm_add_ps(_mm_mul_ps(ck,sl),_mm_mul_ps(sk,cl))))));
+                        rsf+=4;isf+=4;h+=4;k+=4,l+=4;
+                     }
+                     for(;jj>0;jj--)
+                     {
+                        const float ch=pcnxyz0[*h   *4];
+                        const float sh=psnxyz0[*h++ *4];
+                        const float ck=pcnxyz0[*k   *4+1];
+                        const float sk=psnxyz0[*k++ *4+1];
+                        const float cl=pcnxyz0[*l   *4+2];
+                        const float sl=psnxyz0[*l++ *4+2];
+                        *rsf++ += popu*(ch*(ck*cl-sk*sl)-sh*(sk*cl+ck*sl));
+                        *isf++ += popu*(sh*(ck*cl-sk*sl)+ch*(sk*cl+ck*sl));
+                     }
                   }
-                  for(;jj>0;jj--)
+                  else
                   {
-                    const REAL tmp = *hh++ * x + *kk++ * y + *ll++ *z;
-                    *rsf++ += popu * cos(tmp);
-                    *isf++ += popu * sin(tmp);
+                     REAL *rsf=vpRealGeomSF[i]+first;
+                     const long *h=mIntH.data()+first;
+                     const long *k=mIntK.data()+first;
+                     const long *l=mIntL.data()+first;
+                     int jj;
+                     const v4sf v4popu=_mm_set1_ps(popu);
+                     for(jj=nbRefl;jj>3;jj-=4)
+                     {
+                        //cout<<__FILE__<<":"<<__LINE__<<":"<<nbRefl<<","<<jj<<"("<<*h<<','<<*k<<","<<*l<<")"<<endl;
+                        const v4sf ck=_mm_set_ps(pcnxyz0[(*(k))*4+1],pcnxyz0[(*(k+1))*4+1],pcnxyz0[(*(k+2))*4+1],pcnxyz0[(*(k+3))*4+1]);//cos 2pi kx =ck
+                        const v4sf cl=_mm_set_ps(pcnxyz0[(*(l))*4+1],pcnxyz0[(*(l+1))*4+1],pcnxyz0[(*(l+2))*4+1],pcnxyz0[(*(l+3))*4+1]);//cos 2pi lz =cl
+                        const v4sf sk=_mm_set_ps(psnxyz0[(*(k))*4+1],psnxyz0[(*(k+1))*4+1],psnxyz0[(*(k+2))*4+1],psnxyz0[(*(k+3))*4+1]);//sin 2pi kx =sk
+                        const v4sf sl=_mm_set_ps(psnxyz0[(*(l))*4+1],psnxyz0[(*(l+1))*4+1],psnxyz0[(*(l+2))*4+1],psnxyz0[(*(l+3))*4+1]);//sin 2pi lz =sl
+                        #define CH _mm_set_ps(pcnxyz0[*(h)*4],pcnxyz0[*(h+1)*4],pcnxyz0[*(h+2)*4],pcnxyz0[*(h+3)*4])
+                        #define SH _mm_set_ps(psnxyz0[*(h)*4],psnxyz0[*(h+1)*4],psnxyz0[*(h+2)*4],psnxyz0[*(h+3)*4])
+                        //                           popu *(                    ch*(                      ck*cl    -        sk*sl)         -    sh*(                     ck*sl + sk*cl))
+                        _mm_store_ps(rsf,_mm_mul_ps(v4popu,_mm_sub_ps(_mm_mul_ps(CH,_mm_sub_ps(_mm_mul_ps(ck,cl),_mm_mul_ps(sk,sl))),_mm_mul_ps(SH,_mm_add_ps(_mm_mul_ps(ck,sl),_mm_mul_ps(sk,cl))))));
+                        rsf+=4;h+=4;k+=4,l+=4;
+                     }
+                     for(;jj>0;jj--)
+                     {
+                        const float ch=pcnxyz0[*h   *4];
+                        const float sh=psnxyz0[*h++ *4];
+                        const float ck=pcnxyz0[*k   *4+1];
+                        const float sk=psnxyz0[*k++ *4+1];
+                        const float cl=pcnxyz0[*l   *4+2];
+                        const float sl=psnxyz0[*l++ *4+2];
+                        *rsf++ += popu*(ch*(ck*cl-sk*sl)-sh*(sk*cl+ck*sl));
+                     }
                   }
-               }
-               else
-               {
-                  REAL *rsf=mvRealGeomSF[pScattPow].data();
-                  int jj=mNbReflUsed;
-                  for(;jj>3;jj-=4)
-                  {
-//                      const v4sf v4cos=cos_ps(_mm_setr_ps(*(hh  )*x+ *(kk  )*y + *(ll  )*z,
-//                                                           *(hh+1)*x+ *(kk+1)*y + *(ll+1)*z,
-//                                                           *(hh+2)*x+ *(kk+2)*y + *(ll+2)*z,
-//                                                           *(hh+3)*x+ *(kk+3)*y + *(ll+3)*z));
-                     const v4sf v4cos=cos_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(hh),v4x),
-                                                        _mm_mul_ps(_mm_loadu_ps(kk),v4y)
-                                                   ),
-                                          _mm_mul_ps(_mm_loadu_ps(ll),v4z)));
-                     _mm_storeu_ps(rsf,_mm_add_ps(_mm_loadu_ps(rsf),_mm_mul_ps(v4cos,v4popu)));
-                     hh+=4;kk+=4;ll+=4;rsf+=4;
-                  }
-                  for(;jj>0;jj--)
-                  {
-                    const REAL tmp = *hh++ * x + *kk++ * y + *ll++ *z;
-                    *rsf++ += popu * cos(tmp);
-                  }
-               }
-               #endif
-               #else
-               REAL *tmp=tmpVect.data();
-               for(int jj=0;jj<mNbReflUsed;jj++) *tmp++ = *hh++ * x + *kk++ * y + *ll++ *z;
 
-               REAL *sf=mvRealGeomSF[pScattPow].data();
-               tmp=tmpVect.data();
 
-               for(int jj=0;jj<mNbReflUsed;jj++) *sf++ += popu * cos(*tmp++);
+                  #else
+                  if(false==pSpg->HasInversionCenter())
+                     GeomSFAdd(hh,kk,ll,x,y,z,popu,vpRealGeomSF[i]+first,vpImagGeomSF[i]+first,nbRefl);
+                  else
+                     GeomSFAdd(hh,kk,ll,x,y,z,popu,vpRealGeomSF[i]+first,0,nbRefl);
+                  #endif
+                  #else
+                  REAL *tmp=phase.data();
+                  for(int jj=0;jj<nbRefl;jj++) *tmp++ = *hh++ * x + *kk++ * y + *ll++ *z;
 
-               if(false==pSpg->HasInversionCenter())
-               {
-                  sf=mvImagGeomSF[pScattPow].data();
-                  tmp=tmpVect.data();
-                  for(int jj=0;jj<mNbReflUsed;jj++) *sf++ += popu * sin(*tmp++);
+                  REAL *sf=vpRealGeomSF[i]+first;
+                  tmp=phase.data();
+
+                  for(int jj=0;jj<nbRefl;jj++) *sf++ += popu * cos(*tmp++);
+
+                  if(false==pSpg->HasInversionCenter())
+                  {
+                     sf=vpImagGeomSF[i]+first;
+                     tmp=phase.data();
+                     for(int jj=0;jj<nbRefl;jj++) *sf++ += popu * sin(*tmp++);
+                  }
+                  #endif
                }
-               #endif
             }
-         }
-      }//for all components...
+         }//for all components...
+      }//for all blocks of reflections
+      mClockGeomSFPartial.Click();
+      // Sum the partial structure factors of all Scatterers
+      for(map<const Scatterer*,GeomSFPartial>::const_iterator pos=mvGeomSFPartial.begin();
+          pos!=mvGeomSFPartial.end();++pos)
+      {
+         for(map<const ScatteringPower*,CrystVector_REAL>::const_iterator
+               posr=pos->second.mvReal.begin();posr!=pos->second.mvReal.end();++posr)
+            mvRealGeomSF[posr->first]+=posr->second;
+         for(map<const ScatteringPower*,CrystVector_REAL>::const_iterator
+               posi=pos->second.mvImag.begin();posi!=pos->second.mvImag.end();++posi)
+            mvImagGeomSF[posi->first]+=posi->second;
+      }
       if(nbTranslationVectors > 1)
       {
          tmpVect=1;
@@ -2053,6 +2382,65 @@ void ScatteringData::CalcGeomStructFactor() const
    mClockGeomStructFact.Click();
    VFN_DEBUG_EXIT("ScatteringData::GeomStructFactor(Vx,Vy,Vz,...)",3)
 }
+void ScatteringData::CalcStructFactorBisoDeriv(const RefinablePar &par)
+{
+   RefinablePar *pPar=const_cast<RefinablePar*>(&par);
+   mFhklCalcReal_FullDeriv[pPar].resize(0);
+   mFhklCalcImag_FullDeriv[pPar].resize(0);
+   const REAL *pStol=mSinThetaLambda.data();
+   if(par.GetPointer()==&mGlobalBiso)
+   {
+      CrystVector_REAL *pRd=&(mFhklCalcReal_FullDeriv[pPar]);
+      CrystVector_REAL *pId=&(mFhklCalcImag_FullDeriv[pPar]);
+      pRd->resize(mNbRefl);
+      pId->resize(mNbRefl);
+      *pRd=0;
+      *pId=0;
+      for(long j=0;j<mNbReflUsed;j++)
+      {
+         (*pRd)(j)=-pStol[j]*pStol[j]*mFhklCalcReal(j);
+         (*pId)(j)=-pStol[j]*pStol[j]*mFhklCalcImag(j);
+      }
+      return;
+   }
+   for(map<const ScatteringPower*,CrystVector_REAL>::const_iterator pos=mvRealGeomSF.begin();
+       pos!=mvRealGeomSF.end();++pos)
+   {
+      const ScatteringPower* pScattPow=pos->first;
+      bool found=false;
+      for(long k=0;k<pScattPow->GetNbPar();k++)
+         if(&(pScattPow->GetPar(k))==&par) {found=true;break;}
+      if(!found) continue;
+      CrystVector_REAL *pRd=&(mFhklCalcReal_FullDeriv[pPar]);
+      CrystVector_REAL *pId=&(mFhklCalcImag_FullDeriv[pPar]);
+      pRd->resize(mNbRefl);
+      pId->resize(mNbRefl);
+      *pRd=0;
+      *pId=0;
+      // Same as the contribution of this ScatteringPower in CalcStructFactor()
+      const REAL * RESTRICT pGeomR=mvRealGeomSF[pScattPow].data();
+      const REAL * RESTRICT pGeomI=mvImagGeomSF[pScattPow].data();
+      const REAL * RESTRICT pScatt=mvScatteringFactor[pScattPow].data();
+      const REAL * RESTRICT pTemp=mvTemperatureFactor[pScattPow].data();
+      const REAL * RESTRICT pLuzzati=0;
+      if(mvLuzzatiFactor[pScattPow].numElements()>0) pLuzzati=mvLuzzatiFactor[pScattPow].data();
+      const REAL * RESTRICT pGlobalTemp=0;
+      if(mGlobalTemperatureFactor.numElements()>0) pGlobalTemp=mGlobalTemperatureFactor.data();
+      const REAL fsecond=mIgnoreImagScattFact?0:mvFsecond[pScattPow];
+      REAL * RESTRICT pReal=pRd->data();
+      REAL * RESTRICT pImag=pId->data();
+      for(long j=0;j<mNbReflUsed;j++)
+      {
+         REAL f=-pStol[j]*pStol[j]*pTemp[j];
+         if(pLuzzati!=0) f*=pLuzzati[j];
+         if(pGlobalTemp!=0) f*=pGlobalTemp[j];
+         pReal[j]=(pGeomR[j]*pScatt[j]-pGeomI[j]*fsecond)*f;
+         pImag[j]=(pGeomI[j]*pScatt[j]+pGeomR[j]*fsecond)*f;
+      }
+      return;
+   }
+}
+
 void ScatteringData::CalcGeomStructFactor_FullDeriv(std::set<RefinablePar*> &vPar)
 {
    TAU_PROFILE("ScatteringData::CalcGeomStructFactor_FullDeriv()","void (..)",TAU_DEFAULT);
@@ -2076,8 +2464,13 @@ void ScatteringData::CalcGeomStructFactor_FullDeriv(std::set<RefinablePar*> &vPa
    TAU_PROFILE_START(timer1);
    // Calculate derivatives of the scattering component list vs all parameters
    std::map<RefinablePar*,CrystVector_REAL> vdx,vdy,vdz,vdocc;
+   // Analytical derivatives from the Scatterers, unless the dynamical occupancy
+   // correction is used (it depends on the positions of all atoms)
+   const bool analyticalDeriv=(this->GetCrystal().GetUseDynPopCorr()==0);
+   const ObjRegistry<Scatterer> *pScattReg=&(this->GetCrystal().GetScattererRegistry());
+   CrystVector_REAL sdx,sdy,sdz,sdocc;
    for(std::set<RefinablePar*>::iterator par=vPar.begin();par!=vPar.end();++par)
-   {// :TODO: get this done in Crystal or Scatterers, and use analytical derivatives
+   {
       if(*par==0) continue;
       CrystVector_REAL *pdx  =&(vdx[*par]);
       CrystVector_REAL *pdy  =&(vdy[*par]);
@@ -2088,6 +2481,45 @@ void ScatteringData::CalcGeomStructFactor_FullDeriv(std::set<RefinablePar*> &vPa
       pdz->resize(nbComp);
       pdocc->resize(nbComp);
 
+      if(analyticalDeriv)
+      {
+         bool found=false;
+         unsigned long offset=0;
+         for(long k=0;k<pScattReg->GetNb();k++)
+         {
+            const Scatterer *pScatt=&(pScattReg->GetObj(k));
+            const unsigned long nb=pScatt->GetScatteringComponentList().GetNbComponent();
+            if(pScatt->GetScatteringComponentListDeriv(**par,sdx,sdy,sdz,sdocc))
+            {
+               *pdx=0;
+               *pdy=0;
+               *pdz=0;
+               *pdocc=0;
+               for(unsigned long i=0;i<nb;++i)
+               {
+                  (*pdx)(offset+i)  =sdx(i);
+                  (*pdy)(offset+i)  =sdy(i);
+                  (*pdz)(offset+i)  =sdz(i);
+                  (*pdocc)(offset+i)=sdocc(i)*(*pScattCompList)(offset+i).mDynPopCorr;
+               }
+               found=true;
+               break;
+            }
+            offset+=nb;
+         }
+         if(found)
+         {
+            if( (MaxAbs(*pdx)==0)&&(MaxAbs(*pdy)==0)&&(MaxAbs(*pdz)==0)&&(MaxAbs(*pdocc)==0))
+            {
+               pdx->resize(0);
+               pdy->resize(0);
+               pdz->resize(0);
+               pdocc->resize(0);
+            }
+            continue;
+         }
+      }
+      // Numerical derivatives
       const REAL p0=(*par)->GetValue();
       const REAL step=(*par)->GetDerivStep();
       (*par)->Mutate(step);
@@ -2121,6 +2553,7 @@ void ScatteringData::CalcGeomStructFactor_FullDeriv(std::set<RefinablePar*> &vPa
          *ppdocc++/=2*step;
       }
       (*par)->SetValue(p0);
+      pScattCompList=&(this->GetCrystal().GetScatteringComponentList());
       if( (MaxAbs(vdx[*par])==0)&&(MaxAbs(vdy[*par])==0)&&(MaxAbs(vdz[*par])==0)&&(MaxAbs(vdocc[*par])==0))
       {
          pdx->resize(0);
@@ -2187,35 +2620,7 @@ void ScatteringData::CalcGeomStructFactor_FullDeriv(std::set<RefinablePar*> &vPa
             const REAL *kk=mK2Pi.data();
             const REAL *ll=mL2Pi.data();
             #ifdef HAVE_SSE_MATHFUN
-            const v4sf v4x=_mm_load1_ps(&x);
-            const v4sf v4y=_mm_load1_ps(&y);
-            const v4sf v4z=_mm_load1_ps(&z);
-            // Can't multiply directly a vector by a scalar ?
-            const v4sf v4popu=_mm_load1_ps(&popu);  POSSIBLY_UNUSED(v4popu);
-            int jj=mNbReflUsed;
-            for(;jj>3;jj-=4)
-            {
-                v4sf v4sin,v4cos;
-//                 sincos_ps(_mm_setr_ps(*(hh  )*x+ *(kk  )*y + *(ll  )*z,
-//                                       *(hh+1)*x+ *(kk+1)*y + *(ll+1)*z,
-//                                       *(hh+2)*x+ *(kk+2)*y + *(ll+2)*z,
-//                                       *(hh+3)*x+ *(kk+3)*y + *(ll+3)*z),&v4sin,&v4cos);
-                sincos_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(hh),v4x),
-                                                _mm_mul_ps(_mm_load_ps(kk),v4y)
-                                               ),
-                                     _mm_mul_ps(_mm_load_ps(ll),v4z)
-                                    ),&v4sin,&v4cos);
-                _mm_store_ps(pc,v4cos);
-                _mm_store_ps(ps,v4sin);
-
-                hh+=4;kk+=4;ll+=4;pc+=4;ps+=4;
-            }
-            for(;jj>0;jj--)
-            {
-               const REAL tmp = *hh++ * x + *kk++ * y + *ll++ *z;
-               *pc++ =cos(tmp);
-               *ps++ =sin(tmp);
-            }
+            GeomSFCosSin(hh,kk,ll,x,y,z,pc,ps,mNbReflUsed);
             #else
             for(int jj=0;jj<mNbReflUsed;jj++)
             {
@@ -521,6 +521,12 @@ class ScatteringData: virtual public RefinableObj
       */
       void CalcGeomStructFactor() const;
       void CalcGeomStructFactor_FullDeriv(std::set<RefinablePar*> &vPar);
+      /** Compute the derivatives of the real and imaginary parts of the structure
+      * factors versus an isotropic temperature factor (either the global Biso,
+      * or the Biso of one ScatteringPower), into mFhklCalcReal_FullDeriv and
+      * mFhklCalcImag_FullDeriv. CalcStructFactor() must have been called before.
+      */
+      void CalcStructFactorBisoDeriv(const RefinablePar &par);
       /** Calculate the Luzzati factor associated to each ScatteringPower and
       * each reflection, for maximum likelihood optimization.
       *
@@ -606,6 +612,23 @@ class ScatteringData: virtual public RefinableObj
          /// Geometrical Structure factor for each ScatteringPower, as vectors with NbRefl elements
          mutable map<const ScatteringPower*,CrystVector_REAL> mvRealGeomSF,mvImagGeomSF;
          mutable map<RefinablePar*,map<const ScatteringPower*,CrystVector_REAL> > mvRealGeomSF_FullDeriv,mvImagGeomSF_FullDeriv;
+         /** \brief Partial geometrical structure factors for one Scatterer
+         *
+         * These are the contributions of a single Scatterer to the geometrical structure
+         * factors (before the translation vectors and inversion center corrections).
+         * They are kept so that only the contributions of the Scatterers whose components
+         * changed are recomputed, e.g. when a single Molecule is moved during a global
+         * optimization.
+         */
+         struct GeomSFPartial
+         {
+            /// The scattering components of the Scatterer for which these were computed
+            ScatteringComponentList mScattCompList;
+            /// Partial geometrical structure factors, for each ScatteringPower
+            map<const ScatteringPower*,CrystVector_REAL> mvReal,mvImag;
+         };
+         /// Partial geometrical structure factors for each Scatterer
+         mutable map<const Scatterer*,GeomSFPartial> mvGeomSFPartial;
 
       //Public Clocks
          /// Clock for the list of hkl
@@ -623,6 +646,8 @@ class ScatteringData: virtual public RefinableObj
          mutable RefinableObjClock mClockScattFactorResonant;
          /// Clock the last time the geometrical structure factors were computed
          mutable RefinableObjClock mClockGeomStructFact;
+         /// Clock the last time the partial (per Scatterer) geometrical structure factors were computed
+         mutable RefinableObjClock mClockGeomSFPartial;
          /// Clock the last time temperature factors were computed
          mutable RefinableObjClock mClockThermicFact;
 
@@ -169,8 +169,7 @@ REAL UnitCell::GetLatticePar(int whichPar)const
    {
       const int num = mSpaceGroup.GetSpaceGroupNumber();
 
-      static CrystVector_REAL cellDim;
-      cellDim=mCellDim;
+      CrystVector_REAL cellDim=mCellDim;
       if((num <=2)||(mConstrainLatticeToSpaceGroup.GetChoice()!=0))
          return cellDim(whichPar);
       if((num <=15) && (0==mSpaceGroup.GetUniqueAxis()))
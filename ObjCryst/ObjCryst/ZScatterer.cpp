@@ -1554,7 +1554,7 @@ void ZScatterer::GlobalOptRandomMove(const REAL mutationAmplitude,
    // give a 2% chance of either moving a single atom, or move
    // all atoms before a given torsion angle.
    // Only try this if there are more than 10 atoms (else it's not worth the speed cost)
-   if((mNbAtom>=10) && ((rand()/(REAL)RAND_MAX)<.02)
+   if((mNbAtom>=10) && ((ObjCrystRand()/(REAL)RAND_MAX)<.02)
       && (gpRefParTypeScattConform->IsDescendantFromOrSameAs(type)))//.01
    {
       TAU_PROFILE_TIMER(timer1,\
@@ -1595,7 +1595,7 @@ void ZScatterer::GlobalOptRandomMove(const REAL mutationAmplitude,
       // Pick one to move and get the relevant parameter
       // (maybe we should random-move also the associated bond lengths an angles,
       // but for now we'll concentrate on dihedral (torsion) angles.
-         const int atom=dihed((int) (rand()/((REAL)RAND_MAX+1)*nbDihed));
+         const int atom=dihed((int) (ObjCrystRand()/((REAL)RAND_MAX+1)*nbDihed));
          //cout<<endl;
          VFN_DEBUG_MESSAGE("ZScatterer::GlobalOptRandomMove(): Changing atom #"<<atom ,3)
          if(atom==2)
@@ -1606,7 +1606,7 @@ void ZScatterer::GlobalOptRandomMove(const REAL mutationAmplitude,
       // Record the current conformation
          mpZMoveMinimizer->RecordConformation();
       // Set up
-         const int moveType= rand()%3;
+         const int moveType= ObjCrystRand()%3;
          mpZMoveMinimizer->FixAllPar();
          REAL x0,y0,z0;
          //cout << " Move Type:"<<moveType<<endl;
@@ -1709,9 +1709,9 @@ void ZScatterer::GlobalOptRandomMove(const REAL mutationAmplitude,
       // not-so-random angles., and then minimize the conformation change
          mpZMoveMinimizer->SetZAtomWeight(weight);
          REAL change;
-         if( (rand()%5)==0)
+         if( (ObjCrystRand()%5)==0)
          {
-            switch(rand()%5)
+            switch(ObjCrystRand()%5)
             {
                case 0: change=-120*DEG2RAD;break;
                case 1: change= -90*DEG2RAD;break;
@@ -1723,7 +1723,7 @@ void ZScatterer::GlobalOptRandomMove(const REAL mutationAmplitude,
          else
          {
             change= par->GetGlobalOptimStep()
-                         *2*(rand()/(REAL)RAND_MAX-0.5)*mutationAmplitude*16;
+                         *2*(ObjCrystRand()/(REAL)RAND_MAX-0.5)*mutationAmplitude*16;
          }
       TAU_PROFILE_STOP(timer1);
          VFN_DEBUG_MESSAGE("ZScatterer::GlobalOptRandomMove(): mutation:"<<change*RAD2DEG,3)
@@ -1774,7 +1774,7 @@ void ZScatterer::GlobalOptRandomMove(const REAL mutationAmplitude,
       if(nbDihed<2) //Can't play :-(
          this->RefinableObj::GlobalOptRandomMove(mutationAmplitude);
       // Pick one
-      const int atom=dihed((int) (rand()/((REAL)RAND_MAX+1)*nbDihed));
+      const int atom=dihed((int) (ObjCrystRand()/((REAL)RAND_MAX+1)*nbDihed));
       VFN_DEBUG_MESSAGE("ZScatterer::GlobalOptRandomMove(): "<<FormatHorizVector<long>(dihed) ,10)
       VFN_DEBUG_MESSAGE("ZScatterer::GlobalOptRandomMove(): Changing atom #"<<atom ,10)
       if(atom==2)
@@ -1784,9 +1784,9 @@ void ZScatterer::GlobalOptRandomMove(const REAL mutationAmplitude,
       // Get the old value
       const REAL old=par->GetValue();
       // Move it, with a max amplitude 8x greater than usual
-      if( (rand()/(REAL)RAND_MAX)<.1)
+      if( (ObjCrystRand()/(REAL)RAND_MAX)<.1)
       {// give some probability to use certain angles: -120,-90,90,120,180
-         switch(rand()%5)
+         switch(ObjCrystRand()%5)
          {
             case 0: par->Mutate(-120*!DEG2RAD);break;
             case 1: par->Mutate( -90*!DEG2RAD);break;
@@ -1797,7 +1797,7 @@ void ZScatterer::GlobalOptRandomMove(const REAL mutationAmplitude,
       }
       else
          par->Mutate( par->GetGlobalOptimStep()
-                      *2*(rand()/(REAL)RAND_MAX-0.5)*mutationAmplitude*8);
+                      *2*(ObjCrystRand()/(REAL)RAND_MAX-0.5)*mutationAmplitude*8);
       const REAL change=mZAtomRegistry.GetObj(atom).GetZDihedralAngle()-old;
       // Now move all atoms using this changed bond as a reference
       //const int atom2=   mZAtomRegistry.GetObj(atom).GetZAngleAtom();
@@ -1810,7 +1810,7 @@ void ZScatterer::GlobalOptRandomMove(const REAL mutationAmplitude,
       //cout <<"ZScatterer::GlobalOptRandomMove:"<<nbDihed
       //     <<" "<<atom
       //     <<" "<<atom2
-      //     <<" "<<rand()
+      //     <<" "<<ObjCrystRand()
       //     <<endl
       //     <<" "<<FormatHorizVector<long>(dihed,4)
       //     <<endl;
@@ -21,21 +21,26 @@
 */
 #include <stdlib.h>
 #include <list>
+#include <sstream>
 #include "ObjCryst/ObjCryst/test.h"
 #include "ObjCryst/ObjCryst/Crystal.h"
 #include "ObjCryst/ObjCryst/Atom.h"
+#include "ObjCryst/ObjCryst/Molecule.h"
 #include "ObjCryst/ObjCryst/DiffractionDataSingleCrystal.h"
 #include "ObjCryst/ObjCryst/PowderPattern.h"
 #include "ObjCryst/RefinableObj/GlobalOptimObj.h"
 #include "ObjCryst/Quirks/VFNStreamFormat.h"
+#include "ObjCryst/Quirks/Chronometer.h"
 
 namespace ObjCryst
 {
 
 SpeedTestReport SpeedTest(const unsigned int nbAtom, const int nbAtomType,const string spacegroup,
                           const RadiationType radiation, const unsigned long nbReflections,
-                          const unsigned int dataType,const REAL time)
+                          const unsigned int dataType,const REAL time,const bool antiBump)
 {
+   // Same random data and starting configuration for every run of a given test
+   srand(1);
    Crystal cryst(9,11,15,1.2,1.3,1.7,spacegroup);
    for(int i=0;i<nbAtomType;++i)
    {
@@ -48,8 +53,15 @@ SpeedTestReport SpeedTest(const unsigned int nbAtom, const int nbAtomType,const
                                   1.));
    }
    cryst.SetUseDynPopCorr(false);
+   if(antiBump)
+      for(int i=0;i<nbAtomType;++i)
+         for(int j=i;j<nbAtomType;++j)
+            cryst.SetBumpMergeDistance(cryst.GetScatteringPowerRegistry().GetObj(i),
+                                       cryst.GetScatteringPowerRegistry().GetObj(j),1.5);
 
    RefinableObj *pData = NULL;
+   ScatteringData *pScattData = NULL;
+   PowderPattern *pPowder = NULL;
    switch(dataType)
    {
       case 0:
@@ -83,6 +95,7 @@ SpeedTestReport SpeedTest(const unsigned int nbAtom, const int nbAtomType,const
          pDataTmp->SetWeightToInvSigma2();
 
          pData=pDataTmp;
+         pScattData=pDataTmp;
          break;
       }
       case 1:
@@ -128,6 +141,8 @@ SpeedTestReport SpeedTest(const unsigned int nbAtom, const int nbAtomType,const
             diffData->SetHKL (hh, kk, ll);
          }
          pData=pDataTmp;
+         pScattData=diffData;
+         pPowder=pDataTmp;
          break;
       }
    }
@@ -168,8 +183,312 @@ SpeedTestReport SpeedTest(const unsigned int nbAtom, const int nbAtomType,const
                              *(REAL)nbReflections
                              *(50000000-nbTrial)/pGlobalOptObj->GetLastOptimElapsedTime()/1e6;
    report.mBogoSPS=(50000000-nbTrial)/pGlobalOptObj->GetLastOptimElapsedTime();
+   report.mAntiBump=antiBump;
+
+   // Time each stage separately, after moving all atoms. Each stage uses the
+   // result of the previous ones, so only its own computation is timed.
+   {
+      // The test crystal only has isolated atoms, so the restraints are timed on a
+      // separate molecule with the same number of atoms, as a chain with bond,
+      // bond angle and dihedral angle restraints.
+      Molecule mol(cryst,"Restraints");
+      for(unsigned int i=0;i<nbAtom;++i)
+      {
+         stringstream name;
+         name<<"O"<<i;
+         mol.AddAtom(1.2*i,.8*(i%2),.4*(i%3),&(cryst.GetScatteringPowerRegistry().GetObj(i%nbAtomType)),
+                     name.str(),false);
+      }
+      for(unsigned int i=1;i<nbAtom;++i)
+      {
+         mol.AddBond(mol.GetAtom(i-1),mol.GetAtom(i),1.5,.01,.02,1.,false);
+         if(i>=2) mol.AddBondAngle(mol.GetAtom(i-2),mol.GetAtom(i-1),mol.GetAtom(i),
+                                   110*DEG2RAD,.01,.02,false);
+         if(i>=3) mol.AddDihedralAngle(mol.GetAtom(i-3),mol.GetAtom(i-2),mol.GetAtom(i-1),mol.GetAtom(i),
+                                       60*DEG2RAD,.01,.02,false);
+      }
+      Chronometer chronoSF,chronoProfile,chronoChi2,chronoDist,chronoRestraints;
+      chronoSF.pause();chronoProfile.pause();chronoChi2.pause();chronoDist.pause();chronoRestraints.pause();
+      Chronometer chrono;
+      long nbEval=0;
+      while((nbEval<10)||(chrono.seconds()<time/4))
+      {
+         for(int i=0;i<cryst.GetNbScatterer();++i)
+            cryst.GetScatt(i).SetX(cryst.GetScatt(i).GetX()+.01*(rand()/(REAL)RAND_MAX-.5));
+         for(unsigned int i=0;i<nbAtom;++i)
+            mol.GetAtom(i).SetX(mol.GetAtom(i).GetX()+.05*(rand()/(REAL)RAND_MAX-.5));
+         chronoSF.resume();
+         pScattData->GetFhklCalcSq();
+         chronoSF.pause();
+         if(pPowder!=NULL)
+         {
+            chronoProfile.resume();
+            pPowder->GetPowderPatternCalc();
+            chronoProfile.pause();
+         }
+         chronoChi2.resume();
+         pData->GetLogLikelihood();
+         chronoChi2.pause();
+         if(antiBump)
+         {
+            chronoDist.resume();
+            cryst.GetBumpMergeCost();
+            chronoDist.pause();
+         }
+         chronoRestraints.resume();
+         mol.GetLogLikelihood();
+         chronoRestraints.pause();
+         nbEval++;
+      }
+      report.mTimeStructFactor=chronoSF.seconds()/nbEval;
+      report.mTimeProfile=chronoProfile.seconds()/nbEval;
+      report.mTimeChi2=chronoChi2.seconds()/nbEval;
+      report.mTimeDistTable=chronoDist.seconds()/nbEval;
+      report.mTimeRestraints=chronoRestraints.seconds()/nbEval;
+   }
    delete pGlobalOptObj;
    delete pData;
    return report;
 }
+
+std::list<SpeedTestReport> SpeedTestMatrix(const REAL time)
+{
+   const char *vSpacegroup[4]={"P1","P-1","P21/c","Fd-3m"};
+   const unsigned int vNbAtom[2]={20,100};
+   const unsigned long vNbRefl[2]={100,500};
+   std::list<SpeedTestReport> vReport;
+   for(unsigned int antiBump=0;antiBump<2;++antiBump)
+      for(unsigned int dataType=0;dataType<2;++dataType)
+         for(unsigned int rad=0;rad<2;++rad)
+         {
+            // Anti-bump tests only with X-rays, the radiation type does not change the distance table
+            if((antiBump==1)&&(rad==1)) continue;
+            const RadiationType radiation=(rad==0)?RAD_XRAY:RAD_NEUTRON;
+            for(unsigned int size=0;size<2;++size)
+               for(unsigned int sg=0;sg<4;++sg)
+               {
+                  vReport.push_back(SpeedTest(vNbAtom[size],4,vSpacegroup[sg],radiation,vNbRefl[size],
+                                              dataType,time,antiBump==1));
+                  const SpeedTestReport *p=&(vReport.back());
+                  cout<<"SpeedTestMatrix: "<<FormatString(p->mSpacegroup,8)<<" "
+                      <<FormatInt(p->mNbAtom)<<" atoms "<<FormatInt(p->mNbReflections)<<" reflections "
+                      <<((p->mDataType==0)?"Single":"Powder")<<" "<<((rad==0)?"X-ray  ":"neutron")
+                      <<((p->mAntiBump)?" anti-bump":"          ")
+                      <<" BogoSPS="<<FormatFloat(p->mBogoSPS)<<endl;
+               }
+         }
+   return vReport;
+}
+
+bool ParallelTemperingTest(const long nbWorld, const long nbTrial)
+{
+   srand(1);
+   Crystal cryst(5,6,7,1.5,1.6,1.7,"P1");
+   ScatteringPowerAtom *pO=new ScatteringPowerAtom("O","O",1.5);
+   cryst.AddScatteringPower(pO);
+   for(unsigned int i=0;i<4;++i)
+   {
+      stringstream name;
+      name<<"O"<<i;
+      cryst.AddScatterer(new Atom(.1+.2*i,.15+.2*i,.2+.2*i,name.str(),pO,1.));
+   }
+   DiffractionDataSingleCrystal *pData=new DiffractionDataSingleCrystal(cryst);
+   pData->SetWavelength(1.54);
+   pData->SetRadiationType(RAD_XRAY);
+   pData->GenHKLFullSpace(0.6,true);
+   pData->SetIobsToIcalc();
+
+   MonteCarloObj *pOpt=new MonteCarloObj;
+   pOpt->AddRefinableObj(*pData);
+   pOpt->AddRefinableObj(cryst);
+   pOpt->FixAllPar();
+   pOpt->SetParIsFixed(gpRefParTypeScattTransl,false);
+   pOpt->SetNbWorld(nbWorld);
+   pOpt->SetAlgorithmParallTempering(ANNEALING_SMART,1e8,1e-8,ANNEALING_BOLTZMANN,8,.125);
+   pOpt->GetOption("Automatic Least Squares Refinement").SetChoice(2);
+   pOpt->GetXMLAutoSaveOption().SetChoice(0);
+   pOpt->RandomizeStartingConfig();
+   const REAL cost0=pOpt->GetLogLikelihood();
+   bool ok=true;
+   try
+   {
+      long nb=nbTrial;
+      pOpt->Optimize(nb,true,0);
+      const REAL cost=pOpt->GetLogLikelihood();
+      ok=(!ISNAN_OR_INF(cost))&&(cost<=cost0);
+   }
+   catch(const ObjCrystException &except)
+   {
+      ok=false;
+   }
+   delete pOpt;
+   delete pData;
+   return ok;
+}
+
+bool MultiRunTest(const long nbRun, const long nbTrial)
+{
+   srand(1);
+   Crystal cryst(5,6,7,1.5,1.6,1.7,"P-1");
+   ScatteringPowerAtom *pO=new ScatteringPowerAtom("O","O",1.5);
+   cryst.AddScatteringPower(pO);
+   for(unsigned int i=0;i<4;++i)
+   {
+      stringstream name;
+      name<<"O"<<i;
+      cryst.AddScatterer(new Atom(.1+.2*i,.15+.2*i,.2+.2*i,name.str(),pO,1.));
+   }
+   DiffractionDataSingleCrystal *pData=new DiffractionDataSingleCrystal(cryst);
+   pData->SetWavelength(1.54);
+   pData->SetRadiationType(RAD_XRAY);
+   pData->GenHKLFullSpace(0.6,true);
+   pData->SetIobsToIcalc();
+
+   MonteCarloObj *pOpt=new MonteCarloObj;
+   pOpt->AddRefinableObj(*pData);
+   pOpt->AddRefinableObj(cryst);
+   pOpt->FixAllPar();
+   pOpt->SetParIsFixed(gpRefParTypeScattTransl,false);
+   pOpt->SetParIsFixed(gpRefParTypeUnitCell,false);
+   pOpt->SetAlgorithmParallTempering(ANNEALING_SMART,1e8,1e-8,ANNEALING_EXPONENTIAL,8,.125);
+   pOpt->GetXMLAutoSaveOption().SetChoice(0);
+   bool ok=true;
+   try
+   {
+      long nbCycle=nbRun,nb=nbTrial;
+      pOpt->MultiRunOptimize(nbCycle,nb,true,0);
+      // The best configuration has been restored
+      const REAL cost=pOpt->GetLogLikelihood(),best=pOpt->GetBestCost();
+      ok=(!ISNAN_OR_INF(cost))&&(fabs(cost-best)<=1e-2*(1+fabs(best)));
+   }
+   catch(const ObjCrystException &except)
+   {
+      ok=false;
+   }
+   delete pOpt;
+   delete pData;
+   return ok;
+}
+
+/// Name of the radiation type, for speed test reports
+static string SpeedTestRadiationName(const RadiationType rad)
+{
+   switch(rad)
+   {
+      case RAD_NEUTRON: return "neutron";
+      case RAD_XRAY: return "X-ray";
+      case RAD_ELECTRON: return "electron";
+   }
+   return "unknown";
+}
+
+/// Quote a string for JSON output, escaping special characters
+static string SpeedTestJSONString(const string &str)
+{
+   stringstream s;
+   s<<"\"";
+   for(string::const_iterator pos=str.begin();pos!=str.end();++pos)
+   {
+      switch(*pos)
+      {
+         case '"': s<<"\\\"";break;
+         case '\\': s<<"\\\\";break;
+         case '\n': s<<"\\n";break;
+         case '\r': s<<"\\r";break;
+         case '\t': s<<"\\t";break;
+         default:
+            if((unsigned char)(*pos)<0x20)
+            {
+               const char *hex="0123456789abcdef";
+               s<<"\\u00"<<hex[(unsigned char)(*pos)>>4]<<hex[(unsigned char)(*pos)&0xf];
+            }
+            else s<<*pos;
+      }
+   }
+   s<<"\"";
+   return s.str();
+}
+
+/// Quote a CSV field if it includes a separator, a quote or a line break
+static string SpeedTestCSVField(const string &str)
+{
+   if(str.find_first_of(",\"\r\n")==string::npos) return str;
+   string s="\"";
+   for(string::const_iterator pos=str.begin();pos!=str.end();++pos)
+   {
+      if(*pos=='"') s+="\"\"";
+      else s+=*pos;
+   }
+   return s+"\"";
+}
+
+/// Compilation options which may change the results of speed tests
+static string SpeedTestBuildOptions()
+{
+   string s=(sizeof(REAL)==4)?"REAL=float":"REAL=double";
+   #ifdef HAVE_SSE_MATHFUN
+   s+=" SSE";
+   #endif
+   #ifdef __AVX2__
+   s+=" AVX2";
+   #endif
+   #ifdef _OPENMP
+   s+=" OpenMP";
+   #endif
+   #ifdef __DEBUG__
+   s+=" DEBUG";
+   #endif
+   return s;
+}
+
+void WriteSpeedTestReportJSON(std::ostream &os,const std::list<SpeedTestReport> &vReport,
+                              const string &version)
+{
+   os<<"{"<<endl
+     <<"  \"version\": "<<SpeedTestJSONString(version)<<","<<endl
+     <<"  \"build\": "<<SpeedTestJSONString(SpeedTestBuildOptions())<<","<<endl
+     <<"  \"nbThread\": "<<GetNbThread()<<","<<endl
+     <<"  \"tests\": ["<<endl;
+   for(std::list<SpeedTestReport>::const_iterator pos=vReport.begin();pos!=vReport.end();++pos)
+   {
+      os<<"    {\"spacegroup\": "<<SpeedTestJSONString(pos->mSpacegroup)
+        <<", \"nbAtom\": "<<pos->mNbAtom
+        <<", \"nbAtomType\": "<<pos->mNbAtomType
+        <<", \"radiation\": "<<SpeedTestJSONString(SpeedTestRadiationName(pos->mRadiation))
+        <<", \"data\": \""<<((pos->mDataType==0)?"single":"powder")<<"\""
+        <<", \"nbRefl\": "<<pos->mNbReflections
+        <<", \"antiBump\": "<<((pos->mAntiBump)?"true":"false")
+        <<", \"BogoSPS\": "<<pos->mBogoSPS
+        <<", \"BogoMRAPS\": "<<pos->mBogoMRAPS
+        <<", \"BogoMRAPSReduced\": "<<pos->mBogoMRAPS_reduced
+        <<", \"tStructFactor\": "<<pos->mTimeStructFactor
+        <<", \"tProfile\": "<<pos->mTimeProfile
+        <<", \"tChi2\": "<<pos->mTimeChi2
+        <<", \"tDistTable\": "<<pos->mTimeDistTable
+        <<", \"tRestraints\": "<<pos->mTimeRestraints
+        <<"}";
+      std::list<SpeedTestReport>::const_iterator next=pos;
+      if(++next!=vReport.end()) os<<",";
+      os<<endl;
+   }
+   os<<"  ]"<<endl<<"}"<<endl;
+}
+
+void WriteSpeedTestReportCSV(std::ostream &os,const std::list<SpeedTestReport> &vReport,
+                             const string &version)
+{
+   os<<"version,build,nbThread,spacegroup,nbAtom,nbAtomType,radiation,data,nbRefl,antiBump,"
+     <<"BogoSPS,BogoMRAPS,BogoMRAPSReduced,tStructFactor,tProfile,tChi2,tDistTable,tRestraints"<<endl;
+   for(std::list<SpeedTestReport>::const_iterator pos=vReport.begin();pos!=vReport.end();++pos)
+   {
+      os<<SpeedTestCSVField(version)<<","<<SpeedTestCSVField(SpeedTestBuildOptions())<<","<<GetNbThread()<<","
+        <<SpeedTestCSVField(pos->mSpacegroup)<<","<<pos->mNbAtom<<","<<pos->mNbAtomType<<","
+        <<SpeedTestCSVField(SpeedTestRadiationName(pos->mRadiation))<<","
+        <<((pos->mDataType==0)?"single":"powder")<<","
+        <<pos->mNbReflections<<","<<((pos->mAntiBump)?1:0)<<","
+        <<pos->mBogoSPS<<","<<pos->mBogoMRAPS<<","<<pos->mBogoMRAPS_reduced<<","
+        <<pos->mTimeStructFactor<<","<<pos->mTimeProfile<<","<<pos->mTimeChi2<<","
+        <<pos->mTimeDistTable<<","<<pos->mTimeRestraints<<endl;
+   }
+}
 }
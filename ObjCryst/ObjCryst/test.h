@@ -23,6 +23,8 @@
 #define _OBJCRYST_TEST_H_
 
 #include "ObjCryst/ObjCryst/General.h"
+#include <list>
+#include <iostream>
 
 namespace ObjCryst
 {
@@ -51,6 +53,22 @@ struct SpeedTestReport
    REAL mBogoMRAPS_reduced;
    /// Number of Structures evaluated Per Second
    REAL mBogoSPS;
+   /// Were anti-bump distances used for the test ?
+   bool mAntiBump;
+   /// Average time (in seconds) for the computation of structure factors, after all atoms have moved
+   REAL mTimeStructFactor;
+   /// Average time (in seconds) for the computation of the powder pattern profile,
+   /// from already computed structure factors (0 for single crystal data)
+   REAL mTimeProfile;
+   /// Average time (in seconds) for the computation of the Chi^2 (log-likelihood) of the data,
+   /// from already computed intensities
+   REAL mTimeChi2;
+   /// Average time (in seconds) for the computation of the interatomic distance table
+   /// and anti-bump cost (0 if anti-bump is not used)
+   REAL mTimeDistTable;
+   /// Average time (in seconds) for the computation of the restraints (log-likelihood) of
+   /// a molecule with nbAtom atoms, with bond, bond angle and dihedral angle restraints
+   REAL mTimeRestraints;
 };
 
 /**
@@ -62,10 +80,56 @@ struct SpeedTestReport
 * \param nbReflections: total number of reflections to use.
 * \param time: duration of the test (10s is usually enough).
 * \param dataType: 0= single crystal, 1= powder pattern (1 background + 1 crystal phase)
+* \param antiBump: if true, use an anti-bump distance between all atom types.
+*
+* After the optimization, the time used by each stage of the cost computation
+* (structure factors, profile, Chi^2, distance table, restraints) is also measured
+* separately.
 */
 SpeedTestReport SpeedTest(const unsigned int nbAtom, const int nbAtomType,const string spacegroup,
                           const RadiationType radiation, const unsigned long nbReflections,
-                          const unsigned int dataType,const REAL time);
+                          const unsigned int dataType,const REAL time,const bool antiBump=false);
+
+/** Run a series of speed tests (see ObjCryst::SpeedTest()), for a matrix of
+* spacegroups (P1, P-1, P21/c, Fd-3m), structure sizes (20 atoms/100 reflections and
+* 100 atoms/500 reflections), single crystal and powder data, X-ray and neutron
+* radiation, with and without anti-bump.
+*
+* \param time: duration of each test
+*/
+std::list<SpeedTestReport> SpeedTestMatrix(const REAL time);
+
+/** Run a short Parallel Tempering optimization with a given number of worlds, on
+* a small P1 structure (4 atoms) against single crystal data computed from the
+* same structure, with automatic least squares refinements and a Boltzmann
+* displacement amplitude schedule.
+*
+* \param nbWorld: the number of parallel tempering worlds
+* \param nbTrial: the number of trials
+* \return true if the optimization ended without error and with a finite cost,
+* which is not larger than the starting one.
+*/
+bool ParallelTemperingTest(const long nbWorld, const long nbTrial);
+
+/** Run several short optimizations with MonteCarloObj::MultiRunOptimize() (concurrently
+* if several threads are available, see ObjCryst::SetNbThread()), on a small P-1
+* structure with refinable lattice parameters.
+*
+* \param nbRun: the number of runs
+* \param nbTrial: the number of trials for each run
+* \return true if the best cost found during the runs is the one computed
+* again from the best configuration, i.e. the concurrent runs did not
+* interfere with each other.
+*/
+bool MultiRunTest(const long nbRun, const long nbTrial);
+
+/// Write speed test results in JSON format, with the version string and compilation options
+void WriteSpeedTestReportJSON(std::ostream &os,const std::list<SpeedTestReport> &vReport,
+                              const string &version="");
+
+/// Write speed test results in CSV format (one line per test, with a header line)
+void WriteSpeedTestReportCSV(std::ostream &os,const std::list<SpeedTestReport> &vReport,
+                             const string &version="");
 
 }
 #endif
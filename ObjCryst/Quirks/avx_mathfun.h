@@ -0,0 +1,344 @@
+/* AVX2 implementation of sin, cos and exp, 8 floats at a time
+   (and sin & cos for 4 doubles at a time)
+
+   This is a direct port to 256-bit AVX2 registers of the SSE2 version
+   of sse_mathfun.h, itself inspired by Intel Approximate Math library,
+   and based on the corresponding algorithms of the cephes math library.
+   The same constants and polynoms are used, so results are identical to
+   the SSE2 version (except for the use of fused multiply-add instructions,
+   if available).
+
+NOTE:
+- This requires AVX2 (integer operations on 256-bit registers), i.e. __AVX2__
+  must be defined (e.g. with -mavx2 or -march=native on a recent processor).
+- Modifications for inclusion in ObjCryst++ (http://objcryst.sf.net):
+ - functions are inline.
+*/
+
+/* Copyright (C) 2007  Julien Pommier (original SSE version)
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+
+  (this is the zlib license)
+*/
+#ifndef _OBJCRYST_AVX_MATHFUN_H_
+#define _OBJCRYST_AVX_MATHFUN_H_
+
+#include <immintrin.h>
+
+typedef __m256  v8sf; // vector of 8 float (avx)
+typedef __m256i v8si; // vector of 8 int   (avx2)
+
+#ifdef __FMA__
+#define avx_madd_ps(a,b,c) _mm256_fmadd_ps(a,b,c)
+#else
+#define avx_madd_ps(a,b,c) _mm256_add_ps(_mm256_mul_ps(a,b),c)
+#endif
+
+/* Constants are declared locally in each function (the compiler turns them into
+   constant loads), rather than as global aligned arrays like in sse_mathfun.h */
+#define _PS256_CONST(Name, Val) \
+  const v8sf _ps256_##Name = _mm256_set1_ps(Val)
+#define _PI32_256_CONST(Name, Val) \
+  const v8si _pi32_256_##Name = _mm256_set1_epi32(Val)
+
+/* evaluation of the cephes sin & cos polynoms, with x reduced to [-Pi/4;Pi/4],
+   y the result of the cosine polynom and y2 the one of the sine polynom */
+inline void avx_sincos_poly(const v8sf x, v8sf &y, v8sf &y2)
+{
+  _PS256_CONST(1  , 1.0f);
+  _PS256_CONST(0p5, 0.5f);
+  _PS256_CONST(sincof_p0, -1.9515295891E-4f);
+  _PS256_CONST(sincof_p1,  8.3321608736E-3f);
+  _PS256_CONST(sincof_p2, -1.6666654611E-1f);
+  _PS256_CONST(coscof_p0,  2.443315711809948E-005f);
+  _PS256_CONST(coscof_p1, -1.388731625493765E-003f);
+  _PS256_CONST(coscof_p2,  4.166664568298827E-002f);
+
+  const v8sf z = _mm256_mul_ps(x,x);
+
+  /* Evaluate the first polynom  (0 <= x <= Pi/4) */
+  y = avx_madd_ps(_ps256_coscof_p0, z, _ps256_coscof_p1);
+  y = avx_madd_ps(y, z, _ps256_coscof_p2);
+  y = _mm256_mul_ps(y, z);
+  y = _mm256_mul_ps(y, z);
+  y = _mm256_sub_ps(y, _mm256_mul_ps(z, _ps256_0p5));
+  y = _mm256_add_ps(y, _ps256_1);
+
+  /* Evaluate the second polynom  (Pi/4 <= x <= 0) */
+  y2 = avx_madd_ps(_ps256_sincof_p0, z, _ps256_sincof_p1);
+  y2 = avx_madd_ps(y2, z, _ps256_sincof_p2);
+  y2 = _mm256_mul_ps(y2, z);
+  y2 = avx_madd_ps(y2, x, x);
+}
+
+/* range reduction: returns the integer octant j (with j=(j+1)&~1) and reduces x
+   to [-Pi/4;Pi/4] using "Extended precision modular arithmetic" */
+inline v8si avx_sincos_reduce(v8sf &x)
+{
+  _PS256_CONST(minus_cephes_DP1, -0.78515625f);
+  _PS256_CONST(minus_cephes_DP2, -2.4187564849853515625e-4f);
+  _PS256_CONST(minus_cephes_DP3, -3.77489497744594108e-8f);
+  _PS256_CONST(cephes_FOPI, 1.27323954473516f); // 4 / M_PI
+  _PI32_256_CONST(1, 1);
+  _PI32_256_CONST(inv1, ~1);
+
+  /* scale by 4/Pi */
+  v8sf y = _mm256_mul_ps(x, _ps256_cephes_FOPI);
+  /* store the integer part of y in emm2 */
+  v8si emm2 = _mm256_cvttps_epi32(y);
+  /* j=(j+1) & (~1) (see the cephes sources) */
+  emm2 = _mm256_add_epi32(emm2, _pi32_256_1);
+  emm2 = _mm256_and_si256(emm2, _pi32_256_inv1);
+  y = _mm256_cvtepi32_ps(emm2);
+
+  /* x = ((x - y * DP1) - y * DP2) - y * DP3; */
+  x = avx_madd_ps(y, _ps256_minus_cephes_DP1, x);
+  x = avx_madd_ps(y, _ps256_minus_cephes_DP2, x);
+  x = avx_madd_ps(y, _ps256_minus_cephes_DP3, x);
+  return emm2;
+}
+
+/* evaluation of sin and cos, any x */
+inline void sincos256_ps(v8sf x, v8sf *s, v8sf *c)
+{
+  _PI32_256_CONST(2, 2);
+  _PI32_256_CONST(4, 4);
+  const v8sf sign_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x80000000));
+
+  /* extract the sign bit (upper one) */
+  v8sf sign_bit_sin = _mm256_and_ps(x, sign_mask);
+  /* take the absolute value */
+  x = _mm256_andnot_ps(sign_mask, x);
+
+  const v8si emm2 = avx_sincos_reduce(x);
+
+  /* get the swap sign flag for the sine */
+  const v8sf swap_sign_bit_sin = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(emm2, _pi32_256_4), 29));
+  sign_bit_sin = _mm256_xor_ps(sign_bit_sin, swap_sign_bit_sin);
+
+  /* get the polynom selection mask */
+  const v8sf poly_mask = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(emm2, _pi32_256_2),
+                                                                _mm256_setzero_si256()));
+
+  /* get the sign flag for the cosine */
+  const v8sf sign_bit_cos = _mm256_castsi256_ps(_mm256_slli_epi32(
+                               _mm256_andnot_si256(_mm256_sub_epi32(emm2, _pi32_256_2), _pi32_256_4), 29));
+
+  v8sf y, y2;
+  avx_sincos_poly(x, y, y2);
+
+  /* select the correct result from the two polynoms */
+  const v8sf ysin = _mm256_blendv_ps(y, y2, poly_mask);
+  const v8sf ycos = _mm256_blendv_ps(y2, y, poly_mask);
+
+  /* update the sign */
+  *s = _mm256_xor_ps(ysin, sign_bit_sin);
+  *c = _mm256_xor_ps(ycos, sign_bit_cos);
+}
+
+/* evaluation of cos, any x */
+inline v8sf cos256_ps(v8sf x)
+{
+  _PI32_256_CONST(2, 2);
+  _PI32_256_CONST(4, 4);
+  const v8sf sign_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x80000000));
+  /* take the absolute value */
+  x = _mm256_andnot_ps(sign_mask, x);
+
+  const v8si emm2 = avx_sincos_reduce(x);
+
+  const v8sf poly_mask = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(emm2, _pi32_256_2),
+                                                                _mm256_setzero_si256()));
+  const v8sf sign_bit_cos = _mm256_castsi256_ps(_mm256_slli_epi32(
+                               _mm256_andnot_si256(_mm256_sub_epi32(emm2, _pi32_256_2), _pi32_256_4), 29));
+  v8sf y, y2;
+  avx_sincos_poly(x, y, y2);
+  return _mm256_xor_ps(_mm256_blendv_ps(y2, y, poly_mask), sign_bit_cos);
+}
+
+/* evaluation of exp(x) */
+inline v8sf exp256_ps(v8sf x)
+{
+  _PS256_CONST(1  , 1.0f);
+  _PS256_CONST(0p5, 0.5f);
+  _PS256_CONST(exp_hi, 88.3762626647949f);
+  _PS256_CONST(exp_lo, -88.3762626647949f);
+  _PS256_CONST(cephes_LOG2EF, 1.44269504088896341f);
+  _PS256_CONST(cephes_exp_C1, 0.693359375f);
+  _PS256_CONST(cephes_exp_C2, -2.12194440e-4f);
+  _PS256_CONST(cephes_exp_p0, 1.9875691500E-4f);
+  _PS256_CONST(cephes_exp_p1, 1.3981999507E-3f);
+  _PS256_CONST(cephes_exp_p2, 8.3334519073E-3f);
+  _PS256_CONST(cephes_exp_p3, 4.1665795894E-2f);
+  _PS256_CONST(cephes_exp_p4, 1.6666665459E-1f);
+  _PS256_CONST(cephes_exp_p5, 5.0000001201E-1f);
+  _PI32_256_CONST(0x7f, 0x7f);
+
+  x = _mm256_min_ps(x, _ps256_exp_hi);
+  x = _mm256_max_ps(x, _ps256_exp_lo);
+
+  /* express exp(x) as exp(g + n*log(2)) */
+  v8sf fx = avx_madd_ps(x, _ps256_cephes_LOG2EF, _ps256_0p5);
+  fx = _mm256_floor_ps(fx);
+
+  x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _ps256_cephes_exp_C1));
+  x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _ps256_cephes_exp_C2));
+
+  const v8sf z = _mm256_mul_ps(x,x);
+  v8sf y = avx_madd_ps(_ps256_cephes_exp_p0, x, _ps256_cephes_exp_p1);
+  y = avx_madd_ps(y, x, _ps256_cephes_exp_p2);
+  y = avx_madd_ps(y, x, _ps256_cephes_exp_p3);
+  y = avx_madd_ps(y, x, _ps256_cephes_exp_p4);
+  y = avx_madd_ps(y, x, _ps256_cephes_exp_p5);
+  y = avx_madd_ps(y, z, x);
+  y = _mm256_add_ps(y, _ps256_1);
+
+  /* build 2^n */
+  v8si emm0 = _mm256_cvttps_epi32(fx);
+  emm0 = _mm256_add_epi32(emm0, _pi32_256_0x7f);
+  emm0 = _mm256_slli_epi32(emm0, 23);
+  return _mm256_mul_ps(y, _mm256_castsi256_ps(emm0));
+}
+
+/* Double precision versions, 4 doubles at a time, using the cephes double
+   precision polynoms (see sse_mathfun_pd.h for the SSE2 equivalent) */
+typedef __m256d v4df; // vector of 4 double (avx)
+
+#define _PD256_CONST(Name, Val) \
+  const v4df _pd256_##Name = _mm256_set1_pd(Val)
+#define _PI64_256_CONST(Name, Val) \
+  const v8si _pi64_256_##Name = _mm256_set1_epi64x(Val)
+
+#ifdef __FMA__
+#define avx_madd_pd(a,b,c) _mm256_fmadd_pd(a,b,c)
+#else
+#define avx_madd_pd(a,b,c) _mm256_add_pd(_mm256_mul_pd(a,b),c)
+#endif
+
+inline void avx_sincos_poly_pd(const v4df x, v4df &y, v4df &y2)
+{
+  _PD256_CONST(1  , 1.0);
+  _PD256_CONST(0p5, 0.5);
+  _PD256_CONST(sincof_p0,  1.58962301576546568060E-10);
+  _PD256_CONST(sincof_p1, -2.50507477628578072866E-8);
+  _PD256_CONST(sincof_p2,  2.75573136213857245213E-6);
+  _PD256_CONST(sincof_p3, -1.98412698295895385996E-4);
+  _PD256_CONST(sincof_p4,  8.33333333332211858878E-3);
+  _PD256_CONST(sincof_p5, -1.66666666666666307295E-1);
+  _PD256_CONST(coscof_p0, -1.13585365213876817300E-11);
+  _PD256_CONST(coscof_p1,  2.08757008419747316778E-9);
+  _PD256_CONST(coscof_p2, -2.75573141792967388112E-7);
+  _PD256_CONST(coscof_p3,  2.48015872888517045348E-5);
+  _PD256_CONST(coscof_p4, -1.38888888888730564116E-3);
+  _PD256_CONST(coscof_p5,  4.16666666666665929218E-2);
+
+  const v4df z = _mm256_mul_pd(x,x);
+
+  /* Evaluate the first polynom  (0 <= x <= Pi/4) */
+  y = avx_madd_pd(_pd256_coscof_p0, z, _pd256_coscof_p1);
+  y = avx_madd_pd(y, z, _pd256_coscof_p2);
+  y = avx_madd_pd(y, z, _pd256_coscof_p3);
+  y = avx_madd_pd(y, z, _pd256_coscof_p4);
+  y = avx_madd_pd(y, z, _pd256_coscof_p5);
+  y = _mm256_mul_pd(y, _mm256_mul_pd(z, z));
+  y = _mm256_sub_pd(y, _mm256_mul_pd(z, _pd256_0p5));
+  y = _mm256_add_pd(y, _pd256_1);
+
+  /* Evaluate the second polynom  (Pi/4 <= x <= 0) */
+  y2 = avx_madd_pd(_pd256_sincof_p0, z, _pd256_sincof_p1);
+  y2 = avx_madd_pd(y2, z, _pd256_sincof_p2);
+  y2 = avx_madd_pd(y2, z, _pd256_sincof_p3);
+  y2 = avx_madd_pd(y2, z, _pd256_sincof_p4);
+  y2 = avx_madd_pd(y2, z, _pd256_sincof_p5);
+  y2 = _mm256_mul_pd(y2, z);
+  y2 = avx_madd_pd(y2, x, x);
+}
+
+/* range reduction: returns the integer octant j (with j=(j+1)&~1) as
+   64-bit integers, and reduces x (>=0) to [-Pi/4;Pi/4] */
+inline v8si avx_sincos_reduce_pd(v4df &x)
+{
+  _PD256_CONST(minus_cephes_DP1, -7.85398125648498535156E-1);
+  _PD256_CONST(minus_cephes_DP2, -3.77489470793079817668E-8);
+  _PD256_CONST(minus_cephes_DP3, -2.69515142907905952645E-15);
+  _PD256_CONST(cephes_FOPI, 1.27323954473516268615); // 4 / M_PI
+
+  __m128i emm2 = _mm256_cvttpd_epi32(_mm256_mul_pd(x, _pd256_cephes_FOPI));
+  /* j=(j+1) & (~1) (see the cephes sources) */
+  emm2 = _mm_add_epi32(emm2, _mm_set1_epi32(1));
+  emm2 = _mm_and_si128(emm2, _mm_set1_epi32(~1));
+  const v4df y = _mm256_cvtepi32_pd(emm2);
+
+  /* x = ((x - y * DP1) - y * DP2) - y * DP3; */
+  x = avx_madd_pd(y, _pd256_minus_cephes_DP1, x);
+  x = avx_madd_pd(y, _pd256_minus_cephes_DP2, x);
+  x = avx_madd_pd(y, _pd256_minus_cephes_DP3, x);
+  return _mm256_cvtepi32_epi64(emm2);
+}
+
+/* evaluation of sin and cos, any x */
+inline void sincos256_pd(v4df x, v4df *s, v4df *c)
+{
+  _PI64_256_CONST(2, 2);
+  _PI64_256_CONST(4, 4);
+  const v4df sign_mask = _mm256_set1_pd(-0.0);
+
+  /* extract the sign bit (upper one) */
+  v4df sign_bit_sin = _mm256_and_pd(x, sign_mask);
+  /* take the absolute value */
+  x = _mm256_andnot_pd(sign_mask, x);
+
+  const v8si j = avx_sincos_reduce_pd(x);
+
+  /* get the swap sign flag for the sine */
+  sign_bit_sin = _mm256_xor_pd(sign_bit_sin,
+                               _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_and_si256(j, _pi64_256_4), 61)));
+  /* get the polynom selection mask */
+  const v4df poly_mask = _mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(j, _pi64_256_2),
+                                                                _mm256_setzero_si256()));
+  /* get the sign flag for the cosine */
+  const v4df sign_bit_cos = _mm256_castsi256_pd(_mm256_slli_epi64(
+                               _mm256_andnot_si256(_mm256_sub_epi64(j, _pi64_256_2), _pi64_256_4), 61));
+  v4df y, y2;
+  avx_sincos_poly_pd(x, y, y2);
+
+  /* select the correct result from the two polynoms, and update the sign */
+  *s = _mm256_xor_pd(_mm256_blendv_pd(y, y2, poly_mask), sign_bit_sin);
+  *c = _mm256_xor_pd(_mm256_blendv_pd(y2, y, poly_mask), sign_bit_cos);
+}
+
+/* evaluation of cos, any x */
+inline v4df cos256_pd(v4df x)
+{
+  _PI64_256_CONST(2, 2);
+  _PI64_256_CONST(4, 4);
+  /* take the absolute value */
+  x = _mm256_andnot_pd(_mm256_set1_pd(-0.0), x);
+
+  const v8si j = avx_sincos_reduce_pd(x);
+
+  const v4df poly_mask = _mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(j, _pi64_256_2),
+                                                                _mm256_setzero_si256()));
+  const v4df sign_bit_cos = _mm256_castsi256_pd(_mm256_slli_epi64(
+                               _mm256_andnot_si256(_mm256_sub_epi64(j, _pi64_256_2), _pi64_256_4), 61));
+  v4df y, y2;
+  avx_sincos_poly_pd(x, y, y2);
+  return _mm256_xor_pd(_mm256_blendv_pd(y2, y, poly_mask), sign_bit_cos);
+}
+
+#endif // _OBJCRYST_AVX_MATHFUN_H_
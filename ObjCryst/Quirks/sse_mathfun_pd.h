@@ -0,0 +1,231 @@
+/* SIMD (SSE2) implementation of sin, cos and exp for double precision values
+
+   This uses the same approach as sse_mathfun.h (range reduction with
+   "Extended precision modular arithmetic", and polynom selection with
+   masks rather than branches), with the double precision polynoms of
+   the cephes math library, giving a precision close to the standard
+   sin() and cos() functions.
+
+   This is used when ObjCryst++ is compiled with REAL=double.
+
+NOTE:
+- This requires SSE2.
+- Modifications for inclusion in ObjCryst++ (http://objcryst.sf.net):
+ - functions are inline.
+*/
+
+/* Copyright (C) 2007  Julien Pommier (original single precision SSE version)
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+
+  (this is the zlib license)
+*/
+#ifndef _OBJCRYST_SSE_MATHFUN_PD_H_
+#define _OBJCRYST_SSE_MATHFUN_PD_H_
+
+#include <emmintrin.h>
+
+typedef __m128d v2df; // vector of 2 double (sse2)
+
+/* Constants are declared locally in each function (the compiler turns them into
+   constant loads), rather than as global aligned arrays like in sse_mathfun.h */
+#define _PD_CONST(Name, Val) \
+  const v2df _pd_##Name = _mm_set1_pd(Val)
+#define _PI64_CONST(Name, Val) \
+  const __m128i _pi64_##Name = _mm_set1_epi64x(Val)
+
+/* evaluation of the cephes double precision sin & cos polynoms, with x reduced
+   to [-Pi/4;Pi/4], y the result of the cosine polynom and y2 the one of the sine polynom */
+inline void sse_sincos_poly_pd(const v2df x, v2df &y, v2df &y2)
+{
+  _PD_CONST(1  , 1.0);
+  _PD_CONST(0p5, 0.5);
+  _PD_CONST(sincof_p0,  1.58962301576546568060E-10);
+  _PD_CONST(sincof_p1, -2.50507477628578072866E-8);
+  _PD_CONST(sincof_p2,  2.75573136213857245213E-6);
+  _PD_CONST(sincof_p3, -1.98412698295895385996E-4);
+  _PD_CONST(sincof_p4,  8.33333333332211858878E-3);
+  _PD_CONST(sincof_p5, -1.66666666666666307295E-1);
+  _PD_CONST(coscof_p0, -1.13585365213876817300E-11);
+  _PD_CONST(coscof_p1,  2.08757008419747316778E-9);
+  _PD_CONST(coscof_p2, -2.75573141792967388112E-7);
+  _PD_CONST(coscof_p3,  2.48015872888517045348E-5);
+  _PD_CONST(coscof_p4, -1.38888888888730564116E-3);
+  _PD_CONST(coscof_p5,  4.16666666666665929218E-2);
+
+  const v2df z = _mm_mul_pd(x,x);
+
+  /* Evaluate the first polynom  (0 <= x <= Pi/4) */
+  y = _mm_add_pd(_mm_mul_pd(_pd_coscof_p0, z), _pd_coscof_p1);
+  y = _mm_add_pd(_mm_mul_pd(y, z), _pd_coscof_p2);
+  y = _mm_add_pd(_mm_mul_pd(y, z), _pd_coscof_p3);
+  y = _mm_add_pd(_mm_mul_pd(y, z), _pd_coscof_p4);
+  y = _mm_add_pd(_mm_mul_pd(y, z), _pd_coscof_p5);
+  y = _mm_mul_pd(y, _mm_mul_pd(z, z));
+  y = _mm_sub_pd(y, _mm_mul_pd(z, _pd_0p5));
+  y = _mm_add_pd(y, _pd_1);
+
+  /* Evaluate the second polynom  (Pi/4 <= x <= 0) */
+  y2 = _mm_add_pd(_mm_mul_pd(_pd_sincof_p0, z), _pd_sincof_p1);
+  y2 = _mm_add_pd(_mm_mul_pd(y2, z), _pd_sincof_p2);
+  y2 = _mm_add_pd(_mm_mul_pd(y2, z), _pd_sincof_p3);
+  y2 = _mm_add_pd(_mm_mul_pd(y2, z), _pd_sincof_p4);
+  y2 = _mm_add_pd(_mm_mul_pd(y2, z), _pd_sincof_p5);
+  y2 = _mm_mul_pd(y2, z);
+  y2 = _mm_add_pd(_mm_mul_pd(y2, x), x);
+}
+
+/* range reduction: takes |x|, returns the integer octant j (with j=(j+1)&~1)
+   as 64-bit integers, and reduces x to [-Pi/4;Pi/4] */
+inline __m128i sse_sincos_reduce_pd(v2df &x)
+{
+  _PD_CONST(minus_cephes_DP1, -7.85398125648498535156E-1);
+  _PD_CONST(minus_cephes_DP2, -3.77489470793079817668E-8);
+  _PD_CONST(minus_cephes_DP3, -2.69515142907905952645E-15);
+  _PD_CONST(cephes_FOPI, 1.27323954473516268615); // 4 / M_PI
+
+  /* scale by 4/Pi and store the integer part in emm2 */
+  __m128i emm2 = _mm_cvttpd_epi32(_mm_mul_pd(x, _pd_cephes_FOPI));
+  /* j=(j+1) & (~1) (see the cephes sources) */
+  emm2 = _mm_add_epi32(emm2, _mm_set1_epi32(1));
+  emm2 = _mm_and_si128(emm2, _mm_set1_epi32(~1));
+  const v2df y = _mm_cvtepi32_pd(emm2);
+
+  /* x = ((x - y * DP1) - y * DP2) - y * DP3; */
+  x = _mm_add_pd(x, _mm_mul_pd(y, _pd_minus_cephes_DP1));
+  x = _mm_add_pd(x, _mm_mul_pd(y, _pd_minus_cephes_DP2));
+  x = _mm_add_pd(x, _mm_mul_pd(y, _pd_minus_cephes_DP3));
+  /* j>=0, so we can just interleave with zeros to get 64-bit integers */
+  return _mm_unpacklo_epi32(emm2, _mm_setzero_si128());
+}
+
+/* polynom selection mask (all bits set if (j&2)==0) */
+inline v2df sse_sincos_polymask_pd(const __m128i j)
+{
+  _PI64_CONST(2, 2);
+  const __m128i m = _mm_cmpeq_epi32(_mm_and_si128(j, _pi64_2), _mm_setzero_si128());
+  // Only the lower 32 bits of each 64-bit value are relevant
+  return _mm_castsi128_pd(_mm_shuffle_epi32(m, _MM_SHUFFLE(2,2,0,0)));
+}
+
+/* sign flag for the cosine */
+inline v2df sse_cos_signbit_pd(const __m128i j)
+{
+  _PI64_CONST(2, 2);
+  _PI64_CONST(4, 4);
+  return _mm_castsi128_pd(_mm_slli_epi64(_mm_andnot_si128(_mm_sub_epi64(j, _pi64_2), _pi64_4), 61));
+}
+
+/* evaluation of sin and cos, any x */
+inline void sincos_pd(v2df x, v2df *s, v2df *c)
+{
+  _PI64_CONST(4, 4);
+  const v2df sign_mask = _mm_set1_pd(-0.0);
+
+  /* extract the sign bit (upper one) */
+  v2df sign_bit_sin = _mm_and_pd(x, sign_mask);
+  /* take the absolute value */
+  x = _mm_andnot_pd(sign_mask, x);
+
+  const __m128i j = sse_sincos_reduce_pd(x);
+
+  /* get the swap sign flag for the sine */
+  sign_bit_sin = _mm_xor_pd(sign_bit_sin, _mm_castsi128_pd(_mm_slli_epi64(_mm_and_si128(j, _pi64_4), 61)));
+
+  const v2df poly_mask = sse_sincos_polymask_pd(j);
+  const v2df sign_bit_cos = sse_cos_signbit_pd(j);
+
+  v2df y, y2;
+  sse_sincos_poly_pd(x, y, y2);
+
+  /* select the correct result from the two polynoms */
+  const v2df ysin = _mm_or_pd(_mm_and_pd(poly_mask, y2), _mm_andnot_pd(poly_mask, y));
+  const v2df ycos = _mm_or_pd(_mm_and_pd(poly_mask, y), _mm_andnot_pd(poly_mask, y2));
+
+  /* update the sign */
+  *s = _mm_xor_pd(ysin, sign_bit_sin);
+  *c = _mm_xor_pd(ycos, sign_bit_cos);
+}
+
+/* evaluation of cos, any x */
+inline v2df cos_pd(v2df x)
+{
+  /* take the absolute value */
+  x = _mm_andnot_pd(_mm_set1_pd(-0.0), x);
+
+  const __m128i j = sse_sincos_reduce_pd(x);
+
+  const v2df poly_mask = sse_sincos_polymask_pd(j);
+  v2df y, y2;
+  sse_sincos_poly_pd(x, y, y2);
+  return _mm_xor_pd(_mm_or_pd(_mm_and_pd(poly_mask, y), _mm_andnot_pd(poly_mask, y2)),
+                    sse_cos_signbit_pd(j));
+}
+
+/* evaluation of exp(x), using the cephes double precision Pade approximation
+   (x is clamped to the range where the result is a normal number) */
+inline v2df exp_pd(v2df x)
+{
+  _PD_CONST(1  , 1.0);
+  _PD_CONST(0p5, 0.5);
+  _PD_CONST(2  , 2.0);
+  _PD_CONST(exp_hi,  709.0);
+  _PD_CONST(exp_lo, -708.0);
+  _PD_CONST(cephes_LOG2E, 1.4426950408889634073599);
+  _PD_CONST(cephes_exp_C1, 6.93145751953125E-1);
+  _PD_CONST(cephes_exp_C2, 1.42860682030941723212E-6);
+  _PD_CONST(cephes_exp_p0, 1.26177193074810590878E-4);
+  _PD_CONST(cephes_exp_p1, 3.02994407707441961300E-2);
+  _PD_CONST(cephes_exp_p2, 9.99999999999999999910E-1);
+  _PD_CONST(cephes_exp_q0, 3.00198505138664455042E-6);
+  _PD_CONST(cephes_exp_q1, 2.52448340349684104192E-3);
+  _PD_CONST(cephes_exp_q2, 2.27265548208155028766E-1);
+  _PD_CONST(cephes_exp_q3, 2.00000000000000000009E0);
+
+  x = _mm_min_pd(x, _pd_exp_hi);
+  x = _mm_max_pd(x, _pd_exp_lo);
+
+  /* express exp(x) as exp(g + n*log(2)), n=floor(x*log2(e)+0.5) (no _mm_floor_pd in SSE2) */
+  v2df fx = _mm_add_pd(_mm_mul_pd(x, _pd_cephes_LOG2E), _pd_0p5);
+  __m128i emm0 = _mm_cvttpd_epi32(fx);
+  v2df tmp = _mm_cvtepi32_pd(emm0);
+  const v2df mask = _mm_cmpgt_pd(tmp, fx);
+  fx = _mm_sub_pd(tmp, _mm_and_pd(mask, _pd_1));
+  emm0 = _mm_cvttpd_epi32(fx);
+
+  x = _mm_sub_pd(x, _mm_mul_pd(fx, _pd_cephes_exp_C1));
+  x = _mm_sub_pd(x, _mm_mul_pd(fx, _pd_cephes_exp_C2));
+
+  /* rational approximation: exp(g) = 1 + 2g P(g^2) / (Q(g^2) - g P(g^2)) */
+  const v2df z = _mm_mul_pd(x, x);
+  v2df p = _mm_add_pd(_mm_mul_pd(_pd_cephes_exp_p0, z), _pd_cephes_exp_p1);
+  p = _mm_add_pd(_mm_mul_pd(p, z), _pd_cephes_exp_p2);
+  p = _mm_mul_pd(p, x);
+  v2df q = _mm_add_pd(_mm_mul_pd(_pd_cephes_exp_q0, z), _pd_cephes_exp_q1);
+  q = _mm_add_pd(_mm_mul_pd(q, z), _pd_cephes_exp_q2);
+  q = _mm_add_pd(_mm_mul_pd(q, z), _pd_cephes_exp_q3);
+  v2df y = _mm_div_pd(p, _mm_sub_pd(q, p));
+  y = _mm_add_pd(_mm_mul_pd(y, _pd_2), _pd_1);
+
+  /* build 2^n (n+1023 is positive, so the 32-bit integers can be interleaved with zeros) */
+  emm0 = _mm_add_epi32(emm0, _mm_set1_epi32(1023));
+  emm0 = _mm_unpacklo_epi32(emm0, _mm_setzero_si128());
+  emm0 = _mm_slli_epi64(emm0, 52);
+  return _mm_mul_pd(y, _mm_castsi128_pd(emm0));
+}
+
+#endif // _OBJCRYST_SSE_MATHFUN_PD_H_
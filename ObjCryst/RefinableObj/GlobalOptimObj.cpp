@@ -24,6 +24,8 @@
 
 #include "ObjCryst/RefinableObj/GlobalOptimObj.h"
 #include "ObjCryst/ObjCryst/Crystal.h"
+#include "ObjCryst/ObjCryst/PowderPattern.h"
+#include "ObjCryst/ObjCryst/DiffractionDataSingleCrystal.h"
 #include "ObjCryst/Quirks/VFNStreamFormat.h"
 #include "ObjCryst/Quirks/VFNDebug.h"
 #include "ObjCryst/Quirks/Chronometer.h"
@@ -109,11 +111,11 @@ void OptimizationObj::RandomizeStartingConfig()
       {
          const REAL min=mRefParList.GetParNotFixed(j).GetMin();
          const REAL max=mRefParList.GetParNotFixed(j).GetMax();
-         mRefParList.GetParNotFixed(j).MutateTo(min+(max-min)*(rand()/(REAL)RAND_MAX) );
+         mRefParList.GetParNotFixed(j).MutateTo(min+(max-min)*(ObjCrystRand()/(REAL)RAND_MAX) );
       }
       else if(true==mRefParList.GetParNotFixed(j).IsPeriodic())
              mRefParList.GetParNotFixed(j).
-                Mutate(mRefParList.GetParNotFixed(j).GetPeriod()*rand()/(REAL)RAND_MAX);
+                Mutate(mRefParList.GetParNotFixed(j).GetPeriod()*ObjCrystRand()/(REAL)RAND_MAX);
    }
       //else cout << mRefParList.GetParNotFixed(j).Name() <<" Not limited :-(" <<endl;
    VFN_DEBUG_EXIT("OptimizationObj::RandomizeStartingConfig()",5)
@@ -475,7 +477,7 @@ OptimizationObj(name),
 mCurrentCost(-1),
 mTemperatureMax(1e6),mTemperatureMin(.001),mTemperatureGamma(1.0),
 mMutationAmplitudeMax(8.),mMutationAmplitudeMin(.125),mMutationAmplitudeGamma(1.0),
-mNbTrialRetry(0),mMinCostRetry(0)
+mNbTrialRetry(0),mMinCostRetry(0),mNbWorld(30)
 #ifdef __WX__CRYST__
 ,mpWXCrystObj(0)
 #endif
@@ -496,7 +498,7 @@ OptimizationObj(""),
 mCurrentCost(-1),
 mTemperatureMax(.03),mTemperatureMin(.003),mTemperatureGamma(1.0),
 mMutationAmplitudeMax(16.),mMutationAmplitudeMin(.125),mMutationAmplitudeGamma(1.0),
-mNbTrialRetry(0),mMinCostRetry(0)
+mNbTrialRetry(0),mMinCostRetry(0),mNbWorld(30)
 #ifdef __WX__CRYST__
 ,mpWXCrystObj(0)
 #endif
@@ -516,6 +518,15 @@ MonteCarloObj::~MonteCarloObj()
 {
    VFN_DEBUG_ENTRY("MonteCarloObj::~MonteCarloObj()",5)
    gOptimizationObjRegistry.DeRegister(*this);
+   if(mvpCopiedObj.size()>0)
+   {// Objects created by CreateParallelCopy(). Delete diffraction data before crystals
+      mRefParList.ResetParList();
+      mRecursiveRefinedObjList.DeRegisterAll();
+      mRefinedObjList.DeRegisterAll();
+      for(std::vector<RefinableObj*>::reverse_iterator pos=mvpCopiedObj.rbegin();pos!=mvpCopiedObj.rend();++pos)
+         delete *pos;
+      mvpCopiedObj.clear();
+   }
    VFN_DEBUG_EXIT ("MonteCarloObj::~MonteCarloObj()",5)
 }
 void MonteCarloObj::SetAlgorithmSimulAnnealing(const AnnealingSchedule scheduleTemp,
@@ -664,6 +675,151 @@ void MonteCarloObj::MultiRunOptimize(long &nbCycle,long &nbStep,const bool silen
    long nbTrialCumul=0;
    const long nbCycle0=nbCycle;
 	Chronometer chrono;
+   // With several threads, independent runs are made concurrently, each thread
+   // using its own copy of the optimized objects.
+   vector<MonteCarloObj*> vpCopy;
+   #ifdef _OPENMP
+   if(  (GetNbThread()>1)&&(nbCycle!=1)&&(mvpCopiedObj.size()==0)
+      &&(mGlobalOptimType.GetChoice()!=GLOBAL_OPTIM_RANDOM_LSQ))
+   {
+      long nbCopy=GetNbThread();
+      if((nbCycle>0)&&(nbCycle<nbCopy)) nbCopy=nbCycle;
+      for(long i=0;i<nbCopy;i++)
+      {
+         MonteCarloObj *pCopy=this->CreateParallelCopy();
+         if(pCopy==0) break;
+         pCopy->InitLSQ(false);
+         vpCopy.push_back(pCopy);
+      }
+      if(vpCopy.size()!=(unsigned long)nbCopy)
+      {
+         if(!silent) cout<<"MonteCarloObj::MultiRunOptimize: could not copy the optimized objects, runs will not be made in parallel"<<endl;
+         for(vector<MonteCarloObj*>::iterator pos=vpCopy.begin();pos!=vpCopy.end();++pos)
+         {
+            (*pos)->EndOptimization();
+            delete *pos;
+         }
+         vpCopy.clear();
+      }
+   }
+   #endif
+   if(vpCopy.size()>0)
+   {
+      const long nbCopy=vpCopy.size();
+      if(!silent) cout <<"MonteCarloObj::MultiRunOptimize: making runs using "<<nbCopy<<" threads"<<endl;
+      chrono.start();
+      // Each run only uses its own copy of the objects, including cell parameters and
+      // any derived matrices. The cost computation (e.g. UnitCell::InitMatrices())
+      // must therefore not use any function-static buffer, which would be shared
+      // between the concurrent runs.
+      // Random generator state of each copy, used for the randomization and the optimization
+      vector<unsigned long> vCopyRandomState(nbCopy);
+      for(long k=0;k<nbCopy;k++) vCopyRandomState[k]=InitRandomState(ObjCrystRand());
+      #ifdef _OPENMP
+      #pragma omp parallel for schedule(static,1) num_threads(nbCopy)
+      #endif
+      for(long k=0;k<nbCopy;k++)
+      {
+         MonteCarloObj *pCopy=vpCopy[k];
+         SetRandomState(&vCopyRandomState[k]);
+         const long setIndex=pCopy->mRefParList.CreateParamSet("MultiRunOptimize: Run result");
+         while(true)
+         {
+            long run=-1;
+            #ifdef _OPENMP
+            #pragma omp critical(MonteCarloObj_MultiRunOptimize)
+            #endif
+            {
+               #ifdef __WX__CRYST__
+               mMutexStopAfterCycle.Lock();
+               #endif
+               if((nbCycle!=0)&&(false==mStopAfterCycle)) run=abs(nbCycle--);
+               #ifdef __WX__CRYST__
+               mMutexStopAfterCycle.Unlock();
+               #endif
+            }
+            if(run<0) break;
+            long nbStepRun=nbStep0;
+            Chronometer chronoRun;
+            chronoRun.start();
+            for(int i=0;i<pCopy->mRefinedObjList.GetNb();i++) pCopy->mRefinedObjList.GetObj(i).RandomizeConfiguration();
+            switch(mGlobalOptimType.GetChoice())
+            {
+               case GLOBAL_OPTIM_SIMULATED_ANNEALING:
+               {
+                  try{pCopy->RunSimulatedAnnealing(nbStepRun,true,finalcost,maxTime);}
+                  catch(...){cout<<"Unhandled exception in MonteCarloObj::MultiRunOptimize() ?"<<endl;}
+                  break;
+               }
+               case GLOBAL_OPTIM_PARALLEL_TEMPERING:
+               {
+                  try{pCopy->RunParallelTempering(nbStepRun,true,finalcost,maxTime);}
+                  catch(...){cout<<"Unhandled exception in MonteCarloObj::MultiRunOptimize() ?"<<endl;}
+                  break;
+               }
+            }
+            pCopy->mRefParList.SaveParamSet(setIndex);
+            const REAL cost=pCopy->GetLogLikelihood();
+            // Merge the result of the run
+            REAL bestCost;
+            #ifdef _OPENMP
+            #pragma omp critical(MonteCarloObj_MultiRunOptimize)
+            #endif
+            {
+               nbTrialCumul+=(nbStep0-nbStepRun);
+               stringstream s;
+               s<<"Run #"<<run;
+               const long runIndex=mRefParList.CreateParamSet(s.str());
+               mRefParList.GetParamSet(runIndex)=pCopy->mRefParList.GetParamSet(setIndex);
+               mvSavedParamSet.push_back(make_pair(runIndex,cost));
+               if(cost<mBestCost)
+               {
+                  mBestCost=cost;
+                  mRefParList.GetParamSet(mBestParSavedSetIndex)=mRefParList.GetParamSet(runIndex);
+               }
+               bestCost=mBestCost;
+            }
+            // Display and save the run result using the optimized objects. This is kept out
+            // of the above critical section (which also hands out the runs), and the parameters
+            // are copied directly from the run result, without accessing the saved parameter sets.
+            #ifdef _OPENMP
+            #pragma omp critical(MonteCarloObj_MultiRunOptimize_Output)
+            #endif
+            {
+               const CrystVector_REAL *pRunPar=&(pCopy->mRefParList.GetParamSet(setIndex));
+               for(long i=0;i<mRefParList.GetNbPar();i++)
+                  if(mRefParList.GetPar(i).IsUsed()) mRefParList.GetPar(i).SetValue((*pRunPar)(i));
+               mCurrentCost=this->GetLogLikelihood();
+               (*fpObjCrystInformUser)((boost::format("Finished Run #%d, final cost=%12.2f, nbTrial=%d (dt=%.1fs)")
+                                        % run % mCurrentCost % (nbStep0-nbStepRun) % chronoRun.seconds()).str());
+               if(!silent) cout <<"MonteCarloObj::MultiRunOptimize: Finished Run#"
+                                <<run<<", Run Best Cost:"<<mCurrentCost
+                                <<", Overall Best Cost:"<<bestCost<<endl;
+               if(false==mStopAfterCycle) this->UpdateDisplay();
+               if(mXMLAutoSave.GetChoice()==5)
+               {
+                  string saveFileName=this->GetName();
+                  time_t date=time(0);
+                  char strDate[40];
+                  strftime(strDate,sizeof(strDate),"%Y-%m-%d_%H-%M-%S",localtime(&date));//%Y-%m-%dT%H:%M:%S%Z
+                  char costAsChar[30];
+                  sprintf(costAsChar,"-Run#%ld-Cost-%f",run,mCurrentCost);
+                  saveFileName=saveFileName+(string)strDate+(string)costAsChar+(string)".xml";
+                  XMLCrystFileSaveGlobal(saveFileName);
+               }
+            }
+         }
+         SetRandomState(0);
+      }
+      for(vector<MonteCarloObj*>::iterator pos=vpCopy.begin();pos!=vpCopy.end();++pos)
+      {
+         (*pos)->EndOptimization();
+         delete *pos;
+      }
+      vpCopy.clear();
+      if(!silent) chrono.print();
+   }
+   else
    while(nbCycle!=0)
    {
       if(!silent) cout <<"MonteCarloObj::MultiRunOptimize: Starting Run#"<<abs(nbCycle)<<endl;
@@ -912,7 +1068,7 @@ void MonteCarloObj::RunSimulatedAnnealing(long &nbStep,const bool silent,
       }
       else
       {
-         if( log((rand()+1)/(REAL)RAND_MAX) < (-(cost-mCurrentCost)/mTemperature) )
+         if( log((ObjCrystRand()+1)/(REAL)RAND_MAX) < (-(cost-mCurrentCost)/mTemperature) )
          {
             accept=1;
             mCurrentCost=cost;
@@ -1232,7 +1388,7 @@ void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
    //Total number of parallel refinements,each is a 'World'. The most stable
    // world must be i=nbWorld-1, and the most changing World (high mutation,
    // high temperature) is i=0.
-      const long nbWorld=30;
+      const long nbWorld=mNbWorld;
       CrystVector_long worldSwapIndex(nbWorld);
       for(int i=0;i<nbWorld;++i) worldSwapIndex(i)=i;
    // Number of successive trials for each World. At the end of these trials
@@ -1276,8 +1432,9 @@ void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
          switch(mAnnealingScheduleMutation.GetChoice())
          {
             case ANNEALING_BOLTZMANN:
+               // log(nbWorld-1) would be 0 with 2 worlds
                mutationAmplitude(i)=
-                  mMutationAmplitudeMin*log((REAL)(nbWorld-1))/log((REAL)(i+2));
+                  mMutationAmplitudeMin*log((REAL)((nbWorld>2)?(nbWorld-1):2))/log((REAL)(i+2));
                break;
             case ANNEALING_CAUCHY:
                mutationAmplitude(i)=mMutationAmplitudeMin*(REAL)(nbWorld-1)/(i+1);break;
@@ -1312,6 +1469,43 @@ void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
       const long lastParSavedSetIndex=mRefParList.CreateParamSet("MonteCarloObj:Last parameters (PT)");
       const long runBestIndex=mRefParList.CreateParamSet("Best parameters for current run (PT)");
       CrystVector_REAL swapPar;
+   // With several threads, each World uses its own copy of the optimized objects,
+   // and the trials of all Worlds are made concurrently. The parameter sets of
+   // the copies are synchronized with worldCurrentSetIndex before and after each
+   // series of trials.
+      vector<MonteCarloObj*> vpWorld;
+      vector<long> vWorldSetIndex,vWorldBestIndex;
+      // Random generator state of each World copy, used for its mutations and acceptance tests
+      vector<unsigned long> vWorldRandomState;
+      // Does the World copy need to be updated from worldCurrentSetIndex ?
+      CrystVector_int worldNeedSync(nbWorld);
+      worldNeedSync=1;
+      #ifdef _OPENMP
+      if((GetNbThread()>1)&&(mvpCopiedObj.size()==0))
+      {// (no nested parallel optimization if this is already a parallel copy)
+         for(int i=0;i<nbWorld;i++)
+         {
+            MonteCarloObj *pWorld=this->CreateParallelCopy();
+            if(pWorld==0) break;
+            vpWorld.push_back(pWorld);
+            vWorldSetIndex.push_back(pWorld->mRefParList.CreateParamSet("Current World parameters (PT)"));
+            vWorldBestIndex.push_back(pWorld->mRefParList.CreateParamSet("Best World parameters (PT)"));
+            vWorldRandomState.push_back(InitRandomState(ObjCrystRand()));
+         }
+         if(vpWorld.size()!=(unsigned long)nbWorld)
+         {
+            if(!silent) cout<<"Parallel Tempering: could not copy the optimized objects, Worlds will not be run in parallel"<<endl;
+            for(vector<MonteCarloObj*>::iterator pos=vpWorld.begin();pos!=vpWorld.end();++pos)
+            {
+               (*pos)->EndOptimization();
+               delete *pos;
+            }
+            vpWorld.clear();
+            vWorldRandomState.clear();
+         }
+         else if(!silent) cout<<"Parallel Tempering: running "<<nbWorld<<" Worlds using "<<GetNbThread()<<" threads"<<endl;
+      }
+      #endif
    //Keep track of how many trials are accepted for each World
       CrystVector_long worldNbAcceptedMoves(nbWorld);
       worldNbAcceptedMoves=0;
@@ -1351,6 +1545,120 @@ void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
    TAU_PROFILE_STOP(timer0b);
    for(;mNbTrial<nbSteps;)
    {
+      if(vpWorld.size()>0)
+      {
+         TAU_PROFILE_START(timer1);
+         for(int i=0;i<nbWorld;i++)
+            if(worldNeedSync(i)!=0)
+            {
+               vpWorld[i]->mRefParList.GetParamSet(vWorldSetIndex[i])=mRefParList.GetParamSet(worldCurrentSetIndex(i));
+               vpWorld[i]->mRefParList.RestoreParamSet(vWorldSetIndex[i]);
+               worldNeedSync(i)=0;
+            }
+         CrystVector_REAL worldBestCost(nbWorld);
+         worldBestCost=runBestCost;
+         bool error=false;
+         #ifdef _OPENMP
+         #pragma omp parallel for schedule(dynamic) num_threads(GetNbThread())
+         #endif
+         for(int i=0;i<nbWorld;i++)
+         {
+            MonteCarloObj *pWorld=vpWorld[i];
+            const long setIndex=vWorldSetIndex[i];
+            pWorld->mMutationAmplitude=mutationAmplitude(i);
+            pWorld->mTemperature=simAnnealTemp(i);
+            SetRandomState(&vWorldRandomState[i]);
+            try
+            {
+               for(int j=0;j<nbTryPerWorld;j++)
+               {
+                  // The last accepted configuration is the current one in the World copy,
+                  // so the parameters only need to be restored after a rejected trial.
+                  pWorld->NewConfiguration();
+                  const REAL cost=pWorld->GetLogLikelihood();
+                  if(  (cost<currentCost(i))
+                     ||(log((ObjCrystRand()+1)/(REAL)RAND_MAX)<(-(cost-currentCost(i))/simAnnealTemp(i))))
+                  {
+                     currentCost(i)=cost;
+                     pWorld->mRefParList.SaveParamSet(setIndex);
+                     worldNbAcceptedMoves(i)++;
+                     if(cost<worldBestCost(i))
+                     {
+                        worldBestCost(i)=cost;
+                        pWorld->mRefParList.SaveParamSet(vWorldBestIndex[i]);
+                     }
+                  }
+                  else pWorld->mRefParList.RestoreParamSet(setIndex);
+               }
+            }
+            catch(...)
+            {// Exceptions must not escape the parallel loop
+               error=true;
+            }
+            SetRandomState(0);
+         }
+         TAU_PROFILE_STOP(timer1);
+         for(int i=0;i<nbWorld;i++)
+            mRefParList.GetParamSet(worldCurrentSetIndex(i))=vpWorld[i]->mRefParList.GetParamSet(vWorldSetIndex[i]);
+         if(error)
+         {
+            for(vector<MonteCarloObj*>::iterator pos=vpWorld.begin();pos!=vpWorld.end();++pos)
+            {
+               (*pos)->EndOptimization();
+               delete *pos;
+            }
+            throw ObjCrystException("MonteCarloObj::RunParallelTempering(): error during parallel trials");
+         }
+         // New best configuration ?
+         long iBest=0;
+         for(int i=1;i<nbWorld;i++) if(worldBestCost(i)<worldBestCost(iBest)) iBest=i;
+         accept=0;
+         if(worldBestCost(iBest)<runBestCost)
+         {
+            accept=2;
+            runBestCost=worldBestCost(iBest);
+            mRefParList.GetParamSet(runBestIndex)=vpWorld[iBest]->mRefParList.GetParamSet(vWorldBestIndex[iBest]);
+            mRefParList.RestoreParamSet(runBestIndex);
+            this->TagNewBestConfig();
+            needUpdateDisplay=true;
+            if(runBestCost<mBestCost)
+            {
+               mBestCost=runBestCost;
+               mRefParList.SaveParamSet(mBestParSavedSetIndex);
+               if(!silent) cout << "->Trial :" << mNbTrial
+                             << " World="<< worldSwapIndex(iBest)
+                             << " Temp="<< simAnnealTemp(iBest)
+                             << " Mutation Ampl.: "<<mutationAmplitude(iBest)
+                             << " NEW OVERALL Best Cost="<<mBestCost<< endl;
+            }
+            else if(!silent) cout << "->Trial :" << mNbTrial
+                             << " World="<< worldSwapIndex(iBest)
+                             << " Temp="<< simAnnealTemp(iBest)
+                             << " Mutation Ampl.: "<<mutationAmplitude(iBest)
+                             << " NEW RUN Best Cost="<<runBestCost<< endl;
+            if(!silent) this->DisplayReport();
+         }
+         if(  ((mXMLAutoSave.GetChoice()==1)&&((chrono.seconds()-secondsWhenAutoSave)>86400))
+            ||((mXMLAutoSave.GetChoice()==2)&&((chrono.seconds()-secondsWhenAutoSave)>3600))
+            ||((mXMLAutoSave.GetChoice()==3)&&((chrono.seconds()-secondsWhenAutoSave)> 600))
+            ||((mXMLAutoSave.GetChoice()==4)&&(accept==2)) )
+         {
+            secondsWhenAutoSave=(unsigned long)chrono.seconds();
+            string saveFileName=this->GetName();
+            time_t date=time(0);
+            char strDate[40];
+            strftime(strDate,sizeof(strDate),"%Y-%m-%d_%H-%M-%S",localtime(&date));//%Y-%m-%dT%H:%M:%S%Z
+            char costAsChar[30];
+            mRefParList.RestoreParamSet(mBestParSavedSetIndex);
+            sprintf(costAsChar,"-Cost-%f",this->GetLogLikelihood());
+            saveFileName=saveFileName+(string)strDate+(string)costAsChar+(string)".xml";
+            XMLCrystFileSaveGlobal(saveFileName);
+         }
+         const long nbTrialWorlds=nbTryPerWorld*nbWorld;
+         mNbTrial+=nbTrialWorlds;nbStep-=nbTrialWorlds;
+         if((mNbTrial%nbTrialsReport)<nbTrialWorlds) makeReport=true;
+      }
+      else
       for(int i=0;i<nbWorld;i++)
       {
          mContext=i;
@@ -1401,7 +1709,7 @@ void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
             }
             else
             {
-               if(log((rand()+1)/(REAL)RAND_MAX)<(-(cost-currentCost(i))/mTemperature) )
+               if(log((ObjCrystRand()+1)/(REAL)RAND_MAX)<(-(cost-currentCost(i))/mTemperature) )
                {
                   accept=1;
                   currentCost(i)=cost;
@@ -1437,7 +1745,7 @@ void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
          if((mNbTrial%autoLSQPeriod)<(nbTryPerWorld*nbWorld))
          {// Try a quick LSQ ?
             for(int i=0;i<mRefinedObjList.GetNb();i++) mRefinedObjList.GetObj(i).SetApproximationFlag(false);
-            for(int i=nbWorld-5;i<nbWorld;i++)
+            for(long i=(nbWorld>5)?(nbWorld-5):0;i<nbWorld;i++)
             {
                #ifdef __WX__CRYST__
                mMutexStopAfterCycle.Lock();
@@ -1486,12 +1794,16 @@ void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
                #endif
                const REAL cost=this->GetLogLikelihood();
                if(!silent) cout<<" -> "<<cost<<endl;
-               if(cost<cost0) mRefParList.SaveParamSet(worldCurrentSetIndex(i));
+               if(cost<cost0)
+               {
+                  mRefParList.SaveParamSet(worldCurrentSetIndex(i));
+                  worldNeedSync(i)=1;
+               }
             }
             //  Need to go back to optimization with approximations allowed (they are not during LSQ)
             for(int i=0;i<mRefinedObjList.GetNb();i++) mRefinedObjList.GetObj(i).SetApproximationFlag(true);
             // And recompute LLK - since they will be lower
-            for(int i=nbWorld-5;i<nbWorld;i++)
+            for(long i=(nbWorld>5)?(nbWorld-5):0;i<nbWorld;i++)
             {
                mRefParList.RestoreParamSet(worldCurrentSetIndex(i));
                const REAL cost=this->GetLogLikelihood();
@@ -1500,6 +1812,7 @@ void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
                {
                   const REAL oldcost=currentCost(i);
                   mRefParList.SaveParamSet(worldCurrentSetIndex(i));
+                  worldNeedSync(i)=1;
                   currentCost(i)=cost;
                   if(cost<runBestCost)
                   {
@@ -1549,14 +1862,14 @@ void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
          cout<<i<<":"<<currentCost(i)<<":"<<this->GetLogLikelihood()<<endl;
          #endif
          #if 1
-         if( log((rand()+1)/(REAL)RAND_MAX)
+         if( log((ObjCrystRand()+1)/(REAL)RAND_MAX)
                 < (-(currentCost(i-1)-currentCost(i))/simAnnealTemp(i)))
          #else
          // Compare World (i-1) and World (i) with the same amplitude,
          // hence the same max likelihood error
          mRefParList.RestoreParamSet(worldCurrentSetIndex(i-1));
          mMutationAmplitude=mutationAmplitude(i);
-         if( log((rand()+1)/(REAL)RAND_MAX)
+         if( log((ObjCrystRand()+1)/(REAL)RAND_MAX)
                 < (-(this->GetLogLikelihood()-currentCost(i))/simAnnealTemp(i)))
          #endif
          {
@@ -1577,6 +1890,8 @@ void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
             const long tmpIndex=worldSwapIndex(i);
             worldSwapIndex(i)=worldSwapIndex(i-1);
             worldSwapIndex(i-1)=tmpIndex;
+            worldNeedSync(i)=1;
+            worldNeedSync(i-1)=1;
             #if 0
             // Compute correct costs in the case we use maximum likelihood
             mRefParList.RestoreParamSet(worldCurrentSetIndex(i));
@@ -1595,14 +1910,14 @@ void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
                "MonteCarloObj::Optimize (Try mating Worlds)"\
                ,"", TAU_FIELD);
       TAU_PROFILE_START(timer1);
-      if( (rand()/(REAL)RAND_MAX)<.1)
+      if( (ObjCrystRand()/(REAL)RAND_MAX)<.1)
       for(int k=nbWorld-1;k>nbWorld/2;k--)
          for(int i=k-nbWorld/3;i<k;i++)
          {
             #if 0
             // Random switching of gene groups
             for(unsigned int j=0;j<nbGeneGroup;j++)
-               crossoverGroupIndex(j)= (int) floor(rand()/((REAL)RAND_MAX-1)*2);
+               crossoverGroupIndex(j)= (int) floor(ObjCrystRand()/((REAL)RAND_MAX-1)*2);
             for(int j=0;j<mRefParList.GetNbPar();j++)
             {
                if(0==crossoverGroupIndex(refParGeneGroupIndex(j)-1))
@@ -1624,9 +1939,9 @@ void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
             #if 1
             // Switch gene groups in two parts
             unsigned int crossoverPoint1=
-               (int)(1+floor(rand()/((REAL)RAND_MAX-1)*(nbGeneGroup)));
+               (int)(1+floor(ObjCrystRand()/((REAL)RAND_MAX-1)*(nbGeneGroup)));
             unsigned int crossoverPoint2=
-               (int)(1+floor(rand()/((REAL)RAND_MAX-1)*(nbGeneGroup)));
+               (int)(1+floor(ObjCrystRand()/((REAL)RAND_MAX-1)*(nbGeneGroup)));
             if(crossoverPoint2<crossoverPoint1)
             {
                int tmp=crossoverPoint1;
@@ -1658,7 +1973,7 @@ void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
                if(junk==0) mRefParList.RestoreParamSet(parSetOffspringA);
                else mRefParList.RestoreParamSet(parSetOffspringB);
                REAL cost=this->GetLogLikelihood();
-               //if(log((rand()+1)/(REAL)RAND_MAX)
+               //if(log((ObjCrystRand()+1)/(REAL)RAND_MAX)
                //    < (-(cost-currentCost(k))/simAnnealTemp(k)))
                if(cost<currentCost(k))
                {
@@ -1772,8 +2087,12 @@ void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
             for(int i=0;i<nbWorld;i++)
             {
                cout<<"   World :"<<worldSwapIndex(i)<<":";
+               // In parallel mode, statistics are recorded in the World copy (context 0)
+               MonteCarloObj *pWorld=this;
+               unsigned long context=i;
+               if(vpWorld.size()>0) {pWorld=vpWorld[i];context=0;}
                map<const RefinableObj*,LogLikelihoodStats>::iterator pos;
-               for(pos=mvContextObjStats[i].begin();pos!=mvContextObjStats[i].end();++pos)
+               for(pos=pWorld->mvContextObjStats[context].begin();pos!=pWorld->mvContextObjStats[context].end();++pos)
                {
                   cout << pos->first->GetName()
                        << "(LLK="
@@ -1782,7 +2101,7 @@ void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
                        //<< pos->second.mTotalLogLikelihood/nbTrialsReport
                        //<< ", <delta(LLK)^2>="
                        //<< pos->second.mTotalLogLikelihoodDeltaSq/nbTrialsReport
-                       << ", w="<<mvObjWeight[pos->first].mWeight
+                       << ", w="<<pWorld->mvObjWeight[pos->first].mWeight
                        <<")  ";
                   pos->second.mTotalLogLikelihood=0;
                   pos->second.mTotalLogLikelihoodDeltaSq=0;
@@ -1873,6 +2192,12 @@ void MonteCarloObj::RunParallelTempering(long &nbStep,const bool silent,
    }//Trials
 
    TAU_PROFILE_START(timerN);
+   for(vector<MonteCarloObj*>::iterator pos=vpWorld.begin();pos!=vpWorld.end();++pos)
+   {
+      (*pos)->EndOptimization();
+      delete *pos;
+   }
+   vpWorld.clear();
    if(mAutoLSQ.GetChoice()>0)
    {// LSQ
       if(!silent) cout<<"Beginning final LSQ refinement"<<endl;
@@ -1976,6 +2301,14 @@ void MonteCarloObj::XMLOutput(ostream &os,int indent)const
       os<<tag2<<endl;
    }
 
+   {
+      XMLCrystTag tag2("NbWorld");
+      for(int i=0;i<indent;i++) os << "  " ;
+      os<<tag2<<mNbWorld;
+      tag2.SetIsEndTag(true);
+      os<<tag2<<endl;
+   }
+
    for(int j=0;j<mRefinedObjList.GetNb();j++)
    {
       XMLCrystTag tag2("RefinedObject",false,true);
@@ -2065,6 +2398,14 @@ void MonteCarloObj::XMLInput(istream &is,const XMLCrystTag &tagg)
          if(false==tag.IsEmptyTag()) XMLCrystTag junk(is);//:KLUDGE: for first release
          continue;
       }
+      if("NbWorld"==tag.GetName())
+      {
+         long nb;
+         is>>nb;
+         this->SetNbWorld(nb);
+         if(false==tag.IsEmptyTag()) XMLCrystTag junk(is);
+         continue;
+      }
       if("RefinedObject"==tag.GetName())
       {
          string name,type;
@@ -2082,6 +2423,129 @@ void MonteCarloObj::XMLInput(istream &is,const XMLCrystTag &tagg)
 
 const string MonteCarloObj::GetClassName()const { return "MonteCarloObj";}
 
+void MonteCarloObj::SetNbWorld(const long nb)
+{
+   if(nb<2) mNbWorld=2;
+   else mNbWorld=nb;
+}
+
+long MonteCarloObj::GetNbWorld()const {return mNbWorld;}
+
+MonteCarloObj* MonteCarloObj::CreateParallelCopy()
+{
+   VFN_DEBUG_ENTRY("MonteCarloObj::CreateParallelCopy()",5)
+   this->PrepareRefParList();
+   // Objects which can be copied through their XML description. Crystals must come
+   // first, as diffraction data objects refer to them by name.
+   static const string copiedClassNames[3]={"Crystal","PowderPattern","DiffractionDataSingleCrystal"};
+   vector<const RefinableObj*> vpObj;
+   for(unsigned int j=0;j<3;j++)
+      for(int i=0;i<mRecursiveRefinedObjList.GetNb();i++)
+         if(mRecursiveRefinedObjList.GetObj(i).GetClassName()==copiedClassNames[j])
+            vpObj.push_back(&(mRecursiveRefinedObjList.GetObj(i)));
+   for(int i=0;i<mRefinedObjList.GetNb();i++)
+      if(find(vpObj.begin(),vpObj.end(),&(mRefinedObjList.GetObj(i)))==vpObj.end())
+      {
+         VFN_DEBUG_EXIT("MonteCarloObj::CreateParallelCopy(): cannot copy "<<mRefinedObjList.GetObj(i).GetName(),5)
+         return 0;
+      }
+   stringstream ss;
+   ss.imbue(std::locale::classic());
+   for(vector<const RefinableObj*>::const_iterator pos=vpObj.begin();pos!=vpObj.end();++pos)
+      (*pos)->XMLOutput(ss,0);
+
+   MonteCarloObj *pCopy=new MonteCarloObj(true);
+   // Copies are not displayed
+   gCrystalRegistry.AutoUpdateUI(false);
+   gPowderPatternRegistry.AutoUpdateUI(false);
+   gDiffractionDataSingleCrystalRegistry.AutoUpdateUI(false);
+   // When a diffraction data object is loaded, the last registered Crystal with the
+   // corresponding name is used, i.e. the copy.
+   while(true)
+   {
+      XMLCrystTag tag(ss);
+      if(true==ss.eof()) break;
+      if(tag.GetName()=="Crystal")
+      {
+         Crystal* obj = new Crystal;
+         obj->XMLInput(ss,tag);
+         pCopy->mvpCopiedObj.push_back(obj);
+      }
+      if(tag.GetName()=="PowderPattern")
+      {
+         PowderPattern* obj = new PowderPattern;
+         obj->XMLInput(ss,tag);
+         pCopy->mvpCopiedObj.push_back(obj);
+      }
+      if(tag.GetName()=="DiffractionDataSingleCrystal")
+      {
+         DiffractionDataSingleCrystal* obj = new DiffractionDataSingleCrystal;
+         obj->XMLInput(ss,tag);
+         pCopy->mvpCopiedObj.push_back(obj);
+      }
+   }
+   gCrystalRegistry.AutoUpdateUI(true);
+   gPowderPatternRegistry.AutoUpdateUI(true);
+   gDiffractionDataSingleCrystalRegistry.AutoUpdateUI(true);
+   // Remove the copies from the global registries, so that they are not saved
+   // with XMLCrystFileSaveGlobal(), nor found when looking for an object by name.
+   for(vector<RefinableObj*>::iterator pos=pCopy->mvpCopiedObj.begin();pos!=pCopy->mvpCopiedObj.end();++pos)
+   {
+      gTopRefinableObjRegistry.DeRegister(**pos);
+      if((*pos)->GetClassName()=="Crystal")
+         gCrystalRegistry.DeRegister(*dynamic_cast<Crystal*>(*pos));
+      else if((*pos)->GetClassName()=="PowderPattern")
+         gPowderPatternRegistry.DeRegister(*dynamic_cast<PowderPattern*>(*pos));
+      else if((*pos)->GetClassName()=="DiffractionDataSingleCrystal")
+         gDiffractionDataSingleCrystalRegistry.DeRegister(*dynamic_cast<DiffractionDataSingleCrystal*>(*pos));
+   }
+   if(pCopy->mvpCopiedObj.size()!=vpObj.size())
+   {
+      delete pCopy;
+      VFN_DEBUG_EXIT("MonteCarloObj::CreateParallelCopy(): XML copy failed",5)
+      return 0;
+   }
+   for(int i=0;i<mRefinedObjList.GetNb();i++)
+   {
+      const long j=find(vpObj.begin(),vpObj.end(),&(mRefinedObjList.GetObj(i)))-vpObj.begin();
+      pCopy->AddRefinableObj(*(pCopy->mvpCopiedObj[j]));
+   }
+   pCopy->SetName(this->GetName());
+   pCopy->mGlobalOptimType.SetChoice(mGlobalOptimType.GetChoice());
+   pCopy->mAnnealingScheduleTemp.SetChoice(mAnnealingScheduleTemp.GetChoice());
+   pCopy->mAnnealingScheduleMutation.SetChoice(mAnnealingScheduleMutation.GetChoice());
+   pCopy->mAutoLSQ.SetChoice(mAutoLSQ.GetChoice());
+   pCopy->mXMLAutoSave.SetChoice(0);
+   pCopy->mSaveTrackedData.SetChoice(0);
+   pCopy->mTemperatureMax=mTemperatureMax;
+   pCopy->mTemperatureMin=mTemperatureMin;
+   pCopy->mTemperatureGamma=mTemperatureGamma;
+   pCopy->mMutationAmplitudeMax=mMutationAmplitudeMax;
+   pCopy->mMutationAmplitudeMin=mMutationAmplitudeMin;
+   pCopy->mMutationAmplitudeGamma=mMutationAmplitudeGamma;
+   pCopy->mNbTrialRetry=mNbTrialRetry;
+   pCopy->mMinCostRetry=mMinCostRetry;
+   pCopy->mNbWorld=mNbWorld;
+   pCopy->BeginOptimization(true);
+   pCopy->PrepareRefParList();
+   if(pCopy->mRefParList.GetNbPar()!=mRefParList.GetNbPar())
+   {
+      pCopy->EndOptimization();
+      delete pCopy;
+      VFN_DEBUG_EXIT("MonteCarloObj::CreateParallelCopy(): different number of parameters",5)
+      return 0;
+   }
+   // Use exactly the same parameters values (the XML output has a limited precision)
+   const long tmpIndex=mRefParList.CreateParamSet("Parallel copy (temporary)");
+   const long copyIndex=pCopy->mRefParList.CreateParamSet("Parallel copy (temporary)");
+   pCopy->mRefParList.GetParamSet(copyIndex)=mRefParList.GetParamSet(tmpIndex);
+   pCopy->mRefParList.RestoreParamSet(copyIndex);
+   pCopy->mRefParList.ClearParamSet(copyIndex);
+   mRefParList.ClearParamSet(tmpIndex);
+   VFN_DEBUG_EXIT("MonteCarloObj::CreateParallelCopy()",5)
+   return pCopy;
+}
+
 LSQNumObj& MonteCarloObj::GetLSQObj() {return mLSQ;}
 
 const LSQNumObj& MonteCarloObj::GetLSQObj() const{return mLSQ;}
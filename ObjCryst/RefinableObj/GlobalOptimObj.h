@@ -439,6 +439,16 @@ class MonteCarloObj:public OptimizationObj
 
       void RunRandomLSQMethod(long &nbCycle);
 
+      /** \brief Set the number of parallel 'worlds' used for Parallel Tempering (default: 30)
+      *
+      * If ObjCryst++ was compiled with OpenMP support and several threads are used (see
+      * ObjCryst::SetNbThread()), the worlds are evaluated concurrently, each using its own
+      * copy of the optimized objects.
+      */
+      void SetNbWorld(const long nb);
+      /// Number of parallel 'worlds' used for Parallel Tempering
+      long GetNbWorld()const;
+
       //Parameter Access by name
       //RefinablePar& GetPar(const string& parName);
 
@@ -481,6 +491,20 @@ class MonteCarloObj:public OptimizationObj
 
       virtual void InitOptions();
 
+      /** \brief Create a copy of this optimization object, using copies of all the optimized
+      * objects, so that it can be used concurrently in another thread.
+      *
+      * The optimized objects (Crystal, PowderPattern and DiffractionDataSingleCrystal) are
+      * copied through their XML description, and belong to the returned object, which also
+      * gets the same algorithm settings (but no automatic saving). The copy is ready for
+      * optimization (BeginOptimization() and PrepareRefParList() have been called), with the
+      * same list of parameters as this object.
+      *
+      * \return the copy, or 0 if one of the optimized objects cannot be copied.
+      * \note this must be called from the main thread, as it creates new objects.
+      */
+      MonteCarloObj* CreateParallelCopy();
+
       /// Method used for the global optimization. Should be removed when we switch
       /// to using several classes for different algorithms.
       RefObjOpt mGlobalOptimType;
@@ -529,6 +553,10 @@ class MonteCarloObj:public OptimizationObj
       LSQNumObj mLSQ;
       /// Option to run automatic least-squares refinements
       RefObjOpt mAutoLSQ;
+      /// Number of parallel 'worlds' for Parallel Tempering
+      long mNbWorld;
+      /// Objects copied by CreateParallelCopy(), which belong to (and are deleted with) this object
+      std::vector<RefinableObj*> mvpCopiedObj;
    private:
    #ifdef __WX__CRYST__
    public:
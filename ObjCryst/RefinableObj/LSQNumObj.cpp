@@ -19,6 +19,10 @@
 #include "ObjCryst/Quirks/VFNStreamFormat.h"
 
 #include "ObjCryst/RefinableObj/LSQNumObj.h"
+#include "ObjCryst/ObjCryst/Crystal.h"
+#include "ObjCryst/ObjCryst/PowderPattern.h"
+#include "ObjCryst/ObjCryst/DiffractionDataSingleCrystal.h"
+#include "ObjCryst/ObjCryst/IO.h"
 
 #ifdef __WX__CRYST__
    #include "ObjCryst/wxCryst/wxLSQ.h"
@@ -33,6 +37,13 @@ using namespace NEWMAT;
 using namespace std;
 
 #include <iomanip>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #define POSSIBLY_UNUSED(expr) (void)(expr)
 
@@ -46,6 +57,7 @@ LSQNumObj::LSQNumObj(string objName)
 {
    mDampingFactor=1.;
    mSaveReportOnEachCycle=false;
+   mUseCholesky=true;
    mName=objName;
    mSaveFileName="LSQrefinement.save";
    mR=0;
@@ -59,6 +71,7 @@ LSQNumObj::~LSQNumObj()
    #ifdef __WX__CRYST__
    this->WXDelete();
    #endif
+   this->ClearParallelCopies();
 }
 
 void LSQNumObj::SetParIsFixed(const string& parName,const bool fix)
@@ -103,18 +116,244 @@ void LSQNumObj::SetParIsUsed(const RefParType *type,const bool use)
    mRefParList.SetParIsUsed(type,use);
 }
 
+/** \internal Solve the normal equations M*delta=B using a Cholesky decomposition
+* of the derivative-scaled normal matrix, and compute the inverse N of M (needed
+* for the sigmas and the variance-covariance matrix).
+*
+* \param maxCond: the largest allowed (estimated) condition number of the scaled matrix.
+* \return false if the scaled matrix is not positive definite or is too ill-conditioned,
+* in which case the eigenvalue filtering must be used instead. N and delta are then
+* left unchanged.
+*/
+static bool LSQCholeskySolve(const CrystMatrix_REAL &M, const CrystVector_REAL &B,
+                             CrystMatrix_REAL &N, CrystVector_REAL &delta, const double maxCond)
+{
+   TAU_PROFILE("LSQCholeskySolve()","bool (...)",TAU_DEFAULT);
+   const long n=M.rows();
+   std::vector<double> vScale(n),vL(n*n,0.),vLinv(n*n,0.),vAinv(n*n);
+   for(long i=0;i<n;i++) vScale[i]=1./sqrt((double)M(i,i));
+   // A=Dscale*M*Dscale=L*L^T, only the lower triangle is used. All diagonal terms of
+   // A are 1, so its largest eigenvalue is at most its largest absolute row sum.
+   double maxEigen=0;
+   for(long j=0;j<n;j++)
+   {
+      double d=1.;
+      for(long k=0;k<j;k++) d-=vL[j*n+k]*vL[j*n+k];
+      if((d<=0)||ISNAN_OR_INF(d)) return false;
+      d=sqrt(d);
+      vL[j*n+j]=d;
+      double rowsum=0;
+      #ifdef _OPENMP
+      #pragma omp parallel for schedule(static) num_threads(GetNbThread()) if((n-j)>100) reduction(+:rowsum)
+      #endif
+      for(long i=j+1;i<n;i++)
+      {
+         double v=M(i,j)*vScale[i]*vScale[j];
+         rowsum+=fabs(v);
+         for(long k=0;k<j;k++) v-=vL[i*n+k]*vL[j*n+k];
+         vL[i*n+j]=v/d;
+      }
+      for(long k=0;k<j;k++) rowsum+=fabs(M(j,k)*vScale[j]*vScale[k]);
+      if((rowsum+1)>maxEigen) maxEigen=rowsum+1;
+   }
+   // Linv: inverse of the lower triangular matrix, one column at a time
+   #ifdef _OPENMP
+   #pragma omp parallel for schedule(dynamic,1) num_threads(GetNbThread()) if(n>100)
+   #endif
+   for(long j=0;j<n;j++)
+   {
+      vLinv[j*n+j]=1./vL[j*n+j];
+      for(long i=j+1;i<n;i++)
+      {
+         double v=0;
+         for(long k=j;k<i;k++) v-=vL[i*n+k]*vLinv[k*n+j];
+         vLinv[i*n+j]=v/vL[i*n+i];
+      }
+   }
+   // Ainv=Linv^T*Linv
+   double maxDiagInv=0;
+   #ifdef _OPENMP
+   #pragma omp parallel for schedule(dynamic,1) num_threads(GetNbThread()) if(n>100)
+   #endif
+   for(long i=0;i<n;i++)
+   {
+      for(long j=0;j<=i;j++)
+      {
+         double v=0;
+         for(long k=i;k<n;k++) v+=vLinv[k*n+i]*vLinv[k*n+j];
+         vAinv[i*n+j]=v;
+         vAinv[j*n+i]=v;
+      }
+   }
+   for(long i=0;i<n;i++) if(vAinv[i*n+i]>maxDiagInv) maxDiagInv=vAinv[i*n+i];
+   // The smallest eigenvalue of A is at most 1/max(Ainv(i,i)). Use this to
+   // estimate the condition number, so that the eigenvalue filtering can
+   // be used when some parameters are too correlated.
+   if((maxEigen*maxDiagInv>maxCond)||ISNAN_OR_INF(maxDiagInv)) return false;
+   for(long i=0;i<n;i++)
+   {
+      double d=0;
+      for(long j=0;j<n;j++)
+      {
+         const double v=vAinv[i*n+j]*vScale[i]*vScale[j];
+         N(i,j)=v;
+         d+=v*B(j);
+      }
+      delta(i)=d;
+   }
+   return true;
+}
+
+/** \internal Add the contribution of one block of observations to one row of the
+* normal matrix M (only the lower triangle, j<=i, is computed) and to B(i), from the
+* derivatives stored only in the range of observations where they are non-zero.
+*
+* \param vFirst: index of the first stored observation for each derivative, relative
+* to the beginning of the block
+* \param obs0: index of the first observation of the block in weight and wres
+* \param wres: the weighted residual, weight*(obs-calc)
+*/
+static void LSQNormalMatrixRow(const long i, const std::vector<long> &vFirst,
+                               const std::vector<CrystVector_REAL> &vDeriv,const long obs0,
+                               const CrystVector_REAL &weight, const CrystVector_REAL &wres,
+                               CrystMatrix_REAL &M, CrystVector_REAL &B)
+{
+   const long firsti=vFirst[i];
+   const long lasti=firsti+vDeriv[i].numElements();
+   const REAL * RESTRICT pDi=vDeriv[i].data();
+   const REAL * RESTRICT pW=weight.data()+obs0;
+   #ifdef _OPENMP
+   #pragma omp parallel for schedule(static) num_threads(GetNbThread()) if((i*(lasti-firsti))>100000)
+   #endif
+   for(long j=0;j<=i;j++)
+   {
+      const long firstj=vFirst[j];
+      const long lastj=firstj+vDeriv[j].numElements();
+      const REAL * RESTRICT pDj=vDeriv[j].data();
+      const long k1=lasti<lastj ? lasti : lastj;
+      REAL v=0;
+      for(long k=firsti>firstj ? firsti : firstj;k<k1;k++) v+= pDi[k-firsti] * pW[k] * pDj[k-firstj];
+      M(i,j)+=v;
+      if(j<i) M(j,i)+=v;
+   }
+   const REAL * RESTRICT pRes=wres.data()+obs0;
+   REAL b=0;
+   for(long k=firsti;k<lasti;k++) b+= pRes[k] * pDi[k-firsti];
+   B(i)+=b;
+}
+
+/** \internal Store a derivative vector only in the range of observations where it is non-zero.
+*/
+static void LSQStoreDeriv(const CrystVector_REAL &deriv, long &first, CrystVector_REAL &stored)
+{
+   const long nb=deriv.numElements();
+   const REAL *pD=deriv.data();
+   long last=nb;
+   first=0;
+   while((first<nb)&&(pD[first]==0)) first++;
+   while((last>first)&&(pD[last-1]==0)) last--;
+   stored.resize(last-first);
+   REAL *p=stored.data();
+   for(long j=first;j<last;j++) *p++ = pD[j];
+}
+
+/** \internal Pair recursively an object and its sub-objects with their copies, which
+* must have the same structure (class, name, number of parameters and of sub-objects).
+*/
+static bool LSQPairObjects(RefinableObj &obj, RefinableObj &copy, map<RefinableObj*,RefinableObj*> &vObjPair)
+{
+   map<RefinableObj*,RefinableObj*>::const_iterator pos=vObjPair.find(&obj);
+   if(pos!=vObjPair.end()) return pos->second==&copy;
+   if(  (obj.GetClassName()!=copy.GetClassName()) || (obj.GetName()!=copy.GetName())
+      ||(obj.GetNbPar()!=copy.GetNbPar())
+      ||(obj.GetSubObjRegistry().GetNb()!=copy.GetSubObjRegistry().GetNb())) return false;
+   vObjPair[&obj]=&copy;
+   for(int i=0;i<obj.GetSubObjRegistry().GetNb();i++)
+      if(!LSQPairObjects(obj.GetSubObjRegistry().GetObj(i),copy.GetSubObjRegistry().GetObj(i),vObjPair))
+         return false;
+   return true;
+}
+
+/** \internal Top-level objects of a list of refined objects, i.e. objects which are not
+* a sub-object of another refined object, indexed by class and name.
+*
+* \return false if two top-level objects have the same class and name.
+*/
+static bool LSQTopObjects(const map<RefinableObj*,unsigned int> &vObj, map<string,RefinableObj*> &vTop)
+{
+   set<RefinableObj*> vSub;
+   for(map<RefinableObj*,unsigned int>::const_iterator pos=vObj.begin();pos!=vObj.end();++pos)
+      for(int i=0;i<pos->first->GetSubObjRegistry().GetNb();i++)
+         vSub.insert(&(pos->first->GetSubObjRegistry().GetObj(i)));
+   vTop.clear();
+   for(map<RefinableObj*,unsigned int>::const_iterator pos=vObj.begin();pos!=vObj.end();++pos)
+   {
+      if(vSub.find(pos->first)!=vSub.end()) continue;
+      const string key=pos->first->GetClassName()+":"+pos->first->GetName();
+      if(vTop.find(key)!=vTop.end()) return false;
+      vTop[key]=pos->first;
+   }
+   return true;
+}
+
+/** \internal Find the objects and parameters in a copy of the refined objects
+* corresponding to the refined ones.
+*
+* \param vParPair: for each parameter of the refined objects (using its value pointer as
+* a key), the corresponding parameter in the copy.
+* \return false if some refined object has no equivalent in the copy.
+*/
+static bool LSQPairParallelCopy(const map<RefinableObj*,unsigned int> &vObj,
+                                const map<RefinableObj*,unsigned int> &vObjCopy,
+                                map<RefinableObj*,RefinableObj*> &vObjPair,
+                                map<const REAL*,RefinablePar*> &vParPair)
+{
+   map<string,RefinableObj*> vTop,vTopCopy;
+   if(!LSQTopObjects(vObj,vTop) || !LSQTopObjects(vObjCopy,vTopCopy)) return false;
+   vObjPair.clear();
+   for(map<string,RefinableObj*>::iterator pos=vTop.begin();pos!=vTop.end();++pos)
+   {
+      map<string,RefinableObj*>::iterator posCopy=vTopCopy.find(pos->first);
+      if(posCopy==vTopCopy.end()) return false;
+      if(!LSQPairObjects(*(pos->second),*(posCopy->second),vObjPair)) return false;
+   }
+   vParPair.clear();
+   for(map<RefinableObj*,unsigned int>::const_iterator pos=vObj.begin();pos!=vObj.end();++pos)
+   {
+      map<RefinableObj*,RefinableObj*>::const_iterator posCopy=vObjPair.find(pos->first);
+      if(posCopy==vObjPair.end()) return false;
+      for(long k=0;k<pos->first->GetNbPar();k++)
+         vParPair[pos->first->GetPar(k).GetPointer()]=&(posCopy->second->GetPar(k));
+   }
+   return true;
+}
+
 void LSQNumObj::Refine (int nbCycle,bool useLevenbergMarquardt,
                         const bool silent, const bool callBeginEndOptimization,
                         const float minChi2var)
 {
    TAU_PROFILE("LSQNumObj::Refine()","void ()",TAU_USER);
    TAU_PROFILE_TIMER(timer1,"LSQNumObj::Refine() 1 - Init","", TAU_FIELD);
-   TAU_PROFILE_TIMER(timer2,"LSQNumObj::Refine() 2 - LSQ Deriv","", TAU_FIELD);
-   TAU_PROFILE_TIMER(timer3,"LSQNumObj::Refine() 3 - LSQ MB","", TAU_FIELD);
+   TAU_PROFILE_TIMER(timer2,"LSQNumObj::Refine() 2 - LSQ Deriv, M and B","", TAU_FIELD);
    TAU_PROFILE_TIMER(timer4,"LSQNumObj::Refine() 4 - LSQ Singular Values","", TAU_FIELD);
    TAU_PROFILE_TIMER(timer5,"LSQNumObj::Refine() 5 - LSQ Newmat, eigenvalues...","", TAU_FIELD);
    TAU_PROFILE_TIMER(timer6,"LSQNumObj::Refine() 6 - LSQ Apply","", TAU_FIELD);
    TAU_PROFILE_TIMER(timer7,"LSQNumObj::Refine() 7 - LSQ Finish","", TAU_FIELD);
+   #ifdef _OPENMP
+   if(  (GetNbThread()>1)&&(omp_in_parallel()==0)
+      &&((mvpParallelCopy.size()==0)||(mvpOwnedParallelCopy.size()>0)))
+   {// No copy supplied: use copies made by this object, which are kept between
+    // refinements as long as the refined objects and their parameters are unchanged
+      if(this->ParallelCopiesNeedUpdate())
+      {
+         if(this->CreateParallelCopies(GetNbThread()-1))
+         {
+            if(!silent) cout << "LSQNumObj::Refine(): computing derivatives using "<<GetNbThread()<<" threads"<<endl;
+         }
+         else if(!silent) cout << "LSQNumObj::Refine(): cannot copy the refined objects, derivatives will not be computed in parallel"<<endl;
+      }
+   }
+   #endif
    TAU_PROFILE_START(timer1);
    if(callBeginEndOptimization) this->BeginOptimization();
    mObs=this->GetLSQObs();
@@ -141,11 +380,14 @@ void LSQNumObj::Refine (int nbCycle,bool useLevenbergMarquardt,
       CrystMatrix_REAL M(nbVar,nbVar);
       CrystMatrix_REAL N(nbVar,nbVar);
       CrystVector_REAL B(nbVar);
-      CrystMatrix_REAL designMatrix(nbVar,nbObs);
+      // The derivatives (transposed design matrix) are only stored for one block of
+      // observations at a time, and only in the range where they are non-zero.
+      std::vector<long> vDerivFirst(nbVar);
+      std::vector<CrystVector_REAL> vDeriv(nbVar);
+      CrystVector_REAL wres;
       CrystVector_REAL deltaVar(nbVar);
-      long i,j,k;
+      long i,j;
       REAL R_ini,Rw_ini;  POSSIBLY_UNUSED(R_ini);
-      REAL *pTmp1,*pTmp2;
 
       REAL marquardt=1e-2;
       const REAL marquardtMult=4.;
@@ -154,6 +396,23 @@ void LSQNumObj::Refine (int nbCycle,bool useLevenbergMarquardt,
    //store old values
    mIndexValuesSetInitial=mRefParList.CreateParamSet("LSQ Refinement-Initial Values");
    mIndexValuesSetLast=mRefParList.CreateParamSet("LSQ Refinement-Last Cycle Values");
+   // Copies of the refined objects used to compute derivatives in parallel
+   std::vector<map<RefinableObj*,RefinableObj*> > vParallelObjPair;
+   std::vector<map<const REAL*,RefinablePar*> > vParallelParPair;
+   #ifdef _OPENMP
+   for(std::vector<LSQNumObj*>::iterator pos=mvpParallelCopy.begin();pos!=mvpParallelCopy.end();++pos)
+   {
+      if((long)vParallelObjPair.size()>=(GetNbThread()-1)) break;
+      vParallelObjPair.push_back(map<RefinableObj*,RefinableObj*>());
+      vParallelParPair.push_back(map<const REAL*,RefinablePar*>());
+      if(!LSQPairParallelCopy(mvRefinedObjMap,(*pos)->GetRefinedObjMap(),vParallelObjPair.back(),vParallelParPair.back()))
+      {
+         if(!silent) cout << "LSQNumObj::Refine(): cannot match the objects of a parallel copy, ignoring it"<<endl;
+         vParallelObjPair.pop_back();
+         vParallelParPair.pop_back();
+      }
+   }
+   #endif
    TAU_PROFILE_STOP(timer1);
    //refine
    for(int cycle=1 ; cycle <=nbCycle;cycle++)
@@ -175,82 +434,112 @@ void LSQNumObj::Refine (int nbCycle,bool useLevenbergMarquardt,
             tmpV1 *= mWeight;
             tmpV2 *= mWeight;
             Rw_ini=sqrt(tmpV1.sum()/tmpV2.sum());
-      //derivatives
-      //designMatrix=0.;
-      pTmp2=designMatrix.data();
+      //weighted residual
+         wres =  mObs;
+         wres -= calc0;
+         wres *= mWeight;
       //cout <<"obs:"<<FormatHorizVector<REAL>(calc0,10,8);
       //cout <<"calc:"<<FormatHorizVector<REAL>(mObs,10,8);
       //cout <<"weight:"<<FormatHorizVector<REAL>(mWeight,10,8);
-      #if 1
-      for(i=0;i<nbVar;i++)
-      {
-         //:NOTE: Real design matrix is the transposed of the one computed here
-         //if(!silent) cout << "........." << mRefParList.GetParNotFixed(i).GetName() <<endl;
-
-         tmpV1=this->GetLSQDeriv(mRefParList.GetParNotFixed(i));
-         pTmp1=tmpV1.data();
-         //cout <<"deriv#"<<i<<":"<<FormatHorizVector<REAL>(tmpV1,10,8);
-         for(j=0;j<nbObs;j++) *pTmp2++ = *pTmp1++;
-      }
-      #else
-      this->GetLSQ_FullDeriv();
-      for(i=0;i<nbVar;i++)
-      {
-         pTmp1=mLSQ_FullDeriv[&(mRefParList.GetParNotFixed(i))].data();
-         //if(i>=(nbVar-2)) cout<<__FILE__<<":"<<__LINE__<<":"<<(mRefParList.GetParNotFixed(i)).GetName()<<"size="<<mLSQ_FullDeriv[&(mRefParList.GetParNotFixed(i))].size()<<":"<<mLSQ_FullDeriv[&(mRefParList.GetParNotFixed(i))]<<endl;
-         for(j=0;j<nbObs;j++) *pTmp2++ = *pTmp1++;
-      }
-      #endif
-         //cout << designMatrix;
-
-      TAU_PROFILE_STOP(timer2);
-      LSQNumObj_Refine_Restart: //Used in case of singular matrix
-      TAU_PROFILE_START(timer3);
-
-      //Calculate M and B matrices
-         tmpV1.resize(nbObs);
-         tmpV2.resize(nbObs);
-         for(i=0;i<nbVar;i++)
+      // Derivatives and normal matrix. The observations are processed by blocks, one for
+      // each LSQ function of the refined objects (e.g. each powder pattern in a joint
+      // refinement). The derivatives of all parameters for a block are computed, added to M
+      // and B, and discarded, so that only the derivatives for one block are stored.
+      if(vParallelObjPair.size()>0)
+      {// Copy parameter values to the copies used for parallel derivatives
+         for(unsigned long c=0;c<vParallelObjPair.size();c++)
          {
-            #if 1
+            for(map<RefinableObj*,RefinableObj*>::iterator pos=vParallelObjPair[c].begin();pos!=vParallelObjPair[c].end();++pos)
             {
-               const REAL * RESTRICT pD=designMatrix.data()+i*designMatrix.cols();
-               const REAL * RESTRICT pW=mWeight.data();
-               REAL * RESTRICT p=tmpV1.data();
-               for(k=0;k<nbObs;k++) *p++ = *pD++ * *pW++;
+               for(long k=0;k<pos->first->GetNbPar();k++)
+                  if(pos->second->GetPar(k).GetValue()!=pos->first->GetPar(k).GetValue())
+                     pos->second->GetPar(k).MutateTo(pos->first->GetPar(k).GetValue());
+               for(unsigned int k=0;k<pos->first->GetNbOption();k++)
+                  if(pos->second->GetOption(k).GetChoice()!=pos->first->GetOption(k).GetChoice())
+                     pos->second->GetOption(k).SetChoice(pos->first->GetOption(k).GetChoice());
             }
-            const REAL * pD=designMatrix.data();
-            for(j=0;j<nbVar;j++)
+         }
+      }
+      vDerivFirst.resize(nbVar);
+      vDeriv.resize(nbVar);
+      M=0;
+      B=0;
+      long obs0=0;// index of the first observation of the current block
+      for(map<RefinableObj*,unsigned int>::iterator posObj=mvRefinedObjMap.begin();posObj!=mvRefinedObjMap.end();++posObj)
+      {
+         if(posObj->first->GetNbLSQFunction()==0) continue;
+         RefinableObj *pObj=posObj->first;
+         const unsigned int nfunc=posObj->second;
+         long nbObsBlock=0;
+         if(vParallelObjPair.size()>0)
+         {// Numerical derivatives computed in parallel, using the copies for all but the first thread
+            const long nbThread=vParallelObjPair.size()+1;
+            long nextPar=0;
+            bool failed=false;
+            #ifdef _OPENMP
+            #pragma omp parallel for schedule(static,1) num_threads(nbThread)
+            #endif
+            for(long t=0;t<nbThread;t++)
             {
-               const REAL * p1=tmpV1.data();
-               REAL v2=0;
-               for(k=0;k<nbObs;k++) v2+= *pD++ * *p1++;
-               M(j,i)=v2;
+               RefinableObj *pObjCopy= t==0 ? pObj : vParallelObjPair[t-1].find(pObj)->second;
+               while(true)
+               {
+                  long ipar;
+                  #ifdef _OPENMP
+                  #pragma omp critical(LSQNumObj_Refine)
+                  #endif
+                  {
+                     ipar=nextPar++;
+                     if(failed) ipar=nbVar;
+                  }
+                  if(ipar>=nbVar) break;
+                  RefinablePar *pPar=&(mRefParList.GetParNotFixed(ipar));
+                  try
+                  {
+                     if(t==0) LSQStoreDeriv(pObj->GetLSQDeriv(nfunc,*pPar),vDerivFirst[ipar],vDeriv[ipar]);
+                     else
+                     {
+                        map<const REAL*,RefinablePar*>::const_iterator pos=vParallelParPair[t-1].find(pPar->GetPointer());
+                        if(pos==vParallelParPair[t-1].end())
+                           throw ObjCrystException("LSQNumObj::Refine(): parameter not found in parallel copy");
+                        RefinablePar *pParCopy=pos->second;
+                        pParCopy->SetDerivStep(pPar->GetDerivStep());
+                        LSQStoreDeriv(pObjCopy->GetLSQDeriv(nfunc,*pParCopy),vDerivFirst[ipar],vDeriv[ipar]);
+                     }
+                     if(ipar==0) nbObsBlock=pObjCopy->GetLSQCalc(nfunc).numElements();
+                  }
+                  catch(...)
+                  {
+                     #ifdef _OPENMP
+                     #pragma omp critical(LSQNumObj_Refine)
+                     #endif
+                     failed=true;
+                  }
+               }
             }
-            REAL b=0;
-            const REAL * pObs=mObs.data();
-            const REAL * pCalc=calc0.data();
-            const REAL * p1=tmpV1.data();
-            for(k=0;k<nbObs;k++) b+= (*pObs++ - *pCalc++)* *p1++;
-            B(i)=b;
-            #else
-            for(k=0;k<nbObs;k++) tmpV1(k)=designMatrix(i,k);
-            tmpV1 *= mWeight;
-            for(j=0;j<nbVar;j++)
+            if(failed) throw ObjCrystException("LSQNumObj::Refine(): error while computing derivatives in parallel");
+            for(i=0;i<nbVar;i++) LSQNormalMatrixRow(i,vDerivFirst,vDeriv,obs0,mWeight,wres,M,B);
+         }
+         else
+         {// derivatives, folded into M and B as soon as they are computed
+            for(i=0;i<nbVar;i++)
             {
-               for(k=0;k<nbObs;k++) tmpV2(k)=designMatrix(j,k);
-               tmpV2 *= tmpV1;
-               M(j,i)= tmpV2.sum();
-                  //M(i,j)=total(designMatrix.row(i)*designMatrix.row(j)*weight);
+               //if(!silent) cout << "........." << mRefParList.GetParNotFixed(i).GetName() <<endl;
+               const CrystVector_REAL *pDeriv=&(pObj->GetLSQDeriv(nfunc,mRefParList.GetParNotFixed(i)));
+               nbObsBlock=pDeriv->numElements();
+               //cout <<"deriv#"<<i<<":"<<FormatHorizVector<REAL>(*pDeriv,10,8);
+               LSQStoreDeriv(*pDeriv,vDerivFirst[i],vDeriv[i]);
+               LSQNormalMatrixRow(i,vDerivFirst,vDeriv,obs0,mWeight,wres,M,B);
             }
-            tmpV2=mObs;
-            tmpV2 -= calc0;
-            tmpV2 *= tmpV1;
-            B(i)=tmpV2.sum();//total((obs-calc0)*weight*designMatrix.row(i))
-            #endif
-
          }
-      TAU_PROFILE_STOP(timer3);
+         obs0+=nbObsBlock;
+      }
+      // Free the derivatives before solving
+      for(i=0;i<nbVar;i++) vDeriv[i].resize(0);
+      if(obs0!=nbObs)
+         throw ObjCrystException("LSQNumObj::Refine(): the derivatives do not match the number of observations");
+
+      TAU_PROFILE_STOP(timer2);
       bool increaseMarquardt=false;
       LSQNumObj_Refine_RestartMarquardt: //Used in case of singular matrix or for Marquardt
       TAU_PROFILE_START(timer4);
@@ -298,35 +587,21 @@ void LSQNumObj::Refine (int nbCycle,bool useLevenbergMarquardt,
                N.resize(nbVar,nbVar);
                deltaVar.resize(nbVar);
 
-               //Just remove the ith line in the design matrix
-                        REAL *p1=designMatrix.data();
-                  const REAL *p2=designMatrix.data();
-                  p1 += i*nbObs;
-                  p2 += i*nbObs+nbObs;
-                  for(long j=i*nbObs+nbObs;j<nbObs*nbVar;j++) *p1++ = *p2++;
-               designMatrix.resizeAndPreserve(nbVar,nbObs);
-
-               //:TODO: Make this work...
-               /*
-               //Remove ith line &Column in M & ith element in B
-                  p1=M.data();
-                  p2=M.data();
-                  for(long j=0;j<=nbVar;j++)
+               //Just remove the ith row and column of M, and the ith element of B
+               {
+                  const CrystMatrix_REAL M0(M);
+                  const CrystVector_REAL B0(B);
+                  M.resize(nbVar,nbVar);
+                  B.resize(nbVar);
+                  for(long j=0;j<nbVar;j++)
                   {
-                     if( (j>=i) && (j<nbVar) ) B(j)=B(j+1);
-                     for(long k=0;k<=nbVar;k++)
-                     {
-                        if((j==i) || (k==i)) p2++;
-                        else *p1++ = *p2++;
-                     }
+                     const long j0= j<i ? j : j+1;
+                     B(j)=B0(j0);
+                     for(long k=0;k<nbVar;k++) M(j,k)=M0(j0, k<i ? k : k+1);
                   }
-               M.resizeAndPreserve(nbVar,nbVar);
-               B.resizeAndPreserve(nbVar);
-               */
-               M.resize(nbVar,nbVar);
-               B.resize(nbVar);
+               }
                TAU_PROFILE_STOP(timer4);
-               goto LSQNumObj_Refine_Restart;
+               goto LSQNumObj_Refine_RestartMarquardt;
             }
          }
       TAU_PROFILE_STOP(timer4);
@@ -375,7 +650,13 @@ void LSQNumObj::Refine (int nbCycle,bool useLevenbergMarquardt,
       }
 */
       TAU_PROFILE_START(timer5);
+      // Cholesky decomposition, unless the normal matrix is ill-conditioned
+      bool solvedCholesky=false;
+      if(mUseCholesky) solvedCholesky=LSQCholeskySolve(M,B,N,deltaVar,1e5);
+      if((!solvedCholesky)&&mUseCholesky&&(!silent))
+         cout << "LSQNumObj::Refine():ill-conditioned normal matrix, using Eigenvalue Filtering" <<endl;
       //Perform "Eigenvalue Filtering" on normal matrix (using newmat library)
+      if(!solvedCholesky)
       {
          //if(!silent) cout << "LSQNumObj::Refine():Eigenvalue Filtering..." <<endl;
          CrystMatrix_REAL V(nbVar,nbVar);
@@ -421,12 +702,6 @@ void LSQNumObj::Refine (int nbCycle,bool useLevenbergMarquardt,
                      for(unsigned int j=0;j<M.cols();j++) cout<<M(i,j)<<" ";
                      cout<<endl;
                   }
-                  cout<<endl<<endl<<"D("<<designMatrix.rows()<<"x"<<designMatrix.cols()<<"):"<<endl;
-                  for(unsigned int i=0;i<designMatrix.rows();i++)
-                  {
-                     for(unsigned int j=0;j<designMatrix.cols();j++) cout<<designMatrix(i,j)<<" ";
-                     cout<<endl;
-                  }
                }
                throw ObjCrystException("LSQNumObj::Refine():caught a newmat exception during Eigenvalues computing !");
             }
@@ -892,6 +1167,180 @@ void LSQNumObj::SetDampingFactor(const REAL newDampFact)
    mDampingFactor=newDampFact;
 }
 
+void LSQNumObj::SetUseCholesky(const bool useCholesky)
+{
+   mUseCholesky=useCholesky;
+}
+
+void LSQNumObj::AddParallelCopy(LSQNumObj &copy)
+{
+   if(mvpOwnedParallelCopy.size()>0) this->ClearParallelCopies();
+   mvpParallelCopy.push_back(&copy);
+}
+
+/** \internal Recursively list an object and its sub-objects which can be copied
+* through their XML description, for each of the given class names.
+*/
+static void LSQCopiableObjects(RefinableObj &obj, const string &className, vector<RefinableObj*> &vpObj)
+{
+   if(  (obj.GetClassName()==className)
+      &&(find(vpObj.begin(),vpObj.end(),&obj)==vpObj.end())) vpObj.push_back(&obj);
+   for(int i=0;i<obj.GetSubObjRegistry().GetNb();i++)
+      LSQCopiableObjects(obj.GetSubObjRegistry().GetObj(i),className,vpObj);
+}
+
+bool LSQNumObj::CreateParallelCopies(const unsigned int nb)
+{
+   VFN_DEBUG_ENTRY("LSQNumObj::CreateParallelCopies()",5)
+   this->ClearParallelCopies();
+   // Objects which can be copied through their XML description. Crystals must come
+   // first, as diffraction data objects refer to them by name.
+   static const string copiedClassNames[3]={"Crystal","PowderPattern","DiffractionDataSingleCrystal"};
+   map<string,RefinableObj*> vTop;
+   if(!LSQTopObjects(mvRefinedObjMap,vTop))
+   {
+      VFN_DEBUG_EXIT("LSQNumObj::CreateParallelCopies(): duplicate top-level objects",5)
+      return false;
+   }
+   for(map<string,RefinableObj*>::iterator pos=vTop.begin();pos!=vTop.end();++pos)
+      if(find(copiedClassNames,copiedClassNames+3,pos->second->GetClassName())==copiedClassNames+3)
+      {
+         VFN_DEBUG_EXIT("LSQNumObj::CreateParallelCopies(): cannot copy "<<pos->second->GetName(),5)
+         return false;
+      }
+   vector<RefinableObj*> vpObj;
+   for(unsigned int j=0;j<3;j++)
+      for(map<string,RefinableObj*>::iterator pos=vTop.begin();pos!=vTop.end();++pos)
+         LSQCopiableObjects(*(pos->second),copiedClassNames[j],vpObj);
+   stringstream ss;
+   ss.imbue(std::locale::classic());
+   for(vector<RefinableObj*>::const_iterator pos=vpObj.begin();pos!=vpObj.end();++pos)
+      (*pos)->XMLOutput(ss,0);
+   const string xml=ss.str();
+
+   // Copies are not displayed
+   gCrystalRegistry.AutoUpdateUI(false);
+   gPowderPatternRegistry.AutoUpdateUI(false);
+   gDiffractionDataSingleCrystalRegistry.AutoUpdateUI(false);
+   bool ok=true;
+   for(unsigned int c=0;(c<nb)&&ok;c++)
+   {
+      // When a diffraction data object is loaded, the last registered Crystal with the
+      // corresponding name is used, i.e. the copy.
+      vector<RefinableObj*> vpCopy;
+      stringstream is(xml);
+      is.imbue(std::locale::classic());
+      while(true)
+      {
+         XMLCrystTag tag(is);
+         if(true==is.eof()) break;
+         if(tag.GetName()=="Crystal")
+         {
+            Crystal* obj = new Crystal;
+            obj->XMLInput(is,tag);
+            vpCopy.push_back(obj);
+         }
+         if(tag.GetName()=="PowderPattern")
+         {
+            PowderPattern* obj = new PowderPattern;
+            obj->XMLInput(is,tag);
+            vpCopy.push_back(obj);
+         }
+         if(tag.GetName()=="DiffractionDataSingleCrystal")
+         {
+            DiffractionDataSingleCrystal* obj = new DiffractionDataSingleCrystal;
+            obj->XMLInput(is,tag);
+            vpCopy.push_back(obj);
+         }
+      }
+      // Remove the copies from the global registries, so that they are not saved
+      // with XMLCrystFileSaveGlobal(), nor found when looking for an object by name.
+      for(vector<RefinableObj*>::iterator pos=vpCopy.begin();pos!=vpCopy.end();++pos)
+      {
+         gTopRefinableObjRegistry.DeRegister(**pos);
+         if((*pos)->GetClassName()=="Crystal")
+            gCrystalRegistry.DeRegister(*dynamic_cast<Crystal*>(*pos));
+         else if((*pos)->GetClassName()=="PowderPattern")
+            gPowderPatternRegistry.DeRegister(*dynamic_cast<PowderPattern*>(*pos));
+         else if((*pos)->GetClassName()=="DiffractionDataSingleCrystal")
+            gDiffractionDataSingleCrystalRegistry.DeRegister(*dynamic_cast<DiffractionDataSingleCrystal*>(*pos));
+         mvpParallelCopiedObj.push_back(*pos);
+      }
+      if(vpCopy.size()!=vpObj.size()) {ok=false;break;}
+      // Refine the same objects and sub-objects in the copy, with the same LSQ functions
+      map<RefinableObj*,RefinableObj*> vObjPair;
+      for(unsigned long j=0;(j<vpObj.size())&&ok;j++)
+         ok=LSQPairObjects(*vpObj[j],*vpCopy[j],vObjPair);
+      if(!ok) break;
+      LSQNumObj *pCopy=new LSQNumObj(mName);
+      mvpOwnedParallelCopy.push_back(pCopy);
+      bool init=true;
+      for(map<RefinableObj*,unsigned int>::const_iterator pos=mvRefinedObjMap.begin();pos!=mvRefinedObjMap.end();++pos)
+      {
+         map<RefinableObj*,RefinableObj*>::const_iterator posCopy=vObjPair.find(pos->first);
+         if(posCopy==vObjPair.end()) {ok=false;break;}
+         pCopy->SetRefinedObj(*(posCopy->second),pos->second,init,false);
+         init=false;
+      }
+      if(ok) mvpParallelCopy.push_back(pCopy);
+   }
+   gCrystalRegistry.AutoUpdateUI(true);
+   gPowderPatternRegistry.AutoUpdateUI(true);
+   gDiffractionDataSingleCrystalRegistry.AutoUpdateUI(true);
+   if(!ok) this->ClearParallelCopies();
+   // Record which objects were copied, so that the copies are only made again if
+   // they change (also if the copy failed, to avoid trying again for each refinement)
+   mvParallelCopyRefinedObjMap=mvRefinedObjMap;
+   mClockParallelCopy.Click();
+   if(!ok)
+   {
+      VFN_DEBUG_EXIT("LSQNumObj::CreateParallelCopies(): XML copy failed",5)
+      return false;
+   }
+   // The copies stay ready for optimization until they are deleted by ClearParallelCopies()
+   for(std::vector<LSQNumObj*>::iterator pos=mvpOwnedParallelCopy.begin();pos!=mvpOwnedParallelCopy.end();++pos)
+      (*pos)->BeginOptimization();
+   VFN_DEBUG_EXIT("LSQNumObj::CreateParallelCopies()",5)
+   return true;
+}
+
+bool LSQNumObj::ParallelCopiesNeedUpdate()const
+{
+   if(mvParallelCopyRefinedObjMap!=mvRefinedObjMap) return true;
+   for(map<RefinableObj*,unsigned int>::const_iterator pos=mvRefinedObjMap.begin();pos!=mvRefinedObjMap.end();++pos)
+      if(pos->first->GetRefParListClock()>mClockParallelCopy) return true;
+   // Copy already attempted and failed for the same objects
+   if(mvpOwnedParallelCopy.size()==0) return false;
+   if((long)mvpOwnedParallelCopy.size()!=(GetNbThread()-1)) return true;
+   // Same objects, parameters and number of observations in the copies
+   map<RefinableObj*,RefinableObj*> vObjPair;
+   map<const REAL*,RefinablePar*> vParPair;
+   if(!LSQPairParallelCopy(mvRefinedObjMap,mvpOwnedParallelCopy[0]->GetRefinedObjMap(),vObjPair,vParPair)) return true;
+   for(map<RefinableObj*,unsigned int>::const_iterator pos=mvRefinedObjMap.begin();pos!=mvRefinedObjMap.end();++pos)
+   {
+      if(pos->first->GetNbLSQFunction()==0) continue;
+      if(  pos->first->GetLSQObs(pos->second).numElements()
+         !=vObjPair[pos->first]->GetLSQObs(pos->second).numElements()) return true;
+   }
+   return false;
+}
+
+void LSQNumObj::ClearParallelCopies()
+{
+   mvpParallelCopy.clear();
+   mvParallelCopyRefinedObjMap.clear();
+   for(std::vector<LSQNumObj*>::iterator pos=mvpOwnedParallelCopy.begin();pos!=mvpOwnedParallelCopy.end();++pos)
+   {
+      (*pos)->EndOptimization();
+      delete *pos;
+   }
+   mvpOwnedParallelCopy.clear();
+   // Delete diffraction data before crystals
+   for(std::vector<RefinableObj*>::reverse_iterator pos=mvpParallelCopiedObj.rbegin();pos!=mvpParallelCopiedObj.rend();++pos)
+      delete *pos;
+   mvpParallelCopiedObj.clear();
+}
+
 void LSQNumObj::PurgeSaveFile()
 {
    //:TODO:
@@ -1041,12 +1490,16 @@ void LSQNumObj::BeginOptimization(const bool allowApproximations, const bool ena
 {
    for(map<RefinableObj*,unsigned int>::iterator pos=mvRefinedObjMap.begin();pos!=mvRefinedObjMap.end();++pos)
       pos->first->BeginOptimization(allowApproximations, enableRestraints);
+   for(std::vector<LSQNumObj*>::iterator pos=mvpParallelCopy.begin();pos!=mvpParallelCopy.end();++pos)
+      (*pos)->BeginOptimization(allowApproximations, enableRestraints);
 }
 
 void LSQNumObj::EndOptimization()
 {
    for(map<RefinableObj*,unsigned int>::iterator pos=mvRefinedObjMap.begin();pos!=mvRefinedObjMap.end();++pos)
       pos->first->EndOptimization();
+   for(std::vector<LSQNumObj*>::iterator pos=mvpParallelCopy.begin();pos!=mvpParallelCopy.end();++pos)
+      (*pos)->EndOptimization();
 }
 
 #ifdef __WX__CRYST__
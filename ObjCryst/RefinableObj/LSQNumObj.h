@@ -28,6 +28,7 @@
 #include <string>
 #include <map>
 #include <list>
+#include <vector>
 
 namespace ObjCryst
 {
@@ -171,6 +172,53 @@ class LSQNumObj
       void SetSaveFile(std::string fileName="refine.save");
       void PrintRefResults()const;
       void SetDampingFactor(const REAL newDampFact);
+      /** Choose how the normal equations are solved at each cycle.
+      *
+      * If true (the default), a Cholesky decomposition of the (derivative-scaled)
+      * normal matrix is used, which is much faster for a large number of parameters.
+      * If the matrix is not positive definite or is ill-conditioned, the
+      * eigenvalue filtering is used for that cycle.
+      *
+      * If false, the eigenvalue filtering (slower, but more robust against
+      * correlated parameters) is always used.
+      */
+      void SetUseCholesky(const bool useCholesky=true);
+      /** Add a copy of this LSQ object, used to compute the numerical derivatives
+      * in parallel, each thread handling a different parameter.
+      *
+      * The copy must refine copies of the refined objects (e.g. created from their
+      * XML description), with the same sub-objects and parameters. The top-level
+      * objects are matched using their class and name. Parameter values are copied
+      * before computing the derivatives, but not any other setting, so the copy
+      * should be made just before the refinement. If the objects cannot be matched,
+      * the copy is ignored.
+      *
+      * The copy is not owned by this object, and must be removed using
+      * ClearParallelCopies() before being deleted. This is only used if the library
+      * is compiled with OpenMP, with one copy per thread beyond the first.
+      *
+      * If no copy has been added, Refine() creates copies using CreateParallelCopies()
+      * when more than one thread is available.
+      */
+      void AddParallelCopy(LSQNumObj &copy);
+      /** Create copies of this object, and of the refined objects from their XML
+      * description, to compute the numerical derivatives in parallel.
+      *
+      * This is only possible if the top-level refined objects are Crystal,
+      * PowderPattern or DiffractionDataSingleCrystal objects. The copies are
+      * owned by this object, and deleted by ClearParallelCopies(). They are kept
+      * between refinements, and only made again by Refine() when the list of refined
+      * objects, their parameters or their number of observations change. Parameter
+      * values and options are copied before computing derivatives, but other settings
+      * are not: call ClearParallelCopies() after changing them.
+      * \param nb: the number of copies to create (one per thread beyond the first)
+      * \return false if the refined objects could not be copied, in which case
+      * no copy is added.
+      */
+      bool CreateParallelCopies(const unsigned int nb);
+      /// Remove all copies added with AddParallelCopy(), and delete those made
+      /// by CreateParallelCopies()
+      void ClearParallelCopies();
       void PurgeSaveFile();
       void WriteReportToFile()const;
 
@@ -225,6 +273,8 @@ class LSQNumObj
       REAL mDampingFactor;
       ///Save result to file after each cycle ?
       bool mSaveReportOnEachCycle;
+      /// Solve the normal equations using a Cholesky decomposition rather than eigenvalue filtering ?
+      bool mUseCholesky;
       /// Name of the refined object
       std::string mName;
       /// File name where refinement info is saved
@@ -265,6 +315,19 @@ class LSQNumObj
       /// using recursive LSQ function
       mutable CrystVector_REAL mLSQObs,mLSQCalc,mLSQWeight,mLSQDeriv;
       mutable std::map<RefinablePar*,CrystVector_REAL> mLSQ_FullDeriv;
+      /// Copies of this object (working on copies of the refined objects), to
+      /// compute numerical derivatives in parallel
+      std::vector<LSQNumObj*> mvpParallelCopy;
+      /// Copies created by CreateParallelCopies(), which belong to (and are deleted with) this object
+      std::vector<LSQNumObj*> mvpOwnedParallelCopy;
+      /// Refined objects copied by CreateParallelCopies(), in the order they were created
+      std::vector<RefinableObj*> mvpParallelCopiedObj;
+      /// Refined objects when the copies were last made by CreateParallelCopies()
+      std::map<RefinableObj*,unsigned int> mvParallelCopyRefinedObjMap;
+      /// When the copies were last made by CreateParallelCopies()
+      RefinableObjClock mClockParallelCopy;
+      /// Do the copies made by CreateParallelCopies() need to be made again ?
+      bool ParallelCopiesNeedUpdate()const;
 #ifdef __WX__CRYST__
    public:
       virtual WXCrystObjBasic* WXCreate(wxWindow* parent);
@@ -30,6 +30,9 @@
    #undef GetClassName // Conflict from wxMSW headers ? (cygwin)
 #endif
 #include <algorithm>
+#ifdef _MSC_VER
+#include <intrin.h> // _InterlockedIncrement64
+#endif
 
 #define POSSIBLY_UNUSED(expr) (void)(expr)
 
@@ -83,13 +86,11 @@ long NiftyStaticGlobalObjectsInitializer_RefinableObj::mCount=0;
 //
 //######################################################################
 
-unsigned long RefinableObjClock::msTick0=0;
-unsigned long RefinableObjClock::msTick1=0;
+unsigned long long RefinableObjClock::msTick=0;
 RefinableObjClock::RefinableObjClock()
 {
    //this->Click();
-   mTick0=0;
-   mTick1=0;
+   mTick=0;
 }
 RefinableObjClock::~RefinableObjClock()
 {
@@ -105,54 +106,42 @@ RefinableObjClock::~RefinableObjClock()
 }
 
 bool RefinableObjClock::operator< (const RefinableObjClock &rhs)const
-{
-   if(mTick1<rhs.mTick1) return true;
-   if(mTick1==rhs.mTick1) {if(mTick0<rhs.mTick0) return true;}
-   return false;
-}
+{return mTick<rhs.mTick;}
 bool RefinableObjClock::operator<=(const RefinableObjClock &rhs)const
-{
-   if(mTick1<rhs.mTick1) return true;
-   if(mTick1==rhs.mTick1) if(mTick0<=rhs.mTick0) return true;
-   return false;
-}
+{return mTick<=rhs.mTick;}
 bool RefinableObjClock::operator> (const RefinableObjClock &rhs)const
-{
-   if(mTick1>rhs.mTick1) return true;
-   if(mTick1==rhs.mTick1) if(mTick0>rhs.mTick0) return true;
-   return false;
-}
+{return mTick>rhs.mTick;}
 bool RefinableObjClock::operator>=(const RefinableObjClock &rhs)const
-{
-   if(mTick1>rhs.mTick1) return true;
-   if(mTick1==rhs.mTick1) if(mTick0>=rhs.mTick0) return true;
-   return false;
-}
+{return mTick>=rhs.mTick;}
 void RefinableObjClock::Click()
 {
    //return;
-   if(++msTick0==0) ++msTick1;//Update ObjCryst++ static event counter
-   mTick0=msTick0;
-   mTick1=msTick1;
+   //Update ObjCryst++ static event counter
+   #if defined(__GNUC__)
+   mTick=__sync_add_and_fetch(&msTick,1);
+   #elif defined(_MSC_VER)
+   mTick=_InterlockedIncrement64((volatile __int64*)&msTick);
+   #else
+   #error "RefinableObjClock::Click(): no atomic increment available for this compiler"
+   #endif
    for(std::set<RefinableObjClock*>::iterator pos=mvParent.begin();
        pos!=mvParent.end();++pos) (*pos)->Click();
-   VFN_DEBUG_MESSAGE("RefinableObjClock::Click():"<<mTick1<<":"<<mTick0<<"(at "<<this<<")",0)
+   VFN_DEBUG_MESSAGE("RefinableObjClock::Click():"<<mTick<<"(at "<<this<<")",0)
    //this->Print();
 }
 void RefinableObjClock::Reset()
 {
-   mTick0=0;
-   mTick1=0;
+   mTick=0;
 }
 void RefinableObjClock::Print()const
 {
-   cout <<"Clock():"<<mTick1<<":"<<mTick0;
+   cout <<"Clock():"<<mTick;
    VFN_DEBUG_MESSAGE_SHORT(" (at "<<this<<")",4)
    cout <<endl;
 }
 void RefinableObjClock::PrintStatic()const
 {
-   cout <<"RefinableObj class Clock():"<<msTick1<<":"<<msTick0<<endl;
+   cout <<"RefinableObj class Clock():"<<msTick<<endl;
 }
 void RefinableObjClock::AddChild(const RefinableObjClock &clock)
 {mvChild.insert(&clock);clock.AddParent(*this);this->Click();}
@@ -181,8 +170,7 @@ void RefinableObjClock::RemoveParent(RefinableObjClock &clock)const
 
 void RefinableObjClock::operator=(const RefinableObjClock &rhs)
 {
-   mTick0=rhs.mTick0;
-   mTick1=rhs.mTick1;
+   mTick=rhs.mTick;
    for(std::set<RefinableObjClock*>::iterator pos=mvParent.begin();
        pos!=mvParent.end();++pos) if( (*this) > (**pos) ) **pos = *this;
 }
@@ -395,11 +383,9 @@ void RefinablePar::SetValue(const REAL value)
    }
 }
 
-const REAL& RefinablePar::GetHumanValue() const
+REAL RefinablePar::GetHumanValue() const
 {
-   static REAL val;
-   val = *mpValue * mHumanScale;
-   return val;
+   return *mpValue * mHumanScale;
 }
 
 void RefinablePar::SetHumanValue(const REAL &value)
@@ -1755,13 +1741,13 @@ void RefinableObj::RandomizeConfiguration()
       {
          const REAL min=this->GetParNotFixed(j).GetMin();
          const REAL max=this->GetParNotFixed(j).GetMax();
-         this->GetParNotFixed(j).MutateTo(min+(max-min)*(rand()/(REAL)RAND_MAX) );
+         this->GetParNotFixed(j).MutateTo(min+(max-min)*(ObjCrystRand()/(REAL)RAND_MAX) );
       }
       else
          if(true==this->GetParNotFixed(j).IsPeriodic())
          {
 
-            this->GetParNotFixed(j).MutateTo((rand()/(REAL)RAND_MAX)
+            this->GetParNotFixed(j).MutateTo((ObjCrystRand()/(REAL)RAND_MAX)
                   * this->GetParNotFixed(j).GetPeriod());
          }
    }
@@ -1779,7 +1765,7 @@ void RefinableObj::GlobalOptRandomMove(const REAL mutationAmplitude,
    {
       if(this->GetParNotFixed(j).GetType()->IsDescendantFromOrSameAs(type))
          this->GetParNotFixed(j).Mutate( this->GetParNotFixed(j).GetGlobalOptimStep()
-                     *2*(rand()/(REAL)RAND_MAX-0.5)*mutationAmplitude);
+                     *2*(ObjCrystRand()/(REAL)RAND_MAX-0.5)*mutationAmplitude);
    }
    for(int i=0;i<mSubObjRegistry.GetNb();i++)
       mSubObjRegistry.GetObj(i).GlobalOptRandomMove(mutationAmplitude,type);
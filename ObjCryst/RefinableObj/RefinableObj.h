@@ -136,6 +136,17 @@ static NiftyStaticGlobalObjectsInitializer_RefinableObj NiftyStaticGlobalObjects
 /// This is purely internal, so don't worry about it...
 ///
 /// The clock values have nothing to do with 'time' as any normal person undertands it.
+///
+/// \par Thread-safety
+/// The global event counter is a 64-bit integer incremented atomically, so that
+/// clocks belonging to \e independent object graphs (e.g. two copies of a Crystal
+/// and its PowderPattern) can be clicked concurrently from different threads, and
+/// their values remain strictly ordered.
+/// However a given clock, its parents and its children (i.e. a given object graph)
+/// must only be used by one thread at a time: the value of a clock and its
+/// lists of parents and children are not protected. Similarly, the creation and
+/// destruction of objects (which modifies the global object registries) should be
+/// done by a single thread, e.g. before and after a parallel computation.
 class RefinableObjClock
 {
    public:
@@ -170,8 +181,10 @@ class RefinableObjClock
       void operator=(const RefinableObjClock &rhs);
    private:
       bool HasParent(const RefinableObjClock &) const;
-      unsigned long mTick0, mTick1;
-      static unsigned long msTick0,msTick1;
+      /// Value of this clock
+      unsigned long long mTick;
+      /// Global event counter, incremented atomically at each Click()
+      static unsigned long long msTick;
       /// List of 'child' clocks, which will click this clock whenever they are clicked.
       std::set<const RefinableObjClock*> mvChild;
       /// List of parent clocks, which will be clicked whenever this one is. This
@@ -329,7 +342,7 @@ class RefinablePar:public Restraint
          /** \brief Current value of parameter, scaled if necessary (for angles) to a
          * human-understandable value.
          */
-         const REAL& GetHumanValue() const;
+         REAL GetHumanValue() const;
 
          /** \brief Current value of parameter, scaled if necessary (for angles) to a
          * human-understandable value.
@@ -51,7 +51,7 @@ clean::
 
 # Build *shared* library - the "shared_libcryst=1" option is mandatory
 lib:libnewmat libcctbx libCrystVector libQuirks libRefinableObj libCryst
-	gcc -shared -Wl,-soname,libObjCryst.so.1 -lnewmat -lcctbx -o libObjCryst.so.1.0.0 */*.o
+	gcc -shared -Wl,-soname,libObjCryst.so.1 -lnewmat -lcctbx ${OPENMP_LIB} -o libObjCryst.so.1.0.0 */*.o
 
 #target to make documentation (requires doxygen)
 #also makes tags file, although it is not related to doxygen
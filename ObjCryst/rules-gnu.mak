@@ -124,6 +124,15 @@ else
 SSE_FLAGS =
 endif
 
+#Using OpenMP for parallel computations ? (use "openmp=1", disabled by default)
+ifeq ($(openmp),1)
+OPENMP_FLAGS = -fopenmp
+OPENMP_LIB = -fopenmp
+else
+OPENMP_FLAGS :=
+OPENMP_LIB :=
+endif
+
 ifneq ($(shared-newmat),1)
 LDNEWMAT := $(DIR_STATIC_LIBS)/lib/libnewmat.a
 else
@@ -144,29 +153,29 @@ else
 endif
 
 ifeq ($(shared_libcryst),1)
- CPPFLAGS = -O3 -w -fPIC -g -ffast-math -fstrict-aliasing -pipe -funroll-loops ${SSE_FLAGS}
+ CPPFLAGS = -O3 -w -fPIC -g -ffast-math -fstrict-aliasing -pipe -funroll-loops ${SSE_FLAGS} ${OPENMP_FLAGS}
  DEPENDFLAGS = ${SEARCHDIRS} ${GL_FLAGS} ${WXCRYSTFLAGS} ${FFTW_FLAGS} ${REAL_FLAG}
 else
  ifeq ($(debug),1)
  #Set DEBUG options
    ifdef RPM_OPT_FLAGS
       # we are building a RPM !
-      CPPFLAGS = ${RPM_OPT_FLAGS}
+      CPPFLAGS = ${RPM_OPT_FLAGS} ${OPENMP_FLAGS}
    else
-      CPPFLAGS = -g -Wall -D__DEBUG__ ${SSE_FLAGS} ${COD_FLAGS}
+      CPPFLAGS = -g -Wall -D__DEBUG__ ${SSE_FLAGS} ${OPENMP_FLAGS} ${COD_FLAGS}
    endif
    DEPENDFLAGS = ${SEARCHDIRS} ${GL_FLAGS} ${WXCRYSTFLAGS} ${FFTW_FLAGS} ${REAL_FLAG}
-   LOADLIBES = -lm -lcryst -lCrystVector -lQuirks -lRefinableObj -lcctbx ${LDNEWMAT} ${PROFILELIB} ${GL_LIB} ${WX_LDFLAGS} ${FFTW_LIB} ${COD_LIB}
+   LOADLIBES = -lm -lcryst -lCrystVector -lQuirks -lRefinableObj -lcctbx ${LDNEWMAT} ${PROFILELIB} ${GL_LIB} ${WX_LDFLAGS} ${FFTW_LIB} ${COD_LIB} ${OPENMP_LIB}
  else
    ifdef RPM_OPT_FLAGS
       # we are building a RPM !
-      CPPFLAGS = ${RPM_OPT_FLAGS}
+      CPPFLAGS = ${RPM_OPT_FLAGS} ${OPENMP_FLAGS}
    else
       #default flags - use "sse=1" to enable SSE optimizations
-      CPPFLAGS = -O3 -w -ffast-math -fstrict-aliasing -pipe -fomit-frame-pointer -funroll-loops -ftree-vectorize ${SSE_FLAGS} ${COD_FLAGS}
+      CPPFLAGS = -O3 -w -ffast-math -fstrict-aliasing -pipe -fomit-frame-pointer -funroll-loops -ftree-vectorize ${SSE_FLAGS} ${OPENMP_FLAGS} ${COD_FLAGS}
    endif
    DEPENDFLAGS = ${SEARCHDIRS} ${GL_FLAGS} ${WXCRYSTFLAGS} ${FFTW_FLAGS} ${REAL_FLAG}
-   LOADLIBES = -lm -lcryst -lCrystVector -lQuirks -lRefinableObj -lcctbx ${LDNEWMAT} ${PROFILELIB} ${GL_LIB} ${WX_LDFLAGS} ${FFTW_LIB} ${COD_LIB}
+   LOADLIBES = -lm -lcryst -lCrystVector -lQuirks -lRefinableObj -lcctbx ${LDNEWMAT} ${PROFILELIB} ${GL_LIB} ${WX_LDFLAGS} ${FFTW_LIB} ${COD_LIB} ${OPENMP_LIB}
  endif
 endif
 # Add to statically link: -nodefaultlibs -lgcc /usr/lib/libstdc++.a